@@ -963,6 +963,7 @@ void ChatWindow::connectSignals() {
 
     // 文件
     connect(net, &NetworkManager::fileNotify,       this, &ChatWindow::onFileNotify);
+    connect(net, &NetworkManager::fileThumbnailNotify, this, &ChatWindow::onFileThumbnailNotify);
     connect(net, &NetworkManager::fileDownloadReady, this, &ChatWindow::onFileDownloadReady);
 
     // 大文件分块传输
@@ -1091,6 +1092,8 @@ void ChatWindow::connectSignals() {
             this, &ChatWindow::handleFriendSendResponse);
     connect(net, &NetworkManager::friendHistoryReceived,  this, &ChatWindow::onFriendHistoryReceived);
     connect(net, &NetworkManager::friendFileNotify,       this, &ChatWindow::onFriendFileNotify);
+    connect(net, &NetworkManager::friendFileThumbnailNotify,
+            this, &ChatWindow::onFriendFileThumbnailNotify);
     connect(net, &NetworkManager::friendOnlineNotify,     this, &ChatWindow::onFriendOnlineNotify);
     connect(net, &NetworkManager::friendOfflineNotify,    this, &ChatWindow::onFriendOfflineNotify);
     connect(net, &NetworkManager::friendReadNotify,       this, &ChatWindow::onFriendReadNotify);
@@ -2572,13 +2575,7 @@ void ChatWindow::sendNextChunk() {
 
     if (chunk.isEmpty()) return;
 
-    QJsonObject data;
-    data["uploadId"] = m_upload.uploadId;
-    data["offset"]   = static_cast<double>(m_upload.offset);
-    data["chunkData"] = QString::fromLatin1(chunk.toBase64());
-    data["chunkSize"] = chunk.size();
-    NetworkManager::instance()->sendMessage(
-        Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK, data));
+    NetworkManager::instance()->sendUploadChunk(m_upload.uploadId, m_upload.offset, chunk);
 
     m_upload.offset += chunk.size();
     double progress = static_cast<double>(m_upload.offset) / m_upload.fileSize;
@@ -3163,7 +3160,7 @@ void ChatWindow::startChunkedDownload(int fileId, const QString &fileName, qint6
     }
 }
 
-void ChatWindow::onDownloadChunkResponse(const QJsonObject &data) {
+void ChatWindow::onDownloadChunkResponse(const QJsonObject &data, const QByteArray &chunk) {
     int fileId = data["fileId"].toInt();
 
     if (!data["success"].toBool()) {
@@ -3182,7 +3179,6 @@ void ChatWindow::onDownloadChunkResponse(const QJsonObject &data) {
     if (!m_downloads.contains(fileId)) return;
     ChunkedDownload &dl = m_downloads[fileId];
 
-    QByteArray chunk = QByteArray::fromBase64(data["chunkData"].toString().toLatin1());
     dl.buffer.append(chunk);
     dl.offset += chunk.size();
 
@@ -3302,6 +3298,29 @@ void ChatWindow::onRecallNotify(const QJsonObject &data) {
     persistRoomSnapshot(roomId);
 }
 
+bool ChatWindow::applyThumbnailPatch(MessageModel *model, int messageId,
+                                     const QString &thumbnail) {
+    const int row = model->findMessageRow(messageId);
+    if (row < 0 || thumbnail.isEmpty()) return false;
+    const int fileId = model->messageAt(row).fileId();
+    // 视频气泡从本地缩略图文件渲染：覆盖后清除像素缓存
+    const QByteArray thumbData = QByteArray::fromBase64(thumbnail.toLatin1());
+    if (fileId != 0 && !thumbData.isEmpty()) {
+        QFile file(FileCache::instance()->thumbDir() + QString("/thumb_%1.jpg").arg(fileId));
+        if (file.open(QIODevice::WriteOnly)) file.write(thumbData);
+        QPixmapCache::remove(QString("vidthumb_%1").arg(fileId));
+    }
+    return model->updateThumbnail(messageId, thumbnail);
+}
+
+void ChatWindow::onFileThumbnailNotify(const QJsonObject &data) {
+    const int roomId = data["roomId"].toInt();
+    if (applyThumbnailPatch(getOrCreateModel(roomId), data["messageId"].toInt(),
+                            data["thumbnail"].toString())) {
+        persistRoomSnapshot(roomId);
+    }
+}
+
 // ==================== 管理员功能 ====================
 
 void ChatWindow::onAdminStatusChanged(int roomId, bool isAdmin) {
@@ -6203,7 +6222,17 @@ void ChatWindow::onFriendRecallNotify(const QJsonObject &data) {
     persistFriendSnapshot(friendUsername);
 }
 
-void ChatWindow::switchToFriendChat(const QString &friendUsername, const QString &friendDisplayName, int friendshipId) {
+void ChatWindow::onFriendFileThumbnailNotify(const QJsonObject &data) {
+    // 与 onFriendFileNotify 相同：发送者是自己时会话对象为 friendUsername
+    const QString sender = data["sender"].toString();
+    const QString chatWith = (sender == m_username) ? data["friendUsername"].toString() : sender;
+    if (applyThumbnailPatch(getOrCreateFriendModel(chatWith), data["messageId"].toInt(),
+                            data["thumbnail"].toString())) {
+        persistFriendSnapshot(chatWith);
+    }
+}
+
+const QString &friendUsername, const QString &friendDisplayName, int friendshipId) {
     flushCurrentDraft();
     m_isFriendChat = true;
     m_currentFriendUsername = friendUsername;
@@ -112,6 +112,7 @@ private slots:
     void onSendFile();
     void onSendImage();
     void onFileNotify(const QJsonObject &data);
+    void onFileThumbnailNotify(const QJsonObject &data);
     void onFileDownloadReady(const QJsonObject &data);
 
     // 撤回
@@ -165,7 +166,7 @@ private slots:
                                const QString &temporaryPath,
                                const QString &error);
     void onFileCosProgress(const QJsonObject &data);
-    void onDownloadChunkResponse(const QJsonObject &data);
+    void onDownloadChunkResponse(const QJsonObject &data, const QByteArray &chunk);
     void onFileForwardResponse(const QJsonObject &data);
 
     // 头像
@@ -245,6 +246,7 @@ private slots:
     void onFriendChatMessage(const QJsonObject &data);
     void onFriendHistoryReceived(const QJsonObject &data);
     void onFriendFileNotify(const QJsonObject &data);
+    void onFriendFileThumbnailNotify(const QJsonObject &data);
     void onFriendOnlineNotify(const QString &username, const QString &displayName);
     void onFriendOfflineNotify(const QString &username);
     void onFriendReadNotify(const QJsonObject &data);
@@ -277,6 +279,8 @@ private:
     void advanceRoomSyncCursor(int roomId, qint64 sequence);
     void requestCurrentRoomResume();
     void persistRoomSnapshot(int roomId);
+    /// 服务端后台生成的缩略图替换消息原有缩略图；视频同时刷新本地缩略图缓存
+    bool applyThumbnailPatch(MessageModel *model, int messageId, const QString &thumbnail);
     void persistRoomMessage(int roomId, const Message &message);
     void removeCachedRoom(int roomId);
     void persistFriendSnapshot(const QString &friendUsername);
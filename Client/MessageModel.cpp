@@ -292,6 +292,18 @@ void MessageModel::recallMessage(int messageId) {
     }
 }
 
+bool MessageModel::updateThumbnail(int messageId, const QString &thumbnail) {
+    for (int i = 0; i < m_messages.size(); ++i) {
+        if (m_messages[i].id() == messageId) {
+            m_messages[i].setThumbnail(thumbnail);
+            QModelIndex idx = index(i);
+            emit dataChanged(idx, idx);
+            return true;
+        }
+    }
+    return false;
+}
+
 void MessageModel::applyDeletionEvents(const QJsonArray &events) {
     for (const QJsonValue &value : events) {
         const QJsonObject event = value.toObject();
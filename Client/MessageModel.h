@@ -44,6 +44,7 @@ public:
     void prependMessages(const QList<Message> &msgs);
     void reconcileSyncPage(const QList<Message> &messages, const QJsonArray &events);
     void recallMessage(int messageId);
+    bool updateThumbnail(int messageId, const QString &thumbnail);
     void applyDeletionEvents(const QJsonArray &events);
     void clear();
     void discardCachedHistory();
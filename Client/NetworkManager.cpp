@@ -19,6 +19,9 @@ NetworkManager *NetworkManager::instance() {
 NetworkManager::NetworkManager(QObject *parent)
     : QObject(parent)
 {
+    // 登录请求总是声明 compressedFrames，服务器只向回显了该能力的会话发送压缩帧
+    m_frames.setAcceptCompressed(true);
+
     m_heartbeatTimer = new QTimer(this);
     m_heartbeatTimer->setInterval(Protocol::HEARTBEAT_INTERVAL_MS);
     connect(m_heartbeatTimer, &QTimer::timeout, this, &NetworkManager::onHeartbeat);
@@ -95,6 +98,8 @@ void NetworkManager::disconnectFromServer() {
     m_heartbeatTimer->stop();
     m_reconnectTimer->stop();
     m_supportsServerFileForward = false;
+    m_cborFrames = false;
+    m_binaryChunks = false;
     m_restoringSession = false;
     m_retryingPendingLogin = false;
     m_userId = 0;
@@ -112,7 +117,7 @@ void NetworkManager::disconnectFromServer() {
         m_socket->deleteLater();
         m_socket = nullptr;
     }
-    m_buffer.clear();
+    m_frames.clear();
 }
 
 bool NetworkManager::isConnected() const {
@@ -121,10 +126,28 @@ bool NetworkManager::isConnected() const {
 
 void NetworkManager::sendMessage(const QJsonObject &msg) {
     if (!isConnected()) return;
-    m_socket->write(Protocol::pack(msg));
+    m_socket->write(m_cborFrames ? Protocol::packCbor(msg) : Protocol::pack(msg));
     m_socket->flush();
 }
 
+void NetworkManager::sendUploadChunk(const QString &uploadId, qint64 offset,
+                                     const QByteArray &chunk) {
+    if (!isConnected()) return;
+    QJsonObject data;
+    data["uploadId"]  = uploadId;
+    data["offset"]    = static_cast<double>(offset);
+    data["chunkSize"] = chunk.size();
+    if (m_binaryChunks) {
+        const QJsonObject header = Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK, data);
+        m_socket->write(Protocol::packBinaryHeader(header, chunk.size()));
+        m_socket->write(chunk);
+        m_socket->flush();
+        return;
+    }
+    data["chunkData"] = QString::fromLatin1(chunk.toBase64());
+    sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK, data));
+}
+
 void NetworkManager::loginWithCredentials(const QString &username,
                                           const QString &password) {
     m_pendingLoginUsername = username;
@@ -170,7 +193,9 @@ void NetworkManager::onConnected() {
     qInfo() << "[Net] 已连接到服务器";
     m_autoReconnect    = true;
     m_heartbeatTimer->start();
-    m_buffer.clear();
+    m_frames.clear();
+    m_cborFrames = false;
+    m_binaryChunks = false;
     if (m_restoringSession && !m_username.isEmpty() && !m_sessionPassword.isEmpty()) {
         sendMessage(Protocol::makeLoginReq(m_username, m_sessionPassword));
         return;
@@ -202,10 +227,19 @@ void NetworkManager::onError(QAbstractSocket::SocketError err) {
 }
 
 void NetworkManager::onReadyRead() {
-    m_buffer.append(m_socket->readAll());
-
-    QJsonObject msg;
-    while (Protocol::unpack(m_buffer, msg)) {
+    m_frames.readFrom(m_socket);
+
+    // 一次读取可能包含多帧：逐帧前移游标解析，损坏的帧跳过，不完整或超长时等待/停止
+    for (;;) {
+        QJsonObject msg;
+        QByteArray payload;
+        const Protocol::FrameParseResult result = m_frames.next(msg, &payload);
+        if (result == Protocol::FrameParseResult::Malformed) continue;
+        if (result == Protocol::FrameParseResult::Binary) {
+            processMessage(msg, &payload);
+            continue;
+        }
+        if (result != Protocol::FrameParseResult::Complete) break;
         processMessage(msg);
     }
 }
@@ -226,7 +260,7 @@ void NetworkManager::tryReconnect() {
 
 // ==================== 消息分发 ====================
 
-void NetworkManager::processMessage(const QJsonObject &msg) {
+void NetworkManager::processMessage(const QJsonObject &msg, const QByteArray *payload) {
     QString type = msg["type"].toString();
     QJsonObject data = msg["data"].toObject();
 
@@ -244,6 +278,8 @@ void NetworkManager::processMessage(const QJsonObject &msg) {
                 m_sessionPassword = m_pendingLoginPassword;
             }
             m_supportsServerFileForward = data["serverFileForward"].toBool(false);
+            m_cborFrames = data["cborFrames"].toBool(false);
+            m_binaryChunks = data["binaryChunks"].toBool(false);
             if (m_httpUpload) {
                 m_httpUpload->configure(
                     m_host,
@@ -349,6 +385,9 @@ void NetworkManager::processMessage(const QJsonObject &msg) {
     else if (type == Protocol::MsgType::FILE_NOTIFY) {
         emit fileNotify(data);
     }
+    else if (type == Protocol::MsgType::FILE_THUMBNAIL_NOTIFY) {
+        emit fileThumbnailNotify(data);
+    }
     else if (type == Protocol::MsgType::FILE_DOWNLOAD_RSP) {
         emit fileDownloadReady(data);
     }
@@ -368,7 +407,9 @@ void NetworkManager::processMessage(const QJsonObject &msg) {
         emit fileCosProgress(data);
     }
     else if (type == Protocol::MsgType::FILE_DOWNLOAD_CHUNK_RSP) {
-        emit downloadChunkResponse(data);
+        // 二进制分块帧直接携带字节；JSON 响应在此解码 base64
+        emit downloadChunkResponse(data, payload ? *payload
+            : QByteArray::fromBase64(data["chunkData"].toString().toLatin1()));
     }
     else if (type == Protocol::MsgType::RECALL_RSP) {
         emit recallResponse(data["success"].toBool(),
@@ -632,6 +673,9 @@ void NetworkManager::processMessage(const QJsonObject &msg) {
     else if (type == Protocol::MsgType::FRIEND_FILE_NOTIFY) {
         emit friendFileNotify(data);
     }
+    else if (type == Protocol::MsgType::FRIEND_FILE_THUMBNAIL_NOTIFY) {
+        emit friendFileThumbnailNotify(data);
+    }
     else if (type == Protocol::MsgType::FRIEND_ONLINE_NOTIFY) {
         emit friendOnlineNotify(data["username"].toString(), data["displayName"].toString());
     }
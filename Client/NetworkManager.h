@@ -7,6 +7,8 @@
 #include <QJsonArray>
 #include <QTimer>
 
+#include "Protocol.h"
+
 class HttpUploadTransport;
 class HttpDownloadTransport;
 
@@ -20,6 +22,8 @@ public:
     void connectToServer(const QString &host, quint16 port, bool useSsl = false);
     void disconnectFromServer();
     void sendMessage(const QJsonObject &msg);
+    /// 发送上传分块：服务器确认 binaryChunks 后走二进制分块帧，否则 base64 嵌入 JSON
+    void sendUploadChunk(const QString &uploadId, qint64 offset, const QByteArray &chunk);
     void loginWithCredentials(const QString &username, const QString &password);
     void changePassword(const QString &oldPassword, const QString &newPassword);
     bool uploadRawFile(const QString &uploadId, const QString &uploadPath,
@@ -67,6 +71,7 @@ signals:
 
     // 文件
     void fileNotify(const QJsonObject &data);
+    void fileThumbnailNotify(const QJsonObject &data);
     void fileDownloadReady(const QJsonObject &data);
     void fileForwardResponse(const QJsonObject &data);
 
@@ -74,7 +79,7 @@ signals:
     void uploadStartResponse(const QJsonObject &data);
     void uploadChunkResponse(const QJsonObject &data);
     void uploadFinalizeResponse(const QJsonObject &data);
-    void downloadChunkResponse(const QJsonObject &data);
+    void downloadChunkResponse(const QJsonObject &data, const QByteArray &chunk);
     void fileCosProgress(const QJsonObject &data);
     void rawUploadProgress(const QString &uploadId, qint64 sent, qint64 total);
     void rawUploadFinished(const QString &uploadId, bool success, const QString &error);
@@ -171,6 +176,7 @@ signals:
     void friendChatSendResponse(const QJsonObject &data);
     void friendHistoryReceived(const QJsonObject &data);
     void friendFileNotify(const QJsonObject &data);
+    void friendFileThumbnailNotify(const QJsonObject &data);
     void friendOnlineNotify(const QString &username, const QString &displayName);
     void friendOfflineNotify(const QString &username);
     void friendReadNotify(const QJsonObject &data);
@@ -190,7 +196,7 @@ private:
     explicit NetworkManager(QObject *parent = nullptr);
     ~NetworkManager() override;
 
-    void processMessage(const QJsonObject &msg);
+    void processMessage(const QJsonObject &msg, const QByteArray *payload = nullptr);
     void openSocket();
 
     static NetworkManager *s_instance;
@@ -198,10 +204,12 @@ private:
     QTcpSocket *m_socket          = nullptr;
     QTimer     *m_heartbeatTimer  = nullptr;
     QTimer     *m_reconnectTimer  = nullptr;
-    QByteArray  m_buffer;
+    Protocol::FrameReader m_frames;
     HttpUploadTransport *m_httpUpload = nullptr;
     HttpDownloadTransport *m_httpDownload = nullptr;
     bool m_supportsServerFileForward = false;
+    bool m_cborFrames = false;   // 服务器确认后发送 CBOR 帧
+    bool m_binaryChunks = false; // 服务器确认后文件分块走二进制分块帧
 
     QString     m_host;
     quint16     m_port            = 0;
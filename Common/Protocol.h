@@ -1,6 +1,11 @@
 #pragma once
 
 #include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QCborMap>
+#include <QCborArray>
+#include <QCborValue>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonDocument>
@@ -9,6 +14,7 @@
 #include <QIODevice>
 #include <QDateTime>
 #include <QUuid>
+#include <QtEndian>
 
 namespace Protocol {
 
@@ -67,6 +73,8 @@ namespace MsgType {
     inline const QString FILE_DOWNLOAD_RSP= QStringLiteral("FILE_DOWNLOAD_RSP");
     inline const QString FILE_FORWARD_REQ  = QStringLiteral("FILE_FORWARD_REQ");
     inline const QString FILE_FORWARD_RSP  = QStringLiteral("FILE_FORWARD_RSP");
+    // 服务端后台生成缩略图后推送，替换 FILE_NOTIFY 中的缩略图
+    inline const QString FILE_THUMBNAIL_NOTIFY = QStringLiteral("FILE_THUMBNAIL_NOTIFY");
 
     // 大文件分块传输
     inline const QString FILE_UPLOAD_START  = QStringLiteral("FILE_UPLOAD_START");
@@ -193,6 +201,7 @@ namespace MsgType {
     inline const QString FRIEND_HISTORY_RSP     = QStringLiteral("FRIEND_HISTORY_RSP");
     inline const QString FRIEND_FILE_SEND       = QStringLiteral("FRIEND_FILE_SEND");
     inline const QString FRIEND_FILE_NOTIFY     = QStringLiteral("FRIEND_FILE_NOTIFY");
+    inline const QString FRIEND_FILE_THUMBNAIL_NOTIFY = QStringLiteral("FRIEND_FILE_THUMBNAIL_NOTIFY");
     inline const QString FRIEND_ONLINE_NOTIFY   = QStringLiteral("FRIEND_ONLINE_NOTIFY");
     inline const QString FRIEND_OFFLINE_NOTIFY  = QStringLiteral("FRIEND_OFFLINE_NOTIFY");
     inline const QString FRIEND_FILE_UPLOAD_START     = QStringLiteral("FRIEND_FILE_UPLOAD_START");
@@ -212,11 +221,48 @@ namespace MsgType {
     inline const QString FILE_COS_PROGRESS    = QStringLiteral("FILE_COS_PROGRESS");
 }
 
+/// CBOR 帧中的消息类型编号：下标即编号。只允许在末尾追加，已有编号不得变动
+inline const QStringList &messageTypeCodes() {
+    using namespace MsgType;
+    static const QStringList codes = {
+        LOGIN_REQ, LOGIN_RSP, REGISTER_REQ, REGISTER_RSP, LOGOUT, CHAT_MSG, CHAT_SEND_RSP,
+        SYSTEM_MSG, CREATE_ROOM_REQ, CREATE_ROOM_RSP, JOIN_ROOM_REQ, JOIN_ROOM_RSP, LEAVE_ROOM,
+        LEAVE_ROOM_RSP, ROOM_LIST_REQ, ROOM_LIST_RSP, USER_LIST_REQ, USER_LIST_RSP,
+        HISTORY_REQ, HISTORY_RSP, FILE_SEND, FILE_NOTIFY, FILE_DOWNLOAD_REQ, FILE_DOWNLOAD_RSP,
+        FILE_FORWARD_REQ, FILE_FORWARD_RSP, FILE_UPLOAD_START, FILE_UPLOAD_START_RSP,
+        FILE_UPLOAD_CHUNK, FILE_UPLOAD_CHUNK_RSP, FILE_UPLOAD_END, FILE_UPLOAD_END_RSP,
+        FILE_DOWNLOAD_CHUNK_REQ, FILE_DOWNLOAD_CHUNK_RSP, FILE_UPLOAD_CANCEL, RECALL_REQ,
+        RECALL_RSP, RECALL_NOTIFY, HEARTBEAT, HEARTBEAT_ACK, USER_JOINED, USER_LEFT,
+        USER_ONLINE, USER_OFFLINE, FORCE_OFFLINE, SET_ADMIN_REQ, SET_ADMIN_RSP, ADMIN_STATUS,
+        DELETE_MSGS_REQ, DELETE_MSGS_RSP, DELETE_MSGS_NOTIFY, ROOM_SETTINGS_REQ,
+        ROOM_SETTINGS_RSP, ROOM_SETTINGS_NOTIFY, ROOM_FILES_REQ, ROOM_FILES_RSP,
+        ROOM_FILES_DELETE_REQ, ROOM_FILES_DELETE_RSP, ROOM_FILES_NOTIFY, DELETE_ROOM_REQ,
+        DELETE_ROOM_RSP, DELETE_ROOM_NOTIFY, RENAME_ROOM_REQ, RENAME_ROOM_RSP,
+        RENAME_ROOM_NOTIFY, SET_ROOM_PASSWORD_REQ, SET_ROOM_PASSWORD_RSP,
+        GET_ROOM_PASSWORD_REQ, GET_ROOM_PASSWORD_RSP, KICK_USER_REQ, KICK_USER_RSP,
+        KICK_USER_NOTIFY, AVATAR_UPLOAD_REQ, AVATAR_UPLOAD_RSP, AVATAR_GET_REQ, AVATAR_GET_RSP,
+        AVATAR_UPDATE_NOTIFY, CHANGE_NICKNAME_REQ, CHANGE_NICKNAME_RSP, NICKNAME_CHANGE_NOTIFY,
+        CHANGE_UID_REQ, CHANGE_UID_RSP, UID_CHANGE_NOTIFY, CHANGE_PASSWORD_REQ,
+        CHANGE_PASSWORD_RSP, ROOM_SEARCH_REQ, ROOM_SEARCH_RSP, ROOM_AVATAR_UPLOAD_REQ,
+        ROOM_AVATAR_UPLOAD_RSP, ROOM_AVATAR_GET_REQ, ROOM_AVATAR_GET_RSP,
+        ROOM_AVATAR_UPDATE_NOTIFY, USER_SEARCH_REQ, USER_SEARCH_RSP, FRIEND_REQUEST_REQ,
+        FRIEND_REQUEST_RSP, FRIEND_REQUEST_NOTIFY, FRIEND_ACCEPT_REQ, FRIEND_ACCEPT_RSP,
+        FRIEND_ACCEPT_NOTIFY, FRIEND_REJECT_REQ, FRIEND_REJECT_RSP, FRIEND_REMOVE_REQ,
+        FRIEND_REMOVE_RSP, FRIEND_REMOVE_NOTIFY, FRIEND_LIST_REQ, FRIEND_LIST_RSP,
+        FRIEND_PENDING_REQ, FRIEND_PENDING_RSP, FRIEND_CHAT_MSG, FRIEND_CHAT_SEND_RSP,
+        FRIEND_HISTORY_REQ, FRIEND_HISTORY_RSP, FRIEND_FILE_SEND, FRIEND_FILE_NOTIFY,
+        FRIEND_ONLINE_NOTIFY, FRIEND_OFFLINE_NOTIFY, FRIEND_FILE_UPLOAD_START,
+        FRIEND_FILE_UPLOAD_START_RSP, MARK_ROOM_READ, MARK_FRIEND_READ, FRIEND_READ_NOTIFY,
+        FRIEND_RECALL_REQ, FRIEND_RECALL_RSP, FRIEND_RECALL_NOTIFY, FILE_COS_PROGRESS,
+        FILE_THUMBNAIL_NOTIFY, FRIEND_FILE_THUMBNAIL_NOTIFY
+    };
+    return codes;
+}
+
 // ==================== 数据包帧: [4字节长度][JSON数据] ====================
 
-/// 将 JSON 对象打包为带长度前缀的二进制帧
-inline QByteArray pack(const QJsonObject &msg) {
-    QByteArray json = QJsonDocument(msg).toJson(QJsonDocument::Compact);
+/// 为已序列化的 JSON 负载加上 4 字节大端长度前缀
+inline QByteArray packPayload(const QByteArray &json) {
     QByteArray packet;
     packet.reserve(4 + json.size());
     QDataStream stream(&packet, QIODevice::WriteOnly);
@@ -226,34 +272,298 @@ inline QByteArray pack(const QJsonObject &msg) {
     return packet;
 }
 
+/// 将 JSON 对象打包为带长度前缀的二进制帧
+inline QByteArray pack(const QJsonObject &msg) {
+    return packPayload(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+}
+
+// ==================== CBOR 帧: [4字节长度|CBOR_FRAME_FLAG][CBOR数据] ====================
+// 登录时按会话协商（LOGIN_REQ.cborFrames，LOGIN_RSP 回显），仅用于 TCP；Web 客户端与旧客户端保持 JSON。
+// 长度前缀最高位标记 CBOR 负载，帧自描述，协商前后的帧可以交错到达。
+// 信封键（type/id/timestamp/data）与已知消息类型编码为整数，二进制字段直接携带字节串；
+// 解码后还原为与 JSON 帧相同的 QJsonObject，处理逻辑不区分编码。
+// 接收方传入 BinaryFields 时，data 中的二进制字段改为原样放入旁路，不再转回 base64 字符串。
+
+constexpr quint32 CBOR_FRAME_FLAG = 0x80000000u;
+
+/// CBOR 帧 data 中以字节串携带的二进制字段：字段名 -> 原始字节
+using BinaryFields = QHash<QString, QByteArray>;
+
+namespace detail {
+
+enum EnvelopeKey : qint64 { TypeKey = 0, IdKey = 1, TimestampKey = 2, DataKey = 3 };
+
+/// JSON 模型中以 base64 字符串表示、在 CBOR 中以原始字节携带的字段
+inline bool isBinaryField(const QString &key) {
+    return key == QLatin1String("fileData") || key == QLatin1String("chunkData")
+        || key == QLatin1String("avatarData") || key == QLatin1String("thumbnail");
+}
+
+inline QCborMap cborFromJsonObject(const QJsonObject &object);
+
+inline QCborValue cborFromJson(const QJsonValue &value) {
+    if (value.isObject()) return cborFromJsonObject(value.toObject());
+    if (value.isArray()) {
+        QCborArray array;
+        for (const QJsonValue &item : value.toArray()) array.append(cborFromJson(item));
+        return array;
+    }
+    return QCborValue::fromJsonValue(value);
+}
+
+inline QCborMap cborFromJsonObject(const QJsonObject &object) {
+    QCborMap map;
+    for (auto it = object.begin(); it != object.end(); ++it) {
+        if (it->isString() && isBinaryField(it.key())) {
+            const QByteArray::FromBase64Result decoded = QByteArray::fromBase64Encoding(
+                it->toString().toLatin1(), QByteArray::AbortOnBase64DecodingErrors);
+            if (decoded) {
+                map.insert(it.key(), QCborValue(*decoded));
+                continue;
+            }
+        }
+        map.insert(it.key(), cborFromJson(*it));
+    }
+    return map;
+}
+
+inline QJsonObject jsonObjectFromCbor(const QCborMap &map);
+
+inline QJsonValue jsonFromCbor(const QCborValue &value) {
+    if (value.isMap()) return jsonObjectFromCbor(value.toMap());
+    if (value.isArray()) {
+        QJsonArray array;
+        for (const QCborValue &item : value.toArray()) array.append(jsonFromCbor(item));
+        return array;
+    }
+    if (value.isByteArray()) return QString::fromLatin1(value.toByteArray().toBase64());
+    return value.toJsonValue();
+}
+
+inline QJsonObject jsonObjectFromCbor(const QCborMap &map) {
+    QJsonObject object;
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        if (it.key().isString())
+            object.insert(it.key().toString(), jsonFromCbor(it.value()));
+    }
+    return object;
+}
+
+inline qint64 messageTypeCode(const QString &type) {
+    static const QHash<QString, qint64> codes = [] {
+        QHash<QString, qint64> byName;
+        const QStringList &names = messageTypeCodes();
+        for (qsizetype i = 0; i < names.size(); ++i) byName.insert(names.at(i), i);
+        return byName;
+    }();
+    return codes.value(type, -1);
+}
+
+inline QCborMap encodeEnvelope(const QJsonObject &msg) {
+    QCborMap map;
+    for (auto it = msg.begin(); it != msg.end(); ++it) {
+        const QString &key = it.key();
+        if (key == QLatin1String("type")) {
+            const qint64 code = messageTypeCode(it->toString());
+            map.insert(TypeKey, code >= 0 ? QCborValue(code) : QCborValue(it->toString()));
+        } else if (key == QLatin1String("id")) {
+            map.insert(IdKey, cborFromJson(*it));
+        } else if (key == QLatin1String("timestamp")) {
+            map.insert(TimestampKey, cborFromJson(*it));
+        } else if (key == QLatin1String("data")) {
+            map.insert(DataKey, cborFromJson(*it));
+        } else {
+            map.insert(key, cborFromJson(*it));
+        }
+    }
+    return map;
+}
+
+/// data 对象的解码：二进制字段进入 binary 旁路，其余字段与 jsonObjectFromCbor 相同
+inline QJsonObject jsonDataFromCbor(const QCborMap &map, BinaryFields *binary) {
+    QJsonObject object;
+    for (auto it = map.begin(); it != map.end(); ++it) {
+        if (!it.key().isString()) continue;
+        const QString key = it.key().toString();
+        if (it.value().isByteArray() && isBinaryField(key))
+            binary->insert(key, it.value().toByteArray());
+        else
+            object.insert(key, jsonFromCbor(it.value()));
+    }
+    return object;
+}
+
+inline QJsonObject decodeEnvelope(const QCborMap &map, BinaryFields *binary = nullptr) {
+    QJsonObject msg = jsonObjectFromCbor(map);
+    const QCborValue type = map.value(TypeKey);
+    if (type.isInteger())
+        msg.insert(QStringLiteral("type"), messageTypeCodes().value(type.toInteger()));
+    else if (type.isString())
+        msg.insert(QStringLiteral("type"), type.toString());
+    if (map.contains(IdKey)) msg.insert(QStringLiteral("id"), jsonFromCbor(map.value(IdKey)));
+    if (map.contains(TimestampKey))
+        msg.insert(QStringLiteral("timestamp"), jsonFromCbor(map.value(TimestampKey)));
+    if (map.contains(DataKey)) {
+        const QCborValue data = map.value(DataKey);
+        msg.insert(QStringLiteral("data"), binary && data.isMap()
+                                               ? QJsonValue(jsonDataFromCbor(data.toMap(), binary))
+                                               : jsonFromCbor(data));
+    }
+    return msg;
+}
+
+} // namespace detail
+
+/// 将 JSON 对象编码为 CBOR 帧
+inline QByteArray packCbor(const QJsonObject &msg) {
+    const QByteArray payload = QCborValue(detail::encodeEnvelope(msg)).toCbor();
+    QByteArray packet(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(payload.size()) | CBOR_FRAME_FLAG, packet.data());
+    packet.append(payload);
+    return packet;
+}
+
+// ==================== 二进制分块帧: [4字节长度|BINARY_FRAME_FLAG][4字节头长度][JSON 头][原始字节] ====================
+// 登录时按会话协商（LOGIN_REQ.binaryChunks，LOGIN_RSP 回显），仅用于 TCP。
+// FILE_UPLOAD_CHUNK 与 FILE_DOWNLOAD_CHUNK_RSP 的分块字节不再 base64 嵌入 JSON：
+// 头部是不含 chunkData 的普通消息信封，分块原样跟在头部之后。
+
+constexpr quint32 BINARY_FRAME_FLAG = 0x40000000u;
+constexpr quint32 MAX_BINARY_HEADER_BYTES = 64 * 1024;
+
+/// 二进制分块帧的长度前缀与头部；分块字节由调用方紧随其后写出，避免拼接大缓冲区
+inline QByteArray packBinaryHeader(const QJsonObject &header, qsizetype payloadBytes) {
+    const QByteArray json = QJsonDocument(header).toJson(QJsonDocument::Compact);
+    QByteArray packet(8, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(4 + json.size() + payloadBytes) | BINARY_FRAME_FLAG,
+                          packet.data());
+    qToBigEndian<quint32>(static_cast<quint32>(json.size()), packet.data() + 4);
+    packet.append(json);
+    return packet;
+}
+
+/// 完整的二进制分块帧
+inline QByteArray packBinary(const QJsonObject &header, const QByteArray &payload) {
+    return packBinaryHeader(header, payload.size()) + payload;
+}
+
+// ==================== 压缩帧: [4字节长度|COMPRESSED_FRAME_FLAG(|CBOR_FRAME_FLAG)][qCompress 数据] ====================
+// 登录时按会话协商（LOGIN_REQ.compressedFrames，LOGIN_RSP 回显），只用于服务器发往客户端的方向。
+// 负载为 qCompress 格式：4 字节大端原始长度 + zlib 流，解压后按 CBOR 标记解析为 JSON 或 CBOR。
+// 只有历史与列表这类字段名大量重复的响应、且编码后不小于 COMPRESSION_THRESHOLD_BYTES 才压缩；
+// 普通聊天帧保持原样。服务器不解压客户端发来的帧，避免解压放大攻击。
+// WebSocket 上同样的 qCompress 字节作为二进制消息发送，浏览器以 DecompressionStream('deflate') 解压。
+
+constexpr quint32 COMPRESSED_FRAME_FLAG = 0x20000000u;
+constexpr quint32 FRAME_FLAG_MASK = CBOR_FRAME_FLAG | BINARY_FRAME_FLAG | COMPRESSED_FRAME_FLAG;
+constexpr qsizetype COMPRESSION_THRESHOLD_BYTES = 2048;
+constexpr int COMPRESSION_LEVEL = 6;
+
+/// 值得压缩的消息类型：历史分页与各类列表
+inline bool isCompressibleType(const QString &type) {
+    return type == MsgType::HISTORY_RSP || type == MsgType::FRIEND_HISTORY_RSP
+        || type == MsgType::ROOM_LIST_RSP || type == MsgType::USER_LIST_RSP
+        || type == MsgType::FRIEND_LIST_RSP || type == MsgType::ROOM_FILES_RSP;
+}
+
+/// 把 JSON 或 CBOR 帧压缩为压缩帧；未达阈值或压缩后不更小时返回 packet 本身
+inline QByteArray compressPacket(const QByteArray &packet) {
+    if (packet.size() - 4 < COMPRESSION_THRESHOLD_BYTES) return packet;
+    const quint32 prefix = qFromBigEndian<quint32>(packet.constData());
+    if (prefix & (BINARY_FRAME_FLAG | COMPRESSED_FRAME_FLAG)) return packet;
+    const QByteArray compressed = qCompress(
+        reinterpret_cast<const uchar *>(packet.constData() + 4), packet.size() - 4, COMPRESSION_LEVEL);
+    if (compressed.size() >= packet.size() - 4) return packet;
+    QByteArray result(4, Qt::Uninitialized);
+    qToBigEndian<quint32>(static_cast<quint32>(compressed.size()) | (prefix & CBOR_FRAME_FLAG)
+                              | COMPRESSED_FRAME_FLAG,
+                          result.data());
+    result.append(compressed);
+    return result;
+}
+
 enum class FrameParseResult {
     Complete,
     Incomplete,
     Oversized,
-    Malformed
+    Malformed,
+    Binary        // 二进制分块帧：msg 为头部，分块字节写入 payload
 };
 
-/// 从缓冲区解析一个完整 JSON 帧，并区分“待补全”与“必须拒绝”。
-inline FrameParseResult inspectFrame(QByteArray &buffer, QJsonObject &msg) {
-    if (buffer.size() < 4)
+namespace detail {
+
+/// 解析一帧（JSON、CBOR 或二进制分块）：data 指向 4 字节长度前缀，available 为其后可读字节总数（含前缀）。
+/// 返回 Complete/Malformed/Binary 时 *frameBytes 为整帧长度，调用方据此前移读位置。
+/// payload 为空的调用方不接受二进制分块帧，acceptCompressed 为假的调用方不接受压缩帧，
+/// 此类帧按 Malformed 跳过。binary 非空时 CBOR 帧 data 中的二进制字段以原始字节放入其中。
+inline FrameParseResult parseFrameAt(const char *data, qsizetype available,
+                                     QJsonObject &msg, qsizetype *frameBytes,
+                                     QByteArray *payload = nullptr,
+                                     bool acceptCompressed = false,
+                                     BinaryFields *binary = nullptr) {
+    if (binary) binary->clear();
+    if (available < 4)
         return FrameParseResult::Incomplete;
 
-    QDataStream stream(buffer.left(4));
-    stream.setByteOrder(QDataStream::BigEndian);
-    quint32 len = 0;
-    stream >> len;
-
+    const quint32 prefix = qFromBigEndian<quint32>(data);
+    const quint32 len = prefix & ~FRAME_FLAG_MASK;
     if (len > MAX_JSON_MESSAGE_BYTES)
         return FrameParseResult::Oversized;
-
-    if (static_cast<quint32>(buffer.size()) < 4 + len)
+    if (available < 4 + static_cast<qsizetype>(len))
         return FrameParseResult::Incomplete;
+    *frameBytes = 4 + static_cast<qsizetype>(len);
 
-    QByteArray json = buffer.mid(4, static_cast<int>(len));
-    buffer.remove(0, 4 + static_cast<int>(len));
+    if ((prefix & CBOR_FRAME_FLAG) && (prefix & BINARY_FRAME_FLAG))
+        return FrameParseResult::Malformed;
 
+    const char *body = data + 4;
+    qsizetype bodyBytes = static_cast<qsizetype>(len);
+    QByteArray inflated;
+    if (prefix & COMPRESSED_FRAME_FLAG) {
+        if (!acceptCompressed || (prefix & BINARY_FRAME_FLAG) || len < 4)
+            return FrameParseResult::Malformed;
+        // 先按声明的原始长度设上限，再核对实际解压长度
+        const quint32 expected = qFromBigEndian<quint32>(body);
+        if (expected > MAX_JSON_MESSAGE_BYTES)
+            return FrameParseResult::Malformed;
+        inflated = qUncompress(reinterpret_cast<const uchar *>(body), bodyBytes);
+        if (inflated.size() != static_cast<qsizetype>(expected) || inflated.isEmpty())
+            return FrameParseResult::Malformed;
+        body = inflated.constData();
+        bodyBytes = inflated.size();
+    }
+
+    if (prefix & BINARY_FRAME_FLAG) {
+        if (!payload || len < 4)
+            return FrameParseResult::Malformed;
+        const quint32 headerLen = qFromBigEndian<quint32>(data + 4);
+        if (headerLen > MAX_BINARY_HEADER_BYTES || headerLen > len - 4)
+            return FrameParseResult::Malformed;
+        QJsonParseError err;
+        const QJsonDocument doc = QJsonDocument::fromJson(
+            QByteArray::fromRawData(data + 8, static_cast<qsizetype>(headerLen)), &err);
+        if (err.error != QJsonParseError::NoError || !doc.isObject())
+            return FrameParseResult::Malformed;
+        msg = doc.object();
+        // 分块需要在缓冲区压缩后继续存活，这里做唯一一次复制
+        *payload = QByteArray(data + 8 + headerLen, static_cast<qsizetype>(len - 4 - headerLen));
+        return FrameParseResult::Binary;
+    }
+
+    if (prefix & CBOR_FRAME_FLAG) {
+        QCborParserError err;
+        const QCborValue value = QCborValue::fromCbor(
+            QByteArray::fromRawData(body, bodyBytes), &err);
+        if (err.error != QCborError::NoError || !value.isMap())
+            return FrameParseResult::Malformed;
+        msg = decodeEnvelope(value.toMap(), binary);
+        return FrameParseResult::Complete;
+    }
+
+    // 直接在接收缓冲区上解析负载，不复制
     QJsonParseError err;
-    QJsonDocument doc = QJsonDocument::fromJson(json, &err);
+    const QJsonDocument doc = QJsonDocument::fromJson(
+        QByteArray::fromRawData(body, bodyBytes), &err);
     if (err.error != QJsonParseError::NoError || !doc.isObject())
         return FrameParseResult::Malformed;
 
@@ -261,6 +571,84 @@ inline FrameParseResult inspectFrame(QByteArray &buffer, QJsonObject &msg) {
     return FrameParseResult::Complete;
 }
 
+} // namespace detail
+
+/// 从缓冲区解析一个完整 JSON 帧，并区分“待补全”与“必须拒绝”。
+/// 每帧都会搬移剩余数据；连续接收请使用 FrameReader。
+inline FrameParseResult inspectFrame(QByteArray &buffer, QJsonObject &msg,
+                                     BinaryFields *binary = nullptr) {
+    qsizetype frameBytes = 0;
+    const FrameParseResult result = detail::parseFrameAt(
+        buffer.constData(), buffer.size(), msg, &frameBytes, nullptr, false, binary);
+    if (result == FrameParseResult::Complete || result == FrameParseResult::Malformed)
+        buffer.remove(0, frameBytes);
+    return result;
+}
+
+/// 增量帧解析器：接收数据追加在缓冲区尾部，解析只前移读游标，长度前缀原地解码、
+/// JSON 直接从缓冲区视图解析。已消费的前缀只在下次追加时、且超过缓冲区一半后才整体压缩，
+/// 一次读取到的大量小帧不再逐帧搬移剩余数据。
+class FrameReader {
+public:
+    /// 追加已收到的数据
+    void append(const QByteArray &data) {
+        compact();
+        m_buffer.append(data);
+    }
+
+    /// 把设备当前可读的数据直接读入缓冲区尾部，返回读取的字节数
+    qint64 readFrom(QIODevice *device) {
+        compact();
+        const qint64 available = device->bytesAvailable();
+        if (available <= 0) return 0;
+        const qsizetype oldSize = m_buffer.size();
+        m_buffer.resize(oldSize + static_cast<qsizetype>(available));
+        const qint64 read = device->read(m_buffer.data() + oldSize, available);
+        m_buffer.resize(oldSize + static_cast<qsizetype>(qMax<qint64>(0, read)));
+        return qMax<qint64>(0, read);
+    }
+
+    /// 解析下一帧；语义同 inspectFrame（Malformed 会跳过该帧，Oversized 不消费数据）。
+    /// 传入 payload 时接受二进制分块帧并返回 Binary；传入 binary 时 CBOR 二进制字段走旁路。
+    FrameParseResult next(QJsonObject &msg, QByteArray *payload = nullptr,
+                          BinaryFields *binary = nullptr) {
+        qsizetype frameBytes = 0;
+        const FrameParseResult result = detail::parseFrameAt(
+            m_buffer.constData() + m_readPos, m_buffer.size() - m_readPos, msg, &frameBytes,
+            payload, m_acceptCompressed, binary);
+        if (result != FrameParseResult::Incomplete && result != FrameParseResult::Oversized)
+            m_readPos += frameBytes;
+        return result;
+    }
+
+    /// 尚未解析的字节数
+    qsizetype bufferedBytes() const { return m_buffer.size() - m_readPos; }
+
+    /// 客户端接受服务器发来的压缩帧；服务端保持默认拒绝
+    void setAcceptCompressed(bool accept) { m_acceptCompressed = accept; }
+
+    void clear() {
+        m_buffer.clear();
+        m_readPos = 0;
+    }
+
+private:
+    void compact() {
+        if (m_readPos == 0) return;
+        if (m_readPos == m_buffer.size()) {
+            m_buffer.resize(0);   // 保留已分配容量
+            m_readPos = 0;
+        } else if (m_readPos >= m_buffer.size() / 2) {
+            m_buffer.remove(0, m_readPos);
+            m_readPos = 0;
+        }
+    }
+
+    QByteArray m_buffer;
+    qsizetype  m_readPos = 0;
+    bool       m_acceptCompressed = false;
+};
+
 /// 旧客户端保持 bool 语义；服务端使用 inspectFrame 处理拒绝原因。
 inline bool unpack(QByteArray &buffer, QJsonObject &msg) {
     return inspectFrame(buffer, msg) == FrameParseResult::Complete;
@@ -283,6 +671,12 @@ inline QJsonObject makeLoginReq(const QString &uniqueId, const QString &password
     QJsonObject data;
     data["username"] = uniqueId;
     data["password"] = password;
+    // 可以解析 CBOR 帧；服务器在 LOGIN_RSP 中回显 cborFrames 后才改发 CBOR
+    data["cborFrames"] = true;
+    // 文件分块可走二进制分块帧；服务器回显 binaryChunks 后双方才使用
+    data["binaryChunks"] = true;
+    // 可以解压历史与列表响应的压缩帧
+    data["compressedFrames"] = true;
     return makeMessage(MsgType::LOGIN_REQ, data);
 }
 
@@ -39,6 +39,7 @@ AuthenticationAbuseGuard::Limits AuthenticationAbuseGuard::limitsFromEnvironment
 AuthenticationAbuseGuard::Decision AuthenticationAbuseGuard::allow(
     const QString &peerAddress, const QString &account)
 {
+    QMutexLocker locker(&m_mutex);
     const qint64 nowMs = QDateTime::currentMSecsSinceEpoch();
     cleanupExpired(nowMs);
 
@@ -64,10 +65,17 @@ AuthenticationAbuseGuard::Decision AuthenticationAbuseGuard::allow(
 }
 
 void AuthenticationAbuseGuard::recordSuccess(const QString &account) {
+    QMutexLocker locker(&m_mutex);
     m_accountBuckets.remove(normalizedAccount(account));
 }
 
+AuthenticationAbuseGuard::Decision AuthenticationAbuseGuard::denyOverloaded(int retryAfterMs) {
+    QMutexLocker locker(&m_mutex);
+    return deny(QStringLiteral("hash-queue"), retryAfterMs);
+}
+
 void AuthenticationAbuseGuard::reset() {
+    QMutexLocker locker(&m_mutex);
     m_gateway = Bucket();
     m_ipBuckets.clear();
     m_accountBuckets.clear();
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <QHash>
+#include <QMutex>
 #include <QString>
 #include <QtGlobal>
 
+/// 认证限流；allow/recordSuccess/reset 可从多个请求工作线程并发调用
 class AuthenticationAbuseGuard {
 public:
     struct Limits {
@@ -29,6 +31,8 @@ public:
 
     Decision allow(const QString &peerAddress, const QString &account);
     void recordSuccess(const QString &account);
+    /// 密码哈希队列已满时记录一次 hash-queue 维度的拒绝
+    Decision denyOverloaded(int retryAfterMs);
     void reset();
 
     const Limits &limits() const { return m_limits; }
@@ -52,6 +56,7 @@ private:
     static QString normalizedAccount(const QString &account);
     static QString normalizedPeer(const QString &peerAddress);
 
+    mutable QMutex m_mutex;
     Limits m_limits;
     Bucket m_gateway;
     QHash<QString, Bucket> m_ipBuckets;
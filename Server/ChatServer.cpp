@@ -8,6 +8,10 @@
 #include "InputValidator.h"
 #include "RoomMessageService.h"
 #include "AdministrativeDeletionService.h"
+#include "RequestDispatcher.h"
+#include "SessionIoPool.h"
+#include "HttpConnection.h"
+#include "TimingWheel.h"
 
 #include <QThread>
 #include <QJsonArray>
@@ -16,15 +20,10 @@
 #include <QDebug>
 #include <QFile>
 #include <QDir>
-#include <QDate>
 #include <QCoreApplication>
 #include <QRegularExpression>
 #include <QWebSocketServer>
 #include <QWebSocket>
-#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
-#include <QImage>
-#include <QBuffer>
-#endif
 #include <QTcpSocket>
 #include <QUrl>
 #include <QUrlQuery>
@@ -33,6 +32,7 @@
 #include <QDateTime>
 #include <QUuid>
 #include <QTimer>
+#include <QPointer>
 #ifdef CHATROOM_ENABLE_BENCHMARK_METRICS
 #include <QElapsedTimer>
 #endif
@@ -40,10 +40,36 @@
 #include <QStringList>
 #include <cmath>
 #include <limits>
+#include <memory>
 
 namespace {
 
 constexpr int kMaxClientMessageIdBytes = 128;
+constexpr int kFileExpiryBatchSize = 200;
+constexpr int kPasswordHashRetryAfterMs = 1000;
+constexpr int kFileExpiryIntervalMs = 10 * 60 * 1000;
+constexpr int kDefaultUploadIdleMs = 10 * 60 * 1000;
+constexpr int kMaxUploadIdleMs = 24 * 60 * 60 * 1000;
+constexpr int kMaxHttpThreads = 64;
+
+// CHATROOM_UPLOAD_IDLE_MS：上传在该时间内没有新的分块即视为放弃
+int uploadIdleTimeoutMs() {
+    bool ok = false;
+    const int configured = qEnvironmentVariableIntValue("CHATROOM_UPLOAD_IDLE_MS", &ok);
+    if (ok && configured > 0 && configured <= kMaxUploadIdleMs) return configured;
+    return kDefaultUploadIdleMs;
+}
+// CHATROOM_HTTP_THREADS：HTTP 连接线程数，默认 CPU 核心数的一半（至少 2）
+int httpThreadCount(int requested) {
+    if (requested > 0) return qMin(requested, kMaxHttpThreads);
+    bool ok = false;
+    const int configured = qEnvironmentVariableIntValue("CHATROOM_HTTP_THREADS", &ok);
+    if (ok && configured > 0 && configured <= kMaxHttpThreads) return configured;
+    return qMax(2, QThread::idealThreadCount() / 2);
+}
+const QString kFileExpiryDispatchKey = QStringLiteral("maintenance:file-expiry");
+// 调整房间配额时每个写事务清除的文件数
+constexpr int kFileCleanupBatchSize = 200;
 
 bool validOptionalClientMessageId(const QString &clientMessageId) {
     return clientMessageId.isEmpty() ||
@@ -87,31 +113,46 @@ QString readEnvValueFromFile(const QString &filePath, const QString &key) {
     return QString();
 }
 
-QString buildForwardThumbnail(const QString &filePath, const QString &fileName,
-                              qint64 fileSize) {
-#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
-    static const QStringList imageExtensions = {
-        "png", "jpg", "jpeg", "gif", "bmp", "webp"
-    };
-    if (fileSize < 20 * 1024 * 1024 &&
-        imageExtensions.contains(QFileInfo(fileName).suffix().toLower())) {
-        QImage image(filePath);
-        if (!image.isNull()) {
-            const QImage thumbnail = image.scaled(
-                200, 200, Qt::KeepAspectRatio, Qt::FastTransformation);
-            QByteArray bytes;
-            QBuffer buffer(&bytes);
-            buffer.open(QIODevice::WriteOnly);
-            thumbnail.save(&buffer, "JPEG", 60);
-            return QString::fromLatin1(bytes.toBase64());
-        }
+// 只接受连接描述符的监听器：socket 交给 I/O 线程创建，不在监听线程产生读通知
+class DescriptorListener : public QTcpServer {
+public:
+    DescriptorListener(std::function<void(qintptr)> accept, QObject *parent)
+        : QTcpServer(parent), m_accept(std::move(accept)) {}
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override { m_accept(socketDescriptor); }
+
+private:
+    std::function<void(qintptr)> m_accept;
+};
+
+// 未声明 blobRefs 的旧客户端仍期望历史消息内联 base64 缩略图：整页哈希一次从 blob 表取回
+QJsonArray inlineThumbnails(DatabaseManager *db, const QJsonArray &messages) {
+    QStringList hashes;
+    for (const QJsonValue &value : messages) {
+        const QString hash = value.toObject().value(QStringLiteral("thumbnailHash")).toString();
+        if (!hash.isEmpty()) hashes.append(hash);
+    }
+    const QHash<QString, QByteArray> thumbnails = db->getBlobs(hashes);
+
+    QJsonArray inlined;
+    for (const QJsonValue &value : messages) {
+        QJsonObject message = value.toObject();
+        const QString hash = message.take(QStringLiteral("thumbnailHash")).toString();
+        message.remove(QStringLiteral("thumbnailSize"));
+        const QByteArray thumbnail = thumbnails.value(hash);
+        if (!thumbnail.isEmpty())
+            message[QStringLiteral("thumbnail")] = QString::fromLatin1(thumbnail.toBase64());
+        inlined.append(message);
     }
-#else
-    Q_UNUSED(filePath)
-    Q_UNUSED(fileName)
-    Q_UNUSED(fileSize)
-#endif
-    return {};
+    return inlined;
+}
+
+// CBOR 帧的二进制字段经旁路以原始字节到达；消息记录与 JSON 通知仍以 base64 文本保存缩略图
+QString thumbnailField(const QJsonObject &data, const Protocol::BinaryFields &binary) {
+    const auto it = binary.constFind(QStringLiteral("thumbnail"));
+    return it != binary.constEnd() ? QString::fromLatin1(it->toBase64())
+                                   : data["thumbnail"].toString();
 }
 
 } // namespace
@@ -121,9 +162,13 @@ ChatServer::ChatServer(QObject *parent)
       m_db(new DatabaseManager(this)),
       m_roomMgr(new RoomManager(this)),
       m_cos(new CosManager(this)),
+      m_dispatcher(new RequestDispatcher(this)),
+      m_ioPool(new SessionIoPool(this)),
+      m_httpPool(new SessionIoPool(this)),
       m_roomMessageService(m_db),
       m_friendMessageService(m_db),
-      m_administrativeDeletionService(m_db) {}
+      m_administrativeDeletionService(m_db),
+      m_fileStore(m_db, QCoreApplication::applicationDirPath() + QStringLiteral("/server_files/blobs")) {}
 
 ChatServer::~ChatServer() {
     stopServer();
@@ -140,6 +185,9 @@ bool ChatServer::startServer(quint16 port, quint16 wsPort, quint16 httpPort) {
     m_administrativeDeletionsAccepted = 0;
     m_administrativeDeletionsDuplicate = 0;
     m_administrativeDeletionsRejected = 0;
+    m_attachmentFinalizationsAccepted = 0;
+    m_attachmentFinalizationsDuplicate = 0;
+    m_attachmentFinalizationsRejected = 0;
     const AuthenticationAbuseGuard::Limits authLimits = m_authAbuseGuard.limits();
     qInfo().noquote()
         << QStringLiteral("[AuthAbuse] configured windowMs=%1 gatewayLimit=%2 ipLimit=%3 accountLimit=%4 maxTrackedKeys=%5")
@@ -148,15 +196,33 @@ bool ChatServer::startServer(quint16 port, quint16 wsPort, quint16 httpPort) {
                .arg(authLimits.ipAttempts)
                .arg(authLimits.accountAttempts)
                .arg(authLimits.maxTrackedKeys);
+    qInfo().noquote()
+        << QStringLiteral("[AuthAbuse] password hashing workers=%1 queueDepth=%2")
+               .arg(m_passwordHashPool.workerCount())
+               .arg(m_passwordHashPool.limits().queueDepth);
+    qInfo().noquote()
+        << QStringLiteral("[Thumbnail] workers=%1 queueDepth=%2 video=%3")
+               .arg(m_thumbnails.workerCount())
+               .arg(m_thumbnails.limits().queueDepth)
+               .arg(m_thumbnails.supports(ThumbnailService::Kind::Video)
+                        ? m_thumbnails.limits().ffmpegPath : QStringLiteral("off"));
 
     // 初始化数据库
     if (!m_db->initialize()) {
         qCritical() << "[Server] 数据库初始化失败";
         return false;
     }
+    if (!m_fileStore.open()) {
+        return false;
+    }
     // 初始化房间管理器（从数据库加载房间列表）
     m_roomMgr->loadRooms(m_db);
 
+    // 请求处理工作线程：需在开始监听前就绪
+    m_dispatcher->start(m_workerThreadCount);
+    // TCP 会话 I/O 线程：固定数量的事件循环承载全部连接，不再每连接一个线程
+    m_ioPool->start(m_ioThreadCount);
+
     if (!listen(QHostAddress::Any, port)) {
         qCritical() << "[Server] TCP 监听端口失败:" << port << errorString();
         return false;
@@ -165,43 +231,64 @@ bool ChatServer::startServer(quint16 port, quint16 wsPort, quint16 httpPort) {
 
     // 启动 WebSocket 服务器（默认 TCP 端口 + 1）
     if (wsPort == 0) wsPort = port + 1;
-    m_wsServer = new QWebSocketServer(
-        QStringLiteral("ChatServer-WS"), QWebSocketServer::NonSecureMode, this);
-    if (!m_wsServer->listen(QHostAddress::Any, wsPort)) {
-        qCritical() << "[Server] WebSocket 监听端口失败:" << wsPort << m_wsServer->errorString();
+    if (!m_wsListener) {
+        m_wsListener = new DescriptorListener(
+            [this](qintptr socketDescriptor) { acceptWebSocketConnection(socketDescriptor); }, this);
+    }
+    if (!m_wsListener->listen(QHostAddress::Any, wsPort)) {
+        qCritical() << "[Server] WebSocket 监听端口失败:" << wsPort << m_wsListener->errorString();
         return false;
     }
-    connect(m_wsServer, &QWebSocketServer::newConnection,
-            this, &ChatServer::onNewWebSocketConnection);
+    for (int i = 0; i < m_ioPool->threadCount(); ++i) {
+        auto *upgrader = new QWebSocketServer(
+            QStringLiteral("ChatServer-WS"), QWebSocketServer::NonSecureMode);
+        upgrader->moveToThread(m_ioPool->thread(i));
+        connect(m_ioPool->thread(i), &QThread::finished, upgrader, &QObject::deleteLater);
+        connect(upgrader, &QWebSocketServer::newConnection, upgrader,
+                [this, upgrader]() { onNewWebSocketConnection(upgrader); });
+        m_wsUpgraders.append(upgrader);
+    }
     qInfo() << "[Server] WebSocket 服务器已启动，监听端口:" << wsPort;
 
-    // 启动 HTTP 下载服务（默认 TCP 端口 + 2）
+    // 启动 HTTP 下载服务（默认 TCP 端口 + 2）：连接在独立的 HTTP 线程上解析与应答
     if (httpPort == 0) httpPort = port + 2;
     m_httpPort = httpPort;
+    m_httpPool->start(httpThreadCount(m_httpThreadCount), QStringLiteral("chat-http"));
     if (!setupHttpServer(httpPort)) {
         return false;
     }
 
-    // 加载 COS 配置（需在 expireStoredFiles 前加载，以便 deleteCosFiles 可用）
+    // 加载 COS 配置（需在文件过期任务前加载，以便 deleteCosFiles 可用）
     m_cos->loadConfig();
+    // 继续上次运行未完成的分片上传，已完成的分片不再重传
+    m_cos->setStateDir(QCoreApplication::applicationDirPath() + QStringLiteral("/server_files/cos_uploads"));
+    const int resumedCosUploads = m_cos->resumePendingUploads([this](const QJsonObject &context) {
+        return cosUploadFinished(context.value(QStringLiteral("fileId")).toInt(),
+                                 context.value(QStringLiteral("isFriendFile")).toBool(),
+                                 context.value(QStringLiteral("fileName")).toString());
+    }, [this](const QJsonObject &context) {
+        // 停机期间被撤回、清理或已过期的记录不再续传
+        return !m_db->getFilePath(context.value(QStringLiteral("fileId")).toInt(),
+                                  context.value(QStringLiteral("isFriendFile")).toBool()).isEmpty();
+    });
+    if (resumedCosUploads > 0)
+        qInfo() << "[COS] 继续上次未完成的分片上传:" << resumedCosUploads;
 
-    deleteCosFiles(m_db->expireStoredFiles());
-
+    // 文件过期是独立的后台维护任务：在工作线程上分批执行，历史/同步等读路径不再写库
     if (!m_expireTimer) {
         m_expireTimer = new QTimer(this);
-        m_expireTimer->setInterval(60 * 60 * 1000);
-        connect(m_expireTimer, &QTimer::timeout, this, [this] {
-            deleteCosFiles(m_db->expireStoredFiles());
-        });
+        m_expireTimer->setInterval(kFileExpiryIntervalMs);
+        connect(m_expireTimer, &QTimer::timeout, this, &ChatServer::scheduleFileExpiry);
     }
     m_expireTimer->start();
+    scheduleFileExpiry();
     return true;
 }
 
 void ChatServer::stopServer() {
     close();
-    if (m_wsServer) {
-        m_wsServer->close();
+    if (m_wsListener) {
+        m_wsListener->close();
     }
     if (m_httpServer) {
         m_httpServer->close();
@@ -211,10 +298,25 @@ void ChatServer::stopServer() {
     if (m_expireTimer) {
         m_expireTimer->stop();
     }
-    QMutexLocker locker(&m_mutex);
-    for (auto *s : std::as_const(m_sessions))
-        s->disconnectFromServer();
-    m_sessions.clear();
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto *s : std::as_const(m_sessions))
+            s->disconnectFromServer();
+        m_sessions.clear();
+    }
+    // HTTP 线程结束时仍打开的连接随线程销毁，未收完的上传请求体按中止清理；
+    // 清理会访问数据库与上传表，须在工作线程停止之前完成
+    m_httpPool->stop();
+    // 先等待在途的密码哈希与缩略图完成（其回调会投递到工作线程），再停止工作线程
+    // （工作线程先执行完已排队的请求与数据库写入再退出）
+    m_passwordHashPool.waitForDone();
+    m_thumbnails.shutdown();
+    m_dispatcher->stop();
+    m_ioPool->stop();
+    m_wsUpgraders.clear();
+    m_fileExpiryActive.storeRelease(0);
+    DatabaseManager::logStatementCacheStats();
+    m_db->logRoomHistoryCacheStats();
 }
 
 // ==================== 新连接 ====================
@@ -222,35 +324,172 @@ void ChatServer::stopServer() {
 void ChatServer::incomingConnection(qintptr socketDescriptor) {
     qInfo() << "[Server] 新 TCP 连接:" << socketDescriptor;
 
-    QThread *thread = new QThread(this);
     ClientSession *session = new ClientSession(socketDescriptor);
-    session->moveToThread(thread);
-
-    connect(thread,  &QThread::started,  session, &ClientSession::init);
-    connect(session, &ClientSession::authenticated,  this, &ChatServer::onClientAuthenticated);
-    connect(session, &ClientSession::disconnected,   this, &ChatServer::onClientDisconnected);
-    connect(session, &ClientSession::messageReceived,this, &ChatServer::onClientMessage);
 
-    connect(session, &ClientSession::destroyed, thread, &QThread::quit);
-    connect(thread,  &QThread::finished,        thread, &QThread::deleteLater);
+    // 会话信号直接在会话线程 / 工作线程中处理，由 RequestDispatcher 负责线程切换
+    connect(session, &ClientSession::authenticated,  this, &ChatServer::onClientAuthenticated,
+            Qt::DirectConnection);
+    connect(session, &ClientSession::disconnected,   this, &ChatServer::dispatchClientDisconnected,
+            Qt::DirectConnection);
+    connect(session, &ClientSession::messageReceived,this, &ChatServer::dispatchClientMessage,
+            Qt::DirectConnection);
+    connect(session, &ClientSession::binaryReceived, this, &ChatServer::dispatchClientBinary,
+            Qt::DirectConnection);
+
+    // 迁移到 I/O 线程后由该线程的事件循环执行 init()，socket 在那里创建
+    m_ioPool->assign(session);
+    QMetaObject::invokeMethod(session, &ClientSession::init, Qt::QueuedConnection);
+}
 
-    thread->start();
+void ChatServer::acceptWebSocketConnection(qintptr socketDescriptor) {
+    const int index = m_ioPool->reserve();
+    if (index < 0) {
+        QTcpSocket socket;
+        socket.setSocketDescriptor(socketDescriptor);
+        socket.abort();
+        return;
+    }
+    // socket 在 I/O 线程创建后由该线程的 QWebSocketServer 完成握手；QWebSocket 接管 socket，
+    // 因此 socket 的生命周期覆盖整个会话，预留的线程负载随它归还
+    QWebSocketServer *upgrader = m_wsUpgraders.at(index);
+    m_ioPool->post(index, [this, index, upgrader, socketDescriptor]() {
+        auto *socket = new QTcpSocket;
+        m_ioPool->attach(index, socket);
+        if (!socket->setSocketDescriptor(socketDescriptor)) {
+            qWarning() << "[Server] WebSocket 连接无法设置 socket descriptor";
+            delete socket;
+            return;
+        }
+        upgrader->handleConnection(socket);
+    });
 }
 
-void ChatServer::onNewWebSocketConnection() {
-    while (m_wsServer->hasPendingConnections()) {
-        QWebSocket *ws = m_wsServer->nextPendingConnection();
+void ChatServer::onNewWebSocketConnection(QWebSocketServer *upgrader) {
+    while (upgrader->hasPendingConnections()) {
+        QWebSocket *ws = upgrader->nextPendingConnection();
         qInfo() << "[Server] 新 WebSocket 连接:" << ws->peerAddress().toString();
 
-        // QWebSocket 已拥有活跃的 socket notifier，不能 moveToThread
-        // 直接在主线程处理 WebSocket 会话
-        ClientSession *session = new ClientSession(ws, this);
+        // 握手已在当前 I/O 线程完成，会话与 QWebSocket 同线程，无需迁移
+        ClientSession *session = new ClientSession(ws);
+
+        connect(session, &ClientSession::authenticated,  this, &ChatServer::onClientAuthenticated,
+                Qt::DirectConnection);
+        connect(session, &ClientSession::disconnected,   this, &ChatServer::dispatchClientDisconnected,
+                Qt::DirectConnection);
+        connect(session, &ClientSession::messageReceived,this, &ChatServer::dispatchClientMessage,
+                Qt::DirectConnection);
         session->init();
+    }
+}
+
+// ==================== 请求分发 ====================
+
+QString ChatServer::sessionDispatchKey(ClientSession *session) {
+    return QStringLiteral("session:%1").arg(reinterpret_cast<quintptr>(session));
+}
+
+QString ChatServer::dispatchKey(ClientSession *session, const QJsonObject &msg) const {
+    const QString type = msg["type"].toString();
+    // 上传流程（START/CHUNK/END/CANCEL）与断连清理都按会话串行，保证同一上传内的顺序；
+    // 未认证会话的请求同样按会话串行，确保排在 LOGIN_REQ 之后执行
+    const bool uploadFlow = type == Protocol::MsgType::FILE_UPLOAD_START
+        || type == Protocol::MsgType::FILE_UPLOAD_CHUNK
+        || type == Protocol::MsgType::FILE_UPLOAD_END
+        || type == Protocol::MsgType::FILE_UPLOAD_CANCEL
+        || type == Protocol::MsgType::FRIEND_FILE_UPLOAD_START;
+    if (uploadFlow || !session->isAuthenticated())
+        return sessionDispatchKey(session);
 
-        connect(session, &ClientSession::authenticated,  this, &ChatServer::onClientAuthenticated);
-        connect(session, &ClientSession::disconnected,   this, &ChatServer::onClientDisconnected);
-        connect(session, &ClientSession::messageReceived,this, &ChatServer::onClientMessage);
+    const QJsonObject data = msg["data"].toObject();
+    const int roomId = data["roomId"].toInt();
+    if (roomId > 0)
+        return QStringLiteral("room:%1").arg(roomId);
+    const int friendshipId = data["friendshipId"].toInt();
+    if (friendshipId > 0)
+        return QStringLiteral("friendship:%1").arg(friendshipId);
+    const QString friendUsername = data["friendUsername"].toString();
+    if (!friendUsername.isEmpty()) {
+        // 好友会话由两端用户唯一确定，双方的请求落在同一分片
+        QString self = session->username();
+        QString peer = friendUsername;
+        if (peer < self) std::swap(self, peer);
+        return QStringLiteral("friend:%1/%2").arg(self, peer);
+    }
+    return sessionDispatchKey(session);
+}
+
+void ChatServer::dispatchClientMessage(ClientSession *session, const QJsonObject &msg,
+                                       const Protocol::BinaryFields &binary) {
+    // 心跳无需访问共享状态，直接在会话线程应答
+    if (msg["type"].toString() == Protocol::MsgType::HEARTBEAT) {
+        session->sendMessage(Protocol::makeHeartbeatAck());
+        return;
     }
+    session->retain();
+    m_dispatcher->post(dispatchKey(session, msg), [this, session, msg, binary]() {
+        onClientMessage(session, msg, binary);
+        session->release();
+    });
+}
+
+void ChatServer::dispatchClientBinary(ClientSession *session, const QJsonObject &header,
+                                      const QByteArray &payload) {
+    // 二进制分块帧只在登录协商 binaryChunks 之后有效；未登录或未协商的会话发来的按协议违规丢弃
+    if (!session->isAuthenticated() || !session->usesBinaryChunks()) {
+        qWarning().noquote() << QStringLiteral("[Protocol] rejected binary frame before negotiation "
+                                               "authenticated=%1 userId=%2")
+                                    .arg(session->isAuthenticated() ? 1 : 0)
+                                    .arg(session->userId());
+        return;
+    }
+    // 二进制分块帧目前只承载上传分块；与 JSON 上传消息同一分片，保持分块顺序
+    if (header["type"].toString() != Protocol::MsgType::FILE_UPLOAD_CHUNK) {
+        qWarning().noquote() << QStringLiteral("[Protocol] ignored binary frame type=%1 userId=%2")
+                                    .arg(header["type"].toString())
+                                    .arg(session->userId());
+        return;
+    }
+    session->retain();
+    m_dispatcher->post(dispatchKey(session, header), [this, session, header, payload]() {
+        handleFileUploadChunk(session, header["data"].toObject(), &payload);
+        session->release();
+    });
+}
+
+void ChatServer::dispatchClientDisconnected(ClientSession *session) {
+    m_dispatcher->post(sessionDispatchKey(session), [this, session]() {
+        onClientDisconnected(session);
+    });
+}
+
+// ==================== 文件过期维护 ====================
+
+void ChatServer::scheduleFileExpiry() {
+    // 上一轮仍在分批处理时跳过，避免同一时刻出现两条批处理链
+    if (!m_fileExpiryActive.testAndSetOrdered(0, 1))
+        return;
+    m_dispatcher->post(kFileExpiryDispatchKey, [this]() { runFileExpiryBatch(); });
+}
+
+void ChatServer::runFileExpiryBatch() {
+    const FileExpiryBatch batch = m_db->expireStoredFiles(kFileExpiryBatchSize);
+    deleteCosFiles(batch.cosUrls);
+    // 过期记录已由触发器减少引用，计数归零的文件 blob 在这里删除
+    const int reapedFileBlobs = m_fileStore.reap();
+    if (batch.expiredCount > 0)
+        qInfo() << "[Server] 已过期文件数:" << batch.expiredCount
+                << (batch.hasMore ? "(继续下一批)" : "");
+    if (batch.prunedBlobCount > 0)
+        qInfo() << "[Server] 已回收无引用 blob:" << batch.prunedBlobCount;
+    if (reapedFileBlobs > 0)
+        qInfo() << "[Server] 已回收无引用文件:" << reapedFileBlobs;
+
+    if (!batch.hasMore && reapedFileBlobs < FileBlobStore::REAP_BATCH) {
+        m_fileExpiryActive.storeRelease(0);
+        return;
+    }
+    // 重新排队而不是循环：同一分片上的其他请求可以插在两批之间执行
+    m_dispatcher->post(kFileExpiryDispatchKey, [this]() { runFileExpiryBatch(); });
 }
 
 // ==================== 会话事件 ====================
@@ -297,22 +536,18 @@ void ChatServer::onClientDisconnected(ClientSession *session) {
 
     // 清理该用户进行中的上传状态
     QList<QString> staleUploads;
-    for (auto it = m_uploads.begin(); it != m_uploads.end(); ++it) {
-        if (it.value().userId == userId)
-            staleUploads.append(it.key());
-    }
-    for (const QString &uploadId : staleUploads) {
-        UploadState state = m_uploads.take(uploadId);
-        if (state.file) {
-            state.file->close();
-            delete state.file;
+    {
+        QMutexLocker uploadLocker(&m_uploadMutex);
+        for (auto it = m_uploads.cbegin(); it != m_uploads.cend(); ++it) {
+            if (it.value()->userId == userId)
+                staleUploads.append(it.key());
         }
-        // 删除不完整的文件
-        if (!state.filePath.isEmpty())
-            QFile::remove(state.filePath);
-        if (state.roomQuotaReserved)
-            releaseRoomFileQuota(state.roomId, state.fileSize);
-        qInfo() << "[Server] 清理断连用户上传:" << state.fileName;
+    }
+    for (const QString &uploadId : std::as_const(staleUploads)) {
+        const UploadStatePtr state = takeUpload(uploadId);
+        if (!state) continue;
+        discardUpload(*state);
+        qInfo() << "[Server] 清理断连用户上传:" << state->fileName;
     }
 
     // 被踢出的 session 不广播（新的 session 会继承房间状态）
@@ -340,10 +575,11 @@ void ChatServer::onClientDisconnected(ClientSession *session) {
     }
 
     qInfo() << "[Server] 用户断开:" << username;
-    session->deleteLater();
+    session->release();
 }
 
-void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg) {
+void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg,
+                                 const Protocol::BinaryFields &binary) {
     QString type = msg["type"].toString();
 
     if (type == Protocol::MsgType::LOGIN_REQ) {
@@ -365,7 +601,7 @@ void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg)
     } else if (type == Protocol::MsgType::HISTORY_REQ) {
         handleHistory(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FILE_SEND) {
-        handleFileSend(session, msg);
+        handleFileSend(session, msg, binary);
     } else if (type == Protocol::MsgType::FILE_DOWNLOAD_REQ) {
         handleFileDownload(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FILE_FORWARD_REQ) {
@@ -373,9 +609,11 @@ void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg)
     } else if (type == Protocol::MsgType::FILE_UPLOAD_START) {
         handleFileUploadStart(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FILE_UPLOAD_CHUNK) {
-        handleFileUploadChunk(session, msg["data"].toObject());
+        const auto chunk = binary.constFind(QStringLiteral("chunkData"));
+        handleFileUploadChunk(session, msg["data"].toObject(),
+                              chunk != binary.constEnd() ? &chunk.value() : nullptr);
     } else if (type == Protocol::MsgType::FILE_UPLOAD_END) {
-        handleFileUploadEnd(session, msg["data"].toObject());
+        handleFileUploadEnd(session, msg["data"].toObject(), binary);
     } else if (type == Protocol::MsgType::FILE_UPLOAD_CANCEL) {
         handleFileUploadCancel(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FILE_DOWNLOAD_CHUNK_REQ) {
@@ -403,7 +641,7 @@ void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg)
     } else if (type == Protocol::MsgType::KICK_USER_REQ) {
         handleKickUser(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::AVATAR_UPLOAD_REQ) {
-        handleAvatarUpload(session, msg["data"].toObject());
+        handleAvatarUpload(session, msg["data"].toObject(), binary);
     } else if (type == Protocol::MsgType::AVATAR_GET_REQ) {
         handleAvatarGet(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::CHANGE_NICKNAME_REQ) {
@@ -417,7 +655,7 @@ void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg)
     } else if (type == Protocol::MsgType::ROOM_SEARCH_REQ) {
         handleRoomSearch(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::ROOM_AVATAR_UPLOAD_REQ) {
-        handleRoomAvatarUpload(session, msg["data"].toObject());
+        handleRoomAvatarUpload(session, msg["data"].toObject(), binary);
     } else if (type == Protocol::MsgType::ROOM_AVATAR_GET_REQ) {
         handleRoomAvatarGet(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FRIEND_REQUEST_REQ) {
@@ -437,7 +675,7 @@ void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg)
     } else if (type == Protocol::MsgType::FRIEND_HISTORY_REQ) {
         handleFriendHistory(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FRIEND_FILE_SEND) {
-        handleFriendFileSend(session, msg);
+        handleFriendFileSend(session, msg, binary);
     } else if (type == Protocol::MsgType::FRIEND_FILE_UPLOAD_START) {
         handleFriendFileUploadStart(session, msg["data"].toObject());
     } else if (type == Protocol::MsgType::FRIEND_RECALL_REQ) {
@@ -470,8 +708,6 @@ void ChatServer::onClientMessage(ClientSession *session, const QJsonObject &msg)
                                             .arg(session->userId());
             }
         }
-    } else if (type == Protocol::MsgType::HEARTBEAT) {
-        session->sendMessage(Protocol::makeHeartbeatAck());
     }
 }
 
@@ -495,13 +731,29 @@ void ChatServer::handleLogin(ClientSession *session, const QJsonObject &data) {
         return;
     }
 
-    int userId = m_db->authenticateUser(username, password);
+    auto userId = std::make_shared<int>(-1);
+    submitPasswordWork(session, QStringLiteral("login"), Protocol::MsgType::LOGIN_RSP,
+        [this, userId, username, password]() {
+            *userId = m_db->authenticateUser(username, password);
+        },
+        [this, session, userId, username, data]() {
+            finishLogin(session, username, *userId, data);
+        });
+}
+
+void ChatServer::finishLogin(ClientSession *session, const QString &username, int userId,
+                             const QJsonObject &loginData) {
+    // 哈希期间连接已断开：断连清理已执行，不能再把会话登记为在线
+    if (session->isClosed()) return;
 
     QJsonObject rspData;
+    bool cborFrames = false;
+    bool binaryChunks = false;
+    bool compressedFrames = false;
     if (userId > 0) {
         QString displayName = m_db->getDisplayName(userId);
         // 踢掉旧连接：先发送强制下线通知，再断开
-        // 注意：必须先释放 mutex 再断开，因为 WebSocket session 在主线程
+        // 注意：必须先释放 mutex 再断开，因为旧会话若恰好在当前线程，
         // disconnectFromServer() 会同步触发 onClientDisconnected()，后者也要加锁
         ClientSession *oldSession = nullptr;
         {
@@ -518,6 +770,14 @@ void ChatServer::handleLogin(ClientSession *session, const QJsonObject &data) {
             oldSession->disconnectFromServer();
         }
         session->setAuthenticated(userId, username, displayName);
+        // 新客户端声明 blobRefs 后，历史消息与头像响应只携带哈希引用
+        session->setBlobReferences(loginData["blobRefs"].toBool());
+        // CBOR 帧与二进制分块帧只在 TCP 上协商，WebSocket 保持 JSON 文本与 base64 分块；
+        // 压缩帧两种传输都可协商：TCP 用长度前缀标记，WebSocket 以二进制消息携带
+        const bool tcp = session->transport() == ClientSession::Tcp;
+        cborFrames = tcp && loginData["cborFrames"].toBool();
+        binaryChunks = tcp && loginData["binaryChunks"].toBool();
+        compressedFrames = loginData["compressedFrames"].toBool();
         rspData["success"]     = true;
         rspData["userId"]      = userId;
         rspData["username"]    = username;
@@ -525,6 +785,10 @@ void ChatServer::handleLogin(ClientSession *session, const QJsonObject &data) {
         rspData["fileToken"]   = generateFileToken(userId);
         rspData["httpPort"]    = m_httpPort;
         rspData["serverFileForward"] = true;
+        rspData["blobRefs"] = session->usesBlobReferences();
+        rspData["cborFrames"] = cborFrames;
+        rspData["binaryChunks"] = binaryChunks;
+        rspData["compressedFrames"] = compressedFrames;
         m_authAbuseGuard.recordSuccess(username);
         emit session->authenticated(session);
     } else {
@@ -532,10 +796,14 @@ void ChatServer::handleLogin(ClientSession *session, const QJsonObject &data) {
         rspData["error"]   = QStringLiteral("用户ID或密码错误");
     }
     session->sendMessage(Protocol::makeMessage(Protocol::MsgType::LOGIN_RSP, rspData));
+    // LOGIN_RSP 以 JSON 写出后才切换编码，客户端据响应得知协商结果
+    if (userId > 0)
+        session->enableFrameCapabilities(cborFrames, binaryChunks, compressedFrames);
 }
 
 
 QString ChatServer::generateFileToken(int userId) {
+    QMutexLocker locker(&m_fileTokenMutex);
     // 清理该用户旧 token，避免并存过多历史令牌。
     for (auto it = m_fileTokens.begin(); it != m_fileTokens.end(); ) {
         if (it.value().first == userId) {
@@ -553,6 +821,7 @@ QString ChatServer::generateFileToken(int userId) {
 
 int ChatServer::validateFileToken(const QString &token) const {
     if (token.isEmpty()) return 0;
+    QMutexLocker locker(&m_fileTokenMutex);
     auto it = m_fileTokens.constFind(token);
     if (it == m_fileTokens.constEnd()) return 0;
     if (it.value().second < QDateTime::currentDateTimeUtc()) return 0;
@@ -573,6 +842,7 @@ bool ChatServer::requireRoomMembership(ClientSession *session, int roomId,
 
 void ChatServer::recordRoomMessageOutcome(RoomMessageService::Status status,
                                           int userId, int roomId) {
+    QMutexLocker locker(&m_outcomeMutex);
     QString outcome;
     if (status == RoomMessageService::Status::Accepted) {
         ++m_roomMessagesAccepted;
@@ -602,6 +872,7 @@ void ChatServer::recordRoomMessageOutcome(RoomMessageService::Status status,
 
 void ChatServer::recordFriendMessageOutcome(FriendMessageService::Status status,
                                             int userId, int friendshipId) {
+    QMutexLocker locker(&m_outcomeMutex);
     QString outcome;
     if (status == FriendMessageService::Status::Accepted) {
         ++m_friendMessagesAccepted;
@@ -632,6 +903,7 @@ void ChatServer::recordFriendMessageOutcome(FriendMessageService::Status status,
 void ChatServer::recordAdministrativeDeletionOutcome(
     AdministrativeDeletionService::Status status, int userId, int roomId,
     qint64 sequence, const QString &clientOperationId) {
+    QMutexLocker locker(&m_outcomeMutex);
     QString outcome;
     if (status == AdministrativeDeletionService::Status::Accepted) {
         ++m_administrativeDeletionsAccepted;
@@ -658,9 +930,8 @@ void ChatServer::recordAdministrativeDeletionOutcome(
 bool ChatServer::requireUploadOwnership(ClientSession *session, const QString &uploadId,
                                         QJsonObject *response) const {
     const int userId = session && session->isAuthenticated() ? session->userId() : 0;
-    const auto it = m_uploads.constFind(uploadId);
-    const bool allowed = userId > 0 && it != m_uploads.constEnd()
-                         && it.value().userId == userId;
+    const UploadStatePtr state = findUpload(uploadId);
+    const bool allowed = userId > 0 && state && state->userId == userId;
     if (allowed) return true;
 
     if (response) {
@@ -700,6 +971,7 @@ void ChatServer::sendUploadFinalizeResponse(
     session->sendMessage(
         Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_END_RSP, response));
 
+    QMutexLocker locker(&m_outcomeMutex);
     QString outcome;
     if (result.status == MessageSaveResult::Status::Created) {
         ++m_attachmentFinalizationsAccepted;
@@ -729,9 +1001,19 @@ bool ChatServer::allowAuthenticationAttempt(ClientSession *session,
         m_authAbuseGuard.allow(session ? session->peerAddress() : QString(), account);
     if (decision.allowed) return true;
 
+    rejectAuthenticationAttempt(session, operation, responseType, decision);
+    return false;
+}
+
+void ChatServer::rejectAuthenticationAttempt(ClientSession *session,
+                                             const QString &operation,
+                                             const QString &responseType,
+                                             const AuthenticationAbuseGuard::Decision &decision) {
     QJsonObject rspData;
     rspData["success"] = false;
-    rspData["error"] = QStringLiteral("认证请求过于频繁，请稍后重试");
+    rspData["error"] = decision.dimension == QStringLiteral("hash-queue")
+        ? QStringLiteral("服务器繁忙，请稍后重试")
+        : QStringLiteral("认证请求过于频繁，请稍后重试");
     if (session) {
         session->sendMessage(Protocol::makeMessage(responseType, rspData));
     }
@@ -750,6 +1032,29 @@ bool ChatServer::allowAuthenticationAttempt(ClientSession *session,
                    .arg(decision.activeIpKeys)
                    .arg(decision.activeAccountKeys);
     }
+}
+
+bool ChatServer::submitPasswordWork(ClientSession *session,
+                                    const QString &operation,
+                                    const QString &responseType,
+                                    std::function<void()> work,
+                                    std::function<void()> resume) {
+    // 会话在哈希完成前必须保持有效；完成回调回到会话分片，与该会话的其他请求保持顺序
+    session->retain();
+    const QString key = sessionDispatchKey(session);
+    const bool queued = m_passwordHashPool.trySubmit(
+        [this, session, key, work = std::move(work), resume = std::move(resume)]() {
+            work();
+            m_dispatcher->post(key, [session, resume]() {
+                resume();
+                session->release();
+            });
+        });
+    if (queued) return true;
+
+    session->release();
+    rejectAuthenticationAttempt(session, operation, responseType,
+                                m_authAbuseGuard.denyOverloaded(kPasswordHashRetryAfterMs));
     return false;
 }
 
@@ -806,21 +1111,10 @@ bool ChatServer::setupHttpServer(quint16 port) {
         m_httpServer = nullptr;
     }
 
-    m_httpServer = new QTcpServer(this);
-    connect(m_httpServer, &QTcpServer::newConnection, this, [this]() {
-        while (m_httpServer->hasPendingConnections()) {
-            QTcpSocket *socket = m_httpServer->nextPendingConnection();
-            connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
-                handleHttpRequest(socket);
-            });
-            connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
-                if (socket->property("rawUploadActive").toBool())
-                    abandonUpload(socket->property("rawUploadId").toString());
-            });
-            connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
-        }
-    });
-
+    // 主线程只接受描述符，连接在独立的 HTTP 线程创建并处理：请求头解析、鉴权查询、
+    // 上传写盘与文件发送既不占用主线程，也不与聊天会话争用 I/O 线程
+    m_httpServer = new DescriptorListener(
+        [this](qintptr socketDescriptor) { acceptHttpConnection(socketDescriptor); }, this);
     if (!m_httpServer->listen(QHostAddress::Any, port)) {
         qCritical() << "[Server] HTTP 监听端口失败:" << port << m_httpServer->errorString();
         return false;
@@ -829,101 +1123,54 @@ bool ChatServer::setupHttpServer(quint16 port) {
     return true;
 }
 
-void ChatServer::handleHttpRequest(QTcpSocket *socket) {
-    if (!socket) return;
-
-    auto writeSimple = [socket](int status, const QByteArray &statusText, const QByteArray &body = QByteArray()) {
-        QByteArray resp;
-        resp += "HTTP/1.1 " + QByteArray::number(status) + " " + statusText + "\r\n";
-        resp += "Access-Control-Allow-Origin: *\r\n";
-        resp += "Access-Control-Allow-Methods: GET, PUT, OPTIONS\r\n";
-        resp += "Access-Control-Allow-Headers: Content-Type, Content-Length\r\n";
-        if (!body.isEmpty()) {
-            resp += "Content-Type: text/plain; charset=utf-8\r\n";
-            resp += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
-        } else {
-            resp += "Content-Length: 0\r\n";
-        }
-        resp += "Connection: close\r\n\r\n";
-        if (!body.isEmpty()) resp += body;
-        socket->write(resp);
-        socket->disconnectFromHost();
-    };
-
-    if (socket->property("rawUploadActive").toBool()) {
-        const QString uploadId = socket->property("rawUploadId").toString();
-        const qint64 expected = socket->property("rawUploadLength").toLongLong();
-        qint64 received = socket->property("rawUploadReceived").toLongLong();
-        auto it = m_uploads.find(uploadId);
-        if (it == m_uploads.end() || !it->file || !it->file->isOpen()) {
-            socket->setProperty("rawUploadActive", false);
-            writeSimple(404, "Not Found", "Unknown upload");
-            return;
-        }
-        while (socket->bytesAvailable() > 0 && received < expected) {
-            const qint64 wanted = qMin<qint64>(64 * 1024, expected - received);
-            const QByteArray chunk = socket->read(wanted);
-            if (chunk.isEmpty()) break;
-            if (it->file->write(chunk) != chunk.size()) {
-                socket->setProperty("rawUploadActive", false);
-                abandonUpload(uploadId);
-                writeSimple(500, "Internal Server Error", "Write failed");
-                return;
-            }
-            received += chunk.size();
-            it->received = received;
-            socket->setProperty("rawUploadReceived", received);
-        }
-        if (received == expected) {
-            if (socket->bytesAvailable() > 0) {
-                socket->setProperty("rawUploadActive", false);
-                abandonUpload(uploadId);
-                writeSimple(400, "Bad Request", "Body exceeds Content-Length");
-                return;
-            }
-            it->file->flush();
-            socket->setProperty("rawUploadActive", false);
-            writeSimple(204, "No Content");
-        }
-        return;
-    }
-
-    QByteArray req = socket->property("httpHeader").toByteArray();
-    if (req.size() >= 16 * 1024) {
-        writeSimple(431, "Request Header Fields Too Large");
-        return;
-    }
-    req += socket->read(16 * 1024 - req.size());
-    const int headerEnd = req.indexOf("\r\n\r\n");
-    if (headerEnd < 0) {
-        socket->setProperty("httpHeader", req);
-        return;
-    }
-    const QByteArray initialBody = req.mid(headerEnd + 4);
-    socket->setProperty("httpHeader", QByteArray());
-    req.truncate(headerEnd + 4);
-
-    const QList<QByteArray> lines = req.split('\n');
-    if (lines.isEmpty()) {
-        socket->disconnectFromHost();
-        return;
-    }
-
-    const QByteArray requestLine = lines.first().trimmed();
-    const QList<QByteArray> parts = requestLine.split(' ');
-    if (parts.size() < 2) {
-        socket->disconnectFromHost();
+void ChatServer::acceptHttpConnection(qintptr socketDescriptor) {
+    const int index = m_httpPool->reserve();
+    if (index < 0) {
+        QTcpSocket socket;
+        socket.setSocketDescriptor(socketDescriptor);
+        socket.abort();
         return;
     }
+    m_httpPool->post(index, [this, index, socketDescriptor]() {
+        auto *socket = new QTcpSocket;
+        if (!socket->setSocketDescriptor(socketDescriptor)) {
+            qWarning() << "[Server] HTTP 连接无法设置 socket descriptor";
+            delete socket;
+            m_httpPool->release(index);
+            return;
+        }
+        // 连接挂在线程的上下文对象下：断开时自行 deleteLater，服务停止时随线程销毁
+        auto *connection = new HttpConnection(socket);
+        m_httpPool->adopt(index, connection);
+        connect(connection, &HttpConnection::requestReceived, this,
+                [this](HttpConnection *conn, const HttpRequest &request) {
+                    handleHttpRequest(conn, request);
+                },
+                Qt::DirectConnection);
+    });
+}
 
-    const QByteArray method = parts[0];
-    const QString target = QString::fromUtf8(parts[1]);
+void ChatServer::handleHttpRequest(HttpConnection *connection, const HttpRequest &request) {
+    auto writeSimple = [connection](int status, const QByteArray &statusText,
+                                    const QByteArray &body = QByteArray()) {
+        QByteArray head;
+        head += "HTTP/1.1 " + QByteArray::number(status) + " " + statusText + "\r\n";
+        head += "Access-Control-Allow-Origin: *\r\n";
+        head += "Access-Control-Allow-Methods: GET, PUT, OPTIONS\r\n";
+        head += "Access-Control-Allow-Headers: Content-Type, Content-Length\r\n";
+        if (!body.isEmpty())
+            head += "Content-Type: text/plain; charset=utf-8\r\n";
+        head += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+        // 错误应答后连接仍可复用；未读取的请求体由连接自行断开处理
+        connection->respond(head, body, status >= 500);
+    };
 
+    const QByteArray &method = request.method;
     if (method == "OPTIONS") {
         writeSimple(204, "No Content");
         return;
     }
-    const QUrl url(target);
+    const QUrl url(QString::fromUtf8(request.target));
     const QString path = url.path();
     if (method == "PUT") {
         static const QRegularExpression uploadRe(
@@ -933,73 +1180,138 @@ void ChatServer::handleHttpRequest(QTcpSocket *socket) {
             writeSimple(404, "Not Found", "Not Found");
             return;
         }
-        qint64 contentLength = -1;
-        for (const QByteArray &line : lines) {
-            const int separator = line.indexOf(':');
-            if (separator <= 0) continue;
-            if (line.left(separator).trimmed().compare("Content-Length", Qt::CaseInsensitive) == 0) {
-                bool ok = false;
-                contentLength = line.mid(separator + 1).trimmed().toLongLong(&ok);
-                if (!ok) contentLength = -1;
-            }
-            if (line.left(separator).trimmed().compare("Transfer-Encoding", Qt::CaseInsensitive) == 0) {
-                writeSimple(400, "Bad Request", "Chunked transfer is not supported");
-                return;
-            }
+        if (request.chunked) {
+            writeSimple(400, "Bad Request", "Chunked transfer is not supported");
+            return;
         }
+        const qint64 contentLength = request.headers.contains("content-length")
+                                         ? request.contentLength : -1;
         const QString uploadId = uploadMatch.captured(1);
         const QUrlQuery query(url);
         const int tokenUserId = validateFileToken(query.queryItemValue(QStringLiteral("token")));
-        auto it = m_uploads.find(uploadId);
         if (tokenUserId <= 0) {
             writeSimple(401, "Unauthorized", "Invalid token");
             return;
         }
-        if (it == m_uploads.end() || it->userId != tokenUserId) {
+        const UploadStatePtr state = findUpload(uploadId);
+        if (!state || state->userId != tokenUserId) {
             qWarning().noquote() << QStringLiteral("[Authz] denied operation=http-file-upload userId=%1")
                                         .arg(tokenUserId);
             writeSimple(403, "Forbidden", "Forbidden");
             return;
         }
-        if (contentLength != it->fileSize || it->received != 0) {
+        bool started = false;
+        {
+            QMutexLocker stateLocker(&state->mutex);
+            started = state->received != 0 || state->closed;
+        }
+        if (contentLength != state->fileSize || started) {
             writeSimple(400, "Bad Request", "Content-Length mismatch or upload already started");
             return;
         }
-        socket->setProperty("rawUploadActive", true);
-        socket->setProperty("rawUploadId", uploadId);
-        socket->setProperty("rawUploadLength", contentLength);
-        socket->setProperty("rawUploadReceived", 0);
-        if (!initialBody.isEmpty()) {
-            if (initialBody.size() > contentLength ||
-                it->file->write(initialBody) != initialBody.size()) {
-                socket->setProperty("rawUploadActive", false);
-                abandonUpload(uploadId);
-                writeSimple(400, "Bad Request", "Invalid upload body");
+
+        {
+            QMutexLocker stateLocker(&state->mutex);
+            if (state->closed) {
+                stateLocker.unlock();
+                writeSimple(404, "Not Found", "Unknown upload");
                 return;
             }
-            it->received = initialBody.size();
-            socket->setProperty("rawUploadReceived", initialBody.size());
+            state->httpConnection = connection;
         }
-        handleHttpRequest(socket);
+
+        // 请求体按段直接写入上传文件；Content-Length 之后的字节属于流水线中的下一个请求。
+        // 只锁定本上传的状态，其他上传与聊天请求不受磁盘写入影响。
+        // 请求体在上传空闲上限内没有新数据时连接中止，上传随之丢弃
+        connection->readBody(contentLength,
+            [this, state](const QByteArray &chunk) {
+                return appendUploadChunk(*state, chunk);
+            },
+            [this, uploadId, state, writeSimple](bool complete) {
+                bool known = false;
+                {
+                    QMutexLocker stateLocker(&state->mutex);
+                    state->httpConnection = nullptr;
+                    known = !state->closed;
+                    if (complete && known && state->file) {
+                        state->file->flush();
+                        stateLocker.unlock();
+                        writeSimple(204, "No Content");
+                        return;
+                    }
+                }
+                if (!known) {
+                    writeSimple(404, "Not Found", "Unknown upload");
+                    return;
+                }
+                // 写入失败、请求体停滞或连接中断：丢弃不完整的上传
+                abandonUpload(uploadId, QStringLiteral("http-body"));
+                writeSimple(500, "Internal Server Error", "Write failed");
+            },
+            uploadIdleTimeoutMs());
         return;
     }
-    if (method != "GET") {
+    if (method != "GET" && method != "HEAD") {
         writeSimple(405, "Method Not Allowed", "Method Not Allowed");
         return;
     }
+    const bool headOnly = method == "HEAD";
 
     if (path == QStringLiteral("/api/health") && !url.hasQuery()) {
         static const QByteArray body = QByteArrayLiteral("{\"protocol\":\"v1\",\"status\":\"ok\"}\n");
-        QByteArray resp;
-        resp += "HTTP/1.1 200 OK\r\n";
-        resp += "Content-Type: application/json; charset=utf-8\r\n";
-        resp += "Cache-Control: no-store\r\n";
-        resp += "X-Content-Type-Options: nosniff\r\n";
-        resp += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
-        resp += "Connection: close\r\n\r\n";
-        resp += body;
-        socket->write(resp);
-        socket->disconnectFromHost();
+        QByteArray head;
+        head += "HTTP/1.1 200 OK\r\n";
+        head += "Content-Type: application/json; charset=utf-8\r\n";
+        head += "Cache-Control: no-store\r\n";
+        head += "X-Content-Type-Options: nosniff\r\n";
+        head += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+        connection->respond(head, headOnly ? QByteArray() : body);
+        return;
+    }
+
+    // 内容寻址的缩略图/头像：哈希即版本，响应可永久缓存，If-None-Match 命中时返回 304。
+    // 令牌之外还要求哈希被调用者可见的消息或头像引用；无权读取与不存在同样返回 404
+    static const QRegularExpression blobRe(QStringLiteral("^/api/blob/([0-9a-f]{64})$"));
+    const QRegularExpressionMatch blobMatch = blobRe.match(path);
+    if (blobMatch.hasMatch()) {
+        const int userId = validateFileToken(QUrlQuery(url).queryItemValue(QStringLiteral("token")));
+        if (userId <= 0) {
+            writeSimple(401, "Unauthorized", "Invalid token");
+            return;
+        }
+        if (!m_db->canUserReadBlob(userId, blobMatch.captured(1))) {
+            writeSimple(404, "Not Found", "Blob not found");
+            return;
+        }
+        const QByteArray etag = '"' + blobMatch.captured(1).toLatin1() + '"';
+        bool notModified = false;
+        for (const QByteArray &candidate : request.header("if-none-match").split(',')) {
+            const QByteArray tag = candidate.trimmed();
+            if (tag == "*" || tag == etag || tag == "W/" + etag) notModified = true;
+        }
+
+        QByteArray body;
+        if (!notModified) {
+            body = m_db->getBlob(blobMatch.captured(1));
+            if (body.isEmpty()) {
+                writeSimple(404, "Not Found", "Blob not found");
+                return;
+            }
+        }
+        QByteArray head;
+        head += notModified ? "HTTP/1.1 304 Not Modified\r\n" : "HTTP/1.1 200 OK\r\n";
+        head += "Access-Control-Allow-Origin: *\r\n";
+        head += "ETag: " + etag + "\r\n";
+        head += "Cache-Control: private, max-age=31536000, immutable\r\n";
+        if (!notModified) {
+            const QMimeType mime = QMimeDatabase().mimeTypeForData(body);
+            head += "Content-Type: " +
+                    (mime.isValid() ? mime.name().toUtf8() : QByteArray("application/octet-stream")) +
+                    "\r\n";
+            head += "X-Content-Type-Options: nosniff\r\n";
+            head += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+        }
+        connection->respond(head, headOnly ? QByteArray() : body);
         return;
     }
 
@@ -1039,22 +1351,21 @@ void ChatServer::handleHttpRequest(QTcpSocket *socket) {
         const QString cosUrl = m_db->getCosUrl(dbFileId, isFriendFile);
         if (!cosUrl.isEmpty()) {
             const QString signedUrl = m_cos->presignedUrl(cosUrl);
-            QByteArray resp;
-            resp += "HTTP/1.1 302 Found\r\n";
-            resp += "Access-Control-Allow-Origin: *\r\n";
-            resp += "Location: " + signedUrl.toUtf8() + "\r\n";
-            resp += "Connection: close\r\n\r\n";
-            socket->write(resp);
-            socket->disconnectFromHost();
+            QByteArray head;
+            head += "HTTP/1.1 302 Found\r\n";
+            head += "Access-Control-Allow-Origin: *\r\n";
+            head += "Location: " + signedUrl.toUtf8() + "\r\n";
+            head += "Content-Length: 0\r\n";
+            connection->respond(head);
             return;
         }
     }
 
     const QString filePath = m_db->getFilePath(dbFileId, isFriendFile);
     const QString fileName = m_db->getFileName(dbFileId, isFriendFile);
-    QFile *file = new QFile(filePath, socket);
+    auto *file = new QFile(filePath);
     if (filePath.isEmpty() || !file->exists() || !file->open(QIODevice::ReadOnly)) {
-        file->deleteLater();
+        delete file;
         writeSimple(404, "Not Found", "File not found");
         return;
     }
@@ -1071,53 +1382,45 @@ void ChatServer::handleHttpRequest(QTcpSocket *socket) {
     qint64 rangeEnd = totalSize - 1;
     bool hasRange = false;
 
-    for (int i = 1; i < lines.size(); ++i) {
-        const QByteArray line = lines[i].trimmed();
-        if (line.startsWith("Range:")) {
-            const QByteArray rangeValue = line.mid(6).trimmed();
-            if (rangeValue.startsWith("bytes=")) {
-                const QString rangeSpec = QString::fromUtf8(rangeValue.mid(6));
-                const int dashIdx = rangeSpec.indexOf(QLatin1Char('-'));
-                if (dashIdx >= 0) {
-                    const QString startStr = rangeSpec.left(dashIdx).trimmed();
-                    const QString endStr = rangeSpec.mid(dashIdx + 1).trimmed();
-                    bool okStart = false, okEnd = false;
-                    if (!startStr.isEmpty()) {
-                        const qint64 s = startStr.toLongLong(&okStart);
-                        if (okStart && s >= 0 && s < totalSize) {
-                            rangeStart = s;
-                            hasRange = true;
-                            if (!endStr.isEmpty()) {
-                                const qint64 e = endStr.toLongLong(&okEnd);
-                                if (okEnd && e >= rangeStart && e < totalSize)
-                                    rangeEnd = e;
-                                else
-                                    rangeEnd = totalSize - 1;
-                            }
-                        }
-                    } else if (!endStr.isEmpty()) {
-                        // suffix range, e.g. bytes=-500
-                        const qint64 suffix = endStr.toLongLong(&okEnd);
-                        if (okEnd && suffix > 0 && suffix <= totalSize) {
-                            rangeStart = totalSize - suffix;
-                            hasRange = true;
-                        }
+    const QByteArray rangeValue = request.header("range");
+    if (rangeValue.startsWith("bytes=")) {
+        const QString rangeSpec = QString::fromUtf8(rangeValue.mid(6));
+        const int dashIdx = rangeSpec.indexOf(QLatin1Char('-'));
+        if (dashIdx >= 0) {
+            const QString startStr = rangeSpec.left(dashIdx).trimmed();
+            const QString endStr = rangeSpec.mid(dashIdx + 1).trimmed();
+            bool okStart = false, okEnd = false;
+            if (!startStr.isEmpty()) {
+                const qint64 s = startStr.toLongLong(&okStart);
+                if (okStart && s >= 0 && s < totalSize) {
+                    rangeStart = s;
+                    hasRange = true;
+                    if (!endStr.isEmpty()) {
+                        const qint64 e = endStr.toLongLong(&okEnd);
+                        if (okEnd && e >= rangeStart && e < totalSize)
+                            rangeEnd = e;
+                        else
+                            rangeEnd = totalSize - 1;
                     }
                 }
+            } else if (!endStr.isEmpty()) {
+                // suffix range, e.g. bytes=-500
+                const qint64 suffix = endStr.toLongLong(&okEnd);
+                if (okEnd && suffix > 0 && suffix <= totalSize) {
+                    rangeStart = totalSize - suffix;
+                    hasRange = true;
+                }
             }
-            break;
         }
     }
 
     if (hasRange && (rangeStart > rangeEnd || rangeStart >= totalSize)) {
-        QByteArray resp;
-        resp += "HTTP/1.1 416 Range Not Satisfiable\r\n";
-        resp += "Content-Range: bytes */" + QByteArray::number(totalSize) + "\r\n";
-        resp += "Connection: close\r\n\r\n";
-        socket->write(resp);
-        file->close();
-        file->deleteLater();
-        socket->disconnectFromHost();
+        delete file;
+        QByteArray head;
+        head += "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        head += "Content-Range: bytes */" + QByteArray::number(totalSize) + "\r\n";
+        head += "Content-Length: 0\r\n";
+        connection->respond(head);
         return;
     }
 
@@ -1141,45 +1444,16 @@ void ChatServer::handleHttpRequest(QTcpSocket *socket) {
     }
     headers += "Content-Disposition: " + QByteArray(asInline ? "inline" : "attachment")
                + "; filename=\"" + safeName + "\"; filename*=UTF-8''" + encodedName + "\r\n";
-    headers += "Connection: close\r\n\r\n";
-    socket->write(headers);
 
-    if (hasRange) {
-        file->seek(rangeStart);
+    if (headOnly) {
+        delete file;
+        connection->respond(headers);
+        return;
     }
-
-    // 非阻塞分段发送，避免大文件传输阻塞事件循环，影响并发下载请求处理。
-    qint64 *remaining = new qint64(contentLength);
-    const auto pump = [socket, file, remaining]() {
-        static const qint64 kChunkSize = 64 * 1024;
-        static const qint64 kHighWater = 2 * 1024 * 1024;
-
-        if (socket->state() != QAbstractSocket::ConnectedState) return;
-
-        while (*remaining > 0 && socket->bytesToWrite() < kHighWater && !file->atEnd()) {
-            const qint64 toRead = qMin(kChunkSize, *remaining);
-            const QByteArray chunk = file->read(toRead);
-            if (chunk.isEmpty()) break;
-            *remaining -= chunk.size();
-            if (socket->write(chunk) < 0) {
-                socket->disconnectFromHost();
-                return;
-            }
-        }
-
-        if ((*remaining <= 0 || file->atEnd()) && socket->bytesToWrite() == 0) {
-            file->close();
-            socket->disconnectFromHost();
-        }
-    };
-
-    connect(socket, &QTcpSocket::bytesWritten, socket, [pump](qint64) { pump(); });
-    connect(socket, &QTcpSocket::disconnected, file, [file, remaining]() {
-        delete remaining;
-        file->deleteLater();
-    });
-    pump();
+    // 文件体由连接发送：Linux 上经 sendfile 零拷贝，完成后继续处理同一连接上的下一个请求
+    connection->respondWithFile(headers, file, rangeStart, contentLength);
 }
+
 void ChatServer::handleRegister(ClientSession *session, const QJsonObject &data) {
     QString username = data["username"].toString();       // uniqueId
     QString displayName = data["displayName"].toString(); // 昵称
@@ -1207,16 +1481,25 @@ void ChatServer::handleRegister(ClientSession *session, const QJsonObject &data)
                                         Protocol::MsgType::REGISTER_RSP)) {
             return;
         }
-        int userId = m_db->registerUser(username, displayName.trimmed(), password);
-        if (userId > 0) {
-            m_authAbuseGuard.recordSuccess(username);
-            rspData["success"]  = true;
-            rspData["userId"]   = userId;
-            rspData["username"] = username;
-        } else {
-            rspData["success"] = false;
-            rspData["error"]   = QStringLiteral("用户ID已存在");
-        }
+        auto userId = std::make_shared<int>(-1);
+        submitPasswordWork(session, QStringLiteral("register"), Protocol::MsgType::REGISTER_RSP,
+            [this, userId, username, displayName, password]() {
+                *userId = m_db->registerUser(username, displayName.trimmed(), password);
+            },
+            [this, session, userId, username]() {
+                QJsonObject result;
+                if (*userId > 0) {
+                    m_authAbuseGuard.recordSuccess(username);
+                    result["success"]  = true;
+                    result["userId"]   = *userId;
+                    result["username"] = username;
+                } else {
+                    result["success"] = false;
+                    result["error"]   = QStringLiteral("用户ID已存在");
+                }
+                session->sendMessage(Protocol::makeMessage(Protocol::MsgType::REGISTER_RSP, result));
+            });
+        return;
     }
     session->sendMessage(Protocol::makeMessage(Protocol::MsgType::REGISTER_RSP, rspData));
 }
@@ -1336,7 +1619,8 @@ void ChatServer::handleCreateRoom(ClientSession *session, const QJsonObject &dat
 }
 
 void ChatServer::handleJoinRoom(ClientSession *session, const QJsonObject &data) {
-    if (!session->isAuthenticated()) return;
+    // 加入请求在房间分片执行，断连清理在会话分片执行；已断开的会话不再写入 RoomManager
+    if (!session->isAuthenticated() || session->isClosed()) return;
 
     int roomId = data["roomId"].toInt();
     QJsonObject rspData;
@@ -1387,6 +1671,13 @@ void ChatServer::handleJoinRoom(ClientSession *session, const QJsonObject &data)
 
         m_roomMgr->addUserToRoom(roomId, session->userId(), session->username());
         m_db->joinRoom(roomId, session->userId());
+        if (session->isClosed()) {
+            // 断连清理可能已在成员资格落库前读取过房间列表，这里自行撤销，避免残留幽灵成员；
+            // 被顶号的旧会话不撤销，成员资格属于新会话
+            if (!session->isKicked())
+                m_roomMgr->removeUserFromRoom(roomId, session->userId());
+            return;
+        }
 
         rspData["success"]  = true;
         rspData["roomId"]   = roomId;
@@ -1453,6 +1744,7 @@ void ChatServer::handleLeaveRoom(ClientSession *session, const QJsonObject &data
         m_db->deleteRoom(roomId);
         m_roomMgr->removeRoom(roomId);
         deleteCosFiles(autoCosUrls);
+        m_fileStore.reap();
         qInfo() << "[Server] 聊天室" << roomId << "因无成员自动解散";
     } else if (wasAdmin) {
         // issue 4: 如果离开的是管理员，检查房间是否还有管理员
@@ -1494,10 +1786,10 @@ void ChatServer::handleRoomList(ClientSession *session) {
 
     // 只返回用户已加入的房间（带未读计数）
     QJsonArray roomArr = m_db->getUserJoinedRooms(session->userId());
+    const QHash<int, int> unread = m_db->getUnreadRoomCounts(session->userId());
     for (int i = 0; i < roomArr.size(); ++i) {
         QJsonObject room = roomArr[i].toObject();
-        int roomId = room["roomId"].toInt();
-        room["unread"] = m_db->getUnreadRoomCount(roomId, session->userId());
+        room["unread"] = unread.value(room["roomId"].toInt());
         roomArr[i] = room;
     }
     QJsonObject rspData;
@@ -1579,6 +1871,7 @@ void ChatServer::handleHistory(ClientSession *session, const QJsonObject &data)
     } else {
         messages = m_db->getMessageHistory(roomId, count, before);
     }
+    if (!session->usesBlobReferences()) messages = inlineThumbnails(m_db, messages);
 
     QJsonObject rspData;
     rspData["roomId"]   = roomId;
@@ -1610,171 +1903,196 @@ QString ChatServer::fileTypeSubDir(const QString &fileName) {
     return QStringLiteral("File");
 }
 
-bool ChatServer::tryReserveRoomFileQuota(int roomId, qint64 fileSize, QString *error) {
-    if (fileSize <= 0) {
-        if (error) *error = QStringLiteral("文件大小无效");
-        return false;
+ChatServer::FileCleanupPlan ChatServer::buildCleanupPlan(int roomId, qint64 newMaxFileSize,
+                                                        qint64 newTotalFileSpace,
+                                                        int newMaxFileCount,
+                                                        QJsonObject *planSummary) {
+    const QList<RoomActiveFile> files = m_db->getRoomActiveFilesOrdered(roomId);
+    FileCleanupPlan plan;
+    plan.currentCount = files.size();
+
+    // 超过新单文件上限的文件无论新旧都要清理，先扣除它们，得到按时间淘汰的起点
+    qint64 oversizeBytes = 0;
+    int oversizeCount = 0;
+    for (const RoomActiveFile &file : files) {
+        plan.currentUsed += file.fileSize;
+        if (newMaxFileSize > 0 && file.fileSize > newMaxFileSize) {
+            oversizeBytes += file.fileSize;
+            ++oversizeCount;
+        }
     }
-
-    QJsonObject settings = m_db->getRoomSettings(roomId);
-    qint64 maxSize = static_cast<qint64>(settings["maxFileSize"].toDouble());
-    qint64 maxTotal = static_cast<qint64>(settings["totalFileSpace"].toDouble());
-    int maxCount = settings["maxFileCount"].toInt(1500);
-
-    if (maxSize > 0 && fileSize > maxSize) {
-        if (error) *error = QString("文件大小超过房间限制(%1MB)").arg(maxSize / 1024 / 1024);
-        return false;
+    plan.afterUsed = plan.currentUsed - oversizeBytes;
+    plan.afterCount = plan.currentCount - oversizeCount;
+
+    // 从最早的文件开始单次遍历：超限文件直接选中，其余文件在总空间或数量仍超限时淘汰
+    for (const RoomActiveFile &file : files) {
+        const bool exceeded = (newTotalFileSpace > 0 && plan.afterUsed > newTotalFileSpace)
+                              || (newMaxFileCount > 0 && plan.afterCount > newMaxFileCount);
+        if (!exceeded && oversizeCount == 0) break;
+        if (newMaxFileSize > 0 && file.fileSize > newMaxFileSize) {
+            --oversizeCount;
+            plan.files.append(file);
+        } else if (exceeded) {
+            plan.afterUsed -= file.fileSize;
+            --plan.afterCount;
+            plan.files.append(file);
+        }
     }
 
-    qint64 usedTotal = m_db->getRoomUsedFileSpace(roomId);
-    int fileCount = m_db->getRoomFileCount(roomId);
-    qint64 reservedBytes = m_roomReservedBytes.value(roomId, 0);
-    int reservedCount = m_roomReservedCount.value(roomId, 0);
-
-    if (maxTotal > 0 && usedTotal + reservedBytes + fileSize > maxTotal) {
-        if (error) *error = QStringLiteral("聊天室总文件空间已达上限");
-        return false;
-    }
-    if (maxCount > 0 && fileCount + reservedCount + 1 > maxCount) {
-        if (error) *error = QStringLiteral("聊天室文件数量已达上限");
-        return false;
+    if (planSummary) {
+        planSummary->insert("currentUsedSpace", static_cast<double>(plan.currentUsed));
+        planSummary->insert("currentFileCount", plan.currentCount);
+        planSummary->insert("afterUsedSpace", static_cast<double>(qMax<qint64>(0, plan.afterUsed)));
+        planSummary->insert("afterFileCount", qMax(0, plan.afterCount));
+        planSummary->insert("clearFileCount", plan.files.size());
+        QJsonArray ids;
+        for (const RoomActiveFile &file : std::as_const(plan.files)) ids.append(file.fileId);
+        planSummary->insert("clearFileIds", ids);
     }
 
-    m_roomReservedBytes[roomId] = reservedBytes + fileSize;
-    m_roomReservedCount[roomId] = reservedCount + 1;
-    return true;
+    return plan;
 }
 
-void ChatServer::releaseRoomFileQuota(int roomId, qint64 fileSize) {
-    if (roomId <= 0 || fileSize <= 0) return;
+bool ChatServer::applyFileCleanupPlan(int roomId, const FileCleanupPlan &plan, const QString &reason, QJsonArray *clearedIdsOut) {
+    if (plan.files.isEmpty()) return true;
 
-    qint64 reservedBytes = m_roomReservedBytes.value(roomId, 0) - fileSize;
-    int reservedCount = m_roomReservedCount.value(roomId, 0) - 1;
-
-    if (reservedBytes > 0) m_roomReservedBytes[roomId] = reservedBytes;
-    else m_roomReservedBytes.remove(roomId);
-
-    if (reservedCount > 0) m_roomReservedCount[roomId] = reservedCount;
-    else m_roomReservedCount.remove(roomId);
-}
-
-QList<int> ChatServer::buildCleanupPlan(int roomId, qint64 newMaxFileSize, qint64 newTotalFileSpace,
-                                        int newMaxFileCount, QJsonObject *planSummary) {
-    QJsonArray files = m_db->getRoomActiveFilesOrdered(roomId);
-    QList<int> cleanupIds;
-    QSet<int> selected;
-
-    qint64 currentUsed = 0;
-    for (const QJsonValue &v : files)
-        currentUsed += static_cast<qint64>(v.toObject()["fileSize"].toDouble());
-    int currentCount = files.size();
-
-    // 1) 新单文件上限：清理所有超限文件
-    for (const QJsonValue &v : files) {
-        QJsonObject f = v.toObject();
-        int fileId = f["fileId"].toInt();
-        qint64 size = static_cast<qint64>(f["fileSize"].toDouble());
-        if (newMaxFileSize > 0 && size > newMaxFileSize && !selected.contains(fileId)) {
-            selected.insert(fileId);
-            cleanupIds.append(fileId);
+    // 分批标记清除：每批一个短写事务，上千个文件的清理不会长时间占用 SQLite 写锁
+    bool ok = true;
+    QStringList filePaths;
+    QStringList cosUrls;
+    for (qsizetype begin = 0; begin < plan.files.size(); begin += kFileCleanupBatchSize) {
+        const qsizetype end = qMin<qsizetype>(begin + kFileCleanupBatchSize, plan.files.size());
+        QList<int> fileIds;
+        fileIds.reserve(end - begin);
+        for (qsizetype i = begin; i < end; ++i)
+            fileIds.append(plan.files.at(i).fileId);
+        QList<int> clearedIds;
+        if (!m_db->markRoomFilesCleared(roomId, fileIds, reason, &clearedIds)) {
+            ok = false;
+            break;
         }
-    }
-
-    // 2) 新总空间/数量上限：按最早文件继续清理到满足条件
-    qint64 afterUsed = currentUsed;
-    int afterCount = currentCount;
-    for (int fileId : cleanupIds) {
-        for (const QJsonValue &v : files) {
-            QJsonObject f = v.toObject();
-            if (f["fileId"].toInt() == fileId) {
-                afterUsed -= static_cast<qint64>(f["fileSize"].toDouble());
-                afterCount -= 1;
-                break;
-            }
+        // 计划生成后已被过期任务清除的文件由过期任务负责删除
+        const QSet<int> cleared(clearedIds.cbegin(), clearedIds.cend());
+        for (qsizetype i = begin; i < end; ++i) {
+            const RoomActiveFile &file = plan.files.at(i);
+            if (!cleared.contains(file.fileId)) continue;
+            filePaths.append(file.filePath);
+            if (!file.cosUrl.isEmpty()) cosUrls.append(file.cosUrl);
+            if (clearedIdsOut) clearedIdsOut->append(file.fileId);
         }
     }
 
-    for (const QJsonValue &v : files) {
-        bool totalExceeded = newTotalFileSpace > 0 && afterUsed > newTotalFileSpace;
-        bool countExceeded = newMaxFileCount > 0 && afterCount > newMaxFileCount;
-        if (!totalExceeded && !countExceeded) break;
-
-        QJsonObject f = v.toObject();
-        int fileId = f["fileId"].toInt();
-        if (selected.contains(fileId)) continue;
-
-        selected.insert(fileId);
-        cleanupIds.append(fileId);
-        afterUsed -= static_cast<qint64>(f["fileSize"].toDouble());
-        afterCount -= 1;
+    // 清除标记已由触发器减少引用计数；磁盘与 COS 删除交给维护分片，房间分片上的后续请求不必等待
+    if (!filePaths.isEmpty()) {
+        m_dispatcher->post(kFileExpiryDispatchKey, [this, filePaths, cosUrls]() {
+            releaseStoredFiles(filePaths);
+            deleteCosFiles(cosUrls);
+        });
     }
+    return ok;
+}
 
-    if (planSummary) {
-        planSummary->insert("currentUsedSpace", static_cast<double>(currentUsed));
-        planSummary->insert("currentFileCount", currentCount);
-        planSummary->insert("afterUsedSpace", static_cast<double>(qMax<qint64>(0, afterUsed)));
-        planSummary->insert("afterFileCount", qMax(0, afterCount));
-        planSummary->insert("clearFileCount", cleanupIds.size());
-        QJsonArray ids;
-        for (int id : cleanupIds) ids.append(id);
-        planSummary->insert("clearFileIds", ids);
+void ChatServer::releaseStoredFiles(const QStringList &filePaths) {
+    bool reapBlobs = false;
+    for (const QString &filePath : filePaths) {
+        if (filePath.isEmpty()) continue;
+        if (m_fileStore.contains(filePath))
+            reapBlobs = true;
+        else
+            QFile::remove(filePath);
     }
-
-    return cleanupIds;
+    if (reapBlobs) m_fileStore.reap();
 }
 
-bool ChatServer::applyFileCleanupPlan(int roomId, const QList<int> &fileIds, const QString &reason, QJsonArray *clearedIdsOut) {
-    if (fileIds.isEmpty()) return true;
-
-    QJsonArray files = m_db->getRoomActiveFilesOrdered(roomId);
-    QMap<int, QString> pathById;
-    for (const QJsonValue &v : files) {
-        QJsonObject f = v.toObject();
-        pathById[f["fileId"].toInt()] = f["filePath"].toString();
-    }
+bool ChatServer::submitThumbnail(const QString &contentType, const QString &filePath,
+                                 qint64 fileSize, const QList<ThumbnailTarget> &targets) {
+    ThumbnailService::Kind kind;
+    if (contentType == QLatin1String("image"))
+        kind = ThumbnailService::Kind::Image;
+    else if (contentType == QLatin1String("video"))
+        kind = ThumbnailService::Kind::Video;
+    else
+        return false;
+    // 解码与编码在缩略图线程池完成，结果投递到各目标所在分片写库并推送；
+    // 写库时要求消息未撤回，生成期间撤回或删除的消息不会被改写
+    return m_thumbnails.trySubmit(kind, filePath, fileSize,
+        [this, targets](const QByteArray &jpeg) {
+            if (jpeg.isEmpty()) return;
+            postThumbnail(targets, jpeg);
+        });
+}
 
-    // 在标记清除前查询 COS URL
-    const QStringList cosUrls = m_db->getCosUrlsForFileIds(fileIds);
+void ChatServer::postThumbnail(const QList<ThumbnailTarget> &targets, const QByteArray &jpeg) {
+    for (const ThumbnailTarget &target : targets)
+        m_dispatcher->post(target.dispatchKey, [apply = target.apply, jpeg]() { apply(jpeg); });
+}
 
-    if (!m_db->markRoomFilesCleared(roomId, fileIds, reason)) {
-        return false;
-    }
+void ChatServer::scheduleRoomThumbnail(int roomId, int messageId, const QString &contentType,
+                                       const QString &filePath, qint64 fileSize) {
+    submitThumbnail(contentType, filePath, fileSize, {roomThumbnailTarget(roomId, messageId)});
+}
 
-    for (int fileId : fileIds) {
-        QString filePath = pathById.value(fileId);
-        if (!filePath.isEmpty()) {
-            QFile::remove(filePath);
-        }
-        if (clearedIdsOut)
-            clearedIdsOut->append(fileId);
-    }
+ChatServer::ThumbnailTarget ChatServer::roomThumbnailTarget(int roomId, int messageId) {
+    return {QStringLiteral("room:%1").arg(roomId),
+        [this, roomId, messageId](const QByteArray &jpeg) {
+            // 消息在生成期间被撤回或删除时不再推送
+            BlobRef thumbnail;
+            if (!m_db->setMessageThumbnail(roomId, messageId, jpeg, &thumbnail)) return;
+            QJsonObject notify;
+            notify["roomId"] = roomId;
+            notify["messageId"] = messageId;
+            notify["thumbnailHash"] = thumbnail.hash;
+            notify["thumbnailSize"] = static_cast<double>(thumbnail.size);
+            const QJsonObject refNotify = notify;
+            notify["thumbnail"] = QString::fromLatin1(jpeg.toBase64());
+            sendBlobNotify(m_roomMgr->usersInRoom(roomId),
+                           Protocol::makeMessage(Protocol::MsgType::FILE_THUMBNAIL_NOTIFY, notify),
+                           Protocol::makeMessage(Protocol::MsgType::FILE_THUMBNAIL_NOTIFY, refNotify));
+        }};
+}
 
-    deleteCosFiles(cosUrls);
-    return true;
+void ChatServer::scheduleFriendThumbnail(int friendshipId, int messageId, const QString &sender,
+                                         const QString &friendUsername,
+                                         const QString &contentType,
+                                         const QString &filePath, qint64 fileSize) {
+    submitThumbnail(contentType, filePath, fileSize,
+                    {friendThumbnailTarget(friendshipId, messageId, sender, friendUsername)});
 }
 
-QString ChatServer::serverFileDir(int roomId, const QString &fileName) const {
-    // server_files/{roomId}/Image|Video|File/{yyyy-MM}/
-    QString typeDir = fileTypeSubDir(fileName);
-    QString yearMonth = QDate::currentDate().toString("yyyy-MM");
-    QString dir = QCoreApplication::applicationDirPath()
-                  + "/server_files/"
-                  + QString::number(roomId) + "/"
-                  + typeDir + "/"
-                  + yearMonth;
-    QDir d(dir);
-    if (!d.exists()) d.mkpath(".");
-    return dir;
+ChatServer::ThumbnailTarget ChatServer::friendThumbnailTarget(int friendshipId, int messageId,
+                                                              const QString &sender,
+                                                              const QString &friendUsername) {
+    return {QStringLiteral("friendship:%1").arg(friendshipId),
+        [this, friendshipId, messageId, sender, friendUsername](const QByteArray &jpeg) {
+            BlobRef thumbnail;
+            if (!m_db->setFriendMessageThumbnail(friendshipId, messageId, jpeg, &thumbnail)) return;
+            // 与 FRIEND_FILE_NOTIFY 相同的 sender / friendUsername，客户端按同样规则定位会话
+            QJsonObject notify;
+            notify["friendshipId"] = friendshipId;
+            notify["messageId"] = messageId;
+            notify["sender"] = sender;
+            notify["friendUsername"] = friendUsername;
+            notify["thumbnailHash"] = thumbnail.hash;
+            notify["thumbnailSize"] = static_cast<double>(thumbnail.size);
+            const QJsonObject refNotify = notify;
+            notify["thumbnail"] = QString::fromLatin1(jpeg.toBase64());
+            QStringList recipients{sender};
+            if (!friendUsername.isEmpty() && friendUsername != sender)
+                recipients.append(friendUsername);
+            sendBlobNotify(recipients,
+                           Protocol::makeMessage(Protocol::MsgType::FRIEND_FILE_THUMBNAIL_NOTIFY, notify),
+                           Protocol::makeMessage(Protocol::MsgType::FRIEND_FILE_THUMBNAIL_NOTIFY, refNotify));
+        }};
 }
 
-void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg) {
+void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg,
+                                const Protocol::BinaryFields &binary) {
     if (!session->isAuthenticated()) return;
 
     QJsonObject data = msg["data"].toObject();
     int roomId        = data["roomId"].toInt();
     QString fileName  = data["fileName"].toString();
     qint64 fileSize   = static_cast<qint64>(data["fileSize"].toDouble());
-    QString fileData  = data["fileData"].toString(); // base64
 
     if (!requireRoomMembership(session, roomId, QStringLiteral("room-file-send"))) {
         QJsonObject rsp;
@@ -1785,12 +2103,18 @@ void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg)
         return;
     }
 
+    // CBOR 帧的 fileData 已是原始字节，JSON 帧为 base64
+    const auto inlineData = binary.constFind(QStringLiteral("fileData"));
     QByteArray rawData;
     QString validationError;
     QString validatedFileName;
     if (!InputValidator::validateFileName(fileName, &validatedFileName, &validationError)
-        || !InputValidator::decodeInlineFile(fileData, fileSize, Protocol::MAX_SMALL_FILE,
-                                             &rawData, &validationError)) {
+        || !(inlineData != binary.constEnd()
+                 ? InputValidator::validateInlineFile(*inlineData, fileSize,
+                                                      Protocol::MAX_SMALL_FILE, &validationError)
+                 : InputValidator::decodeInlineFile(data["fileData"].toString(), fileSize,
+                                                    Protocol::MAX_SMALL_FILE,
+                                                    &rawData, &validationError))) {
         QJsonObject rsp;
         rsp["roomId"] = roomId;
         rsp["success"] = false;
@@ -1799,9 +2123,10 @@ void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg)
         return;
     }
     fileName = validatedFileName;
+    if (inlineData != binary.constEnd()) rawData = *inlineData;
 
     QString quotaError;
-    if (!tryReserveRoomFileQuota(roomId, fileSize, &quotaError)) {
+    if (!m_db->reserveRoomFileQuota(roomId, fileSize, &quotaError)) {
         QJsonObject rsp;
         rsp["roomId"] = roomId;
         rsp["success"] = false;
@@ -1810,44 +2135,22 @@ void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg)
         return;
     }
 
-    // 保存文件到服务器磁盘（多级目录：{roomId}/类型/年月/）
-    QString targetDir = serverFileDir(roomId, fileName);
-    QString safeName = QString::number(QDateTime::currentMSecsSinceEpoch()) + "_" + fileName;
-    QString filePath = targetDir + "/" + safeName;
-
-    QFile file(filePath);
-    if (file.open(QIODevice::WriteOnly)) {
-        if (file.write(rawData) != rawData.size()) {
-            file.close();
-            QFile::remove(filePath);
-            releaseRoomFileQuota(roomId, fileSize);
-            QJsonObject rsp;
-            rsp["roomId"] = roomId;
-            rsp["success"] = false;
-            rsp["error"] = QStringLiteral("服务器写入文件失败");
-            session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_NOTIFY, rsp));
-            return;
-        }
-        file.close();
-    } else {
-        releaseRoomFileQuota(roomId, fileSize);
-        QJsonObject rsp;
-        rsp["roomId"] = roomId;
-        rsp["success"] = false;
-        rsp["error"] = QStringLiteral("服务器无法创建文件");
-        session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_NOTIFY, rsp));
-        return;
-    }
-
-    // 保存文件信息到数据库
-    int fileId = m_db->saveFile(roomId, session->userId(), fileName, filePath, fileSize);
+    // 按内容哈希存入 server_files/blobs（相同内容已存在时不再写盘），并保存文件记录
+    QString filePath;
+    const int fileId = m_fileStore.storeData(rawData,
+        [&](const QString &blobPath, const QString &contentHash) {
+            filePath = blobPath;
+            return m_db->saveFile(roomId, session->userId(), fileName, blobPath,
+                                  fileSize, contentHash);
+        });
     if (fileId <= 0) {
-        QFile::remove(filePath);
-        releaseRoomFileQuota(roomId, fileSize);
+        releaseStoredFiles({filePath});
+        m_db->releaseRoomFileQuota(roomId, fileSize);
         QJsonObject rsp;
         rsp["roomId"] = roomId;
         rsp["success"] = false;
-        rsp["error"] = QStringLiteral("文件保存失败");
+        rsp["error"] = filePath.isEmpty() ? QStringLiteral("服务器写入文件失败")
+                                          : QStringLiteral("文件保存失败");
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_NOTIFY, rsp));
         return;
     }
@@ -1860,26 +2163,8 @@ void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg)
     else if (typeDir == QLatin1String("Video"))
         contentType = QStringLiteral("video");
 
-    // 自动生成缩略图
-    QString thumbnail;
-#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
-    if (contentType == QLatin1String("image") && fileSize < 20 * 1024 * 1024) {
-        // 从已保存的磁盘文件读取，避免二次 base64 解码
-        QImage img(filePath);
-        if (!img.isNull()) {
-            QImage thumb = img.scaled(200, 200, Qt::KeepAspectRatio, Qt::FastTransformation);
-            QByteArray thumbData;
-            QBuffer buf(&thumbData);
-            buf.open(QIODevice::WriteOnly);
-            thumb.save(&buf, "JPEG", 60);
-            thumbnail = QString::fromLatin1(thumbData.toBase64());
-        }
-    }
-#endif
-    // QImage 失败或非图片类型时，使用客户端提供的缩略图
-    if (thumbnail.isEmpty() && data.contains("thumbnail")) {
-        thumbnail = data["thumbnail"].toString();
-    }
+    // 先使用客户端提供的缩略图，服务端缩略图在后台生成后再推送替换
+    const QString thumbnail = thumbnailField(data, binary);
 
     // 保存消息记录（含缩略图）
     qint64 sequence = 0;
@@ -1888,9 +2173,9 @@ void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg)
                                   fileName, fileSize, fileId, thumbnail,
                                   &sequence, &timestamp);
     if (msgId <= 0) {
+        // 文件记录已保存时预留已转为已用，删除记录即归还配额
         m_db->deleteStoredFileRecord(fileId);
-        QFile::remove(filePath);
-        releaseRoomFileQuota(roomId, fileSize);
+        releaseStoredFiles({filePath});
         return;
     }
 
@@ -1913,7 +2198,7 @@ void ChatServer::handleFileSend(ClientSession *session, const QJsonObject &msg)
     notifyData["fileCleared"] = false;
 
     broadcastToRoom(roomId, Protocol::makeMessage(Protocol::MsgType::FILE_NOTIFY, notifyData));
-    releaseRoomFileQuota(roomId, fileSize);
+    scheduleRoomThumbnail(roomId, msgId, contentType, filePath, fileSize);
 }
 
 void ChatServer::handleFileDownload(ClientSession *session, const QJsonObject &data) {
@@ -2011,8 +2296,8 @@ void ChatServer::handleFileForward(ClientSession *session, const QJsonObject &da
         return;
     }
 
-    const QString sourcePath = m_db->getFilePath(static_cast<int>(absoluteFileId),
-                                                  isFriendFile);
+    QString sourcePath = m_db->getFilePath(static_cast<int>(absoluteFileId),
+                                            isFriendFile);
     const QString fileName = m_db->getFileName(static_cast<int>(absoluteFileId),
                                                isFriendFile);
     const QFileInfo sourceInfo(sourcePath);
@@ -2023,15 +2308,15 @@ void ChatServer::handleFileForward(ClientSession *session, const QJsonObject &da
         fileName, &validatedFileName, &fileNameError);
     if (sourcePath.isEmpty() || !validFileName || validatedFileName != fileName ||
         !sourceInfo.isFile() ||
-        fileSize <= 0 || fileSize > Protocol::MAX_SMALL_FILE) {
+        fileSize <= 0 || fileSize > Protocol::MAX_LARGE_FILE) {
         response["success"] = false;
         response["forwardedCount"] = 0;
         response["failedCount"] = 0;
-        response["errorCode"] = fileSize > Protocol::MAX_SMALL_FILE
+        response["errorCode"] = fileSize > Protocol::MAX_LARGE_FILE
             ? QStringLiteral("SOURCE_FILE_TOO_LARGE")
             : QStringLiteral("SOURCE_FILE_UNAVAILABLE");
-        response["error"] = fileSize > Protocol::MAX_SMALL_FILE
-            ? QStringLiteral("当前服务端转发上限为 8MB")
+        response["error"] = fileSize > Protocol::MAX_LARGE_FILE
+            ? QStringLiteral("源文件超过服务器大小上限")
             : QStringLiteral("源文件不可用");
         session->sendMessage(
             Protocol::makeMessage(Protocol::MsgType::FILE_FORWARD_RSP, response));
@@ -2065,20 +2350,56 @@ void ChatServer::handleFileForward(ClientSession *session, const QJsonObject &da
         return;
     }
 
+    // 转发只新增引用同一 blob 的记录，不复制字节；旧版单独存放的源文件先收入存储，
+    // 源记录随即改为引用 blob，之后每个目标以及以后的转发都共享这一份
+    if (!m_fileStore.contains(sourcePath)) {
+        const QString legacyPath = sourcePath;
+        sourcePath = m_fileStore.import(legacyPath,
+            [&](const QString &blobPath, const QString &contentHash) {
+                return m_db->adoptFileBlob(static_cast<int>(absoluteFileId), isFriendFile,
+                                           legacyPath, blobPath, contentHash);
+            });
+        if (sourcePath.isEmpty()) {
+            response["success"] = false;
+            response["forwardedCount"] = 0;
+            response["failedCount"] = 0;
+            response["errorCode"] = QStringLiteral("SOURCE_FILE_UNAVAILABLE");
+            response["error"] = QStringLiteral("源文件不可用");
+            session->sendMessage(
+                Protocol::makeMessage(Protocol::MsgType::FILE_FORWARD_RSP, response));
+            return;
+        }
+    }
+
     QJsonArray results;
     int forwardedCount = 0;
+    QList<ThumbnailTarget> thumbnailTargets;
     for (int roomId : roomIds) {
         QJsonObject result = forwardFileToRoom(session, roomId, sourcePath,
-                                               fileName, fileSize);
+                                               fileName, fileSize, &thumbnailTargets);
         if (result["success"].toBool()) ++forwardedCount;
         results.append(result);
     }
     for (const QString &friendUsername : friendUsernames) {
         QJsonObject result = forwardFileToFriend(session, friendUsername, sourcePath,
-                                                 fileName, fileSize);
+                                                 fileName, fileSize, &thumbnailTargets);
         if (result["success"].toBool()) ++forwardedCount;
         results.append(result);
     }
+    // 所有目标的字节相同：源消息已有缩略图时直接复用，否则只生成一次并写入每条转发消息
+    if (!thumbnailTargets.isEmpty()) {
+        const QString thumbnailHash = m_db->getFileThumbnailHash(
+            static_cast<int>(absoluteFileId), isFriendFile);
+        const QByteArray thumbnail = thumbnailHash.isEmpty()
+            ? QByteArray() : m_db->getBlob(thumbnailHash);
+        const QString typeDir = fileTypeSubDir(fileName);
+        const QString contentType = typeDir == QLatin1String("Image")
+            ? QStringLiteral("image") : QStringLiteral("video");
+        if (!thumbnail.isEmpty())
+            postThumbnail(thumbnailTargets, thumbnail);
+        else
+            submitThumbnail(contentType, sourcePath, fileSize, thumbnailTargets);
+    }
 
     response["success"] = forwardedCount > 0;
     response["forwardedCount"] = forwardedCount;
@@ -2097,7 +2418,8 @@ void ChatServer::handleFileForward(ClientSession *session, const QJsonObject &da
 QJsonObject ChatServer::forwardFileToRoom(ClientSession *session, int roomId,
                                           const QString &sourcePath,
                                           const QString &fileName,
-                                          qint64 fileSize) {
+                                          qint64 fileSize,
+                                          QList<ThumbnailTarget> *thumbnailTargets) {
     QJsonObject result;
     result["targetType"] = QStringLiteral("room");
     result["roomId"] = roomId;
@@ -2111,41 +2433,43 @@ QJsonObject ChatServer::forwardFileToRoom(ClientSession *session, int roomId,
     }
 
     QString quotaError;
-    if (!tryReserveRoomFileQuota(roomId, fileSize, &quotaError)) {
+    if (!m_db->reserveRoomFileQuota(roomId, fileSize, &quotaError)) {
         result["success"] = false;
         result["errorCode"] = QStringLiteral("ROOM_FILE_QUOTA_EXCEEDED");
         result["error"] = quotaError;
         return result;
     }
 
-    const QString targetPath = serverFileDir(roomId, fileName) + "/" +
-        QUuid::createUuid().toString(QUuid::WithoutBraces) + "_" + fileName;
-    if (!QFile::copy(sourcePath, targetPath)) {
-        releaseRoomFileQuota(roomId, fileSize);
+    QString targetPath;
+    const int fileId = m_fileStore.share(sourcePath,
+        [&](const QString &blobPath, const QString &contentHash) {
+            targetPath = blobPath;
+            return m_db->saveFile(roomId, session->userId(), fileName, blobPath,
+                                  fileSize, contentHash);
+        });
+    if (targetPath.isEmpty()) {
+        m_db->releaseRoomFileQuota(roomId, fileSize);
         result["success"] = false;
-        result["errorCode"] = QStringLiteral("FILE_COPY_FAILED");
+        result["errorCode"] = QStringLiteral("SOURCE_FILE_UNAVAILABLE");
         return result;
     }
 
-    const int fileId = m_db->saveFile(roomId, session->userId(), fileName,
-                                      targetPath, fileSize);
     const QString typeDir = fileTypeSubDir(fileName);
     const QString contentType = typeDir == QLatin1String("Image")
         ? QStringLiteral("image")
         : (typeDir == QLatin1String("Video")
                ? QStringLiteral("video") : QStringLiteral("file"));
-    const QString thumbnail = buildForwardThumbnail(targetPath, fileName, fileSize);
     qint64 sequence = 0;
     qint64 timestamp = 0;
     const int messageId = fileId > 0
         ? m_db->saveMessage(roomId, session->userId(), fileName, contentType,
-                            fileName, fileSize, fileId, thumbnail,
+                            fileName, fileSize, fileId, QString(),
                             &sequence, &timestamp)
         : -1;
     if (fileId <= 0 || messageId <= 0) {
         if (fileId > 0) m_db->deleteStoredFileRecord(fileId);
-        QFile::remove(targetPath);
-        releaseRoomFileQuota(roomId, fileSize);
+        else m_db->releaseRoomFileQuota(roomId, fileSize);
+        releaseStoredFiles({targetPath});
         result["success"] = false;
         result["errorCode"] = QStringLiteral("FORWARD_PERSIST_FAILED");
         return result;
@@ -2164,10 +2488,10 @@ QJsonObject ChatServer::forwardFileToRoom(ClientSession *session, int roomId,
     notify["fileCleared"] = false;
     notify["sequence"] = static_cast<double>(sequence);
     notify["timestamp"] = static_cast<double>(timestamp);
-    if (!thumbnail.isEmpty()) notify["thumbnail"] = thumbnail;
     broadcastToRoom(roomId,
                     Protocol::makeMessage(Protocol::MsgType::FILE_NOTIFY, notify));
-    releaseRoomFileQuota(roomId, fileSize);
+    if (contentType != QLatin1String("file"))
+        thumbnailTargets->append(roomThumbnailTarget(roomId, messageId));
     result["success"] = true;
     result["fileId"] = fileId;
     result["messageId"] = messageId;
@@ -2178,7 +2502,8 @@ QJsonObject ChatServer::forwardFileToFriend(ClientSession *session,
                                             const QString &friendUsername,
                                             const QString &sourcePath,
                                             const QString &fileName,
-                                            qint64 fileSize) {
+                                            qint64 fileSize,
+                                            QList<ThumbnailTarget> *thumbnailTargets) {
     QJsonObject result;
     result["targetType"] = QStringLiteral("friend");
     result["friendUsername"] = friendUsername;
@@ -2199,32 +2524,34 @@ QJsonObject ChatServer::forwardFileToFriend(ClientSession *session,
         return result;
     }
 
-    const QString targetPath = friendFileDir(friendshipId, fileName) + "/" +
-        QUuid::createUuid().toString(QUuid::WithoutBraces) + "_" + fileName;
-    if (!QFile::copy(sourcePath, targetPath)) {
+    QString targetPath;
+    const int fileId = m_fileStore.share(sourcePath,
+        [&](const QString &blobPath, const QString &contentHash) {
+            targetPath = blobPath;
+            return m_db->saveFriendFile(friendshipId, session->userId(), fileName,
+                                        blobPath, fileSize, contentHash);
+        });
+    if (targetPath.isEmpty()) {
         result["success"] = false;
-        result["errorCode"] = QStringLiteral("FILE_COPY_FAILED");
+        result["errorCode"] = QStringLiteral("SOURCE_FILE_UNAVAILABLE");
         return result;
     }
 
-    const int fileId = m_db->saveFriendFile(friendshipId, session->userId(),
-                                            fileName, targetPath, fileSize);
     const QString typeDir = fileTypeSubDir(fileName);
     const QString contentType = typeDir == QLatin1String("Image")
         ? QStringLiteral("image")
         : (typeDir == QLatin1String("Video")
                ? QStringLiteral("video") : QStringLiteral("file"));
-    const QString thumbnail = buildForwardThumbnail(targetPath, fileName, fileSize);
     qint64 sequence = 0;
     qint64 timestamp = 0;
     const int messageId = fileId > 0
         ? m_db->saveFriendMessage(friendshipId, session->userId(), fileName,
-                                  contentType, fileName, fileSize, fileId, thumbnail,
+                                  contentType, fileName, fileSize, fileId, QString(),
                                   &sequence, &timestamp)
         : -1;
     if (fileId <= 0 || messageId <= 0) {
         if (fileId > 0) m_db->deleteStoredFileRecord(fileId, true);
-        QFile::remove(targetPath);
+        releaseStoredFiles({targetPath});
         result["success"] = false;
         result["errorCode"] = QStringLiteral("FORWARD_PERSIST_FAILED");
         return result;
@@ -2243,12 +2570,14 @@ QJsonObject ChatServer::forwardFileToFriend(ClientSession *session,
     notify["fileId"] = -fileId;
     notify["sequence"] = static_cast<double>(sequence);
     notify["timestamp"] = static_cast<double>(timestamp);
-    if (!thumbnail.isEmpty()) notify["thumbnail"] = thumbnail;
     const QJsonObject notification =
         Protocol::makeMessage(Protocol::MsgType::FRIEND_FILE_NOTIFY, notify);
     session->sendMessage(notification);
     if (friendUsername != session->username())
         sendToUser(friendUsername, notification);
+    if (contentType != QLatin1String("file"))
+        thumbnailTargets->append(friendThumbnailTarget(friendshipId, messageId,
+                                                       session->username(), friendUsername));
     result["success"] = true;
     result["fileId"] = -fileId;
     result["messageId"] = messageId;
@@ -2302,23 +2631,20 @@ void ChatServer::handleFileUploadStart(ClientSession *session, const QJsonObject
     }
 
     QString quotaError;
-    if (!tryReserveRoomFileQuota(roomId, fileSize, &quotaError)) {
+    if (!m_db->reserveRoomFileQuota(roomId, fileSize, &quotaError)) {
         rspData["success"] = false;
         rspData["error"]   = quotaError;
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_START_RSP, rspData));
         return;
     }
 
-    // 生成上传ID和临时文件路径（多级目录：{roomId}/类型/年月/）
+    // 生成上传ID和临时文件路径；完成时按内容哈希收入 server_files/blobs
     QString uploadId = QUuid::createUuid().toString(QUuid::WithoutBraces);
-
-    QString targetDir = serverFileDir(roomId, fileName);
-    QString safeName = QString::number(QDateTime::currentMSecsSinceEpoch()) + "_" + fileName;
-    QString filePath = targetDir + "/" + safeName;
+    QString filePath = m_fileStore.createIncomingPath();
 
     auto *file = new QFile(filePath);
     if (!file->open(QIODevice::WriteOnly)) {
-        releaseRoomFileQuota(roomId, fileSize);
+        m_db->releaseRoomFileQuota(roomId, fileSize);
         rspData["success"] = false;
         rspData["error"]   = QStringLiteral("服务器无法创建文件");
         delete file;
@@ -2326,19 +2652,21 @@ void ChatServer::handleFileUploadStart(ClientSession *session, const QJsonObject
         return;
     }
 
-    UploadState state;
-    state.roomId      = roomId;
-    state.userId      = session->userId();
-    state.username    = session->username();
-    state.displayName = session->displayName();
-    state.clientMessageId = clientMessageId;
-    state.fileName    = fileName;
-    state.filePath = filePath;
-    state.fileSize = fileSize;
-    state.received = 0;
-    state.roomQuotaReserved = true;
-    state.file     = file;
-    m_uploads[uploadId] = state;
+    auto state = std::make_shared<UploadState>();
+    state->roomId      = roomId;
+    state->userId      = session->userId();
+    state->username    = session->username();
+    state->displayName = session->displayName();
+    state->clientMessageId = clientMessageId;
+    state->fileName    = fileName;
+    state->filePath = filePath;
+    state->fileSize = fileSize;
+    state->roomQuotaReserved = true;
+    state->file     = file;
+    state->hash     = std::make_shared<QCryptographicHash>(QCryptographicHash::Sha256);
+    state->lastActivityMs = TimingWheel::clockMs();
+    registerUpload(uploadId, state);
+    watchUploadIdle(uploadId, uploadIdleTimeoutMs());
 
     rspData["success"]  = true;
     rspData["uploadId"] = uploadId;
@@ -2349,13 +2677,15 @@ void ChatServer::handleFileUploadStart(ClientSession *session, const QJsonObject
     qInfo() << "[Server] 大文件上传开始:" << fileName << fileSize << "bytes, uploadId:" << uploadId;
 }
 
-void ChatServer::handleFileUploadChunk(ClientSession *session, const QJsonObject &data) {
+void ChatServer::handleFileUploadChunk(ClientSession *session, const QJsonObject &data,
+                                       const QByteArray *rawChunk) {
     QString uploadId = data["uploadId"].toString();
 
     QJsonObject rspData;
     rspData["uploadId"] = uploadId;
 
-    if (!m_uploads.contains(uploadId)) {
+    const UploadStatePtr state = findUpload(uploadId);
+    if (!state) {
         rspData["success"] = false;
         rspData["error"]   = QStringLiteral("无效的上传ID");
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK_RSP, rspData));
@@ -2367,33 +2697,46 @@ void ChatServer::handleFileUploadChunk(ClientSession *session, const QJsonObject
         return;
     }
 
-    UploadState &state = m_uploads[uploadId];
+    qint64 remaining = 0;
+    {
+        QMutexLocker stateLocker(&state->mutex);
+        remaining = state->fileSize - state->received;
+    }
+    // base64 解码与长度校验在锁外完成；appendUploadChunk 写入前再次核对剩余长度
     QByteArray chunk;
     QString validationError;
-    if (!InputValidator::decodeUploadChunk(data["chunkData"].toString(),
-                                           state.fileSize - state.received,
-                                           &chunk, &validationError)) {
+    const bool validChunk = rawChunk
+        ? InputValidator::validateUploadChunk(*rawChunk, remaining, &validationError)
+        : InputValidator::decodeUploadChunk(data["chunkData"].toString(), remaining,
+                                            &chunk, &validationError);
+    if (rawChunk) chunk = *rawChunk;
+    if (!validChunk) {
         rspData["success"] = false;
         rspData["error"] = validationError;
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK_RSP, rspData));
         return;
     }
 
-    if (!state.file || !state.file->isOpen() || state.file->write(chunk) != chunk.size()) {
+    if (!appendUploadChunk(*state, chunk)) {
         rspData["success"] = false;
         rspData["error"] = QStringLiteral("服务器写入分片失败");
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK_RSP, rspData));
         handleFileUploadCancel(session, data);
         return;
     }
-    state.received += chunk.size();
+    qint64 received = 0;
+    {
+        QMutexLocker stateLocker(&state->mutex);
+        received = state->received;
+    }
 
     rspData["success"]  = true;
-    rspData["received"] = static_cast<double>(state.received);
+    rspData["received"] = static_cast<double>(received);
     session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK_RSP, rspData));
 }
 
-void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &data) {
+void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &data,
+                                     const Protocol::BinaryFields &binary) {
     const QString uploadId = data["uploadId"].toString();
     const QString requestedClientMessageId = data["clientMessageId"].toString();
     if (!validOptionalClientMessageId(requestedClientMessageId)) {
@@ -2405,7 +2748,8 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
         return;
     }
 
-    if (!m_uploads.contains(uploadId)) {
+    const UploadStatePtr pending = findUpload(uploadId);
+    if (!pending) {
         if (!requestedClientMessageId.isEmpty() && session->isAuthenticated()) {
             const MessageSaveResult room =
                 m_db->findRoomAttachmentByClientMessageId(
@@ -2455,50 +2799,59 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
         return;
     }
 
-    const UploadState &pending = m_uploads[uploadId];
-    const QString clientMessageId = pending.clientMessageId;
+    const QString clientMessageId = pending->clientMessageId;
     if (!requestedClientMessageId.isEmpty() &&
         requestedClientMessageId != clientMessageId) {
         MessageSaveResult conflict;
         conflict.status = MessageSaveResult::Status::Conflict;
         sendUploadFinalizeResponse(
             session, uploadId, requestedClientMessageId, conflict,
-            pending.roomId < 0, QStringLiteral("CLIENT_MESSAGE_ID_CONFLICT"),
+            pending->roomId < 0, QStringLiteral("CLIENT_MESSAGE_ID_CONFLICT"),
             QStringLiteral("完成请求与上传开始的客户端消息 ID 不一致"));
         handleFileUploadCancel(session, data);
         return;
     }
-    const bool stillAuthorized = pending.roomId < 0
-        ? m_db->isUserInFriendship(-pending.roomId, pending.userId)
-        : m_db->isUserInRoom(pending.roomId, pending.userId);
+    const bool stillAuthorized = pending->roomId < 0
+        ? m_db->isUserInFriendship(-pending->roomId, pending->userId)
+        : m_db->isUserInRoom(pending->roomId, pending->userId);
     if (!stillAuthorized) {
         qWarning().noquote() << QStringLiteral("[Authz] denied operation=upload-finalize userId=%1")
-                                    .arg(pending.userId);
+                                    .arg(pending->userId);
         MessageSaveResult rejected;
         sendUploadFinalizeResponse(session, uploadId, clientMessageId, rejected,
-                                   pending.roomId < 0,
+                                   pending->roomId < 0,
                                    QStringLiteral("UPLOAD_AUTHORIZATION_REVOKED"),
                                    QStringLiteral("会话权限已变更，无法完成上传"));
         handleFileUploadCancel(session, data);
         return;
     }
-    if (pending.received != pending.fileSize) {
+    qint64 received = 0;
+    {
+        QMutexLocker stateLocker(&pending->mutex);
+        received = pending->received;
+    }
+    if (received != pending->fileSize) {
         qWarning().noquote() << QStringLiteral("[Input] rejected category=upload-size userId=%1")
-                                    .arg(pending.userId);
+                                    .arg(pending->userId);
         MessageSaveResult rejected;
         sendUploadFinalizeResponse(session, uploadId, clientMessageId, rejected,
-                                   pending.roomId < 0,
+                                   pending->roomId < 0,
                                    QStringLiteral("UPLOAD_INCOMPLETE"),
                                    QStringLiteral("文件字节尚未全部上传"));
         handleFileUploadCancel(session, data);
         return;
     }
 
-    UploadState state = m_uploads.take(uploadId);
-    if (state.file) {
-        state.file->close();
-        delete state.file;
+    // 字节已收齐，不会再有合法分块；取出时若已被取消或超时清理则按未知上传处理
+    const UploadStatePtr taken = takeUpload(uploadId);
+    if (!taken) {
+        MessageSaveResult missing;
+        sendUploadFinalizeResponse(session, uploadId, clientMessageId, missing, false,
+                                   QStringLiteral("UNKNOWN_UPLOAD_ID"),
+                                   QStringLiteral("上传 ID 不存在或已过期"));
+        return;
     }
+    UploadState &state = *taken;
 
     // 根据文件后缀确定 contentType
     QString contentType = QStringLiteral("file");
@@ -2508,38 +2861,33 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
     else if (typeDir == QLatin1String("Video"))
         contentType = QStringLiteral("video");
 
-    // 缩略图：图片自动生成（限制大小），视频由客户端提供
-    QString thumbnail;
-#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
-    if (contentType == QLatin1String("image") && state.fileSize < 20 * 1024 * 1024) {
-        QImage img(state.filePath);
-        if (!img.isNull()) {
-            QImage thumb = img.scaled(200, 200, Qt::KeepAspectRatio, Qt::FastTransformation);
-            QByteArray thumbData;
-            QBuffer buf(&thumbData);
-            buf.open(QIODevice::WriteOnly);
-            thumb.save(&buf, "JPEG", 60);
-            thumbnail = QString::fromLatin1(thumbData.toBase64());
-        }
-    }
-#endif
-    // QImage 失败或非图片类型时，使用客户端提供的缩略图
-    if (thumbnail.isEmpty() && data.contains("thumbnail")) {
-        thumbnail = data["thumbnail"].toString();
-    }
+    // 先使用客户端提供的缩略图，服务端缩略图在消息保存后于后台生成
+    const QString thumbnail = thumbnailField(data, binary);
 
     auto cleanupCandidate = [this, &state](int fileId, bool isFriendFile) {
         if (fileId > 0) m_db->deleteStoredFileRecord(fileId, isFriendFile);
-        QFile::remove(state.filePath);
+        releaseStoredFiles({state.filePath});
     };
 
-    // 保存文件信息到数据库
+    // 上传过程中已累积内容哈希：相同内容已存储时丢弃临时文件，否则重命名为 blob，
+    // 再保存引用它的文件记录；收入后 state.filePath 指向 blob
+    const QString tempPath = state.filePath;
+    const int fileId = m_fileStore.storeFile(
+        tempPath, QString::fromLatin1(state.hash->result().toHex()), state.fileSize,
+        [&](const QString &blobPath, const QString &contentHash) {
+            state.filePath = blobPath;
+            return state.roomId < 0
+                ? m_db->saveFriendFile(-state.roomId, state.userId, state.fileName,
+                                       blobPath, state.fileSize, contentHash)
+                : m_db->saveFile(state.roomId, state.userId, state.fileName,
+                                 blobPath, state.fileSize, contentHash);
+        });
+
     if (state.roomId < 0) {
         // 好友文件上传 (roomId = -friendshipId)
         int friendshipId = -state.roomId;
-        int fileId = m_db->saveFriendFile(friendshipId, state.userId, state.fileName, state.filePath, state.fileSize);
         if (fileId <= 0) {
-            QFile::remove(state.filePath);
+            releaseStoredFiles({state.filePath});
             MessageSaveResult failed;
             sendUploadFinalizeResponse(session, uploadId, clientMessageId,
                                        failed, true);
@@ -2607,6 +2955,8 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
         qInfo() << "[Server] 好友大文件上传完成:" << state.fileName << state.fileSize << "bytes";
         sendUploadFinalizeResponse(session, uploadId, clientMessageId,
                                    saveResult, true);
+        scheduleFriendThumbnail(friendshipId, saveResult.messageId, state.username,
+                                friendUsername, contentType, state.filePath, state.fileSize);
 
         // COS 异步上传（好友文件）
         if (m_cos->isEnabled()) {
@@ -2616,11 +2966,10 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
         }
     } else {
         // 房间文件上传
-        int fileId = m_db->saveFile(state.roomId, state.userId, state.fileName, state.filePath, state.fileSize);
         if (fileId <= 0) {
-            QFile::remove(state.filePath);
+            releaseStoredFiles({state.filePath});
             if (state.roomQuotaReserved)
-                releaseRoomFileQuota(state.roomId, state.fileSize);
+                m_db->releaseRoomFileQuota(state.roomId, state.fileSize);
             MessageSaveResult failed;
             sendUploadFinalizeResponse(session, uploadId, clientMessageId,
                                        failed, false);
@@ -2642,9 +2991,8 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
                 : MessageSaveResult::Status::Failed;
         }
         if (saveResult.status != MessageSaveResult::Status::Created) {
+            // 文件记录保存时预留已转为已用，删除记录即归还配额
             cleanupCandidate(fileId, false);
-            if (state.roomQuotaReserved)
-                releaseRoomFileQuota(state.roomId, state.fileSize);
             sendUploadFinalizeResponse(
                 session, uploadId, clientMessageId, saveResult, false,
                 saveResult.status == MessageSaveResult::Status::Conflict
@@ -2676,12 +3024,11 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
 
         broadcastToRoom(state.roomId, Protocol::makeMessage(Protocol::MsgType::FILE_NOTIFY, notifyData));
 
-        if (state.roomQuotaReserved)
-            releaseRoomFileQuota(state.roomId, state.fileSize);
-
         qInfo() << "[Server] 大文件上传完成:" << state.fileName << state.fileSize << "bytes";
         sendUploadFinalizeResponse(session, uploadId, clientMessageId,
                                    saveResult, false);
+        scheduleRoomThumbnail(state.roomId, saveResult.messageId, contentType,
+                              state.filePath, state.fileSize);
 
         // COS 异步上传（房间文件）
         if (m_cos->isEnabled()) {
@@ -2693,7 +3040,13 @@ void ChatServer::handleFileUploadEnd(ClientSession *session, const QJsonObject &
 }
 
 void ChatServer::deleteCosFiles(const QStringList &cosUrls) {
-    if (!m_cos->isEnabled()) return;
+    if (!m_cos->isEnabled() || cosUrls.isEmpty()) return;
+    // CosManager 的 QNetworkAccessManager 属于主线程，工作线程的请求转投回主线程
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, [this, cosUrls]() { deleteCosFiles(cosUrls); },
+                                  Qt::QueuedConnection);
+        return;
+    }
     for (const QString &url : cosUrls)
         m_cos->deleteCosFile(url);
 }
@@ -2701,19 +3054,24 @@ void ChatServer::deleteCosFiles(const QStringList &cosUrls) {
 void ChatServer::cleanupDeletedRoomFiles(const QJsonArray &fileIds) {
     QStringList cosUrls;
     QSet<int> seen;
+    bool reapBlobs = false;
     for (const QJsonValue &value : fileIds) {
         const int fileId = value.toInt();
         if (fileId <= 0 || seen.contains(fileId)) continue;
         seen.insert(fileId);
         const QString path = m_db->getFilePath(fileId, false);
         const QString cosUrl = m_db->getCosUrl(fileId, false);
-        if (!path.isEmpty() && QFile::exists(path) && !QFile::remove(path)) {
+        // 共享 blob 先删记录（触发器减少引用），计数归零后统一回收
+        const bool sharedBlob = m_fileStore.contains(path);
+        if (!sharedBlob && !path.isEmpty() && QFile::exists(path) && !QFile::remove(path)) {
             qWarning() << "[AdminDelete] 本地文件清理失败，保留记录供重试:" << fileId;
             continue;
         }
         if (!cosUrl.isEmpty()) cosUrls.append(cosUrl);
         m_db->deleteStoredFileRecord(fileId, false);
+        reapBlobs |= sharedBlob;
     }
+    if (reapBlobs) m_fileStore.reap();
     deleteCosFiles(cosUrls);
 }
 
@@ -2721,10 +3079,21 @@ void ChatServer::startCosUpload(const QString &localPath, const QString &fileNam
                                  const QString &dirPrefix, int fileId, bool isFriendFile,
                                  const QString &uploaderUsername, const QString &uploadId)
 {
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, [=]() {
+            startCosUpload(localPath, fileName, dirPrefix, fileId, isFriendFile,
+                           uploaderUsername, uploadId);
+        }, Qt::QueuedConnection);
+        return;
+    }
+
     // 拼接 COS objectKey：prefix / dirPrefix / yyyy-MM / timestampFilename
+    // 本地 blob 按内容共享，COS 对象仍按记录各自命名，删除一条记录的对象不影响其他记录
     QString month = QDateTime::currentDateTime().toString(QStringLiteral("yyyy-MM"));
-    QString objectKey = QStringLiteral("%1/%2/%3")
-                            .arg(dirPrefix, month, QFileInfo(localPath).fileName());
+    QString objectKey = QStringLiteral("%1/%2/%3_%4")
+                            .arg(dirPrefix, month)
+                            .arg(QDateTime::currentMSecsSinceEpoch())
+                            .arg(fileName);
 
     auto onProgress = [this, uploaderUsername, uploadId](qint64 sent, qint64 total) {
         QJsonObject pd;
@@ -2735,51 +3104,137 @@ void ChatServer::startCosUpload(const QString &localPath, const QString &fileNam
                    Protocol::makeMessage(Protocol::MsgType::FILE_COS_PROGRESS, pd));
     };
 
-    auto onFinished = [this, fileId, isFriendFile, fileName, objectKey](bool ok, const QString &urlOrError) {
+    QJsonObject context;
+    context["fileId"]       = fileId;
+    context["isFriendFile"] = isFriendFile;
+    context["fileName"]     = fileName;
+
+    m_cos->uploadFile(localPath, objectKey, onProgress,
+                      cosUploadFinished(fileId, isFriendFile, fileName), context);
+    qInfo() << "[COS] 开始上传:" << fileName << "objectKey=" << objectKey;
+}
+
+std::function<void(bool, const QString &)> ChatServer::cosUploadFinished(int fileId, bool isFriendFile,
+                                                                         const QString &fileName)
+{
+    return [this, fileId, isFriendFile, fileName](bool ok, const QString &urlOrError) {
         if (ok) {
-            m_db->setCosUrl(fileId, isFriendFile, urlOrError);
-            qInfo() << "[COS] 上传成功:" << fileName << "->" << urlOrError;
+            const int updated = m_db->setCosUrl(fileId, isFriendFile, urlOrError);
+            if (updated == 0) {
+                // 上传期间记录已被撤回或清理，清理任务看不到这个对象，只能在这里删除
+                qInfo() << "[COS] 记录已不存在，删除刚上传的对象:" << fileName;
+                deleteCosFiles({urlOrError});
+                return;
+            }
+            if (updated < 0)
+                qWarning() << "[COS] 保存 COS URL 失败:" << fileName << urlOrError;
+            else
+                qInfo() << "[COS] 上传成功:" << fileName << "->" << urlOrError;
         } else {
             qWarning() << "[COS] 上传失败:" << fileName << urlOrError;
         }
     };
-
-    m_cos->uploadFile(localPath, objectKey, onProgress, onFinished);
-    qInfo() << "[COS] 开始上传:" << fileName << "objectKey=" << objectKey;
 }
 
 void ChatServer::handleFileUploadCancel(ClientSession *session, const QJsonObject &data) {
     QString uploadId = data["uploadId"].toString();
-    if (!m_uploads.contains(uploadId)) return;
+    if (!findUpload(uploadId)) return;
     if (!requireUploadOwnership(session, uploadId)) return;
 
-    UploadState state = m_uploads.take(uploadId);
-    if (state.file) {
-        state.file->close();
-        delete state.file;
+    const UploadStatePtr state = takeUpload(uploadId);
+    if (!state) return;
+    discardUpload(*state);
+    qInfo() << "[Server] 上传已取消:" << state->fileName;
+}
+
+void ChatServer::abandonUpload(const QString &uploadId, const QString &reason) {
+    const UploadStatePtr state = takeUpload(uploadId);
+    if (!state) return;
+    discardUpload(*state);
+    qInfo().noquote() << QStringLiteral("[Upload] abandoned reason=%1 userId=%2")
+                             .arg(reason)
+                             .arg(state->userId);
+}
+
+void ChatServer::registerUpload(const QString &uploadId, const UploadStatePtr &state) {
+    QMutexLocker uploadLocker(&m_uploadMutex);
+    m_uploads.insert(uploadId, state);
+}
+
+ChatServer::UploadStatePtr ChatServer::findUpload(const QString &uploadId) const {
+    QMutexLocker uploadLocker(&m_uploadMutex);
+    return m_uploads.value(uploadId);
+}
+
+ChatServer::UploadStatePtr ChatServer::takeUpload(const QString &uploadId) {
+    UploadStatePtr state;
+    {
+        QMutexLocker uploadLocker(&m_uploadMutex);
+        state = m_uploads.take(uploadId);
+    }
+    if (!state) return state;
+    // 等待正在写入的分块结束后关闭文件；之后的分块看到 closed 直接失败
+    QMutexLocker stateLocker(&state->mutex);
+    state->closed = true;
+    if (HttpConnection *connection = state->httpConnection) {
+        // 客户端可能已停止发送，不能等下一个分块写入失败；在连接所在线程断开
+        state->httpConnection = nullptr;
+        QMetaObject::invokeMethod(connection, [connection]() { connection->abort(); },
+                                  Qt::QueuedConnection);
+    }
+    if (state->file) {
+        state->file->close();
+        delete state->file;
+        state->file = nullptr;
+    }
+    return state;
+}
+
+bool ChatServer::appendUploadChunk(UploadState &state, const QByteArray &chunk) {
+    QMutexLocker stateLocker(&state.mutex);
+    if (state.closed || !state.file || !state.file->isOpen()
+        || chunk.size() > state.fileSize - state.received
+        || state.file->write(chunk) != chunk.size()) {
+        return false;
     }
+    state.hash->addData(chunk);
+    state.received += chunk.size();
+    state.lastActivityMs = TimingWheel::clockMs();
+    return true;
+}
+
+void ChatServer::discardUpload(const UploadState &state) {
     // 删除不完整的文件
     if (!state.filePath.isEmpty())
         QFile::remove(state.filePath);
     if (state.roomQuotaReserved)
-        releaseRoomFileQuota(state.roomId, state.fileSize);
-    qInfo() << "[Server] 上传已取消:" << state.fileName;
+        m_db->releaseRoomFileQuota(state.roomId, state.fileSize);
+}
+
+void ChatServer::watchUploadIdle(const QString &uploadId, qint64 delayMs) {
+    const QPointer<ChatServer> server(this);
+    QMetaObject::invokeMethod(this, [server, uploadId, delayMs]() {
+        TimingWheel::forCurrentThread()->schedule(delayMs, [server, uploadId]() {
+            if (server) server->expireIdleUpload(uploadId);
+        });
+    }, Qt::QueuedConnection);
 }
 
-void ChatServer::abandonUpload(const QString &uploadId) {
-    auto it = m_uploads.find(uploadId);
-    if (it == m_uploads.end()) return;
-    UploadState state = it.value();
-    m_uploads.erase(it);
-    if (state.file) {
-        state.file->close();
-        delete state.file;
+void ChatServer::expireIdleUpload(const QString &uploadId) {
+    const qint64 timeoutMs = uploadIdleTimeoutMs();
+    const UploadStatePtr state = findUpload(uploadId);
+    if (!state) return;
+    qint64 idleMs = 0;
+    {
+        QMutexLocker stateLocker(&state->mutex);
+        idleMs = TimingWheel::clockMs() - state->lastActivityMs;
     }
-    if (!state.filePath.isEmpty()) QFile::remove(state.filePath);
-    if (state.roomQuotaReserved)
-        releaseRoomFileQuota(state.roomId, state.fileSize);
-    qInfo().noquote() << QStringLiteral("[Upload] abandoned transport=http userId=%1")
-                             .arg(state.userId);
+    if (idleMs >= timeoutMs) {
+        abandonUpload(uploadId, QStringLiteral("idle-timeout"));
+        return;
+    }
+    // 分块到达只刷新时间戳；仍在传输的上传按剩余时间再检查一次
+    watchUploadIdle(uploadId, timeoutMs - idleMs);
 }
 
 void ChatServer::handleFileDownloadChunk(ClientSession *session, const QJsonObject &data) {
@@ -2829,10 +3284,16 @@ void ChatServer::handleFileDownloadChunk(ClientSession *session, const QJsonObje
 
     rspData["success"]   = true;
     rspData["offset"]    = static_cast<double>(offset);
-    rspData["chunkData"] = QString::fromLatin1(chunk.toBase64());
     rspData["chunkSize"] = chunk.size();
     rspData["fileSize"]  = static_cast<double>(file.size());
 
+    // 协商了二进制分块的 TCP 会话：分块原样跟在头部后，不做 base64 与 JSON 序列化
+    if (session->usesBinaryChunks()) {
+        session->sendBinary(Protocol::makeMessage(Protocol::MsgType::FILE_DOWNLOAD_CHUNK_RSP, rspData),
+                            chunk);
+        return;
+    }
+    rspData["chunkData"] = QString::fromLatin1(chunk.toBase64());
     session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FILE_DOWNLOAD_CHUNK_RSP, rspData));
 }
 
@@ -2867,13 +3328,13 @@ void ChatServer::handleRecall(ClientSession *session, const QJsonObject &data) {
         auto fileInfo = m_db->getFileInfoForMessage(messageId);
         if (fileInfo.first > 0) {
             const QString cosUrl = m_db->getCosUrl(fileInfo.first, false);
+            m_db->deleteFileRecords({fileInfo.first});
             if (!fileInfo.second.isEmpty()) {
-                QFile::remove(fileInfo.second);
-                qInfo() << "[Server] 撤回消息，已删除文件:" << fileInfo.second;
+                releaseStoredFiles({fileInfo.second});
+                qInfo() << "[Server] 撤回消息，已释放文件:" << fileInfo.second;
             }
-            m_db->deleteFileRecords({fileInfo.first});
             if (!cosUrl.isEmpty())
-                m_cos->deleteCosFile(cosUrl);
+                deleteCosFiles({cosUrl});
         }
 
         rspData["success"] = true;
@@ -3490,10 +3951,11 @@ void ChatServer::handleRoomSettings(ClientSession *session, const QJsonObject &d
         }
 
         QJsonObject cleanupSummary;
-        QList<int> cleanupIds = buildCleanupPlan(roomId, maxFileSize, totalFileSpace, maxFileCount, &cleanupSummary);
+        const FileCleanupPlan cleanupPlan =
+            buildCleanupPlan(roomId, maxFileSize, totalFileSpace, maxFileCount, &cleanupSummary);
         bool forceCleanup = data["forceCleanup"].toBool(false);
 
-        if (!cleanupIds.isEmpty() && !forceCleanup) {
+        if (!cleanupPlan.files.isEmpty() && !forceCleanup) {
             rspData["success"] = false;
             rspData["needConfirm"] = true;
             rspData["error"] = QStringLiteral("调整后需要清理部分历史文件");
@@ -3507,10 +3969,12 @@ void ChatServer::handleRoomSettings(ClientSession *session, const QJsonObject &d
         }
 
         QJsonArray clearedIds;
-        if (!cleanupIds.isEmpty()) {
-            if (!applyFileCleanupPlan(roomId, cleanupIds, QStringLiteral("文件已过期或被清除"), &clearedIds)) {
+        if (!cleanupPlan.files.isEmpty()) {
+            if (!applyFileCleanupPlan(roomId, cleanupPlan, QStringLiteral("文件已过期或被清除"), &clearedIds)) {
+                // 已提交的批次保持清除状态，重试时按剩余文件重新计算计划
                 rspData["success"] = false;
                 rspData["error"] = QStringLiteral("清理历史文件失败，请稍后重试");
+                rspData["clearedFileIds"] = clearedIds;
                 session->sendMessage(Protocol::makeMessage(Protocol::MsgType::ROOM_SETTINGS_RSP, rspData));
                 return;
             }
@@ -3601,6 +4065,8 @@ void ChatServer::handleDeleteRoom(ClientSession *session, const QJsonObject &dat
         // 从内存缓存中移除
         m_roomMgr->removeRoom(roomId);
         deleteCosFiles(roomCosUrls);
+        // 级联删除的文件记录已由触发器减少引用，回收不再被其他会话引用的文件
+        m_fileStore.reap();
 
         rspData["success"] = true;
         rspData["roomName"] = roomName;
@@ -3614,11 +4080,17 @@ void ChatServer::handleDeleteRoom(ClientSession *session, const QJsonObject &dat
 
 // ==================== 头像功能 ====================
 
-void ChatServer::handleAvatarUpload(ClientSession *session, const QJsonObject &data) {
+void ChatServer::handleAvatarUpload(ClientSession *session, const QJsonObject &data,
+                                    const Protocol::BinaryFields &binary) {
     if (!session->isAuthenticated()) return;
 
-    QString avatarBase64 = data["avatarData"].toString();
-    QByteArray avatarData = QByteArray::fromBase64(avatarBase64.toLatin1());
+    // CBOR 帧的 avatarData 已是原始字节，只在给旧客户端内联时才编码 base64
+    const auto rawAvatar = binary.constFind(QStringLiteral("avatarData"));
+    QString avatarBase64 = rawAvatar != binary.constEnd() ? QString()
+                                                          : data["avatarData"].toString();
+    QByteArray avatarData = rawAvatar != binary.constEnd()
+                                ? *rawAvatar
+                                : QByteArray::fromBase64(avatarBase64.toLatin1());
 
     QJsonObject rspData;
 
@@ -3629,23 +4101,30 @@ void ChatServer::handleAvatarUpload(ClientSession *session, const QJsonObject &d
         return;
     }
 
-    if (m_db->setUserAvatar(session->userId(), avatarData)) {
+    BlobRef avatar;
+    if (m_db->setUserAvatar(session->userId(), avatarData, &avatar)) {
         rspData["success"] = true;
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::AVATAR_UPLOAD_RSP, rspData));
 
-        // 通知所有人头像已更新（通过所有房间广播）
+        // 通知所有人头像已更新：blobRefs 客户端只收哈希，按需经 /api/blob 获取
         QJsonObject notifyData;
         notifyData["username"] = session->username();
-        notifyData["avatarData"] = avatarBase64;
-
-        // 向所有在线用户广播头像更新
-        QMutexLocker locker(&m_mutex);
-        for (auto it = m_sessions.begin(); it != m_sessions.end(); ++it) {
-            if (it.key() != session->username()) {
-                QMetaObject::invokeMethod(it.value(), "sendMessage", Qt::QueuedConnection,
-                    Q_ARG(QJsonObject, Protocol::makeMessage(Protocol::MsgType::AVATAR_UPDATE_NOTIFY, notifyData)));
-            }
+        notifyData["avatarHash"] = avatar.hash;
+        notifyData["avatarSize"] = static_cast<double>(avatar.size);
+        const QJsonObject refNotify = notifyData;
+        notifyData["avatarData"] = avatarBase64.isEmpty()
+                                       ? QString::fromLatin1(avatarData.toBase64())
+                                       : avatarBase64;
+
+        QStringList online;
+        {
+            QMutexLocker locker(&m_mutex);
+            online = m_sessions.keys();
         }
+        sendBlobNotify(online,
+                       Protocol::makeMessage(Protocol::MsgType::AVATAR_UPDATE_NOTIFY, notifyData),
+                       Protocol::makeMessage(Protocol::MsgType::AVATAR_UPDATE_NOTIFY, refNotify),
+                       session);
     } else {
         rspData["success"] = false;
         rspData["error"] = QStringLiteral("保存头像失败");
@@ -3657,13 +4136,16 @@ void ChatServer::handleAvatarGet(ClientSession *session, const QJsonObject &data
     if (!session->isAuthenticated()) return;
 
     QString username = data["username"].toString();
-    QByteArray avatarData = m_db->getUserAvatarByName(username);
+    const BlobRef avatar = m_db->getUserAvatarRef(username);
 
     QJsonObject rspData;
     rspData["username"] = username;
-    if (!avatarData.isEmpty()) {
+    if (!avatar.hash.isEmpty()) {
         rspData["success"] = true;
-        rspData["avatarData"] = QString::fromLatin1(avatarData.toBase64());
+        rspData["avatarHash"] = avatar.hash;
+        rspData["avatarSize"] = static_cast<double>(avatar.size);
+        if (!session->usesBlobReferences())
+            rspData["avatarData"] = QString::fromLatin1(m_db->getBlob(avatar.hash).toBase64());
     } else {
         rspData["success"] = false;
     }
@@ -3813,36 +4295,59 @@ void ChatServer::handleChangePassword(ClientSession *session, const QJsonObject
                                         Protocol::MsgType::CHANGE_PASSWORD_RSP)) {
             return;
         }
-        bool ok = m_db->changePassword(session->userId(), oldPassword, newPassword);
-        if (ok) {
-            m_authAbuseGuard.recordSuccess(session->username());
-            rspData["success"] = true;
-        } else {
-            rspData["success"] = false;
-            rspData["error"]   = QStringLiteral("旧密码不正确");
-        }
+        auto ok = std::make_shared<bool>(false);
+        const int userId = session->userId();
+        const QString username = session->username();
+        submitPasswordWork(session, QStringLiteral("change-password"),
+                           Protocol::MsgType::CHANGE_PASSWORD_RSP,
+            [this, ok, userId, oldPassword, newPassword]() {
+                *ok = m_db->changePassword(userId, oldPassword, newPassword);
+            },
+            [this, session, ok, username]() {
+                QJsonObject result;
+                if (*ok) {
+                    m_authAbuseGuard.recordSuccess(username);
+                    result["success"] = true;
+                } else {
+                    result["success"] = false;
+                    result["error"]   = QStringLiteral("旧密码不正确");
+                }
+                session->sendMessage(Protocol::makeMessage(
+                    Protocol::MsgType::CHANGE_PASSWORD_RSP, result));
+            });
+        return;
     }
     session->sendMessage(Protocol::makeMessage(Protocol::MsgType::CHANGE_PASSWORD_RSP, rspData));
 }
 
 void ChatServer::broadcastToRoom(int roomId, const QJsonObject &msg, ClientSession *exclude) {
     QStringList users = m_roomMgr->usersInRoom(roomId);
+    // 整个房间共享一份预编码帧，每种传输层只序列化一次
+    const OutboundFramePtr frame = makeOutboundFrame(msg);
     QMutexLocker locker(&m_mutex);
     for (const QString &username : users) {
-        if (m_sessions.contains(username)) {
-            ClientSession *s = m_sessions[username];
-            if (s != exclude)
-                QMetaObject::invokeMethod(s, "sendMessage", Qt::QueuedConnection,
-                                          Q_ARG(QJsonObject, msg));
-        }
+        ClientSession *s = m_sessions.value(username);
+        if (s && s != exclude)
+            s->sendFrame(frame);
     }
 }
 
 void ChatServer::sendToUser(const QString &username, const QJsonObject &msg) {
     QMutexLocker locker(&m_mutex);
-    if (m_sessions.contains(username)) {
-        QMetaObject::invokeMethod(m_sessions[username], "sendMessage", Qt::QueuedConnection,
-                                  Q_ARG(QJsonObject, msg));
+    if (ClientSession *target = m_sessions.value(username))
+        target->sendMessage(msg);
+}
+
+void ChatServer::sendBlobNotify(const QStringList &usernames, const QJsonObject &inlineMsg,
+                                const QJsonObject &refMsg, ClientSession *exclude) {
+    // 两种帧各自只编码一次；没有接收者使用的帧不会被序列化
+    const OutboundFramePtr inlineFrame = makeOutboundFrame(inlineMsg);
+    const OutboundFramePtr refFrame = makeOutboundFrame(refMsg);
+    QMutexLocker locker(&m_mutex);
+    for (const QString &username : usernames) {
+        ClientSession *s = m_sessions.value(username);
+        if (s && s != exclude)
+            s->sendFrame(s->usesBlobReferences() ? refFrame : inlineFrame);
     }
 }
 
@@ -3857,21 +4362,6 @@ QStringList ChatServer::onlineUsersInRoom(int roomId) const {
     return online;
 }
 
-// ==================== 好友文件目录 ====================
-
-QString ChatServer::friendFileDir(int friendshipId, const QString &fileName) const {
-    QString typeDir = fileTypeSubDir(fileName);
-    QString yearMonth = QDate::currentDate().toString("yyyy-MM");
-    QString dir = QCoreApplication::applicationDirPath()
-                  + "/server_files/friends/"
-                  + QString::number(friendshipId) + "/"
-                  + typeDir + "/"
-                  + yearMonth;
-    QDir d(dir);
-    if (!d.exists()) d.mkpath(".");
-    return dir;
-}
-
 // ==================== 用户搜索 ====================
 
 void ChatServer::handleUserSearch(ClientSession *session, const QJsonObject &data) {
@@ -3928,12 +4418,17 @@ void ChatServer::handleRoomSearch(ClientSession *session, const QJsonObject &dat
 
 // ==================== 聊天室头像 ====================
 
-void ChatServer::handleRoomAvatarUpload(ClientSession *session, const QJsonObject &data) {
+void ChatServer::handleRoomAvatarUpload(ClientSession *session, const QJsonObject &data,
+                                        const Protocol::BinaryFields &binary) {
     if (!session->isAuthenticated()) return;
 
     int roomId = data["roomId"].toInt();
-    QString avatarBase64 = data["avatarData"].toString();
-    QByteArray avatarData = QByteArray::fromBase64(avatarBase64.toLatin1());
+    const auto rawAvatar = binary.constFind(QStringLiteral("avatarData"));
+    QString avatarBase64 = rawAvatar != binary.constEnd() ? QString()
+                                                          : data["avatarData"].toString();
+    QByteArray avatarData = rawAvatar != binary.constEnd()
+                                ? *rawAvatar
+                                : QByteArray::fromBase64(avatarBase64.toLatin1());
 
     QJsonObject rspData;
     rspData["roomId"] = roomId;
@@ -3953,15 +4448,24 @@ void ChatServer::handleRoomAvatarUpload(ClientSession *session, const QJsonObjec
         return;
     }
 
-    if (m_db->setRoomAvatar(roomId, avatarData)) {
+    BlobRef avatar;
+    if (m_db->setRoomAvatar(roomId, avatarData, &avatar)) {
         rspData["success"] = true;
         session->sendMessage(Protocol::makeMessage(Protocol::MsgType::ROOM_AVATAR_UPLOAD_RSP, rspData));
 
         // 通知房间内所有成员头像已更新
         QJsonObject notifyData;
         notifyData["roomId"] = roomId;
-        notifyData["avatarData"] = avatarBase64;
-        broadcastToRoom(roomId, Protocol::makeMessage(Protocol::MsgType::ROOM_AVATAR_UPDATE_NOTIFY, notifyData), session);
+        notifyData["avatarHash"] = avatar.hash;
+        notifyData["avatarSize"] = static_cast<double>(avatar.size);
+        const QJsonObject refNotify = notifyData;
+        notifyData["avatarData"] = avatarBase64.isEmpty()
+                                       ? QString::fromLatin1(avatarData.toBase64())
+                                       : avatarBase64;
+        sendBlobNotify(m_roomMgr->usersInRoom(roomId),
+                       Protocol::makeMessage(Protocol::MsgType::ROOM_AVATAR_UPDATE_NOTIFY, notifyData),
+                       Protocol::makeMessage(Protocol::MsgType::ROOM_AVATAR_UPDATE_NOTIFY, refNotify),
+                       session);
     } else {
         rspData["success"] = false;
         rspData["error"] = QStringLiteral("保存聊天室头像失败");
@@ -3973,13 +4477,16 @@ void ChatServer::handleRoomAvatarGet(ClientSession *session, const QJsonObject &
     if (!session->isAuthenticated()) return;
 
     int roomId = data["roomId"].toInt();
-    QByteArray avatarData = m_db->getRoomAvatar(roomId);
+    const BlobRef avatar = m_db->getRoomAvatarRef(roomId);
 
     QJsonObject rspData;
     rspData["roomId"] = roomId;
-    if (!avatarData.isEmpty()) {
+    if (!avatar.hash.isEmpty()) {
         rspData["success"] = true;
-        rspData["avatarData"] = QString::fromLatin1(avatarData.toBase64());
+        rspData["avatarHash"] = avatar.hash;
+        rspData["avatarSize"] = static_cast<double>(avatar.size);
+        if (!session->usesBlobReferences())
+            rspData["avatarData"] = QString::fromLatin1(m_db->getBlob(avatar.hash).toBase64());
     } else {
         rspData["success"] = false;
     }
@@ -4100,6 +4607,8 @@ void ChatServer::handleFriendRemove(ClientSession *session, const QJsonObject &d
     if (friendId > 0 && m_db->removeFriend(session->userId(), friendId)) {
         rspData["success"]  = true;
         rspData["username"] = friendUsername;
+        // 好友文件记录随好友关系级联删除，回收不再被引用的文件
+        m_fileStore.reap();
 
         // 通知对方刷新好友列表
         QJsonObject notifyData;
@@ -4117,14 +4626,15 @@ void ChatServer::handleFriendList(ClientSession *session) {
     if (!session->isAuthenticated()) return;
 
     QJsonArray friends = m_db->getFriendList(session->userId());
+    const QHash<int, int> unread = m_db->getUnreadFriendCounts(session->userId());
 
-    // 添加在线状态和未读计数
+    // 添加在线状态和未读计数（锁内只查在线表，不访问数据库）
     {
         QMutexLocker locker(&m_mutex);
         for (int i = 0; i < friends.size(); ++i) {
             QJsonObject fr = friends[i].toObject();
             fr["isOnline"] = m_sessions.contains(fr["username"].toString());
-            fr["unread"] = m_db->getUnreadFriendCount(fr["friendshipId"].toInt(), session->userId());
+            fr["unread"] = unread.value(fr["friendshipId"].toInt());
             friends[i] = fr;
         }
     }
@@ -4244,6 +4754,7 @@ void ChatServer::handleFriendHistory(ClientSession *session, const QJsonObject &
                               ? m_db->getFriendMessageHistoryAfterSequence(
                                     friendshipId, count, afterSequence)
                               : m_db->getFriendMessageHistory(friendshipId, count, before);
+    if (!session->usesBlobReferences()) messages = inlineThumbnails(m_db, messages);
 
     rspData["success"] = true;
     rspData["friendshipId"]  = friendshipId;
@@ -4262,27 +4773,32 @@ void ChatServer::handleFriendHistory(ClientSession *session, const QJsonObject &
     session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FRIEND_HISTORY_RSP, rspData));
 }
 
-void ChatServer::handleFriendFileSend(ClientSession *session, const QJsonObject &msg) {
+void ChatServer::handleFriendFileSend(ClientSession *session, const QJsonObject &msg,
+                                      const Protocol::BinaryFields &binary) {
     if (!session->isAuthenticated()) return;
 
     QJsonObject data = msg["data"].toObject();
     QString friendUsername = data["friendUsername"].toString();
     QString fileName  = data["fileName"].toString();
     qint64 fileSize   = static_cast<qint64>(data["fileSize"].toDouble());
-    QString fileData  = data["fileData"].toString();
-    QString thumbnail = data["thumbnail"].toString();
+    const QString thumbnail = thumbnailField(data, binary);
 
     int friendId = m_db->getUserIdByName(friendUsername);
     if (friendId < 0) return;
     int friendshipId = m_db->getFriendshipId(session->userId(), friendId);
     if (friendshipId < 0) return;
 
+    const auto inlineData = binary.constFind(QStringLiteral("fileData"));
     QByteArray rawData;
     QString validationError;
     QString validatedFileName;
     if (!InputValidator::validateFileName(fileName, &validatedFileName, &validationError)
-        || !InputValidator::decodeInlineFile(fileData, fileSize, Protocol::MAX_SMALL_FILE,
-                                             &rawData, &validationError)) {
+        || !(inlineData != binary.constEnd()
+                 ? InputValidator::validateInlineFile(*inlineData, fileSize,
+                                                      Protocol::MAX_SMALL_FILE, &validationError)
+                 : InputValidator::decodeInlineFile(data["fileData"].toString(), fileSize,
+                                                    Protocol::MAX_SMALL_FILE,
+                                                    &rawData, &validationError))) {
         QJsonObject rsp;
         rsp["success"] = false;
         rsp["error"] = validationError;
@@ -4290,6 +4806,7 @@ void ChatServer::handleFriendFileSend(ClientSession *session, const QJsonObject
         return;
     }
     fileName = validatedFileName;
+    if (inlineData != binary.constEnd()) rawData = *inlineData;
 
     // 根据文件后缀确定 contentType（与房间 handleFileSend 一致）
     QString contentType = QStringLiteral("file");
@@ -4299,48 +4816,23 @@ void ChatServer::handleFriendFileSend(ClientSession *session, const QJsonObject
     else if (typeDir == QLatin1String("Video"))
         contentType = QStringLiteral("video");
 
-    // 保存文件
-    QString targetDir = friendFileDir(friendshipId, fileName);
-    QString safeName = QString::number(QDateTime::currentMSecsSinceEpoch()) + "_" + fileName;
-    QString filePath = targetDir + "/" + safeName;
-
-    QFile f(filePath);
-    if (!f.open(QIODevice::WriteOnly)) return;
-    if (f.write(rawData) != rawData.size()) {
-        f.close();
-        QFile::remove(filePath);
-        QJsonObject rsp;
-        rsp["success"] = false;
-        rsp["error"] = QStringLiteral("服务器写入文件失败");
-        session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FRIEND_FILE_NOTIFY, rsp));
-        return;
-    }
-    f.close();
-
-    int fileId = m_db->saveFriendFile(friendshipId, session->userId(), fileName, filePath, fileSize);
+    // 保存文件（按内容哈希存入 server_files/blobs，与房间 handleFileSend 一致）
+    QString filePath;
+    const int fileId = m_fileStore.storeData(rawData,
+        [&](const QString &blobPath, const QString &contentHash) {
+            filePath = blobPath;
+            return m_db->saveFriendFile(friendshipId, session->userId(), fileName,
+                                        blobPath, fileSize, contentHash);
+        });
     if (fileId <= 0) {
-        QFile::remove(filePath);
-        return;
-    }
-
-    // 图片自动生成缩略图（与房间 handleFileSend 一致）
-#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
-    if (contentType == QLatin1String("image") && fileSize < 20 * 1024 * 1024) {
-        QImage img(filePath);
-        if (!img.isNull()) {
-            QImage thumb = img.scaled(200, 200, Qt::KeepAspectRatio, Qt::FastTransformation);
-            QByteArray thumbData;
-            QBuffer buf(&thumbData);
-            buf.open(QIODevice::WriteOnly);
-            thumb.save(&buf, "JPEG", 60);
-            QString serverThumb = QString::fromLatin1(thumbData.toBase64());
-            if (!serverThumb.isEmpty()) thumbnail = serverThumb;
+        releaseStoredFiles({filePath});
+        if (filePath.isEmpty()) {
+            QJsonObject rsp;
+            rsp["success"] = false;
+            rsp["error"] = QStringLiteral("服务器写入文件失败");
+            session->sendMessage(Protocol::makeMessage(Protocol::MsgType::FRIEND_FILE_NOTIFY, rsp));
         }
-    }
-#endif
-    // QImage 失败或非图片类型时，使用客户端提供的缩略图（视频缩略图由客户端生成）
-    if (thumbnail.isEmpty() && data.contains("thumbnail")) {
-        thumbnail = data["thumbnail"].toString();
+        return;
     }
 
     qint64 sequence = 0;
@@ -4350,7 +4842,7 @@ void ChatServer::handleFriendFileSend(ClientSession *session, const QJsonObject
         fileName, fileSize, fileId, thumbnail, &sequence, &timestamp);
     if (msgId <= 0) {
         m_db->deleteStoredFileRecord(fileId, true);
-        QFile::remove(filePath);
+        releaseStoredFiles({filePath});
         return;
     }
 
@@ -4374,6 +4866,9 @@ void ChatServer::handleFriendFileSend(ClientSession *session, const QJsonObject
     if (friendUsername != session->username()) {
         sendToUser(friendUsername, notifyMsg);
     }
+    // 与房间 handleFileSend 一致：服务端缩略图在后台生成后推送替换
+    scheduleFriendThumbnail(friendshipId, msgId, session->username(), friendUsername,
+                            contentType, filePath, fileSize);
 }
 
 void ChatServer::handleFriendFileUploadStart(ClientSession *session, const QJsonObject &data) {
@@ -4431,9 +4926,7 @@ void ChatServer::handleFriendFileUploadStart(ClientSession *session, const QJson
     }
 
     QString uploadId = QUuid::createUuid().toString(QUuid::WithoutBraces);
-    QString targetDir = friendFileDir(friendshipId, fileName);
-    QString safeName = QString::number(QDateTime::currentMSecsSinceEpoch()) + "_" + fileName;
-    QString filePath = targetDir + "/" + safeName;
+    QString filePath = m_fileStore.createIncomingPath();
 
     auto *file = new QFile(filePath);
     if (!file->open(QIODevice::WriteOnly)) {
@@ -4444,18 +4937,20 @@ void ChatServer::handleFriendFileUploadStart(ClientSession *session, const QJson
         return;
     }
 
-    UploadState state;
-    state.roomId      = -friendshipId; // 用负数标识好友文件上传
-    state.userId      = session->userId();
-    state.username    = session->username();
-    state.displayName = session->displayName();
-    state.clientMessageId = clientMessageId;
-    state.fileName    = fileName;
-    state.filePath    = filePath;
-    state.fileSize    = fileSize;
-    state.received    = 0;
-    state.file        = file;
-    m_uploads[uploadId] = state;
+    auto state = std::make_shared<UploadState>();
+    state->roomId      = -friendshipId; // 用负数标识好友文件上传
+    state->userId      = session->userId();
+    state->username    = session->username();
+    state->displayName = session->displayName();
+    state->clientMessageId = clientMessageId;
+    state->fileName    = fileName;
+    state->filePath    = filePath;
+    state->fileSize    = fileSize;
+    state->file        = file;
+    state->hash        = std::make_shared<QCryptographicHash>(QCryptographicHash::Sha256);
+    state->lastActivityMs = TimingWheel::clockMs();
+    registerUpload(uploadId, state);
+    watchUploadIdle(uploadId, uploadIdleTimeoutMs());
 
     rspData["success"]        = true;
     rspData["uploadId"]       = uploadId;
@@ -4493,13 +4988,13 @@ void ChatServer::handleFriendRecall(ClientSession *session, const QJsonObject &d
         auto fileInfo = m_db->getFileInfoForFriendMessage(messageId);
         if (fileInfo.first > 0) {
             const QString cosUrl = m_db->getCosUrl(fileInfo.first, true);
+            m_db->deleteStoredFileRecord(fileInfo.first, true);
             if (!fileInfo.second.isEmpty()) {
-                QFile::remove(fileInfo.second);
-                qInfo() << "[Server] 好友撤回消息，已删除文件:" << fileInfo.second;
+                releaseStoredFiles({fileInfo.second});
+                qInfo() << "[Server] 好友撤回消息，已释放文件:" << fileInfo.second;
             }
-            m_db->deleteStoredFileRecord(fileInfo.first, true);
             if (!cosUrl.isEmpty())
-                m_cos->deleteCosFile(cosUrl);
+                deleteCosFiles({cosUrl});
         }
 
         rspData["success"] = true;
@@ -2,26 +2,38 @@
 
 #include <QTcpServer>
 #include <QMap>
+#include <QHash>
 #include <QSet>
 #include <QMutex>
+#include <QAtomicInt>
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QFile>
 #include <QDateTime>
+#include <memory>
 
 #include "AuthenticationAbuseGuard.h"
+#include "FileBlobStore.h"
+#include "PasswordHashPool.h"
+#include "ThumbnailService.h"
 #include "AdministrativeDeletionService.h"
 #include "FriendMessageService.h"
 #include "RoomMessageService.h"
+#include "Protocol.h"
 
 class QWebSocketServer;
 class QWebSocket;
 class QTcpSocket;
 class QTimer;
+class QCryptographicHash;
 class ClientSession;
 class DatabaseManager;
 class RoomManager;
 class CosManager;
+class RequestDispatcher;
+class SessionIoPool;
+class HttpConnection;
+struct HttpRequest;
 
 /// 聊天服务器 —— 管理所有客户端连接和消息路由
 class ChatServer : public QTcpServer {
@@ -33,6 +45,13 @@ public:
     bool startServer(quint16 port, quint16 wsPort = 0, quint16 httpPort = 0);
     void stopServer();
 
+    /// 请求工作线程数量（需在 startServer 前设置；<= 0 使用默认值）
+    void setWorkerThreadCount(int count) { m_workerThreadCount = count; }
+    /// TCP 会话 I/O 线程数量（需在 startServer 前设置；<= 0 使用默认值）
+    void setIoThreadCount(int count) { m_ioThreadCount = count; }
+    /// HTTP 连接线程数量（需在 startServer 前设置；<= 0 使用默认值）
+    void setHttpThreadCount(int count) { m_httpThreadCount = count; }
+
     DatabaseManager *database() const { return m_db; }
     RoomManager     *roomManager() const { return m_roomMgr; }
     CosManager      *cosManager() const { return m_cos; }
@@ -43,6 +62,10 @@ public:
     // 向指定用户发送消息
     void sendToUser(const QString &username, const QJsonObject &msg);
 
+    // 向指定用户发送缩略图/头像通知：blobRefs 客户端收到只带哈希的 refMsg，其余收到内联 base64 的 inlineMsg
+    void sendBlobNotify(const QStringList &usernames, const QJsonObject &inlineMsg,
+                        const QJsonObject &refMsg, ClientSession *exclude = nullptr);
+
     // 获取指定房间在线用户列表
     QStringList onlineUsersInRoom(int roomId) const;
 
@@ -52,12 +75,27 @@ protected:
 private slots:
     void onClientAuthenticated(ClientSession *session);
     void onClientDisconnected(ClientSession *session);
-    void onClientMessage(ClientSession *session, const QJsonObject &msg);
-    void onNewWebSocketConnection();
-    void handleHttpRequest(QTcpSocket *socket);
+    /// binary 为 CBOR 帧携带的二进制字段（fileData/chunkData/avatarData/thumbnail 的原始字节）
+    void onClientMessage(ClientSession *session, const QJsonObject &msg,
+                         const Protocol::BinaryFields &binary = Protocol::BinaryFields());
 
 private:
+    // 请求分发：在会话所在线程被直接调用，投递到对应分片的工作线程
+    void dispatchClientMessage(ClientSession *session, const QJsonObject &msg,
+                               const Protocol::BinaryFields &binary);
+    void dispatchClientBinary(ClientSession *session, const QJsonObject &header,
+                              const QByteArray &payload);
+    void dispatchClientDisconnected(ClientSession *session);
+    // WebSocket 连接：主线程只接受描述符，socket 创建、握手与会话都在 I/O 线程
+    void acceptWebSocketConnection(qintptr socketDescriptor);
+    void onNewWebSocketConnection(QWebSocketServer *upgrader);
+    QString dispatchKey(ClientSession *session, const QJsonObject &msg) const;
+    static QString sessionDispatchKey(ClientSession *session);
+
     bool setupHttpServer(quint16 port);
+    // HTTP 连接与 WebSocket 一样在 I/O 线程创建；请求在所属 I/O 线程内处理
+    void acceptHttpConnection(qintptr socketDescriptor);
+    void handleHttpRequest(HttpConnection *connection, const HttpRequest &request);
     QString generateFileToken(int userId);
     int validateFileToken(const QString &token) const;
     bool validateDeveloperKey(const QString &providedKey, QString *error = nullptr) const;
@@ -65,7 +103,21 @@ private:
                                const QString &operation) const;
     bool requireUploadOwnership(ClientSession *session, const QString &uploadId,
                                 QJsonObject *response = nullptr) const;
-    void abandonUpload(const QString &uploadId);
+    void abandonUpload(const QString &uploadId, const QString &reason);
+    /// 在 ChatServer 线程的时间轮上登记上传空闲检查；可在任意线程调用
+    void watchUploadIdle(const QString &uploadId, qint64 delayMs);
+    void expireIdleUpload(const QString &uploadId);
+    /// 认证成功时才记录 blobRefs 并在 LOGIN_RSP 写出后启用 CBOR/二进制分块/压缩帧；失败不改变会话能力
+    void finishLogin(ClientSession *session, const QString &username, int userId,
+                     const QJsonObject &loginData);
+    void rejectAuthenticationAttempt(ClientSession *session, const QString &operation,
+                                     const QString &responseType,
+                                     const AuthenticationAbuseGuard::Decision &decision);
+    /// 将涉及 Argon2id 的数据库操作投递到密码哈希线程池，完成后在会话分片上执行 resume；
+    /// 队列已满时按 hash-queue 维度拒绝（已向客户端回复 responseType）并返回 false
+    bool submitPasswordWork(ClientSession *session, const QString &operation,
+                            const QString &responseType,
+                            std::function<void()> work, std::function<void()> resume);
     bool allowAuthenticationAttempt(ClientSession *session, const QString &account,
                                     const QString &operation,
                                     const QString &responseType);
@@ -93,12 +145,16 @@ private:
     void handleRoomList(ClientSession *session);
     void handleUserList(ClientSession *session, const QJsonObject &data);
     void handleHistory(ClientSession *session, const QJsonObject &data);
-    void handleFileSend(ClientSession *session, const QJsonObject &msg);
+    void handleFileSend(ClientSession *session, const QJsonObject &msg,
+                        const Protocol::BinaryFields &binary = Protocol::BinaryFields());
     void handleFileDownload(ClientSession *session, const QJsonObject &data);
     void handleFileForward(ClientSession *session, const QJsonObject &data);
     void handleFileUploadStart(ClientSession *session, const QJsonObject &data);
-    void handleFileUploadChunk(ClientSession *session, const QJsonObject &data);
-    void handleFileUploadEnd(ClientSession *session, const QJsonObject &data);
+    /// rawChunk 非空时来自二进制分块帧，直接写入；否则解码 data.chunkData
+    void handleFileUploadChunk(ClientSession *session, const QJsonObject &data,
+                               const QByteArray *rawChunk = nullptr);
+    void handleFileUploadEnd(ClientSession *session, const QJsonObject &data,
+                             const Protocol::BinaryFields &binary = Protocol::BinaryFields());
     void handleFileDownloadChunk(ClientSession *session, const QJsonObject &data);
     void handleRecall(ClientSession *session, const QJsonObject &data);
     void handleSetAdmin(ClientSession *session, const QJsonObject &data);
@@ -111,7 +167,8 @@ private:
     void handleSetRoomPassword(ClientSession *session, const QJsonObject &data);
     void handleGetRoomPassword(ClientSession *session, const QJsonObject &data);
     void handleKickUser(ClientSession *session, const QJsonObject &data);
-    void handleAvatarUpload(ClientSession *session, const QJsonObject &data);
+    void handleAvatarUpload(ClientSession *session, const QJsonObject &data,
+                            const Protocol::BinaryFields &binary = Protocol::BinaryFields());
     void handleAvatarGet(ClientSession *session, const QJsonObject &data);
     void handleFileUploadCancel(ClientSession *session, const QJsonObject &data);
     void handleChangeNickname(ClientSession *session, const QJsonObject &data);
@@ -125,7 +182,8 @@ private:
     void handleRoomSearch(ClientSession *session, const QJsonObject &data);
 
     // 聊天室头像
-    void handleRoomAvatarUpload(ClientSession *session, const QJsonObject &data);
+    void handleRoomAvatarUpload(ClientSession *session, const QJsonObject &data,
+                                const Protocol::BinaryFields &binary = Protocol::BinaryFields());
     void handleRoomAvatarGet(ClientSession *session, const QJsonObject &data);
 
     // 好友系统
@@ -137,49 +195,96 @@ private:
     void handleFriendPending(ClientSession *session);
     void handleFriendChatMessage(ClientSession *session, const QJsonObject &msg);
     void handleFriendHistory(ClientSession *session, const QJsonObject &data);
-    void handleFriendFileSend(ClientSession *session, const QJsonObject &msg);
+    void handleFriendFileSend(ClientSession *session, const QJsonObject &msg,
+                              const Protocol::BinaryFields &binary = Protocol::BinaryFields());
     void handleFriendFileUploadStart(ClientSession *session, const QJsonObject &data);
     void handleFriendRecall(ClientSession *session, const QJsonObject &data);
-    bool tryReserveRoomFileQuota(int roomId, qint64 fileSize, QString *error);
-    void releaseRoomFileQuota(int roomId, qint64 fileSize);
-    QList<int> buildCleanupPlan(int roomId, qint64 newMaxFileSize, qint64 newTotalFileSpace,
-                                int newMaxFileCount, QJsonObject *planSummary);
-    bool applyFileCleanupPlan(int roomId, const QList<int> &fileIds, const QString &reason, QJsonArray *clearedIdsOut);
+    /// 调整房间配额时需要清理的文件：超过新单文件上限的全部清理，其余按创建时间从早到晚淘汰
+    struct FileCleanupPlan {
+        QList<RoomActiveFile> files;   // 按创建时间升序
+        qint64 currentUsed = 0;
+        int currentCount = 0;
+        qint64 afterUsed = 0;
+        int afterCount = 0;
+    };
+    FileCleanupPlan buildCleanupPlan(int roomId, qint64 newMaxFileSize, qint64 newTotalFileSpace,
+                                     int newMaxFileCount, QJsonObject *planSummary);
+    bool applyFileCleanupPlan(int roomId, const FileCleanupPlan &plan, const QString &reason, QJsonArray *clearedIdsOut);
+    /// 后台缩略图的一个写入目标：结果投递到 dispatchKey 分片后由 apply 写库并推送
+    struct ThumbnailTarget {
+        QString dispatchKey;
+        std::function<void(const QByteArray &)> apply;
+    };
+    /// 转发成功时把新消息追加到 thumbnailTargets，由 handleFileForward 统一补写缩略图
     QJsonObject forwardFileToRoom(ClientSession *session, int roomId,
                                   const QString &sourcePath, const QString &fileName,
-                                  qint64 fileSize);
+                                  qint64 fileSize, QList<ThumbnailTarget> *thumbnailTargets);
     QJsonObject forwardFileToFriend(ClientSession *session, const QString &friendUsername,
                                     const QString &sourcePath, const QString &fileName,
-                                    qint64 fileSize);
+                                    qint64 fileSize, QList<ThumbnailTarget> *thumbnailTargets);
 
     /// 根据文件名返回类型子目录 ("Image", "Video", "File")
     static QString fileTypeSubDir(const QString &fileName);
-    /// 构建服务端文件存放目录：server_files/{roomId}/Image|Video|File/{yyyy-MM}/
-    QString serverFileDir(int roomId, const QString &fileName) const;
-    /// 构建好友文件存放目录：server_files/friends/{friendshipId}/Image|Video|File/{yyyy-MM}/
-    QString friendFileDir(int friendshipId, const QString &fileName) const;
+    /// 文件记录删除或清除后释放其字节：旧版按记录存放的文件直接删除，
+    /// 内容寻址 blob 只在引用计数归零时回收
+    void releaseStoredFiles(const QStringList &filePaths);
+
+    /// 图片/视频消息保存后在后台生成缩略图，完成后回到会话分片写库并推送
+    /// FILE_THUMBNAIL_NOTIFY / FRIEND_FILE_THUMBNAIL_NOTIFY；其他类型为空操作
+    void scheduleRoomThumbnail(int roomId, int messageId, const QString &contentType,
+                               const QString &filePath, qint64 fileSize);
+    void scheduleFriendThumbnail(int friendshipId, int messageId, const QString &sender,
+                                 const QString &friendUsername, const QString &contentType,
+                                 const QString &filePath, qint64 fileSize);
+    ThumbnailTarget roomThumbnailTarget(int roomId, int messageId);
+    ThumbnailTarget friendThumbnailTarget(int friendshipId, int messageId, const QString &sender,
+                                          const QString &friendUsername);
+    /// 同一文件只生成一次缩略图，结果写入所有目标
+    bool submitThumbnail(const QString &contentType, const QString &filePath, qint64 fileSize,
+                         const QList<ThumbnailTarget> &targets);
+    void postThumbnail(const QList<ThumbnailTarget> &targets, const QByteArray &jpeg);
 
     /// 异步上传文件到 COS，发送进度给上传者
     void startCosUpload(const QString &localPath, const QString &fileName,
                         const QString &dirPrefix, int fileId, bool isFriendFile,
                         const QString &uploaderUsername, const QString &uploadId);
+    /// COS 上传结束后回写文件记录；重启续传时按断点状态里保存的 fileId 等重建
+    std::function<void(bool, const QString &)> cosUploadFinished(int fileId, bool isFriendFile,
+                                                                 const QString &fileName);
 
     /// 批量删除 COS 对象（fire-and-forget，COS 未启用时为空操作）
     void deleteCosFiles(const QStringList &cosUrls);
     void cleanupDeletedRoomFiles(const QJsonArray &fileIds);
 
+    /// 文件过期维护：定时投递到工作线程，每批处理 kFileExpiryBatchSize 个文件直到清空
+    void scheduleFileExpiry();
+    void runFileExpiryBatch();
+
     DatabaseManager *m_db       = nullptr;
     RoomManager     *m_roomMgr  = nullptr;
     CosManager      *m_cos      = nullptr;
+    RequestDispatcher *m_dispatcher = nullptr;
+    int              m_workerThreadCount = 0;
+    SessionIoPool   *m_ioPool = nullptr;
+    int              m_ioThreadCount = 0;
+    SessionIoPool   *m_httpPool = nullptr;   // HTTP 连接独占的线程，上传写盘与鉴权查询不阻塞会话 I/O
+    int              m_httpThreadCount = 0;
     RoomMessageService m_roomMessageService;
     FriendMessageService m_friendMessageService;
     AdministrativeDeletionService m_administrativeDeletionService;
-    QWebSocketServer *m_wsServer = nullptr;
+    FileBlobStore    m_fileStore;   // server_files/blobs：上传与转发的文件字节按内容只存一份
+    QTcpServer      *m_wsListener = nullptr;
+    QList<QWebSocketServer *> m_wsUpgraders;  // 每个 I/O 线程一个，只做握手不监听
     QTcpServer      *m_httpServer = nullptr;
     QTimer          *m_expireTimer = nullptr;
+    QAtomicInt       m_fileExpiryActive{0};
     quint16          m_httpPort = 0;
+    mutable QMutex m_fileTokenMutex;
     QMap<QString, QPair<int, QDateTime>> m_fileTokens; // token -> {userId, expireAt(UTC)}
     AuthenticationAbuseGuard m_authAbuseGuard;
+    PasswordHashPool m_passwordHashPool;
+    ThumbnailService m_thumbnails;
+    QMutex m_outcomeMutex;   // 保护以下发送结果计数
     quint64 m_roomMessagesAccepted = 0;
     quint64 m_roomMessagesDuplicate = 0;
     quint64 m_roomMessagesRejected = 0;
@@ -197,20 +302,42 @@ private:
     QMap<QString, ClientSession*> m_sessions;  // username -> session
 
     // 大文件上传临时状态
+    // m_uploadMutex 只保护 m_uploads 映射本身；单个上传的文件写入、哈希与进度由 UploadState::mutex 保护。
+    // 磁盘写入与数据库调用都不在映射锁内执行，不同上传的分块互不阻塞
+    //（房间配额预留由数据库层的配额账本管理）
     struct UploadState {
+        // 以下字段创建后不再修改，持有指针即可读取（取出后由完成流程独占，可改写 filePath）
         int roomId = 0;
         int userId = 0;
         QString username;
         QString displayName;
         QString clientMessageId;
         QString fileName;
-        QString filePath;    // 临时文件路径
+        QString filePath;    // 临时文件路径（FileBlobStore 的 incoming 目录）
         qint64 fileSize = 0;
-        qint64 received = 0;
         bool roomQuotaReserved = false;
+
+        // 以下字段受 mutex 保护
+        QMutex mutex;
         QFile *file = nullptr;
+        std::shared_ptr<QCryptographicHash> hash;   // 分块写入时同步累积 SHA-256，完成时直接得到内容哈希
+        qint64 received = 0;
+        qint64 lastActivityMs = 0;   // TimingWheel::clockMs()，空闲超过上限的上传被丢弃
+        bool closed = false;         // 已从 m_uploads 取出，迟到的分块不再写入
+        // 正在经 HTTP PUT 接收请求体的连接；请求体结束（含连接析构）时在锁内清空，非空即存活
+        HttpConnection *httpConnection = nullptr;
     };
-    QMap<QString, UploadState> m_uploads;  // uploadId -> state
-    QMap<int, qint64> m_roomReservedBytes;  // roomId -> reserved bytes by in-flight uploads
-    QMap<int, int> m_roomReservedCount;     // roomId -> reserved file count by in-flight uploads
+    using UploadStatePtr = std::shared_ptr<UploadState>;
+    mutable QMutex m_uploadMutex;
+    QHash<QString, UploadStatePtr> m_uploads;  // uploadId -> state
+
+    void registerUpload(const QString &uploadId, const UploadStatePtr &state);
+    UploadStatePtr findUpload(const QString &uploadId) const;
+    /// 从映射中取出上传并关闭文件；此后迟到的分块写入失败，仍在接收请求体的 HTTP 连接被断开。
+    /// 已被取出时返回空
+    UploadStatePtr takeUpload(const QString &uploadId);
+    /// 追加一个分块：校验剩余长度、写入文件并累积哈希；上传已关闭或写入失败时返回 false
+    bool appendUploadChunk(UploadState &state, const QByteArray &chunk);
+    /// 删除已取出上传的临时文件并归还配额预留
+    void discardUpload(const UploadState &state);
 };
@@ -6,6 +6,91 @@
 #include <QDebug>
 #include <QWebSocket>
 
+namespace {
+
+// 会话线程长时间来不及写出时，队列超过该深度后丢弃新的进度与状态通知
+constexpr int kMaxQueuedFrames = 4096;
+// 分级背压：会话待发字节（出站队列 + socket 写缓冲）超过阈值后依次丢弃进度、上下线通知
+constexpr qint64 kShedProgressBytes = 256 * 1024;
+constexpr qint64 kShedPresenceBytes = 2 * 1024 * 1024;
+// 全部会话待发字节超过预算后，写缓冲积压超过该值的会话按慢消费者断开
+constexpr qint64 kBudgetSessionFloorBytes = 1024 * 1024;
+constexpr qint64 kDefaultOutboundBudgetMB = 256;
+constexpr qint64 kMaxOutboundBudgetMB = 64 * 1024;
+
+QAtomicInteger<quint64> g_outboxFlushes{0};
+QAtomicInteger<quint64> g_outboxFrames{0};
+QAtomicInteger<quint64> g_outboxMerged{0};
+QAtomicInteger<quint64> g_outboxDropped{0};
+QAtomicInteger<quint64> g_outboxCompressed{0};
+QAtomicInt g_outboxMaxDepth{0};
+QAtomicInteger<qint64> g_pendingBytes{0};
+QAtomicInteger<qint64> g_pendingHighWater{0};
+QAtomicInteger<qint64> g_sessionHighWater{0};
+QAtomicInteger<quint64> g_shedProgress{0};
+QAtomicInteger<quint64> g_shedPresence{0};
+QAtomicInteger<quint64> g_budgetDisconnects{0};
+
+// CHATROOM_OUTBOUND_BUDGET_MB：所有会话待发字节的总预算，默认 256MB
+qint64 outboundBudgetBytes() {
+    static const qint64 budget = [] {
+        bool ok = false;
+        const qint64 configured = qEnvironmentVariableIntValue("CHATROOM_OUTBOUND_BUDGET_MB", &ok);
+        const qint64 mb = ok && configured > 0 && configured <= kMaxOutboundBudgetMB
+            ? configured : kDefaultOutboundBudgetMB;
+        return mb * 1024 * 1024;
+    }();
+    return budget;
+}
+
+void recordHighWater(QAtomicInteger<qint64> &mark, qint64 value) {
+    qint64 seen = mark.loadRelaxed();
+    while (value > seen && !mark.testAndSetRelaxed(seen, value))
+        seen = mark.loadRelaxed();
+}
+
+void logBackpressure() {
+    qInfo().noquote()
+        << QStringLiteral("[Session] backpressure pendingKB=%1 highWaterKB=%2 sessionHighWaterKB=%3 "
+                          "shedProgress=%4 shedPresence=%5 budgetDisconnects=%6")
+               .arg(g_pendingBytes.loadRelaxed() / 1024)
+               .arg(g_pendingHighWater.loadRelaxed() / 1024)
+               .arg(g_sessionHighWater.loadRelaxed() / 1024)
+               .arg(g_shedProgress.loadRelaxed())
+               .arg(g_shedPresence.loadRelaxed())
+               .arg(g_budgetDisconnects.loadRelaxed());
+}
+
+void recordShed(QAtomicInteger<quint64> &counter) {
+    const quint64 shed = counter.fetchAndAddRelaxed(1) + 1;
+    if ((shed & (shed - 1)) == 0 && shed >= 1024) logBackpressure();
+}
+
+void recordQueueDepth(int depth) {
+    int seen = g_outboxMaxDepth.loadRelaxed();
+    while (depth > seen && !g_outboxMaxDepth.testAndSetRelaxed(seen, depth))
+        seen = g_outboxMaxDepth.loadRelaxed();
+}
+
+void recordFlush(int frames) {
+    const quint64 total = g_outboxFrames.fetchAndAddRelaxed(frames) + frames;
+    const quint64 flushes = g_outboxFlushes.fetchAndAddRelaxed(1) + 1;
+    if ((flushes & (flushes - 1)) == 0 && flushes >= 1024) {
+        qInfo().noquote()
+            << QStringLiteral("[Session] outbound flushes=%1 frames=%2 avgBatch=%3 maxDepth=%4 merged=%5 dropped=%6 compressed=%7")
+                   .arg(flushes)
+                   .arg(total)
+                   .arg(static_cast<double>(total) / static_cast<double>(flushes), 0, 'f', 2)
+                   .arg(g_outboxMaxDepth.loadRelaxed())
+                   .arg(g_outboxMerged.loadRelaxed())
+                   .arg(g_outboxDropped.loadRelaxed())
+                   .arg(g_outboxCompressed.loadRelaxed());
+        logBackpressure();
+    }
+}
+
+} // namespace
+
 // ==================== TCP 构造 ====================
 
 ClientSession::ClientSession(qintptr socketDescriptor, QObject *parent)
@@ -22,10 +107,12 @@ ClientSession::ClientSession(QWebSocket *ws, QObject *parent)
     , m_transport(WebSock)
     , m_webSocket(ws)
 {
-    // 仅保存指针，信号连接延迟到 init() 在工作线程中执行
+    // 仅保存指针，信号连接延迟到 init() 在会话所在的 I/O 线程中执行
 }
 
 ClientSession::~ClientSession() {
+    // 归还尚未写出的字节，全局预算只统计存活会话
+    adjustPendingBytes(-(m_outboxBytes + m_socketBytes));
     if (m_socket) {
         m_socket->close();
         m_socket->deleteLater();
@@ -49,11 +136,15 @@ void ClientSession::init() {
         m_socket->setReadBufferSize(static_cast<qint64>(Protocol::MAX_JSON_MESSAGE_BYTES) + 4);
         connect(m_socket, &QTcpSocket::readyRead,    this, &ClientSession::onTcpReadyRead);
         connect(m_socket, &QTcpSocket::disconnected,  this, &ClientSession::onDisconnected);
+        connect(m_socket, &QTcpSocket::bytesWritten,  this, &ClientSession::syncSocketBytes);
         setupHeartbeat();
-        m_peerAddress = m_socket->peerAddress().toString();
+        {
+            QMutexLocker locker(&m_identityMutex);
+            m_peerAddress = m_socket->peerAddress().toString();
+        }
         qDebug() << "[Session/TCP] 初始化完成，来源:" << m_peerAddress;
     } else {
-        // WebSocket: 信号连接在工作线程中进行，避免跨线程 QSocketNotifier 问题
+        // WebSocket: 信号连接在会话所在的 I/O 线程中进行，避免跨线程 QSocketNotifier 问题
         if (m_webSocket) {
             m_webSocket->setParent(this);
             m_webSocket->setMaxAllowedIncomingFrameSize(Protocol::MAX_JSON_MESSAGE_BYTES);
@@ -62,32 +153,116 @@ void ClientSession::init() {
                     this, &ClientSession::onWsTextReceived);
             connect(m_webSocket, &QWebSocket::disconnected,
                     this, &ClientSession::onDisconnected);
+            connect(m_webSocket, &QWebSocket::bytesWritten,
+                    this, &ClientSession::syncSocketBytes);
             setupHeartbeat();
-            m_peerAddress = m_webSocket->peerAddress().toString();
+            {
+                QMutexLocker locker(&m_identityMutex);
+                m_peerAddress = m_webSocket->peerAddress().toString();
+            }
             qDebug() << "[Session/WS] 初始化完成，来源:" << m_peerAddress;
         }
     }
 }
 
 void ClientSession::setupHeartbeat() {
-    m_heartbeatTimer = new QTimer(this);
-    m_heartbeatTimer->setInterval(Protocol::HEARTBEAT_TIMEOUT_MS);
-    connect(m_heartbeatTimer, &QTimer::timeout, this, &ClientSession::onHeartbeatTimeout);
-    m_heartbeatTimer->start();
+    m_heartbeat.start(Protocol::HEARTBEAT_TIMEOUT_MS, [this]() { onHeartbeatTimeout(); });
 }
 
 void ClientSession::setAuthenticated(int userId, const QString &username, const QString &displayName) {
+    QMutexLocker locker(&m_identityMutex);
     m_userId        = userId;
     m_username      = username;
     m_displayName   = displayName;
     m_authenticated = true;
 }
 
+int ClientSession::userId() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_userId;
+}
+
+QString ClientSession::username() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_username;
+}
+
+QString ClientSession::displayName() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_displayName;
+}
+
+QString ClientSession::peerAddress() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_peerAddress;
+}
+
+bool ClientSession::isAuthenticated() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_authenticated;
+}
+
+void ClientSession::setDisplayName(const QString &dn) {
+    QMutexLocker locker(&m_identityMutex);
+    m_displayName = dn;
+}
+
+void ClientSession::setUsername(const QString &u) {
+    QMutexLocker locker(&m_identityMutex);
+    m_username = u;
+}
+
+void ClientSession::setKicked(bool v) {
+    QMutexLocker locker(&m_identityMutex);
+    m_kicked = v;
+}
+
+bool ClientSession::isKicked() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_kicked;
+}
+
+void ClientSession::setBlobReferences(bool v) {
+    QMutexLocker locker(&m_identityMutex);
+    m_blobReferences = v;
+}
+
+bool ClientSession::usesBlobReferences() const {
+    QMutexLocker locker(&m_identityMutex);
+    return m_blobReferences;
+}
+
+void ClientSession::enableFrameCapabilities(bool cborFrames, bool binaryChunks,
+                                            bool compressedFrames) {
+    if (QThread::currentThread() != this->thread()) {
+        QMetaObject::invokeMethod(this, [this, cborFrames, binaryChunks, compressedFrames]() {
+            enableFrameCapabilities(cborFrames, binaryChunks, compressedFrames);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    // 已排队的帧在客户端得知协商结果之前写出，仍用 JSON 编码
+    flushOutbox();
+    m_cborFrames.storeRelease(cborFrames ? 1 : 0);
+    m_binaryChunks.storeRelease(binaryChunks ? 1 : 0);
+    m_compressedFrames.storeRelease(compressedFrames ? 1 : 0);
+}
+
+void ClientSession::retain() {
+    m_references.ref();
+}
+
+void ClientSession::release() {
+    if (!m_references.deref())
+        deleteLater();
+}
+
 void ClientSession::disconnectFromServer() {
     if (QThread::currentThread() != this->thread()) {
         QMetaObject::invokeMethod(this, "disconnectFromServer", Qt::QueuedConnection);
         return;
     }
+    // 断开前写出仍在队列中的帧（如 FORCE_OFFLINE），socket 关闭时会尽量发完写缓冲
+    flushOutbox();
     if (m_transport == Tcp) {
         if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState)
             m_socket->disconnectFromHost();
@@ -100,48 +275,204 @@ void ClientSession::disconnectFromServer() {
 // ==================== 发送消息（自动选择传输层） ====================
 
 void ClientSession::sendMessage(const QJsonObject &msg) {
-    if (QThread::currentThread() != this->thread()) {
-        QMetaObject::invokeMethod(this, "sendMessage", Qt::QueuedConnection,
-                                  Q_ARG(QJsonObject, msg));
-        return;
+    // 帧不可变且线程安全，任意线程都可直接编码入队
+    sendFrame(makeOutboundFrame(msg));
+}
+
+void ClientSession::sendFrame(const OutboundFramePtr &frame) {
+    bool schedule = false;
+    {
+        QMutexLocker locker(&m_outboxMutex);
+        const QString &key = frame->mergeKey();
+        const auto merged = key.isEmpty() ? m_outboxMerge.cend() : m_outboxMerge.constFind(key);
+        if (merged != m_outboxMerge.cend()) {
+            // 旧状态尚未写出：置空旧帧，新帧排到队尾，保持状态最终一致；替换不增加积压
+            OutboundFramePtr &superseded = m_outbox[merged.value()];
+            m_outboxBytes -= superseded->sizeHint();
+            adjustPendingBytes(-superseded->sizeHint());
+            superseded.reset();
+            g_outboxMerged.fetchAndAddRelaxed(1);
+        } else if (shouldShed(frame->priority(), m_outbox.size())) {
+            return;
+        }
+        if (!key.isEmpty())
+            m_outboxMerge.insert(key, m_outbox.size());
+        m_outbox.append(frame);
+        // 锁内只累加构造时算好的估算值，编码留到 flushOutbox 在锁外按会话协议进行
+        m_outboxBytes += frame->sizeHint();
+        adjustPendingBytes(frame->sizeHint());
+        recordQueueDepth(static_cast<int>(m_outbox.size()));
+        if (!m_flushScheduled) {
+            m_flushScheduled = true;
+            schedule = true;
+        }
+    }
+    // 同一轮事件循环内入队的帧共享一次投递与一次写出
+    if (schedule)
+        QMetaObject::invokeMethod(this, &ClientSession::flushOutbox, Qt::QueuedConnection);
+}
+
+int ClientSession::outboundQueueDepth() const {
+    QMutexLocker locker(&m_outboxMutex);
+    return static_cast<int>(m_outbox.size());
+}
+
+bool ClientSession::shouldShed(OutboundFrame::Priority priority, qsizetype depth) const {
+    if (priority == OutboundFrame::Priority::Normal) return false;
+    // 进度在会话或全局积压较轻时就开始丢弃，上下线状态容忍更多积压
+    const bool progress = priority == OutboundFrame::Priority::Progress;
+    const qint64 sessionLimit = progress ? kShedProgressBytes : kShedPresenceBytes;
+    const qint64 globalLimit = progress ? outboundBudgetBytes() / 2 : outboundBudgetBytes() / 4 * 3;
+    if (depth < kMaxQueuedFrames && m_pendingBytes.loadRelaxed() < sessionLimit
+        && g_pendingBytes.loadRelaxed() < globalLimit) {
+        return false;
+    }
+    g_outboxDropped.fetchAndAddRelaxed(1);
+    recordShed(progress ? g_shedProgress : g_shedPresence);
+    return true;
+}
+
+void ClientSession::adjustPendingBytes(qint64 delta) {
+    if (delta == 0) return;
+    const qint64 session = m_pendingBytes.fetchAndAddRelaxed(delta) + delta;
+    const qint64 total = g_pendingBytes.fetchAndAddRelaxed(delta) + delta;
+    if (delta > 0) {
+        recordHighWater(g_sessionHighWater, session);
+        recordHighWater(g_pendingHighWater, total);
     }
+}
+
+void ClientSession::syncSocketBytes() {
+    const qint64 buffered = m_transport == Tcp
+        ? (m_socket ? m_socket->bytesToWrite() : 0)
+        : (m_webSocket ? m_webSocket->bytesToWrite() : 0);
+    adjustPendingBytes(buffered - m_socketBytes);
+    m_socketBytes = buffered;
+}
 
+void ClientSession::flushOutbox() {
+    QList<OutboundFramePtr> frames;
+    qint64 takenBytes = 0;
+    {
+        QMutexLocker locker(&m_outboxMutex);
+        frames.swap(m_outbox);
+        m_outboxMerge.clear();
+        m_flushScheduled = false;
+        takenBytes = m_outboxBytes;
+        m_outboxBytes = 0;
+    }
+    // 出队的估算字节换成 socket 写缓冲中的实际字节
+    adjustPendingBytes(-takenBytes);
+    if (frames.isEmpty())
+        return;
+
+    int written = 0;
     if (m_transport == Tcp) {
         if (!m_socket || m_socket->state() != QAbstractSocket::ConnectedState)
             return;
-        QByteArray packet = Protocol::pack(msg);
-        if (packet.size() - 4 > Protocol::MAX_JSON_MESSAGE_BYTES
-            || !ensureOutboundCapacity(packet.size()))
+        const bool cbor = usesCborFrames();
+        const bool compressed = usesCompressedFrames();
+        const auto packetFor = [cbor, compressed](const OutboundFrame &frame) -> const QByteArray & {
+            if (compressed) return frame.compressedTcpPacket(cbor);
+            return cbor ? frame.cborPacket() : frame.tcpPacket();
+        };
+        qint64 total = 0;
+        const QByteArray *single = nullptr;
+        for (const OutboundFramePtr &frame : std::as_const(frames)) {
+            if (!frame) continue;
+            const QByteArray &packet = packetFor(*frame);
+            if (packet.size() - 4 > Protocol::MAX_JSON_MESSAGE_BYTES) continue;
+            if (qFromBigEndian<quint32>(packet.constData()) & Protocol::COMPRESSED_FRAME_FLAG)
+                g_outboxCompressed.fetchAndAddRelaxed(1);
+            total += packet.size();
+            single = written == 0 ? &packet : nullptr;
+            ++written;
+        }
+        if (written == 0 || !ensureOutboundCapacity(total))
             return;
-        m_socket->write(packet);
+        if (single) {
+            m_socket->write(*single);
+        } else {
+            // 多帧拼成一块连续缓冲区，socket 写缓冲只多一个分段，一次系统调用写出
+            QByteArray batch;
+            batch.reserve(total);
+            for (const OutboundFramePtr &frame : std::as_const(frames)) {
+                if (!frame) continue;
+                const QByteArray &packet = packetFor(*frame);
+                if (packet.size() - 4 > Protocol::MAX_JSON_MESSAGE_BYTES) continue;
+                batch.append(packet);
+            }
+            m_socket->write(batch);
+        }
+        syncSocketBytes();
     } else {
-        if (!m_webSocket || !m_webSocket->isValid())
-            return;
-        QByteArray json = QJsonDocument(msg).toJson(QJsonDocument::Compact);
-        if (json.size() > Protocol::MAX_JSON_MESSAGE_BYTES
-            || !ensureOutboundCapacity(json.size()))
-            return;
-        m_webSocket->sendTextMessage(QString::fromUtf8(json));
+        // WebSocket 消息边界即帧边界，逐条发送，但仍只占用一次事件投递
+        const bool compressed = usesCompressedFrames();
+        for (const OutboundFramePtr &frame : std::as_const(frames)) {
+            if (!frame) continue;
+            if (!m_webSocket || !m_webSocket->isValid())
+                return;
+            const QByteArray &json = frame->json();
+            if (json.size() > Protocol::MAX_JSON_MESSAGE_BYTES)
+                return;
+            const QByteArray deflated = compressed ? frame->webSocketCompressed() : QByteArray();
+            if (!deflated.isEmpty()) {
+                // 压缩的历史/列表响应以二进制消息发送，其余消息仍是 JSON 文本
+                if (!ensureOutboundCapacity(deflated.size())) return;
+                m_webSocket->sendBinaryMessage(deflated);
+                g_outboxCompressed.fetchAndAddRelaxed(1);
+            } else {
+                if (!ensureOutboundCapacity(json.size())) return;
+                m_webSocket->sendTextMessage(frame->webSocketText());
+            }
+            ++written;
+        }
+        syncSocketBytes();
     }
+    recordFlush(written);
+}
+
+void ClientSession::sendBinary(const QJsonObject &header, const QByteArray &payload) {
+    if (QThread::currentThread() != this->thread()) {
+        QMetaObject::invokeMethod(this, [this, header, payload]() { sendBinary(header, payload); },
+                                  Qt::QueuedConnection);
+        return;
+    }
+
+    if (m_transport != Tcp || !m_socket || m_socket->state() != QAbstractSocket::ConnectedState)
+        return;
+    // 先写出已排队的帧，分块不越过之前发送的消息
+    flushOutbox();
+    const QByteArray head = Protocol::packBinaryHeader(header, payload.size());
+    if (head.size() + payload.size() - 4 > Protocol::MAX_JSON_MESSAGE_BYTES
+        || !ensureOutboundCapacity(head.size() + payload.size()))
+        return;
+    // 头部与分块分两次写入 socket 缓冲区，不在内存中拼接整帧
+    m_socket->write(head);
+    m_socket->write(payload);
+    syncSocketBytes();
 }
 
 // ==================== TCP 数据接收 ====================
 
 void ClientSession::onTcpReadyRead() {
-    m_buffer.append(m_socket->readAll());
-    if (m_buffer.size() > static_cast<int>(Protocol::MAX_JSON_MESSAGE_BYTES) + 4) {
+    m_frames.readFrom(m_socket);
+    if (m_frames.bufferedBytes() > static_cast<qsizetype>(Protocol::MAX_JSON_MESSAGE_BYTES) + 4) {
         rejectConnection(QStringLiteral("tcp-buffer-limit"));
         return;
     }
     processBuffer();
-    if (m_heartbeatTimer)
-        m_heartbeatTimer->start();
+    m_heartbeat.touch();
 }
 
 void ClientSession::processBuffer() {
     while (true) {
         QJsonObject msg;
-        const Protocol::FrameParseResult result = Protocol::inspectFrame(m_buffer, msg);
+        QByteArray payload;
+        Protocol::BinaryFields binary;
+        // 未协商 binaryChunks 时不接受二进制分块帧，按损坏帧计数
+        const Protocol::FrameParseResult result =
+            m_frames.next(msg, usesBinaryChunks() ? &payload : nullptr, &binary);
         if (result == Protocol::FrameParseResult::Incomplete) return;
         if (result == Protocol::FrameParseResult::Oversized) {
             rejectConnection(QStringLiteral("tcp-frame-oversized"));
@@ -160,15 +491,17 @@ void ClientSession::processBuffer() {
             continue;
         }
         if (!allowInboundRate(msg)) return;
-        emit messageReceived(this, msg);
+        if (result == Protocol::FrameParseResult::Binary)
+            emit binaryReceived(this, msg, payload);
+        else
+            emit messageReceived(this, msg, binary);
     }
 }
 
 // ==================== WebSocket 数据接收 ====================
 
 void ClientSession::onWsTextReceived(const QString &text) {
-    if (m_heartbeatTimer)
-        m_heartbeatTimer->start();
+    m_heartbeat.touch();
 
     const QByteArray json = text.toUtf8();
     if (json.size() > Protocol::MAX_JSON_MESSAGE_BYTES) {
@@ -186,7 +519,7 @@ void ClientSession::onWsTextReceived(const QString &text) {
     }
     const QJsonObject msg = doc.object();
     if (!hasValidEnvelope(msg) || !allowInboundRate(msg)) return;
-    emit messageReceived(this, msg);
+    emit messageReceived(this, msg, Protocol::BinaryFields());
 }
 
 bool ClientSession::hasValidEnvelope(const QJsonObject &msg) {
@@ -238,6 +571,13 @@ bool ClientSession::ensureOutboundCapacity(qint64 messageBytes) {
     const qint64 pending = m_transport == Tcp
         ? (m_socket ? m_socket->bytesToWrite() : 0)
         : (m_webSocket ? m_webSocket->bytesToWrite() : 0);
+    // 全局预算耗尽时，写缓冲仍积压的会话让出内存；正常消费的会话写缓冲很快清空，不受影响
+    if (pending > kBudgetSessionFloorBytes && g_pendingBytes.loadRelaxed() > outboundBudgetBytes()) {
+        g_budgetDisconnects.fetchAndAddRelaxed(1);
+        logBackpressure();
+        rejectConnection(QStringLiteral("outbound-budget"));
+        return false;
+    }
     if (messageBytes <= Protocol::MAX_PENDING_WRITE_BYTES - pending) return true;
 
     rejectConnection(QStringLiteral("slow-consumer"));
@@ -247,25 +587,33 @@ bool ClientSession::ensureOutboundCapacity(qint64 messageBytes) {
 void ClientSession::rejectConnection(const QString &category) {
     qWarning().noquote() << QStringLiteral("[Protocol] disconnect category=%1 userId=%2 transport=%3")
                                 .arg(category)
-                                .arg(m_userId)
+                                .arg(userId())
                                 .arg(m_transport == Tcp ? QStringLiteral("tcp")
                                                        : QStringLiteral("websocket"));
-    m_buffer.clear();
+    m_frames.clear();
+    {
+        // 被拒绝的连接不再写出排队的帧
+        QMutexLocker locker(&m_outboxMutex);
+        m_outbox.clear();
+        m_outboxMerge.clear();
+        adjustPendingBytes(-m_outboxBytes);
+        m_outboxBytes = 0;
+    }
     disconnectFromServer();
 }
 
 // ==================== 公共事件 ====================
 
 void ClientSession::onDisconnected() {
-    qDebug() << "[Session] 断开:" << m_username
+    qDebug() << "[Session] 断开:" << username()
              << (m_transport == Tcp ? "(TCP)" : "(WS)");
-    if (m_heartbeatTimer)
-        m_heartbeatTimer->stop();
+    m_heartbeat.stop();
+    m_closed.storeRelease(1);
     emit disconnected(this);
 }
 
 void ClientSession::onHeartbeatTimeout() {
-    qWarning() << "[Session] 心跳超时:" << m_username;
+    qWarning() << "[Session] 心跳超时:" << username();
     if (m_transport == Tcp) {
         if (m_socket) m_socket->disconnectFromHost();
     } else {
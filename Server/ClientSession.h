@@ -3,8 +3,15 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QJsonObject>
-#include <QTimer>
 #include <QElapsedTimer>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+
+#include "OutboundFrame.h"
+#include "Protocol.h"
+#include "TimingWheel.h"
 
 class QWebSocket;
 
@@ -21,18 +28,49 @@ public:
     explicit ClientSession(QWebSocket *ws, QObject *parent = nullptr);
     ~ClientSession() override;
 
+    // 身份信息会被多个请求工作线程读取，访问器内部加锁
     Transport transport() const { return m_transport; }
-    int     userId() const   { return m_userId; }
-    QString username() const { return m_username; }
-    QString displayName() const { return m_displayName; }
-    QString peerAddress() const { return m_peerAddress; }
-    bool    isAuthenticated() const { return m_authenticated; }
+    int     userId() const;
+    QString username() const;
+    QString displayName() const;
+    QString peerAddress() const;
+    bool    isAuthenticated() const;
 
     void setAuthenticated(int userId, const QString &username, const QString &displayName);
-    void setDisplayName(const QString &dn) { m_displayName = dn; }
-    void setUsername(const QString &u) { m_username = u; }
-    void setKicked(bool v) { m_kicked = v; }
-    bool isKicked() const  { return m_kicked; }
+    void setDisplayName(const QString &dn);
+    void setUsername(const QString &u);
+    void setKicked(bool v);
+    bool isKicked() const;
+    /// 登录时声明 blobRefs 的客户端只接收缩略图/头像的哈希引用，字节经 HTTP 按需获取
+    void setBlobReferences(bool v);
+    bool usesBlobReferences() const;
+    /// 登录成功后启用协商的帧能力：在会话线程先按原编码写出已排队的帧（含 LOGIN_RSP），再切换。
+    /// 客户端在收到 LOGIN_RSP 之前只会看到 JSON 帧；可在任意线程调用
+    void enableFrameCapabilities(bool cborFrames, bool binaryChunks, bool compressedFrames);
+    /// 声明 cborFrames 的 TCP 客户端此后接收 CBOR 帧；WebSocket 始终使用 JSON 文本
+    bool usesCborFrames() const { return m_cborFrames.loadAcquire() != 0; }
+    /// 声明 binaryChunks 的 TCP 客户端以二进制分块帧收发文件分块，不经 base64
+    bool usesBinaryChunks() const { return m_binaryChunks.loadAcquire() != 0; }
+    /// 声明 compressedFrames 的客户端接收压缩的历史/列表响应（TCP 压缩帧或 WebSocket 二进制消息）
+    bool usesCompressedFrames() const { return m_compressedFrames.loadAcquire() != 0; }
+    /// 连接已断开（disconnected 信号发出前置位），异步回调据此放弃后续处理
+    bool isClosed() const { return m_closed.loadAcquire() != 0; }
+
+    /// 请求引用计数：连接本身持有一份，每个投递到工作线程的请求各持有一份。
+    /// 计数归零时 deleteLater()，保证排队中的请求不会访问已释放的会话。
+    void retain();
+    void release();
+
+    /// 发送预编码帧：可在任意线程调用，帧进入会话出站队列，帧本身在接收者间共享。
+    /// 队列每轮事件循环在会话线程合并写出一次；上下线与进度通知按 mergeKey 只保留最新一条。
+    /// 会话积压时按优先级丢弃：先丢进度，再丢上下线状态，聊天与响应只受断开上限约束。
+    void sendFrame(const OutboundFramePtr &frame);
+    /// 出站队列中尚未写出的帧数
+    int outboundQueueDepth() const;
+    /// 待发字节：出站队列估算值加 socket 写缓冲
+    qint64 pendingOutboundBytes() const { return m_pendingBytes.loadRelaxed(); }
+    /// 发送二进制分块帧（仅 TCP）；跨线程调用时排队到会话线程，分块字节隐式共享不复制
+    void sendBinary(const QJsonObject &header, const QByteArray &payload);
 
 public slots:
     void init();              // 仅 TCP 需要；WebSocket 在构造时已就绪
@@ -42,7 +80,10 @@ public slots:
 signals:
     void authenticated(ClientSession *session);
     void disconnected(ClientSession *session);
-    void messageReceived(ClientSession *session, const QJsonObject &msg);
+    /// binary 为 CBOR 帧 data 中以字节串携带的二进制字段（不再出现在 msg 中）；JSON 帧为空
+    void messageReceived(ClientSession *session, const QJsonObject &msg,
+                         const Protocol::BinaryFields &binary);
+    void binaryReceived(ClientSession *session, const QJsonObject &header, const QByteArray &payload);
 
 private slots:
     void onTcpReadyRead();          // TCP
@@ -57,23 +98,42 @@ private:
     bool allowInboundRate(const QJsonObject &msg);
     void rejectConnection(const QString &category);
     bool ensureOutboundCapacity(qint64 messageBytes);
+    void flushOutbox();             // 会话线程：把出站队列一次写出
+    bool shouldShed(OutboundFrame::Priority priority, qsizetype depth) const;
+    void adjustPendingBytes(qint64 delta);
+    void syncSocketBytes();         // 会话线程：按 socket 写缓冲更新待发字节
 
     Transport    m_transport        = Tcp;
     qintptr      m_socketDescriptor = -1;
     QTcpSocket  *m_socket           = nullptr;
     QWebSocket  *m_webSocket        = nullptr;
-    QTimer      *m_heartbeatTimer   = nullptr;
-    QByteArray   m_buffer;
+    IdleWatch    m_heartbeat;          // 所在 I/O 线程的时间轮上计时，收到数据只刷新时间戳
+    Protocol::FrameReader m_frames;
     QElapsedTimer m_rateWindow;
     int          m_messagesInWindow = 0;
     int          m_malformedMessages = 0;
     QElapsedTimer m_authRateWindow;
     int          m_authAttemptsInWindow = 0;
 
+    mutable QMutex m_outboxMutex;
+    QList<OutboundFramePtr> m_outbox;          // 被合并的帧置空，写出时跳过
+    QHash<QString, qsizetype> m_outboxMerge;   // mergeKey -> 队列下标
+    bool         m_flushScheduled   = false;
+    qint64       m_outboxBytes      = 0;       // 受 m_outboxMutex 保护
+    qint64       m_socketBytes      = 0;       // 仅会话线程访问
+    QAtomicInteger<qint64> m_pendingBytes{0};
+
+    mutable QMutex m_identityMutex;
+    QAtomicInt   m_references{1};
+    QAtomicInt   m_closed{0};
+    QAtomicInt   m_cborFrames{0};
+    QAtomicInt   m_binaryChunks{0};
+    QAtomicInt   m_compressedFrames{0};
     int          m_userId           = 0;
     QString      m_username;
     QString      m_displayName;
     QString      m_peerAddress;
     bool         m_authenticated    = false;
     bool         m_kicked           = false;
+    bool         m_blobReferences   = false;
 };
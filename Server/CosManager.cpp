@@ -14,6 +14,10 @@
 #include <QCryptographicHash>
 #include <QXmlStreamReader>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QSet>
 #include <algorithm>
 
 // ---------- .env 读取辅助 ----------
@@ -51,6 +55,13 @@ static QString readEnvValue(const QString &key) {
     return {};
 }
 
+static int readEnvInt(const QString &key, int fallback, int minimum, int maximum) {
+    bool ok = false;
+    const int value = readEnvValue(key).toInt(&ok);
+    if (!ok || value < minimum || value > maximum) return fallback;
+    return value;
+}
+
 // ---------- CosManager ----------
 
 CosManager::CosManager(QObject *parent)
@@ -78,6 +89,15 @@ bool CosManager::loadConfig() {
     m_enabled = !m_secretId.isEmpty() && !m_secretKey.isEmpty()
                 && !m_bucket.isEmpty() && !m_region.isEmpty();
 
+    // QNetworkAccessManager 对同一主机最多开 6 个 HTTP/1.1 连接，更大的窗口只会在其内部排队
+    const MultipartLimits defaults;
+    m_multipart.partsInFlight = readEnvInt(QStringLiteral("COS_PARTS_IN_FLIGHT"),
+                                           defaults.partsInFlight, 1, 6);
+    m_multipart.maxAttempts = readEnvInt(QStringLiteral("COS_PART_MAX_ATTEMPTS"),
+                                         defaults.maxAttempts, 1, 10);
+    m_multipart.retryBaseMs = readEnvInt(QStringLiteral("COS_PART_RETRY_BASE_MS"),
+                                         defaults.retryBaseMs, 0, 60000);
+
     if (m_enabled) {
         // 自动推导默认 Endpoint
         if (m_internalEndpoint.isEmpty())
@@ -85,7 +105,8 @@ bool CosManager::loadConfig() {
         if (m_externalEndpoint.isEmpty())
             m_externalEndpoint = QStringLiteral("cos.%1.myqcloud.com").arg(m_region);
 
-        qInfo() << "[COS] 已启用 — Bucket:" << m_bucket << " Region:" << m_region;
+        qInfo() << "[COS] 已启用 — Bucket:" << m_bucket << " Region:" << m_region
+                << " 分片并发:" << m_multipart.partsInFlight;
     } else {
         qInfo() << "[COS] 未配置或配置不完整，使用本地文件存储";
     }
@@ -251,8 +272,9 @@ QByteArray CosManager::sign(const QByteArray &method,
 
 void CosManager::uploadFile(const QString &localPath,
                              const QString &objectKey,
-                             std::function<void(qint64, qint64)> onProgress,
-                             std::function<void(bool, const QString &)> onFinished)
+                             ProgressFn onProgress,
+                             FinishedFn onFinished,
+                             const QJsonObject &context)
 {
     QFileInfo fi(localPath);
     if (!fi.exists()) {
@@ -264,7 +286,7 @@ void CosManager::uploadFile(const QString &localPath,
     if (fileSize <= MULTIPART_THRESHOLD) {
         putObject(objectKey, localPath, onProgress, onFinished);
     } else {
-        initiateMultipartUpload(objectKey, localPath, onProgress, onFinished);
+        initiateMultipartUpload(objectKey, localPath, onProgress, onFinished, context);
     }
 }
 
@@ -272,8 +294,8 @@ void CosManager::uploadFile(const QString &localPath,
 
 void CosManager::putObject(const QString &objectKey,
                             const QString &localPath,
-                            std::function<void(qint64, qint64)> onProgress,
-                            std::function<void(bool, const QString &)> onFinished)
+                            ProgressFn onProgress,
+                            FinishedFn onFinished)
 {
     QFile *file = new QFile(localPath, this);
     if (!file->open(QIODevice::ReadOnly)) {
@@ -327,10 +349,46 @@ void CosManager::putObject(const QString &objectKey,
 
 // ==================== 分片上传 ====================
 
+/// 一次分片上传的共享状态，由各分片回复的回调共同持有
+struct CosManager::MultipartUpload {
+    QString objectKey;
+    QString uploadId;
+    QString localPath;
+    qint64 fileSize = 0;
+    int totalParts = 0;
+    QList<int> pendingParts;          // 尚未开始的分片号（升序）
+    QMap<int, QString> eTags;         // 已完成分片 → ETag
+    QHash<int, qint64> partSent;      // 上传中分片已发送的字节
+    QSet<QNetworkReply *> replies;
+    int inFlight = 0;                 // 上传中或等待重试的分片数
+    qint64 completedBytes = 0;
+    int retries = 0;
+    bool done = false;                // 已进入 Complete 或已失败
+    QJsonObject context;
+    ProgressFn onProgress;
+    FinishedFn onFinished;
+    QElapsedTimer elapsed;
+
+    // 所有分片共用一个只读句柄；映射成功时分片直接引用映射内存，不再逐片读入副本。
+    // 映射随最后一个持有者释放，此时各分片回复都已结束
+    QFile file;
+    uchar *mapped = nullptr;
+
+    ~MultipartUpload() {
+        if (mapped) file.unmap(mapped);
+    }
+
+    qint64 partLength(int partNumber) const {
+        const qint64 offset = static_cast<qint64>(partNumber - 1) * PART_SIZE;
+        return qMin(PART_SIZE, fileSize - offset);
+    }
+};
+
 void CosManager::initiateMultipartUpload(const QString &objectKey,
                                            const QString &localPath,
-                                           std::function<void(qint64, qint64)> onProgress,
-                                           std::function<void(bool, const QString &)> onFinished)
+                                           ProgressFn onProgress,
+                                           FinishedFn onFinished,
+                                           const QJsonObject &context)
 {
     const QString path = "/" + objectKey;
     const QString host = internalHost();
@@ -357,7 +415,7 @@ void CosManager::initiateMultipartUpload(const QString &objectKey,
     QNetworkReply *reply = m_nam->post(req, QByteArray());
 
     connect(reply, &QNetworkReply::finished, this,
-            [this, reply, objectKey, localPath, onProgress, onFinished]() {
+            [this, reply, objectKey, localPath, onProgress, onFinished, context]() {
                 reply->deleteLater();
                 if (reply->error() != QNetworkReply::NoError) {
                     const QString err = QStringLiteral("COS InitMultipart 失败: %1")
@@ -385,145 +443,197 @@ void CosManager::initiateMultipartUpload(const QString &objectKey,
 
                 qInfo() << "[COS] Multipart initiated, uploadId:" << uploadId;
 
-                QFileInfo fi(localPath);
-                uploadParts(objectKey, uploadId, localPath, fi.size(), onProgress, onFinished);
+                auto upload = std::make_shared<MultipartUpload>();
+                upload->objectKey = objectKey;
+                upload->uploadId = uploadId;
+                upload->localPath = localPath;
+                upload->fileSize = QFileInfo(localPath).size();
+                upload->context = context;
+                upload->onProgress = onProgress;
+                upload->onFinished = onFinished;
+                uploadParts(upload);
             });
 }
 
-void CosManager::uploadParts(const QString &objectKey,
-                              const QString &uploadId,
-                              const QString &localPath,
-                              qint64 fileSize,
-                              std::function<void(qint64, qint64)> onProgress,
-                              std::function<void(bool, const QString &)> onFinished)
+void CosManager::uploadParts(const UploadPtr &upload)
+{
+    upload->totalParts = static_cast<int>((upload->fileSize + PART_SIZE - 1) / PART_SIZE);
+    upload->file.setFileName(upload->localPath);
+    if (!upload->file.open(QIODevice::ReadOnly) || upload->file.size() != upload->fileSize) {
+        failMultipart(upload, QStringLiteral("无法读取文件分片"));
+        return;
+    }
+    upload->mapped = upload->file.map(0, upload->fileSize);
+
+    // 续传时跳过断点状态里已完成的分片
+    upload->completedBytes = 0;
+    for (int part = 1; part <= upload->totalParts; ++part) {
+        if (upload->eTags.contains(part))
+            upload->completedBytes += upload->partLength(part);
+        else
+            upload->pendingParts.append(part);
+    }
+    upload->elapsed.start();
+    saveState(*upload);
+    fillPartWindow(upload);
+}
+
+void CosManager::fillPartWindow(const UploadPtr &upload)
 {
-    // 使用共享状态对象跟踪进度
-    struct UploadCtx {
-        QString objectKey;
-        QString uploadId;
-        QString localPath;
-        qint64 fileSize;
-        int totalParts;
-        int currentPart;       // 下一个要上传的分片号 (1-based)
-        qint64 uploadedBytes;  // 已完成分片的总字节
+    if (upload->done) return;
+
+    if (upload->pendingParts.isEmpty() && upload->inFlight == 0) {
+        // 所有分片完成，调用 Complete
+        upload->done = true;
         QList<QPair<int, QString>> eTags;
-        bool aborted = false;
-        std::function<void(qint64, qint64)> onProgress;
-        std::function<void(bool, const QString &)> onFinished;
-    };
+        for (auto it = upload->eTags.cbegin(); it != upload->eTags.cend(); ++it)
+            eTags.append(qMakePair(it.key(), it.value()));
+        const QString objectKey = upload->objectKey;
+        const QString summary = QStringLiteral("parts=%1 bytes=%2 retries=%3")
+                                    .arg(upload->totalParts)
+                                    .arg(upload->fileSize)
+                                    .arg(upload->retries);
+        const qint64 partsMs = upload->elapsed.elapsed();
+        completeMultipartUpload(objectKey, upload->uploadId, eTags,
+            [this, objectKey, summary, partsMs, onFinished = upload->onFinished](
+                bool ok, const QString &urlOrError) {
+                removeState(objectKey);
+                if (ok) {
+                    qInfo().noquote() << QStringLiteral("[COS] 分片上传耗时 %1ms %2")
+                                             .arg(partsMs).arg(summary);
+                }
+                if (onFinished) onFinished(ok, urlOrError);
+            });
+        return;
+    }
 
-    auto *ctx = new UploadCtx;
-    ctx->objectKey = objectKey;
-    ctx->uploadId = uploadId;
-    ctx->localPath = localPath;
-    ctx->fileSize = fileSize;
-    ctx->totalParts = static_cast<int>((fileSize + PART_SIZE - 1) / PART_SIZE);
-    ctx->currentPart = 1;
-    ctx->uploadedBytes = 0;
-    ctx->onProgress = onProgress;
-    ctx->onFinished = onFinished;
-
-    // 递归 lambda 上传每一片
-    auto uploadNext = std::make_shared<std::function<void()>>();
-    *uploadNext = [this, ctx, uploadNext]() {
-        if (ctx->aborted) {
-            delete ctx;
-            return;
-        }
+    while (upload->inFlight < m_multipart.partsInFlight && !upload->pendingParts.isEmpty()) {
+        ++upload->inFlight;
+        uploadPart(upload, upload->pendingParts.takeFirst(), 1);
+    }
+}
 
-        if (ctx->currentPart > ctx->totalParts) {
-            // 所有分片完成，调用 Complete
-            completeMultipartUpload(ctx->objectKey, ctx->uploadId, ctx->eTags, ctx->onFinished);
-            delete ctx;
-            return;
-        }
+QByteArray CosManager::readPart(MultipartUpload &upload, int partNumber) const
+{
+    const qint64 offset = static_cast<qint64>(partNumber - 1) * PART_SIZE;
+    const qint64 length = upload.partLength(partNumber);
+    if (upload.mapped)
+        return QByteArray::fromRawData(reinterpret_cast<const char *>(upload.mapped + offset), length);
+
+    // 无法映射时（如 32 位进程上的大文件）退回共享句柄上的定位读取
+    if (!upload.file.seek(offset)) return {};
+    const QByteArray data = upload.file.read(length);
+    return data.size() == length ? data : QByteArray();
+}
 
-        const int partNumber = ctx->currentPart;
-        const qint64 offset = static_cast<qint64>(partNumber - 1) * PART_SIZE;
-        const qint64 partLen = qMin(PART_SIZE, ctx->fileSize - offset);
-
-        QFile *file = new QFile(ctx->localPath);
-        if (!file->open(QIODevice::ReadOnly)) {
-            delete file;
-            abortMultipartUpload(ctx->objectKey, ctx->uploadId);
-            if (ctx->onFinished) ctx->onFinished(false, QStringLiteral("无法读取文件分片"));
-            ctx->aborted = true;
-            delete ctx;
-            return;
-        }
-        file->seek(offset);
-        QByteArray partData = file->read(partLen);
-        file->close();
-        delete file;
+void CosManager::uploadPart(const UploadPtr &upload, int partNumber, int attempt)
+{
+    if (upload->done) return;
 
-        const QString path = "/" + ctx->objectKey;
-        const QString host = internalHost();
-
-        QMap<QString, QString> signHeaders;
-        signHeaders["host"] = host;
-        QMap<QString, QString> signParams;
-        signParams["partNumber"] = QString::number(partNumber);
-        signParams["uploadId"] = ctx->uploadId;
-
-        const QByteArray auth = sign("PUT", path, signHeaders, signParams);
-
-        QUrl url;
-        url.setScheme(QStringLiteral("http"));
-        url.setHost(host);
-        url.setPath(path);
-        QUrlQuery q;
-        q.addQueryItem(QStringLiteral("partNumber"), QString::number(partNumber));
-        q.addQueryItem(QStringLiteral("uploadId"), ctx->uploadId);
-        url.setQuery(q);
-
-        QNetworkRequest req(url);
-        req.setRawHeader("Host", host.toUtf8());
-        req.setRawHeader("Authorization", auth);
-        req.setRawHeader("Content-Length", QByteArray::number(partData.size()));
-
-        QNetworkReply *reply = m_nam->put(req, partData);
-
-        // 分片级别进度
-        const qint64 prevUploaded = ctx->uploadedBytes;
-        if (ctx->onProgress) {
-            connect(reply, &QNetworkReply::uploadProgress, this,
-                    [ctx, prevUploaded](qint64 sent, qint64 /*total*/) {
-                        ctx->onProgress(prevUploaded + sent, ctx->fileSize);
-                    });
-        }
+    const QByteArray partData = readPart(*upload, partNumber);
+    if (partData.isEmpty()) {
+        failMultipart(upload, QStringLiteral("无法读取文件分片 %1").arg(partNumber));
+        return;
+    }
+
+    const QString path = "/" + upload->objectKey;
+    const QString host = internalHost();
+
+    QMap<QString, QString> signHeaders;
+    signHeaders["host"] = host;
+    QMap<QString, QString> signParams;
+    signParams["partNumber"] = QString::number(partNumber);
+    signParams["uploadId"] = upload->uploadId;
+
+    const QByteArray auth = sign("PUT", path, signHeaders, signParams);
+
+    QUrl url;
+    url.setScheme(QStringLiteral("http"));
+    url.setHost(host);
+    url.setPath(path);
+    QUrlQuery q;
+    q.addQueryItem(QStringLiteral("partNumber"), QString::number(partNumber));
+    q.addQueryItem(QStringLiteral("uploadId"), upload->uploadId);
+    url.setQuery(q);
+
+    QNetworkRequest req(url);
+    req.setRawHeader("Host", host.toUtf8());
+    req.setRawHeader("Authorization", auth);
+    req.setRawHeader("Content-Length", QByteArray::number(partData.size()));
+
+    QNetworkReply *reply = m_nam->put(req, partData);
+    upload->replies.insert(reply);
+
+    // 整体进度 = 已完成分片 + 各上传中分片已发送的字节
+    if (upload->onProgress) {
+        connect(reply, &QNetworkReply::uploadProgress, this,
+                [upload, partNumber](qint64 sent, qint64 /*total*/) {
+                    if (upload->done) return;
+                    upload->partSent[partNumber] = sent;
+                    qint64 uploaded = upload->completedBytes;
+                    for (const qint64 partBytes : std::as_const(upload->partSent))
+                        uploaded += partBytes;
+                    upload->onProgress(uploaded, upload->fileSize);
+                });
+    }
+
+    connect(reply, &QNetworkReply::finished, this,
+            [this, reply, upload, partNumber, attempt]() {
+                reply->deleteLater();
+                upload->replies.remove(reply);
+                upload->partSent.remove(partNumber);
+                if (upload->done) return;
+
+                if (reply->error() != QNetworkReply::NoError) {
+                    const int status =
+                        reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+                    const QString err = QStringLiteral("COS UploadPart %1 失败（第 %2 次）: %3 %4")
+                        .arg(partNumber).arg(attempt).arg(status)
+                        .arg(QString::fromUtf8(reply->readAll().left(500)));
+                    qWarning() << "[COS]" << err;
 
-        connect(reply, &QNetworkReply::finished, this,
-                [this, reply, ctx, partNumber, partLen, uploadNext]() {
-                    reply->deleteLater();
-                    if (reply->error() != QNetworkReply::NoError) {
-                        const QString err = QStringLiteral("COS UploadPart %1 失败: %2")
-                            .arg(partNumber).arg(QString::fromUtf8(reply->readAll().left(500)));
-                        qWarning() << "[COS]" << err;
-                        abortMultipartUpload(ctx->objectKey, ctx->uploadId);
-                        if (ctx->onFinished) ctx->onFinished(false, err);
-                        ctx->aborted = true;
-                        delete ctx;
+                    // 网络错误、5xx、408、429 按指数退避重试该分片，其余 4xx 重试也不会成功
+                    const bool retryable = status == 0 || status >= 500
+                                           || status == 408 || status == 429;
+                    if (!retryable || attempt >= m_multipart.maxAttempts) {
+                        failMultipart(upload, err);
                         return;
                     }
+                    ++upload->retries;
+                    QTimer::singleShot(m_multipart.retryBaseMs << (attempt - 1), this,
+                                       [this, upload, partNumber, attempt]() {
+                                           uploadPart(upload, partNumber, attempt + 1);
+                                       });
+                    return;
+                }
 
-                    const QString etag = QString::fromUtf8(reply->rawHeader("ETag"));
-                    ctx->eTags.append(qMakePair(partNumber, etag));
-                    ctx->uploadedBytes += partLen;
-                    ctx->currentPart++;
+                upload->eTags.insert(partNumber, QString::fromUtf8(reply->rawHeader("ETag")));
+                upload->completedBytes += upload->partLength(partNumber);
+                --upload->inFlight;
+                saveState(*upload);
+                fillPartWindow(upload);
+            });
+}
 
-                    // 上传下一片（使用 QTimer::singleShot 避免递归栈溢出）
-                    QTimer::singleShot(0, this, [uploadNext]() { (*uploadNext)(); });
-                });
-    };
+void CosManager::failMultipart(const UploadPtr &upload, const QString &error)
+{
+    if (upload->done) return;
+    upload->done = true;
 
-    // 开始第一片
-    (*uploadNext)();
+    // 其余分片的回复随即以 OperationCanceledError 结束，回调看到 done 后直接返回
+    const QList<QNetworkReply *> replies(upload->replies.cbegin(), upload->replies.cend());
+    for (QNetworkReply *reply : replies)
+        reply->abort();
+
+    abortMultipartUpload(upload->objectKey, upload->uploadId);
+    removeState(upload->objectKey);
+    if (upload->onFinished) upload->onFinished(false, error);
 }
 
 void CosManager::completeMultipartUpload(const QString &objectKey,
                                           const QString &uploadId,
                                           const QList<QPair<int, QString>> &partETags,
-                                          std::function<void(bool, const QString &)> onFinished)
+                                          FinishedFn onFinished)
 {
     // 按 partNumber 排序后组装 XML
     auto sorted = partETags;
@@ -565,12 +675,14 @@ void CosManager::completeMultipartUpload(const QString &objectKey,
     QNetworkReply *reply = m_nam->post(req, body);
 
     connect(reply, &QNetworkReply::finished, this,
-            [this, reply, objectKey, onFinished]() {
+            [this, reply, objectKey, uploadId, onFinished]() {
                 reply->deleteLater();
                 if (reply->error() != QNetworkReply::NoError) {
                     const QString err = QStringLiteral("COS CompleteMultipart 失败: %1")
                         .arg(QString::fromUtf8(reply->readAll().left(500)));
                     qWarning() << "[COS]" << err;
+                    // 断点状态随即删除，不中止的话已上传的分片会一直占用存储
+                    abortMultipartUpload(objectKey, uploadId);
                     if (onFinished) onFinished(false, err);
                     return;
                 }
@@ -607,3 +719,108 @@ void CosManager::abortMultipartUpload(const QString &objectKey, const QString &u
 
     qInfo() << "[COS] Aborted multipart upload:" << objectKey << uploadId;
 }
+
+// ==================== 断点续传 ====================
+
+void CosManager::setStateDir(const QString &dir) {
+    m_stateDir = dir;
+    if (!m_stateDir.isEmpty() && !QDir().mkpath(m_stateDir))
+        qWarning() << "[COS] 无法创建分片上传状态目录:" << m_stateDir;
+}
+
+QString CosManager::statePath(const QString &objectKey) const {
+    const QByteArray digest =
+        QCryptographicHash::hash(objectKey.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir(m_stateDir).filePath(QString::fromLatin1(digest) + QStringLiteral(".json"));
+}
+
+void CosManager::saveState(const MultipartUpload &upload) const {
+    if (m_stateDir.isEmpty()) return;
+
+    QJsonObject parts;
+    for (auto it = upload.eTags.cbegin(); it != upload.eTags.cend(); ++it)
+        parts.insert(QString::number(it.key()), it.value());
+
+    QJsonObject state;
+    state["objectKey"] = upload.objectKey;
+    state["uploadId"]  = upload.uploadId;
+    state["localPath"] = upload.localPath;
+    state["fileSize"]  = upload.fileSize;
+    state["partSize"]  = PART_SIZE;
+    state["parts"]     = parts;
+    state["context"]   = upload.context;
+
+    // 先写临时文件再替换，进程在写入中途退出时保留上一次的完整状态
+    QSaveFile file(statePath(upload.objectKey));
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(QJsonDocument(state).toJson(QJsonDocument::Compact)) < 0
+        || !file.commit()) {
+        qWarning() << "[COS] 写入分片上传状态失败:" << upload.objectKey;
+    }
+}
+
+void CosManager::removeState(const QString &objectKey) const {
+    if (m_stateDir.isEmpty()) return;
+    QFile::remove(statePath(objectKey));
+}
+
+int CosManager::resumePendingUploads(
+    const std::function<FinishedFn(const QJsonObject &context)> &makeFinished,
+    const std::function<bool(const QJsonObject &context)> &stillNeeded)
+{
+    if (!m_enabled || m_stateDir.isEmpty()) return 0;
+
+    int resumed = 0;
+    const QFileInfoList entries = QDir(m_stateDir).entryInfoList(
+        {QStringLiteral("*.json")}, QDir::Files, QDir::Name);
+    for (const QFileInfo &entry : entries) {
+        QJsonObject state;
+        QFile file(entry.filePath());
+        if (file.open(QIODevice::ReadOnly))
+            state = QJsonDocument::fromJson(file.readAll()).object();
+        file.close();
+
+        auto upload = std::make_shared<MultipartUpload>();
+        upload->objectKey = state.value(QStringLiteral("objectKey")).toString();
+        upload->uploadId  = state.value(QStringLiteral("uploadId")).toString();
+        upload->localPath = state.value(QStringLiteral("localPath")).toString();
+        upload->fileSize  = state.value(QStringLiteral("fileSize")).toInteger();
+        upload->context   = state.value(QStringLiteral("context")).toObject();
+        if (upload->objectKey.isEmpty() || upload->uploadId.isEmpty()) {
+            qWarning() << "[COS] 丢弃无法解析的分片上传状态:" << entry.fileName();
+            QFile::remove(entry.filePath());
+            continue;
+        }
+
+        // 停机期间记录已不需要上传：中止服务端的分片上传，不再调用完成回调
+        if (stillNeeded && !stillNeeded(upload->context)) {
+            qInfo() << "[COS] 记录已不存在，放弃续传:" << upload->objectKey;
+            abortMultipartUpload(upload->objectKey, upload->uploadId);
+            QFile::remove(entry.filePath());
+            continue;
+        }
+
+        const int totalParts = static_cast<int>((upload->fileSize + PART_SIZE - 1) / PART_SIZE);
+        const QJsonObject parts = state.value(QStringLiteral("parts")).toObject();
+        for (auto it = parts.constBegin(); it != parts.constEnd(); ++it) {
+            bool ok = false;
+            const int partNumber = it.key().toInt(&ok);
+            if (ok && partNumber >= 1 && partNumber <= totalParts)
+                upload->eTags.insert(partNumber, it.value().toString());
+        }
+        upload->onFinished = makeFinished ? makeFinished(upload->context) : FinishedFn();
+
+        // 分片大小变化或本地文件已不是当初的文件时，已上传的分片无法复用
+        if (state.value(QStringLiteral("partSize")).toInteger() != PART_SIZE
+            || QFileInfo(upload->localPath).size() != upload->fileSize) {
+            failMultipart(upload, QStringLiteral("本地文件已变化，放弃续传: %1").arg(upload->localPath));
+            continue;
+        }
+
+        qInfo() << "[COS] 继续分片上传:" << upload->objectKey
+                << "已完成分片" << upload->eTags.size() << "/" << totalParts;
+        uploadParts(upload);
+        ++resumed;
+    }
+    return resumed;
+}
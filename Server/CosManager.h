@@ -3,7 +3,9 @@
 #include <QObject>
 #include <QString>
 #include <QByteArray>
+#include <QJsonObject>
 #include <functional>
+#include <memory>
 
 class QNetworkAccessManager;
 class QNetworkReply;
@@ -12,10 +14,20 @@ class QTimer;
 
 /// 腾讯云 COS 对象存储管理器
 /// 使用内网 Endpoint 上传，外网 Endpoint 生成访问 URL
-/// 支持分片上传（Multipart Upload），不阻塞主线程
+/// 支持分片上传（Multipart Upload），不阻塞主线程：同一文件的多个分片并发上传，
+/// 分片失败按指数退避重试，已完成分片的 ETag 落盘，重启后可继续未完成的上传
 class CosManager : public QObject {
     Q_OBJECT
 public:
+    using ProgressFn = std::function<void(qint64 sent, qint64 total)>;
+    using FinishedFn = std::function<void(bool ok, const QString &urlOrError)>;
+
+    struct MultipartLimits {
+        int partsInFlight = 4;    // 同一文件同时上传的分片数（COS_PARTS_IN_FLIGHT）
+        int maxAttempts = 4;      // 每个分片最多尝试次数，含首次（COS_PART_MAX_ATTEMPTS）
+        int retryBaseMs = 500;    // 第 n 次重试前等待 retryBaseMs * 2^(n-1)
+    };
+
     explicit CosManager(QObject *parent = nullptr);
     ~CosManager() override;
 
@@ -30,10 +42,22 @@ public:
     /// @param objectKey  COS 上的对象键名 (e.g. "room/1/Image/2026-04/xxx.jpg")
     /// @param onProgress 进度回调 (已上传字节, 总字节)
     /// @param onFinished 完成回调 (成功, 外网URL或错误信息)
+    /// @param context    随分片上传断点状态保存的调用方数据，重启后交给 resumePendingUploads
     void uploadFile(const QString &localPath,
                     const QString &objectKey,
-                    std::function<void(qint64 sent, qint64 total)> onProgress,
-                    std::function<void(bool ok, const QString &urlOrError)> onFinished);
+                    ProgressFn onProgress,
+                    FinishedFn onFinished,
+                    const QJsonObject &context = QJsonObject());
+
+    /// 分片上传断点状态目录：每个进行中的分片上传对应一个 JSON 文件
+    void setStateDir(const QString &dir);
+    /// 启动时调用：继续上次运行未完成的分片上传，返回继续的数量。
+    /// makeFinished 按 uploadFile 传入的 context 重建完成回调；本地文件已不存在的上传直接中止。
+    /// stillNeeded 返回 false 的上传（如对应记录已撤回、清理或过期）不再继续，直接中止
+    int resumePendingUploads(const std::function<FinishedFn(const QJsonObject &context)> &makeFinished,
+                             const std::function<bool(const QJsonObject &context)> &stillNeeded = {});
+
+    const MultipartLimits &multipartLimits() const { return m_multipart; }
 
     /// 生成外网访问 URL
     QString externalUrl(const QString &objectKey) const;
@@ -48,6 +72,9 @@ public:
     void deleteCosFile(const QString &cosUrl);
 
 private:
+    struct MultipartUpload;
+    using UploadPtr = std::shared_ptr<MultipartUpload>;
+
     // COS API 签名（V5 + HMAC-SHA1）
     QByteArray sign(const QByteArray &method,
                     const QString &path,
@@ -58,28 +85,34 @@ private:
     // 分片上传的三个阶段
     void initiateMultipartUpload(const QString &objectKey,
                                   const QString &localPath,
-                                  std::function<void(qint64, qint64)> onProgress,
-                                  std::function<void(bool, const QString &)> onFinished);
+                                  ProgressFn onProgress,
+                                  FinishedFn onFinished,
+                                  const QJsonObject &context);
 
-    void uploadParts(const QString &objectKey,
-                     const QString &uploadId,
-                     const QString &localPath,
-                     qint64 fileSize,
-                     std::function<void(qint64, qint64)> onProgress,
-                     std::function<void(bool, const QString &)> onFinished);
+    /// 打开本地文件并在并发窗口内上传尚未完成的分片；全部完成后调用 Complete
+    void uploadParts(const UploadPtr &upload);
+    void fillPartWindow(const UploadPtr &upload);
+    void uploadPart(const UploadPtr &upload, int partNumber, int attempt);
+    QByteArray readPart(MultipartUpload &upload, int partNumber) const;
+    void failMultipart(const UploadPtr &upload, const QString &error);
 
     void completeMultipartUpload(const QString &objectKey,
                                   const QString &uploadId,
                                   const QList<QPair<int, QString>> &partETags,
-                                  std::function<void(bool, const QString &)> onFinished);
+                                  FinishedFn onFinished);
 
     void abortMultipartUpload(const QString &objectKey, const QString &uploadId);
 
     // 单次 PUT 上传（小文件 < 分片阈值）
     void putObject(const QString &objectKey,
                    const QString &localPath,
-                   std::function<void(qint64, qint64)> onProgress,
-                   std::function<void(bool, const QString &)> onFinished);
+                   ProgressFn onProgress,
+                   FinishedFn onFinished);
+
+    // 断点状态：initiate 后与每个分片完成后原子写入，上传结束时删除
+    QString statePath(const QString &objectKey) const;
+    void saveState(const MultipartUpload &upload) const;
+    void removeState(const QString &objectKey) const;
 
     /// 从数据库存储的未签名 URL 中提取 objectKey
     QString objectKeyFromUrl(const QString &cosUrl) const;
@@ -95,6 +128,8 @@ private:
     QString m_internalEndpoint;  // 内网 Endpoint (e.g. cos-internal.ap-guangzhou.myqcloud.com)
     QString m_externalEndpoint;  // 外网 Endpoint (e.g. cos.ap-guangzhou.myqcloud.com)
     QString m_prefix;            // 对象键前缀 (e.g. "chatroom/")
+    QString m_stateDir;
+    MultipartLimits m_multipart;
 
     QNetworkAccessManager *m_nam = nullptr;
 
@@ -14,7 +14,12 @@
 #include <QMutex>
 #include <QHash>
 #include <QTimeZone>
+#include <QElapsedTimer>
+#include <QDeadlineTimer>
+#include <QCryptographicHash>
 #include <algorithm>
+#include <memory>
+#include <unordered_map>
 
 namespace {
 constexpr qint64 kDefaultRoomMaxFileSize = 10LL * 1024 * 1024 * 1024; // 10GB
@@ -23,65 +28,444 @@ constexpr int    kDefaultRoomMaxFileCount = 1500;
 constexpr int    kDefaultRoomMaxMembers   = 50;
 constexpr int    kFileExpireDays = 7;
 const QString    kExpiredFileReason = QStringLiteral("文件已过期或被清除");
+constexpr int    kBusyTimeoutMs = 5000;
+constexpr int    kDefaultMessageCommitWindowUs = 1000;
+constexpr int    kDefaultMessageCommitMaxBatch = 64;
+constexpr int    kMaxMessageCommitWindowUs = 100000;
+constexpr int    kMaxMessageCommitBatch = 4096;
+constexpr int    kDefaultHistoryCacheMessages = 200;
+constexpr int    kDefaultHistoryCacheRooms = 256;
+constexpr int    kMaxHistoryCacheMessages = 5000;
+constexpr int    kMaxHistoryCacheRooms = 65536;
+constexpr quint64 kHistoryCacheStatsLogThreshold = 1024;
+constexpr int    kDefaultBlobCacheMb = 32;
+constexpr int    kMaxBlobCacheMb = 1024;
+constexpr int    kBlobSweepBatch = 512;
+
+// 读取整数环境变量，未设置或超出 [minValue, maxValue] 时使用默认值
+int boundedEnvironmentInt(const char *name, int minValue, int maxValue, int defaultValue) {
+    bool ok = false;
+    const int value = qEnvironmentVariableIntValue(name, &ok);
+    return ok && value >= minValue && value <= maxValue ? value : defaultValue;
+}
+
+// 写事务统一使用 BEGIN IMMEDIATE：多个请求工作线程并发写入时在 busy_timeout 内排队，
+// 避免默认的延迟事务在读锁升级为写锁时直接返回 SQLITE_BUSY。
+bool beginWriteTransaction(QSqlDatabase &db) {
+    QSqlQuery begin(db);
+    return begin.exec(QStringLiteral("BEGIN IMMEDIATE"));
+}
+
+// ==================== 预编译语句缓存 ====================
+// QSqlQuery::prepare 每次都会让 SQLite 重新编译语句；热点路径改为按线程、按连接缓存已准备好的
+// QSqlQuery，后续调用只重新绑定参数。连接本身是线程私有的，因此缓存无需加锁。
+constexpr quint64 kStatementStatsLogThreshold = 1024;
+
+// 计数用原子量：每条语句的计数块在首次准备时登记一次，之后随线程缓存条目一起保存指针，
+// 命中与执行路径不再加锁；输出统计时再汇总。最大耗时用 CAS 更新
+struct StatementStats {
+    QAtomicInteger<quint64> hits{0};
+    QAtomicInteger<quint64> misses{0};
+    QAtomicInteger<quint64> executions{0};
+    QAtomicInteger<qint64>  totalNs{0};
+    QAtomicInteger<qint64>  maxNs{0};
+};
+
+struct StatementStatsSnapshot {
+    quint64 hits = 0;
+    quint64 misses = 0;
+    quint64 executions = 0;
+    qint64  totalNs = 0;
+    qint64  maxNs = 0;
+};
+
+struct StatementCacheSnapshot {
+    quint64 lookups = 0;
+    quint64 hits = 0;
+    QHash<QString, StatementStatsSnapshot> statements;
+};
+
+// 登记表只在语句首次准备（缓存未命中）与输出统计时加锁；计数块登记后不释放，指针长期有效
+QMutex g_statementStatsMutex;
+std::unordered_map<QString, std::unique_ptr<StatementStats>> g_statementStats;
+QAtomicInteger<quint64> g_statementLookups{0};
+QAtomicInteger<quint64> g_statementHits{0};
+
+StatementStats *statementStatsFor(const QString &id) {
+    QMutexLocker locker(&g_statementStatsMutex);
+    std::unique_ptr<StatementStats> &stats = g_statementStats[id];
+    if (!stats) stats = std::make_unique<StatementStats>();
+    return stats.get();
+}
+
+StatementStatsSnapshot snapshotOf(const StatementStats &stats) {
+    StatementStatsSnapshot snapshot;
+    snapshot.hits = stats.hits.loadRelaxed();
+    snapshot.misses = stats.misses.loadRelaxed();
+    snapshot.executions = stats.executions.loadRelaxed();
+    snapshot.totalNs = stats.totalNs.loadRelaxed();
+    snapshot.maxNs = stats.maxNs.loadRelaxed();
+    return snapshot;
+}
+
+StatementCacheSnapshot statementCacheSnapshot() {
+    StatementCacheSnapshot snapshot;
+    snapshot.lookups = g_statementLookups.loadRelaxed();
+    snapshot.hits = g_statementHits.loadRelaxed();
+    QMutexLocker locker(&g_statementStatsMutex);
+    for (const auto &entry : g_statementStats)
+        snapshot.statements.insert(entry.first, snapshotOf(*entry.second));
+    return snapshot;
+}
+
+void logStatementCacheSnapshot(const StatementCacheSnapshot &snapshot) {
+    const double hitRate = snapshot.lookups == 0
+                               ? 0.0
+                               : 100.0 * static_cast<double>(snapshot.hits) / static_cast<double>(snapshot.lookups);
+    qInfo().noquote()
+        << QStringLiteral("[DB] statement-cache lookups=%1 hits=%2 hitRate=%3% statements=%4")
+               .arg(snapshot.lookups)
+               .arg(snapshot.hits)
+               .arg(hitRate, 0, 'f', 1)
+               .arg(snapshot.statements.size());
+    QStringList ids = snapshot.statements.keys();
+    ids.sort();
+    for (const QString &id : std::as_const(ids)) {
+        const StatementStatsSnapshot &stats = snapshot.statements[id];
+        const qint64 avgUs = stats.executions == 0
+                                 ? 0
+                                 : stats.totalNs / static_cast<qint64>(stats.executions) / 1000;
+        qInfo().noquote()
+            << QStringLiteral("[DB] statement id=%1 executions=%2 hits=%3 misses=%4 avgUs=%5 maxUs=%6")
+                   .arg(id)
+                   .arg(stats.executions)
+                   .arg(stats.hits)
+                   .arg(stats.misses)
+                   .arg(avgUs)
+                   .arg(stats.maxNs / 1000);
+    }
+}
+
+void recordStatementLookup(StatementStats &stats, bool hit) {
+    const quint64 lookups = g_statementLookups.fetchAndAddRelaxed(1) + 1;
+    if (hit) {
+        stats.hits.fetchAndAddRelaxed(1);
+        g_statementHits.fetchAndAddRelaxed(1);
+    } else {
+        stats.misses.fetchAndAddRelaxed(1);
+    }
+    // 只在总查找次数为 2 的幂时输出，避免热点路径刷屏
+    if (lookups >= kStatementStatsLogThreshold && (lookups & (lookups - 1)) == 0)
+        logStatementCacheSnapshot(statementCacheSnapshot());
+}
+
+void recordStatementExecution(StatementStats &stats, qint64 elapsedNs) {
+    stats.executions.fetchAndAddRelaxed(1);
+    stats.totalNs.fetchAndAddRelaxed(elapsedNs);
+    qint64 currentMax = stats.maxNs.loadRelaxed();
+    while (elapsedNs > currentMax && !stats.maxNs.testAndSetRelaxed(currentMax, elapsedNs, currentMax)) {
+    }
+}
+
+struct CachedStatement {
+    std::unique_ptr<QSqlQuery> query;
+    StatementStats *stats = nullptr;
+};
 
+using StatementCache = std::unordered_map<QString, CachedStatement>;
+
+StatementCache &threadStatementCache() {
+    thread_local StatementCache cache;
+    return cache;
+}
+
+// 取出（或首次准备）id 对应的缓存语句，离开作用域时 finish() 释放读快照。
+// 同一 id 不可在作用域内重入使用：嵌套调用会共享同一个 QSqlQuery。
+class CachedQuery {
+public:
+    CachedQuery(QSqlDatabase &db, const QString &id, const QString &sql)
+        : m_id(id)
+        , m_key(db.connectionName() + QLatin1Char('/') + id)
+    {
+        StatementCache &cache = threadStatementCache();
+        const auto it = cache.find(m_key);
+        if (it != cache.end()) {
+            m_query = it->second.query.get();
+            m_stats = it->second.stats;
+            recordStatementLookup(*m_stats, true);
+            return;
+        }
+        m_stats = statementStatsFor(m_id);
+        recordStatementLookup(*m_stats, false);
+
+        auto query = std::make_unique<QSqlQuery>(db);
+        if (!query->prepare(sql)) {
+            // 准备失败不进入缓存，exec() 会返回同样的错误供调用方记录
+            qWarning() << "[DB] 预编译语句失败:" << m_id << query->lastError().text();
+            m_owned = std::move(query);
+            m_query = m_owned.get();
+            return;
+        }
+        m_query = query.get();
+        cache.emplace(m_key, CachedStatement{std::move(query), m_stats});
+    }
+
+    ~CachedQuery() {
+        m_query->finish();
+        // 执行失败（例如连接被重新打开导致语句失效）时丢弃缓存，下次重新准备
+        if (m_failed && !m_owned) threadStatementCache().erase(m_key);
+    }
+
+    CachedQuery(const CachedQuery &) = delete;
+    CachedQuery &operator=(const CachedQuery &) = delete;
+
+    bool exec() {
+        QElapsedTimer timer;
+        timer.start();
+        const bool ok = m_query->exec();
+        recordStatementExecution(*m_stats, timer.nsecsElapsed());
+        if (!ok) m_failed = true;
+        return ok;
+    }
+
+    QSqlQuery *operator->() { return m_query; }
+    QSqlQuery &operator*() { return *m_query; }
+
+private:
+    QString m_id;
+    QString m_key;
+    QSqlQuery *m_query = nullptr;
+    StatementStats *m_stats = nullptr;
+    std::unique_ptr<QSqlQuery> m_owned;
+    bool m_failed = false;
+};
+
+// ==================== 内容寻址 blob ====================
+// 缩略图与头像按 SHA-256 存入 blobs 表，消息行和头像表只保存哈希与大小；
+// 相同内容只存一份，字节由 HTTP /api/blob/<hash> 提供并可按 ETag 缓存。
+bool storeBlob(QSqlDatabase &db, const QByteArray &data, BlobRef *ref) {
+    const QString hash = QString::fromLatin1(
+        QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex());
+    CachedQuery insert(db, QStringLiteral("blob.insert"),
+                       "INSERT OR IGNORE INTO blobs (hash, data, size) VALUES (?, ?, ?)");
+    insert->addBindValue(hash);
+    insert->addBindValue(data);
+    insert->addBindValue(static_cast<qint64>(data.size()));
+    if (!insert.exec()) {
+        qWarning() << "[DB] 写入 blob 失败:" << insert->lastError().text();
+        return false;
+    }
+    ref->hash = hash;
+    ref->size = data.size();
+    return true;
+}
+
+// 客户端上传的缩略图为 base64；为空或无法解码时返回空引用
+bool storeThumbnailBlob(QSqlDatabase &db, const QString &base64, BlobRef *ref) {
+    *ref = BlobRef{};
+    if (base64.isEmpty()) return true;
+    const QByteArray data = QByteArray::fromBase64(base64.toLatin1());
+    if (data.isEmpty()) return true;
+    return storeBlob(db, data, ref);
+}
+
+// 旧版本把缩略图以 base64 存在 thumbnail 列：分批写入 blobs，消息行改为只保留哈希与大小
+bool migrateInlineThumbnails(QSqlDatabase &db, const QString &messageTable) {
+    constexpr int kBatchSize = 256;
+    int migrated = 0;
+    for (;;) {
+        QList<QPair<int, QString>> rows;
+        {
+            QSqlQuery select(db);
+            if (!select.exec(QStringLiteral("SELECT id, thumbnail FROM %1 WHERE thumbnail <> '' LIMIT %2")
+                                 .arg(messageTable)
+                                 .arg(kBatchSize))) {
+                qCritical() << "[DB] 查询内联缩略图失败:" << messageTable << select.lastError().text();
+                return false;
+            }
+            while (select.next()) rows.append({select.value(0).toInt(), select.value(1).toString()});
+        }
+        if (rows.isEmpty()) break;
+
+        if (!beginWriteTransaction(db)) return false;
+        QSqlQuery update(db);
+        update.prepare(QStringLiteral("UPDATE %1 SET thumbnail = '', thumbnail_hash = ?, thumbnail_size = ? "
+                                      "WHERE id = ?")
+                           .arg(messageTable));
+        for (const auto &row : std::as_const(rows)) {
+            BlobRef ref;
+            if (!storeThumbnailBlob(db, row.second, &ref)) {
+                db.rollback();
+                return false;
+            }
+            update.bindValue(0, ref.hash);
+            update.bindValue(1, ref.size);
+            update.bindValue(2, row.first);
+            if (!update.exec()) {
+                qCritical() << "[DB] 迁移内联缩略图失败:" << messageTable << update.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        if (!db.commit()) return false;
+        migrated += rows.size();
+    }
+    if (migrated > 0) qInfo() << "[DB] 已迁移内联缩略图:" << messageTable << migrated;
+    return true;
+}
+
+// 旧版本头像字节存在 avatar_data 列：写入 blobs 后清空该列
+bool migrateAvatarBlobs(QSqlDatabase &db, const QString &avatarTable, const QString &ownerColumn) {
+    constexpr int kBatchSize = 64;
+    for (;;) {
+        QList<QPair<int, QByteArray>> rows;
+        {
+            QSqlQuery select(db);
+            if (!select.exec(QStringLiteral("SELECT %2, avatar_data FROM %1 "
+                                            "WHERE avatar_data IS NOT NULL LIMIT %3")
+                                 .arg(avatarTable, ownerColumn)
+                                 .arg(kBatchSize))) {
+                qCritical() << "[DB] 查询内联头像失败:" << avatarTable << select.lastError().text();
+                return false;
+            }
+            while (select.next()) rows.append({select.value(0).toInt(), select.value(1).toByteArray()});
+        }
+        if (rows.isEmpty()) return true;
+
+        if (!beginWriteTransaction(db)) return false;
+        QSqlQuery update(db);
+        update.prepare(QStringLiteral("UPDATE %1 SET avatar_data = NULL, avatar_hash = ?, avatar_size = ? "
+                                      "WHERE %2 = ?")
+                           .arg(avatarTable, ownerColumn));
+        for (const auto &row : std::as_const(rows)) {
+            BlobRef ref;
+            if (!row.second.isEmpty() && !storeBlob(db, row.second, &ref)) {
+                db.rollback();
+                return false;
+            }
+            update.bindValue(0, ref.hash);
+            update.bindValue(1, ref.size);
+            update.bindValue(2, row.first);
+            if (!update.exec()) {
+                qCritical() << "[DB] 迁移内联头像失败:" << avatarTable << update.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        if (!db.commit()) return false;
+    }
+}
+
+// 增量回收：从 cursor 之后检查最多 batchSize 个 blob，删除其中不再被消息或头像引用的；
+// 扫描到表尾时 cursor 归零，下一轮从头开始
+int sweepUnreferencedBlobs(QSqlDatabase &db, int batchSize, qint64 *cursor) {
+    if (!beginWriteTransaction(db)) return 0;
+
+    CachedQuery window(db, QStringLiteral("blob.sweep.window"),
+        "SELECT COUNT(*), MAX(rowid) FROM "
+        "(SELECT rowid FROM blobs WHERE rowid > ? ORDER BY rowid LIMIT ?)");
+    window->addBindValue(*cursor);
+    window->addBindValue(batchSize);
+    if (!window.exec() || !window->next()) {
+        db.rollback();
+        return 0;
+    }
+    const int scanned = window->value(0).toInt();
+    const qint64 last = window->value(1).toLongLong();
+
+    CachedQuery remove(db, QStringLiteral("blob.sweep.delete"),
+        "DELETE FROM blobs WHERE rowid > ? AND rowid <= ? "
+        "AND NOT EXISTS (SELECT 1 FROM messages WHERE thumbnail_hash = blobs.hash) "
+        "AND NOT EXISTS (SELECT 1 FROM friend_messages WHERE thumbnail_hash = blobs.hash) "
+        "AND NOT EXISTS (SELECT 1 FROM user_avatars WHERE avatar_hash = blobs.hash) "
+        "AND NOT EXISTS (SELECT 1 FROM room_avatars WHERE avatar_hash = blobs.hash)");
+    remove->addBindValue(*cursor);
+    remove->addBindValue(last);
+    if (!remove.exec()) {
+        qWarning() << "[DB] 回收无引用 blob 失败:" << remove->lastError().text();
+        db.rollback();
+        return 0;
+    }
+    const int removed = remove->numRowsAffected();
+    if (!db.commit()) return 0;
+    *cursor = scanned < batchSize ? 0 : last;
+    return removed;
+}
+
+// 过期由后台任务分批标记；下载鉴权这类读路径只按时间过滤，不在请求内写库
+QString notExpiredPredicate(const QString &createdAtColumn) {
+    return QStringLiteral("%1 > datetime('now', '-%2 days')").arg(createdAtColumn).arg(kFileExpireDays);
+}
+
+// 按 created_at 顺序标记最多 batchSize 个到期文件；expiredCount 返回本批实际处理的数量。
+// 查询与标记在同一写事务内，且只改写仍未清除的记录：房间清理计划并发清除的文件
+// 不会被改写 clear_reason，其 COS 对象与旧版文件也不会被重复删除
 bool markExpiredFiles(QSqlDatabase &db,
                       const QString &fileTable,
                       const QString &messageTable,
                       const QString &reason,
-                      QStringList &cosUrlsOut) {
+                      int batchSize,
+                      QStringList &cosUrlsOut,
+                      int *expiredCount) {
+    *expiredCount = 0;
+    if (!beginWriteTransaction(db)) {
+        qWarning() << "[DB] 开启文件过期事务失败:" << fileTable << db.lastError().text();
+        return false;
+    }
+
     QSqlQuery select(db);
-    select.prepare(QStringLiteral("SELECT id, file_path, cos_url FROM %1 WHERE cleared = 0 AND created_at <= datetime('now', '-%2 days')")
+    select.prepare(QStringLiteral("SELECT id, file_path, cos_url, content_hash FROM %1 WHERE cleared = 0 AND created_at <= datetime('now', '-%2 days') "
+                                  "ORDER BY created_at, id LIMIT ?")
                    .arg(fileTable)
                    .arg(kFileExpireDays));
+    select.addBindValue(batchSize);
     if (!select.exec()) {
+        db.rollback();
         qWarning() << "[DB] 查询待过期文件失败:" << fileTable << select.lastError().text();
         return false;
     }
 
+    QSqlQuery updateFile(db);
+    updateFile.prepare(QStringLiteral("UPDATE %1 SET cleared = 1, clear_reason = ?, cleared_at = CURRENT_TIMESTAMP "
+                                      "WHERE id = ? AND cleared = 0")
+                       .arg(fileTable));
     QList<int> fileIds;
     QStringList filePaths;
+    QStringList cosUrls;
     while (select.next()) {
-        fileIds.append(select.value(0).toInt());
-        filePaths.append(select.value(1).toString());
+        const int fileId = select.value(0).toInt();
+        updateFile.addBindValue(reason);
+        updateFile.addBindValue(fileId);
+        if (!updateFile.exec()) {
+            db.rollback();
+            qWarning() << "[DB] 更新过期文件状态失败:" << fileTable << updateFile.lastError().text();
+            return false;
+        }
+        if (updateFile.numRowsAffected() != 1)
+            continue;
+        fileIds.append(fileId);
+        // 内容寻址文件由触发器减少引用计数，字节在计数归零后统一回收；这里只删除旧版按记录存放的文件
+        if (select.value(3).toString().isEmpty())
+            filePaths.append(select.value(1).toString());
         const QString cosUrl = select.value(2).toString();
         if (!cosUrl.isEmpty())
-            cosUrlsOut.append(cosUrl);
+            cosUrls.append(cosUrl);
     }
     if (fileIds.isEmpty()) {
+        db.rollback();
         return true;
     }
 
-    if (!db.transaction()) {
-        qWarning() << "[DB] 开启文件过期事务失败:" << fileTable << db.lastError().text();
-        return false;
-    }
-
     QStringList placeholders;
     for (int i = 0; i < fileIds.size(); ++i) {
         placeholders << QStringLiteral("?");
     }
-    const QString inExpr = placeholders.join(QStringLiteral(","));
-
-    QSqlQuery updateFiles(db);
-    updateFiles.prepare(QStringLiteral("UPDATE %1 SET cleared = 1, clear_reason = ?, cleared_at = CURRENT_TIMESTAMP "
-                                       "WHERE id IN (%2)")
-                        .arg(fileTable, inExpr));
-    updateFiles.addBindValue(reason);
-    for (int fileId : fileIds) {
-        updateFiles.addBindValue(fileId);
-    }
-    if (!updateFiles.exec()) {
-        db.rollback();
-        qWarning() << "[DB] 更新过期文件状态失败:" << fileTable << updateFiles.lastError().text();
-        return false;
-    }
-
     QSqlQuery updateMessages(db);
     updateMessages.prepare(QStringLiteral("UPDATE %1 SET file_cleared = 1, clear_reason = ? "
-                                          "WHERE file_id IN (%2)")
-                           .arg(messageTable, inExpr));
+                                          "WHERE file_id IN (%2) AND file_cleared = 0")
+                           .arg(messageTable, placeholders.join(QStringLiteral(","))));
     updateMessages.addBindValue(reason);
-    for (int fileId : fileIds) {
+    for (int fileId : std::as_const(fileIds)) {
         updateMessages.addBindValue(fileId);
     }
     if (!updateMessages.exec()) {
@@ -94,6 +478,8 @@ bool markExpiredFiles(QSqlDatabase &db,
         qWarning() << "[DB] 提交文件过期事务失败:" << fileTable << db.lastError().text();
         return false;
     }
+    *expiredCount = fileIds.size();
+    cosUrlsOut.append(cosUrls);
 
     for (const QString &path : filePaths) {
         if (!path.isEmpty() && QFile::exists(path) && !QFile::remove(path)) {
@@ -103,36 +489,6 @@ bool markExpiredFiles(QSqlDatabase &db,
     return true;
 }
 
-bool reserveMessageSequence(QSqlDatabase &db,
-                            const QString &sequenceTable,
-                            const QString &ownerColumn,
-                            int ownerId,
-                            qint64 *sequence) {
-    QSqlQuery select(db);
-    select.prepare(QStringLiteral("SELECT last_sequence FROM %1 WHERE %2 = ?")
-                       .arg(sequenceTable, ownerColumn));
-    select.addBindValue(ownerId);
-    if (!select.exec()) return false;
-
-    if (select.next()) {
-        *sequence = select.value(0).toLongLong() + 1;
-        QSqlQuery update(db);
-        update.prepare(QStringLiteral("UPDATE %1 SET last_sequence = ? WHERE %2 = ?")
-                           .arg(sequenceTable, ownerColumn));
-        update.addBindValue(*sequence);
-        update.addBindValue(ownerId);
-        return update.exec() && update.numRowsAffected() == 1;
-    }
-
-    *sequence = 1;
-    QSqlQuery insert(db);
-    insert.prepare(QStringLiteral("INSERT INTO %1 (%2, last_sequence) VALUES (?, ?)")
-                       .arg(sequenceTable, ownerColumn));
-    insert.addBindValue(ownerId);
-    insert.addBindValue(*sequence);
-    return insert.exec();
-}
-
 qint64 utcTimestampMs(const QVariant &value) {
     QDateTime timestamp = value.toDateTime();
 #if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
@@ -143,6 +499,128 @@ qint64 utcTimestampMs(const QVariant &value) {
     return timestamp.toMSecsSinceEpoch();
 }
 
+// ==================== 消息组提交 ====================
+// 以下两个函数只负责单条幂等消息的查重、序列分配与插入，事务由组提交批次统一开启和提交；
+// 调用方用 SAVEPOINT 包住每一条，失败时只回滚这一条。
+MessageSaveResult writeRoomMessage(QSqlDatabase &db, MessageSequenceAllocator &sequences,
+                                   int roomId, int userId,
+                                   const QString &clientMessageId,
+                                   const QString &content, const QString &contentType) {
+    MessageSaveResult result;
+    CachedQuery existing(db, QStringLiteral("room.message.by_client_id"),
+                         "SELECT id, room_id, content, content_type, sequence, created_at "
+                         "FROM messages WHERE user_id = ? AND client_message_id = ?");
+    existing->addBindValue(userId);
+    existing->addBindValue(clientMessageId);
+    if (!existing.exec()) {
+        qWarning() << "[DB] 查询幂等消息失败:" << existing->lastError().text();
+        return result;
+    }
+    if (existing->next()) {
+        result.messageId = existing->value(0).toInt();
+        result.sequence = existing->value(4).toLongLong();
+        result.createdAtMs = utcTimestampMs(existing->value(5));
+        const bool sameCommand = existing->value(1).toInt() == roomId &&
+                                 existing->value(2).toString() == content &&
+                                 existing->value(3).toString() == contentType;
+        result.status = sameCommand ? MessageSaveResult::Status::Duplicate
+                                    : MessageSaveResult::Status::Conflict;
+        return result;
+    }
+
+    if (!sequences.reserve(db, roomId, &result.sequence)) {
+        qWarning() << "[DB] 分配幂等消息序列失败:" << db.lastError().text();
+        return MessageSaveResult{};
+    }
+
+    CachedQuery insert(db, QStringLiteral("room.message.insert_idempotent"),
+                       "INSERT INTO messages "
+                       "(room_id, user_id, content, content_type, client_message_id, sequence) "
+                       "VALUES (?, ?, ?, ?, ?, ?)");
+    insert->addBindValue(roomId);
+    insert->addBindValue(userId);
+    insert->addBindValue(content);
+    insert->addBindValue(contentType);
+    insert->addBindValue(clientMessageId);
+    insert->addBindValue(result.sequence);
+    if (!insert.exec()) {
+        qWarning() << "[DB] 保存幂等消息失败:" << insert->lastError().text();
+        return MessageSaveResult{};
+    }
+    result.messageId = insert->lastInsertId().toInt();
+
+    CachedQuery created(db, QStringLiteral("room.message.created_at"),
+                        "SELECT created_at FROM messages WHERE id = ?");
+    created->addBindValue(result.messageId);
+    if (!created.exec() || !created->next()) {
+        qWarning() << "[DB] 读取新消息时间失败:" << created->lastError().text();
+        return MessageSaveResult{};
+    }
+    result.createdAtMs = utcTimestampMs(created->value(0));
+    result.status = MessageSaveResult::Status::Created;
+    return result;
+}
+
+MessageSaveResult writeFriendMessage(QSqlDatabase &db, MessageSequenceAllocator &sequences,
+                                     int friendshipId, int senderId,
+                                     const QString &clientMessageId,
+                                     const QString &content, const QString &contentType) {
+    MessageSaveResult result;
+    CachedQuery existing(db, QStringLiteral("friend.message.by_client_id"),
+        "SELECT id, friendship_id, content, content_type, sequence, created_at "
+        "FROM friend_messages WHERE sender_id = ? AND client_message_id = ?");
+    existing->addBindValue(senderId);
+    existing->addBindValue(clientMessageId);
+    if (!existing.exec()) {
+        qWarning() << "[DB] 查询私聊幂等消息失败:" << existing->lastError().text();
+        return result;
+    }
+    if (existing->next()) {
+        result.messageId = existing->value(0).toInt();
+        result.sequence = existing->value(4).toLongLong();
+        result.createdAtMs = utcTimestampMs(existing->value(5));
+        const bool sameCommand = existing->value(1).toInt() == friendshipId &&
+                                 existing->value(2).toString() == content &&
+                                 existing->value(3).toString() == contentType;
+        result.status = sameCommand ? MessageSaveResult::Status::Duplicate
+                                    : MessageSaveResult::Status::Conflict;
+        return result;
+    }
+
+    if (!sequences.reserve(db, friendshipId, &result.sequence)) {
+        return MessageSaveResult{};
+    }
+    CachedQuery insert(db, QStringLiteral("friend.message.insert_idempotent"),
+        "INSERT INTO friend_messages "
+        "(friendship_id, sender_id, content, content_type, client_message_id, sequence) "
+        "VALUES (?, ?, ?, ?, ?, ?)");
+    insert->addBindValue(friendshipId);
+    insert->addBindValue(senderId);
+    insert->addBindValue(content);
+    insert->addBindValue(contentType);
+    insert->addBindValue(clientMessageId);
+    insert->addBindValue(result.sequence);
+    if (!insert.exec()) {
+        qWarning() << "[DB] 保存私聊幂等消息失败:" << insert->lastError().text();
+        return MessageSaveResult{};
+    }
+    result.messageId = insert->lastInsertId().toInt();
+    CachedQuery created(db, QStringLiteral("friend.message.created_at"),
+                        "SELECT created_at FROM friend_messages WHERE id = ?");
+    created->addBindValue(result.messageId);
+    if (!created.exec() || !created->next()) {
+        return MessageSaveResult{};
+    }
+    result.createdAtMs = utcTimestampMs(created->value(0));
+    result.status = MessageSaveResult::Status::Created;
+    return result;
+}
+
+bool execSavepointStatement(QSqlDatabase &db, const QString &id, const QString &sql) {
+    CachedQuery statement(db, id, sql);
+    return statement.exec();
+}
+
 QJsonArray roomMessagesFromQuery(QSqlQuery &query, int roomId) {
     QJsonArray messages;
     while (query.next()) {
@@ -162,8 +640,11 @@ QJsonArray roomMessagesFromQuery(QSqlQuery &query, int roomId) {
                                       : displayName;
         message["roomId"]      = roomId;
 
-        const QString thumbnail = query.value(10).toString();
-        if (!thumbnail.isEmpty()) message["thumbnail"] = thumbnail;
+        const QString thumbnailHash = query.value(10).toString();
+        if (!thumbnailHash.isEmpty()) {
+            message["thumbnailHash"] = thumbnailHash;
+            message["thumbnailSize"] = static_cast<double>(query.value(17).toLongLong());
+        }
         if (query.value(11).toInt() != 0) {
             message["fileCleared"] = true;
             message["clearReason"] = query.value(12).toString();
@@ -180,6 +661,49 @@ QJsonArray roomMessagesFromQuery(QSqlQuery &query, int roomId) {
     return messages;
 }
 
+qint64 messageSequence(const QJsonObject &message) {
+    return static_cast<qint64>(message["sequence"].toDouble());
+}
+
+qint64 messageSyncSequence(const QJsonObject &message) {
+    return static_cast<qint64>(message["syncSequence"].toDouble());
+}
+
+// 房间最新一页消息：子查询取最新 N 条（DESC），再按序列正序排列（ASC）
+QString latestRoomMessagesSql(bool beforeTimestamp) {
+    QString sql = "SELECT * FROM ("
+                  "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id,"
+                  "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail_hash,"
+                  "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id,"
+                  "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)), m.thumbnail_size"
+                  " FROM messages m JOIN users u ON m.user_id = u.id"
+                  " WHERE m.room_id = ?";
+
+    if (beforeTimestamp)
+        sql += " AND m.created_at < datetime(? / 1000, 'unixepoch')";
+
+    sql += " ORDER BY m.sequence DESC LIMIT ?"
+           ") ORDER BY sequence ASC";
+    return sql;
+}
+
+// 读取单条房间消息的完整记录（与历史查询同构），用于在写事务内为房间缓存准备追加项
+QJsonObject readRoomMessageRecord(QSqlDatabase &db, int roomId, int messageId) {
+    CachedQuery query(db, QStringLiteral("room.message.record"),
+        "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id, "
+        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail_hash, "
+        "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id, "
+        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)), m.thumbnail_size "
+        "FROM messages m JOIN users u ON m.user_id = u.id WHERE m.id = ?");
+    query->addBindValue(messageId);
+    if (!query.exec()) {
+        qWarning() << "[DB] 读取房间消息记录失败:" << query->lastError().text();
+        return {};
+    }
+    const QJsonArray messages = roomMessagesFromQuery(*query, roomId);
+    return messages.isEmpty() ? QJsonObject{} : messages.first().toObject();
+}
+
 QJsonArray friendMessagesFromQuery(QSqlQuery &query, int friendshipId) {
     QJsonArray messages;
     while (query.next()) {
@@ -199,8 +723,11 @@ QJsonArray friendMessagesFromQuery(QSqlQuery &query, int friendshipId) {
                                     ? message["sender"].toString()
                                     : displayName;
         message["friendshipId"] = friendshipId;
-        const QString thumbnail = query.value(10).toString();
-        if (!thumbnail.isEmpty()) message["thumbnail"] = thumbnail;
+        const QString thumbnailHash = query.value(10).toString();
+        if (!thumbnailHash.isEmpty()) {
+            message["thumbnailHash"] = thumbnailHash;
+            message["thumbnailSize"] = static_cast<double>(query.value(17).toLongLong());
+        }
         if (query.value(11).toInt() != 0) {
             message["fileCleared"] = true;
             message["clearReason"] = query.value(12).toString();
@@ -267,11 +794,15 @@ bool ensureColumn(QSqlDatabase &db, const QString &table,
                           .arg(table, column, definition));
 }
 
+// 启动时重建每个会话的最新序列号：持久化高水位、消息序列、撤回变更序列与事件序列取最大值，
+// 回填旧数据缺失的序列后写回高水位表；recovered 返回结果用于初始化内存分配器
 bool migrateMessageSequences(QSqlDatabase &db,
                              const QString &messageTable,
                              const QString &ownerColumn,
                              const QString &sequenceTable,
-                             const QString &sequenceOwnerColumn) {
+                             const QString &sequenceOwnerColumn,
+                             const QString &eventTable,
+                             QHash<int, qint64> *recovered) {
     QHash<int, qint64> lastSequences;
     QSqlQuery durable(db);
     if (!durable.exec(QStringLiteral("SELECT %1, last_sequence FROM %2")
@@ -314,6 +845,23 @@ bool migrateMessageSequences(QSqlDatabase &db,
     }
     mutationMaxima.finish();
 
+    if (!eventTable.isEmpty()) {
+        QSqlQuery eventMaxima(db);
+        if (!eventMaxima.exec(QStringLiteral(
+                "SELECT %1, COALESCE(MAX(sequence), 0) FROM %2 GROUP BY %1")
+                                  .arg(ownerColumn, eventTable))) {
+            qCritical() << "[DB] 读取事件最大序列失败:" << eventTable
+                        << eventMaxima.lastError().text();
+            return false;
+        }
+        while (eventMaxima.next()) {
+            const int ownerId = eventMaxima.value(0).toInt();
+            lastSequences.insert(ownerId, qMax(lastSequences.value(ownerId, 0),
+                                                eventMaxima.value(1).toLongLong()));
+        }
+        eventMaxima.finish();
+    }
+
     QSqlQuery missing(db);
     if (!missing.exec(QStringLiteral(
             "SELECT id, %1 FROM %2 WHERE sequence IS NULL ORDER BY %1, id")
@@ -341,7 +889,7 @@ bool migrateMessageSequences(QSqlDatabase &db,
                                       legacyRecalls.value(1).toInt()));
     legacyRecalls.finish();
 
-    if (!db.transaction()) {
+    if (!beginWriteTransaction(db)) {
         qCritical() << "[DB] 开启消息序列迁移事务失败:" << messageTable
                     << db.lastError().text();
         return false;
@@ -381,44 +929,556 @@ bool migrateMessageSequences(QSqlDatabase &db,
             return false;
         }
     }
-
-    QSqlQuery insertHighWatermark(db);
-    insertHighWatermark.prepare(QStringLiteral(
-        "INSERT OR IGNORE INTO %1 (%2, last_sequence) VALUES (?, ?)")
-                                    .arg(sequenceTable, sequenceOwnerColumn));
-    QSqlQuery updateHighWatermark(db);
-    updateHighWatermark.prepare(QStringLiteral(
-        "UPDATE %1 SET last_sequence = MAX(last_sequence, ?) WHERE %2 = ?")
-                                    .arg(sequenceTable, sequenceOwnerColumn));
-    for (auto it = lastSequences.cbegin(); it != lastSequences.cend(); ++it) {
-        insertHighWatermark.bindValue(0, it.key());
-        insertHighWatermark.bindValue(1, it.value());
-        if (!insertHighWatermark.exec()) {
-            qCritical() << "[DB] 创建消息高水位失败:" << sequenceTable
-                        << insertHighWatermark.lastError().text();
-            db.rollback();
+
+    QSqlQuery insertHighWatermark(db);
+    insertHighWatermark.prepare(QStringLiteral(
+        "INSERT OR IGNORE INTO %1 (%2, last_sequence) VALUES (?, ?)")
+                                    .arg(sequenceTable, sequenceOwnerColumn));
+    QSqlQuery updateHighWatermark(db);
+    updateHighWatermark.prepare(QStringLiteral(
+        "UPDATE %1 SET last_sequence = MAX(last_sequence, ?) WHERE %2 = ?")
+                                    .arg(sequenceTable, sequenceOwnerColumn));
+    for (auto it = lastSequences.cbegin(); it != lastSequences.cend(); ++it) {
+        insertHighWatermark.bindValue(0, it.key());
+        insertHighWatermark.bindValue(1, it.value());
+        if (!insertHighWatermark.exec()) {
+            qCritical() << "[DB] 创建消息高水位失败:" << sequenceTable
+                        << insertHighWatermark.lastError().text();
+            db.rollback();
+            return false;
+        }
+        updateHighWatermark.bindValue(0, it.value());
+        updateHighWatermark.bindValue(1, it.key());
+        if (!updateHighWatermark.exec() || updateHighWatermark.numRowsAffected() != 1) {
+            qCritical() << "[DB] 更新消息高水位失败:" << sequenceTable
+                        << updateHighWatermark.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        qCritical() << "[DB] 提交消息序列迁移失败:" << messageTable
+                    << db.lastError().text();
+        return false;
+    }
+    if (recovered) *recovered = lastSequences;
+    return true;
+}
+
+// 文件记录所属的房间，删除前查询，用于使这些房间的配额账本失效
+QList<int> roomsOwningFiles(QSqlDatabase &db, const QList<int> &fileIds) {
+    QList<int> roomIds;
+    if (fileIds.isEmpty()) return roomIds;
+    QStringList placeholders;
+    for (int i = 0; i < fileIds.size(); ++i)
+        placeholders << QStringLiteral("?");
+    QSqlQuery q(db);
+    q.prepare(QStringLiteral("SELECT DISTINCT room_id FROM files WHERE id IN (%1)")
+                  .arg(placeholders.join(QStringLiteral(","))));
+    for (int fileId : fileIds)
+        q.addBindValue(fileId);
+    if (q.exec()) {
+        while (q.next()) roomIds.append(q.value(0).toInt());
+    }
+    return roomIds;
+}
+}
+
+// ==================== 消息序列号分配 ====================
+
+MessageSequenceAllocator::MessageSequenceAllocator(const Scope &scope)
+    : m_scope(scope)
+    , m_loadStatementId(QStringLiteral("sequence.load.") + scope.messageTable)
+{
+    // 懒加载与启动重建使用同样的来源：高水位、消息序列、撤回变更序列、事件序列
+    QStringList sources{
+        QStringLiteral("(SELECT last_sequence FROM %1 WHERE %2 = ?)")
+            .arg(scope.watermarkTable, scope.ownerColumn),
+        QStringLiteral("(SELECT MAX(sequence) FROM %1 WHERE %2 = ?)")
+            .arg(scope.messageTable, scope.ownerColumn),
+        QStringLiteral("(SELECT MAX(mutation_sequence) FROM %1 WHERE %2 = ?)")
+            .arg(scope.messageTable, scope.ownerColumn)};
+    if (!scope.eventTable.isEmpty()) {
+        sources << QStringLiteral("(SELECT MAX(sequence) FROM %1 WHERE %2 = ?)")
+                       .arg(scope.eventTable, scope.ownerColumn);
+    }
+    for (QString &source : sources) source = QStringLiteral("COALESCE(%1, 0)").arg(source);
+    m_loadSql = QStringLiteral("SELECT MAX(%1)").arg(sources.join(QStringLiteral(", ")));
+}
+
+void MessageSequenceAllocator::seed(const QHash<int, qint64> &lastSequences) {
+    QMutexLocker locker(&m_mutex);
+    m_counters.clear();
+    for (auto it = lastSequences.cbegin(); it != lastSequences.cend(); ++it)
+        m_counters.insert(it.key(), Counter{it.value(), it.value()});
+}
+
+bool MessageSequenceAllocator::load(QSqlDatabase &db, int ownerId, qint64 *lastSequence) {
+    CachedQuery query(db, m_loadStatementId, m_loadSql);
+    const int sources = m_scope.eventTable.isEmpty() ? 3 : 4;
+    for (int i = 0; i < sources; ++i) query->addBindValue(ownerId);
+    if (!query.exec() || !query->next()) {
+        qWarning() << "[DB] 加载会话消息序列失败:" << m_scope.messageTable << ownerId
+                   << query->lastError().text();
+        return false;
+    }
+    *lastSequence = query->value(0).toLongLong();
+    return true;
+}
+
+MessageSequenceAllocator::Counter &MessageSequenceAllocator::counterFor(int ownerId,
+                                                                        qint64 lastSequence) {
+    // 调用方持有 m_mutex；若加载期间已有其他线程建立计数器，以已有值为准
+    auto it = m_counters.find(ownerId);
+    if (it == m_counters.end())
+        it = m_counters.insert(ownerId, Counter{lastSequence, lastSequence});
+    return it.value();
+}
+
+bool MessageSequenceAllocator::reserve(QSqlDatabase &db, int ownerId, qint64 *sequence) {
+    {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_counters.find(ownerId);
+        if (it != m_counters.end()) {
+            *sequence = ++it->allocated;
+            return true;
+        }
+    }
+
+    // 首次使用：调用方已持有写事务，读到的持久化数据即为最新状态
+    qint64 lastSequence = 0;
+    if (!load(db, ownerId, &lastSequence)) return false;
+    QMutexLocker locker(&m_mutex);
+    *sequence = ++counterFor(ownerId, lastSequence).allocated;
+    return true;
+}
+
+void MessageSequenceAllocator::publish(int ownerId, qint64 sequence) {
+    QMutexLocker locker(&m_mutex);
+    Counter &counter = counterFor(ownerId, sequence);
+    counter.committed = qMax(counter.committed, sequence);
+}
+
+qint64 MessageSequenceAllocator::lastCommitted(QSqlDatabase &db, int ownerId) {
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto it = m_counters.constFind(ownerId);
+        if (it != m_counters.cend()) return it->committed;
+    }
+
+    qint64 lastSequence = 0;
+    if (!load(db, ownerId, &lastSequence)) return 0;
+    QMutexLocker locker(&m_mutex);
+    return counterFor(ownerId, lastSequence).committed;
+}
+
+// ==================== 热点房间消息缓存 ====================
+
+RoomHistoryCache::RoomHistoryCache(int messagesPerRoom, int maxRooms)
+    : m_messagesPerRoom(messagesPerRoom)
+    , m_maxRooms(maxRooms)
+{
+}
+
+bool RoomHistoryCache::contains(int roomId) {
+    if (!enabled()) return false;
+    QMutexLocker locker(&m_mutex);
+    return m_rooms.contains(roomId);
+}
+
+bool RoomHistoryCache::latestFrom(const Window &window, int count, QJsonArray *messages) {
+    // 窗口不足 count 条时，只有房间的全部消息都在窗口内才能回答
+    if (count <= 0 || (window.messages.size() < count && window.floorSequence > 0))
+        return false;
+    const qsizetype first = qMax<qsizetype>(0, window.messages.size() - count);
+    for (qsizetype i = first; i < window.messages.size(); ++i)
+        messages->append(window.messages.at(i));
+    return true;
+}
+
+bool RoomHistoryCache::syncPageFrom(const Window &window, int count, qint64 afterSequence,
+                                    RoomSyncPage *page) {
+    // 游标早于 syncFloor 时，窗口外可能还有撤回变更或删除事件，交给数据库
+    if (count <= 0 || afterSequence < window.syncFloor) return false;
+    QList<QJsonObject> items;
+    for (const QJsonObject &message : window.messages) {
+        if (messageSyncSequence(message) > afterSequence) items.append(message);
+    }
+    std::sort(items.begin(), items.end(), [](const QJsonObject &left, const QJsonObject &right) {
+        return messageSyncSequence(left) < messageSyncSequence(right);
+    });
+    if (items.size() > count) items.resize(count);
+    for (const QJsonObject &item : std::as_const(items)) {
+        page->messages.append(item);
+        page->nextSequence = messageSyncSequence(item);
+        ++page->itemCount;
+    }
+    return true;
+}
+
+bool RoomHistoryCache::latest(int roomId, int count, QJsonArray *messages) {
+    if (!enabled()) return false;
+    QMutexLocker locker(&m_mutex);
+    if (m_writesInFlight.contains(roomId)) return false;
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end() || !latestFrom(*it, count, messages)) return false;
+    it->lastUsed = ++m_tick;
+    return true;
+}
+
+bool RoomHistoryCache::syncPage(int roomId, int count, qint64 afterSequence,
+                                RoomSyncPage *page) {
+    if (!enabled()) return false;
+    QMutexLocker locker(&m_mutex);
+    if (m_writesInFlight.contains(roomId)) return false;
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end() || !syncPageFrom(*it, count, afterSequence, page)) return false;
+    it->lastUsed = ++m_tick;
+    return true;
+}
+
+quint64 RoomHistoryCache::version(int roomId) {
+    QMutexLocker locker(&m_mutex);
+    return versionFor(roomId);
+}
+
+void RoomHistoryCache::install(int roomId, quint64 version, Window window) {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    if (versionFor(roomId) != version) return;
+    if (!m_rooms.contains(roomId) && m_rooms.size() >= m_maxRooms) evictLeastRecentlyUsed();
+    window.lastUsed = ++m_tick;
+    m_rooms.insert(roomId, std::move(window));
+    ++m_loads;
+}
+
+void RoomHistoryCache::beginWrite(int roomId) {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    ++m_writesInFlight[roomId];
+}
+
+void RoomHistoryCache::append(int roomId, const QJsonObject &message) {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end()) return;
+    if (message.isEmpty()) {
+        m_rooms.erase(it);
+        ++m_invalidations;
+        return;
+    }
+
+    const qint64 sequence = messageSequence(message);
+    if (sequence <= it->floorSequence) return;
+    QList<QJsonObject> &messages = it->messages;
+    const auto position = std::upper_bound(
+        messages.begin(), messages.end(), sequence,
+        [](qint64 value, const QJsonObject &existing) { return value < messageSequence(existing); });
+    // 加载快照已包含该消息时保留快照中的记录
+    if (position != messages.begin() && messageSequence(*(position - 1)) == sequence) return;
+    messages.insert(position, message);
+
+    while (messages.size() > m_messagesPerRoom) {
+        const QJsonObject evicted = messages.takeFirst();
+        it->floorSequence = qMax(it->floorSequence, messageSequence(evicted));
+        it->syncFloor = qMax(it->syncFloor,
+                             qMax(it->floorSequence, messageSyncSequence(evicted)));
+    }
+}
+
+void RoomHistoryCache::applyRecall(int roomId, int messageId, qint64 mutationSequence) {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end()) return;
+    for (QJsonObject &message : it->messages) {
+        if (message["id"].toInt() != messageId) continue;
+        message["recalled"] = true;
+        message["content"] = QStringLiteral("此消息已被撤回");
+        message["mutationSequence"] = static_cast<double>(mutationSequence);
+        message["syncSequence"] =
+            static_cast<double>(qMax(messageSequence(message), mutationSequence));
+        return;
+    }
+    // 撤回的是窗口之外的旧消息：更早游标的增量页改由数据库回答
+    it->syncFloor = qMax(it->syncFloor, mutationSequence);
+}
+
+void RoomHistoryCache::applyThumbnail(int roomId, int messageId, const BlobRef &thumbnail) {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end()) return;
+    // 缩略图不改变同步序号，窗口之外的旧消息下次按需从数据库读取
+    for (QJsonObject &message : it->messages) {
+        if (message["id"].toInt() != messageId) continue;
+        message["thumbnailHash"] = thumbnail.hash;
+        message["thumbnailSize"] = static_cast<double>(thumbnail.size);
+        return;
+    }
+}
+
+void RoomHistoryCache::endWrite(int roomId) {
+    if (!enabled()) return;
+    // 提交前开始加载的线程可能读到旧快照，推进版本号使其放弃写入
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    const auto it = m_writesInFlight.find(roomId);
+    if (it != m_writesInFlight.end() && --it.value() <= 0) m_writesInFlight.erase(it);
+}
+
+void RoomHistoryCache::invalidate(int roomId) {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    if (m_rooms.remove(roomId) > 0) ++m_invalidations;
+}
+
+void RoomHistoryCache::invalidateAll() {
+    if (!enabled()) return;
+    QMutexLocker locker(&m_mutex);
+    for (quint64 &version : m_versions) ++version;
+    m_invalidations += static_cast<quint64>(m_rooms.size());
+    m_rooms.clear();
+}
+
+void RoomHistoryCache::evictLeastRecentlyUsed() {
+    // 调用方持有 m_mutex；房间数上限通常只有数百，线性扫描即可
+    auto victim = m_rooms.begin();
+    for (auto it = m_rooms.begin(); it != m_rooms.end(); ++it) {
+        if (it->lastUsed < victim->lastUsed) victim = it;
+    }
+    if (victim != m_rooms.end()) m_rooms.erase(victim);
+}
+
+QString RoomHistoryCache::statsLine() const {
+    const double hitRate = m_lookups == 0
+                               ? 0.0
+                               : 100.0 * static_cast<double>(m_hits) / static_cast<double>(m_lookups);
+    return QStringLiteral("[DB] history-cache lookups=%1 hits=%2 misses=%3 hitRate=%4% "
+                          "rooms=%5 loads=%6 invalidations=%7")
+        .arg(m_lookups)
+        .arg(m_hits)
+        .arg(m_lookups - m_hits)
+        .arg(hitRate, 0, 'f', 1)
+        .arg(m_rooms.size())
+        .arg(m_loads)
+        .arg(m_invalidations);
+}
+
+void RoomHistoryCache::recordLookup(bool hit) {
+    if (!enabled()) return;
+    QString line;
+    {
+        QMutexLocker locker(&m_mutex);
+        const quint64 lookups = ++m_lookups;
+        if (hit) ++m_hits;
+        // 与语句缓存一致，只在查找次数为 2 的幂时输出
+        if (lookups >= kHistoryCacheStatsLogThreshold && (lookups & (lookups - 1)) == 0)
+            line = statsLine();
+    }
+    if (!line.isEmpty()) qInfo().noquote() << line;
+}
+
+void RoomHistoryCache::logStats() {
+    if (!enabled()) return;
+    QString line;
+    {
+        QMutexLocker locker(&m_mutex);
+        line = statsLine();
+    }
+    qInfo().noquote() << line;
+}
+
+// ==================== 房间文件配额账本 ====================
+
+bool RoomFileQuotaLedger::load(QSqlDatabase &db, int roomId, Usage *usage) {
+    quint64 version = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        version = versionFor(roomId);
+    }
+
+    Usage loaded;
+    loaded.maxFileSize = kDefaultRoomMaxFileSize;
+    loaded.totalFileSpace = kDefaultRoomTotalSpace;
+    loaded.maxFileCount = kDefaultRoomMaxFileCount;
+    {
+        CachedQuery settings(db, QStringLiteral("room_quota.settings"),
+                             "SELECT max_file_size, total_file_space, max_file_count "
+                             "FROM room_settings WHERE room_id = ?");
+        settings->addBindValue(roomId);
+        if (!settings.exec()) {
+            qWarning() << "[DB] 加载房间配额设置失败:" << roomId << settings->lastError().text();
+            return false;
+        }
+        if (settings->next()) {
+            loaded.maxFileSize = settings->value(0).toLongLong();
+            loaded.totalFileSpace = settings->value(1).toLongLong();
+            loaded.maxFileCount = settings->value(2).toInt();
+        }
+    }
+    {
+        CachedQuery used(db, QStringLiteral("room_quota.usage"),
+                         "SELECT COALESCE(SUM(file_size), 0), COUNT(*) "
+                         "FROM files WHERE room_id = ? AND cleared = 0");
+        used->addBindValue(roomId);
+        if (!used.exec() || !used->next()) {
+            qWarning() << "[DB] 加载房间文件用量失败:" << roomId << used->lastError().text();
             return false;
         }
-        updateHighWatermark.bindValue(0, it.value());
-        updateHighWatermark.bindValue(1, it.key());
-        if (!updateHighWatermark.exec() || updateHighWatermark.numRowsAffected() != 1) {
-            qCritical() << "[DB] 更新消息高水位失败:" << sequenceTable
-                        << updateHighWatermark.lastError().text();
-            db.rollback();
-            return false;
+        loaded.usedBytes = used->value(0).toLongLong();
+        loaded.fileCount = used->value(1).toInt();
+    }
+    *usage = loaded;
+
+    // 加载期间有文件记录写入或房间失效时放弃装入，调用方本次仍使用读到的值
+    QMutexLocker locker(&m_mutex);
+    if (versionFor(roomId) != version) return true;
+    Room &room = m_rooms[roomId];
+    room.usage = loaded;
+    room.loaded = true;
+    return true;
+}
+
+void RoomFileQuotaLedger::dropIfIdle(int roomId) {
+    // 调用方持有 m_mutex；未加载且没有预留的房间不必保留
+    const auto it = m_rooms.find(roomId);
+    if (it != m_rooms.end() && !it->loaded && it->reservedBytes <= 0 && it->reservedCount <= 0)
+        m_rooms.erase(it);
+}
+
+bool RoomFileQuotaLedger::usage(QSqlDatabase &db, int roomId, Usage *usage) {
+    {
+        QMutexLocker locker(&m_mutex);
+        const auto it = m_rooms.constFind(roomId);
+        if (it != m_rooms.cend() && it->loaded) {
+            *usage = it->usage;
+            return true;
         }
     }
-    if (!db.commit()) {
-        qCritical() << "[DB] 提交消息序列迁移失败:" << messageTable
-                    << db.lastError().text();
+    return load(db, roomId, usage);
+}
+
+bool RoomFileQuotaLedger::reserve(QSqlDatabase &db, int roomId, qint64 fileSize, QString *error) {
+    if (fileSize <= 0) {
+        if (error) *error = QStringLiteral("文件大小无效");
         return false;
     }
-    return true;
+
+    Usage loaded;
+    bool fresh = false;
+    for (;;) {
+        // 读取已用量与写入预留在同一临界区内，避免并发上传同时通过检查
+        QMutexLocker locker(&m_mutex);
+        auto it = m_rooms.find(roomId);
+        const bool cached = it != m_rooms.end() && it->loaded;
+        if (!cached && !fresh) {
+            locker.unlock();
+            if (!load(db, roomId, &loaded)) {
+                if (error) *error = QStringLiteral("读取聊天室配额失败");
+                return false;
+            }
+            fresh = true;
+            continue;
+        }
+
+        if (it == m_rooms.end()) it = m_rooms.insert(roomId, Room());
+        Room &room = it.value();
+        // 未能装入时读到的值可能已包含正在提交的记录，此时对应预留被重复计算，只会偏严
+        const Usage &current = cached ? room.usage : loaded;
+        QString reason;
+        if (current.maxFileSize > 0 && fileSize > current.maxFileSize)
+            reason = QString("文件大小超过房间限制(%1MB)").arg(current.maxFileSize / 1024 / 1024);
+        else if (current.totalFileSpace > 0
+                 && current.usedBytes + room.reservedBytes + fileSize > current.totalFileSpace)
+            reason = QStringLiteral("聊天室总文件空间已达上限");
+        else if (current.maxFileCount > 0
+                 && current.fileCount + room.reservedCount + 1 > current.maxFileCount)
+            reason = QStringLiteral("聊天室文件数量已达上限");
+        if (!reason.isEmpty()) {
+            dropIfIdle(roomId);
+            if (error) *error = reason;
+            return false;
+        }
+
+        room.reservedBytes += fileSize;
+        ++room.reservedCount;
+        return true;
+    }
+}
+
+void RoomFileQuotaLedger::release(int roomId, qint64 fileSize) {
+    if (roomId <= 0 || fileSize <= 0) return;
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end()) return;
+    it->reservedBytes = qMax<qint64>(0, it->reservedBytes - fileSize);
+    it->reservedCount = qMax(0, it->reservedCount - 1);
+    dropIfIdle(roomId);
+}
+
+void RoomFileQuotaLedger::beginWrite(int roomId) {
+    // 写入前开始的加载可能读到提交前或提交后的状态，推进版本号使其放弃装入
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+}
+
+void RoomFileQuotaLedger::commit(int roomId, qint64 fileSize) {
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end()) return;
+    it->reservedBytes = qMax<qint64>(0, it->reservedBytes - fileSize);
+    it->reservedCount = qMax(0, it->reservedCount - 1);
+    if (it->loaded) {
+        it->usage.usedBytes += fileSize;
+        ++it->usage.fileCount;
+    }
+    dropIfIdle(roomId);
+}
+
+void RoomFileQuotaLedger::invalidate(int roomId) {
+    QMutexLocker locker(&m_mutex);
+    ++versionFor(roomId);
+    const auto it = m_rooms.find(roomId);
+    if (it == m_rooms.end()) return;
+    it->loaded = false;
+    dropIfIdle(roomId);
 }
+
+void RoomFileQuotaLedger::invalidateAll() {
+    QMutexLocker locker(&m_mutex);
+    for (quint64 &version : m_versions) ++version;
+    for (auto it = m_rooms.begin(); it != m_rooms.end();) {
+        it->loaded = false;
+        if (it->reservedBytes <= 0 && it->reservedCount <= 0)
+            it = m_rooms.erase(it);
+        else
+            ++it;
+    }
 }
 
 DatabaseManager::DatabaseManager(QObject *parent)
     : QObject(parent)
+    , m_roomSequences({QStringLiteral("messages"), QStringLiteral("room_id"),
+                       QStringLiteral("room_message_sequences"),
+                       QStringLiteral("room_message_deletion_events")})
+    , m_friendshipSequences({QStringLiteral("friend_messages"),
+                             QStringLiteral("friendship_id"),
+                             QStringLiteral("friendship_message_sequences"), QString()})
+    // 每个房间缓存的消息条数为 0 时关闭缓存
+    , m_roomHistory(boundedEnvironmentInt("CHATROOM_HISTORY_CACHE_MESSAGES", 0,
+                                          kMaxHistoryCacheMessages, kDefaultHistoryCacheMessages),
+                    boundedEnvironmentInt("CHATROOM_HISTORY_CACHE_ROOMS", 0,
+                                          kMaxHistoryCacheRooms, kDefaultHistoryCacheRooms))
+    , m_blobCache(boundedEnvironmentInt("CHATROOM_BLOB_CACHE_MB", 0, kMaxBlobCacheMb,
+                                        kDefaultBlobCacheMb) * 1024 * 1024)
 {
     // 默认将数据库文件放在可执行文件同目录
     m_dbPath = QCoreApplication::applicationDirPath() + "/chatroom.db";
@@ -426,10 +1486,38 @@ DatabaseManager::DatabaseManager(QObject *parent)
     // 可通过环境变量覆盖路径
     if (qEnvironmentVariableIsSet("CHATROOM_DB_PATH"))
         m_dbPath = qEnvironmentVariable("CHATROOM_DB_PATH");
+
+    // 消息组提交：繁忙时最多等待 windowUs 收集更多写入，单批最多 maxBatch 条
+    m_messageCommitWindowUs = boundedEnvironmentInt("CHATROOM_MESSAGE_COMMIT_WINDOW_US", 0,
+                                                    kMaxMessageCommitWindowUs,
+                                                    kDefaultMessageCommitWindowUs);
+    m_messageCommitMaxBatch = boundedEnvironmentInt("CHATROOM_MESSAGE_COMMIT_BATCH", 1,
+                                                    kMaxMessageCommitBatch,
+                                                    kDefaultMessageCommitMaxBatch);
 }
 
 DatabaseManager::~DatabaseManager() = default;
 
+void DatabaseManager::logStatementCacheStats() {
+    logStatementCacheSnapshot(statementCacheSnapshot());
+}
+
+StatementCacheCounters DatabaseManager::statementCacheCounters(const QString &statementId) {
+    StatementCacheCounters counters;
+    QMutexLocker locker(&g_statementStatsMutex);
+    const auto it = g_statementStats.find(statementId);
+    if (it == g_statementStats.end()) return counters;
+    const StatementStatsSnapshot snapshot = snapshotOf(*it->second);
+    counters.hits = snapshot.hits;
+    counters.misses = snapshot.misses;
+    counters.executions = snapshot.executions;
+    return counters;
+}
+
+void DatabaseManager::logRoomHistoryCacheStats() {
+    m_roomHistory.logStats();
+}
+
 QSqlDatabase DatabaseManager::getConnection() {
     QString connName = QStringLiteral("chatroom_conn_%1")
                            .arg(reinterpret_cast<quintptr>(QThread::currentThreadId()));
@@ -443,6 +1531,8 @@ QSqlDatabase DatabaseManager::getConnection() {
 
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connName);
     db.setDatabaseName(m_dbPath);
+    // 每个请求工作线程各持一个连接，写锁冲突时等待而不是立即失败
+    db.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=%1").arg(kBusyTimeoutMs));
 
     if (!db.open()) {
         qCritical() << "[DB] SQLite 打开失败:" << db.lastError().text();
@@ -584,16 +1674,21 @@ bool DatabaseManager::initialize() {
 
     // Expand/migrate deterministically from the durable high watermark. This is
     // restart-safe and never reuses a sequence removed by administration.
+    QHash<int, qint64> roomSequences;
     if (!migrateMessageSequences(db, QStringLiteral("messages"),
                                  QStringLiteral("room_id"),
                                  QStringLiteral("room_message_sequences"),
-                                 QStringLiteral("room_id"))) {
+                                 QStringLiteral("room_id"),
+                                 QStringLiteral("room_message_deletion_events"),
+                                 &roomSequences)) {
         return false;
     }
+    m_roomSequences.seed(roomSequences);
 
     // 消息索引
     q.exec("CREATE INDEX IF NOT EXISTS idx_msg_room_time ON messages(room_id, created_at)");
     q.exec("CREATE INDEX IF NOT EXISTS idx_messages_room_id_id ON messages(room_id, id)");
+    q.exec("CREATE INDEX IF NOT EXISTS idx_messages_file_id ON messages(file_id) WHERE file_id > 0");
     if (!q.exec("CREATE UNIQUE INDEX IF NOT EXISTS idx_messages_room_sequence "
                 "ON messages(room_id, sequence) WHERE sequence IS NOT NULL") ||
         !q.exec("CREATE INDEX IF NOT EXISTS idx_messages_room_mutation_sequence "
@@ -627,6 +1722,7 @@ bool DatabaseManager::initialize() {
         q.exec("ALTER TABLE files ADD COLUMN cos_url TEXT DEFAULT ''");
         q.exec("CREATE INDEX IF NOT EXISTS idx_files_room_active "
                "ON files(room_id, cleared, created_at, id)");
+        q.exec("CREATE INDEX IF NOT EXISTS idx_files_expiry ON files(cleared, created_at)");
 
     // 房间管理员表
     q.exec("CREATE TABLE IF NOT EXISTS room_admins ("
@@ -776,6 +1872,8 @@ bool DatabaseManager::initialize() {
     q.exec("CREATE INDEX IF NOT EXISTS idx_friend_msg_time ON friend_messages(friendship_id, created_at)");
     q.exec("CREATE INDEX IF NOT EXISTS idx_friend_messages_friendship_id_id "
            "ON friend_messages(friendship_id, id)");
+    q.exec("CREATE INDEX IF NOT EXISTS idx_friend_messages_file_id "
+           "ON friend_messages(file_id) WHERE file_id > 0");
 
     q.exec("ALTER TABLE friend_messages ADD COLUMN file_cleared INTEGER DEFAULT 0");
     q.exec("ALTER TABLE friend_messages ADD COLUMN clear_reason TEXT DEFAULT ''");
@@ -799,12 +1897,15 @@ bool DatabaseManager::initialize() {
         qCritical() << "[DB] 创建私聊消息序列表失败:" << q.lastError().text();
         return false;
     }
+    QHash<int, qint64> friendshipSequences;
     if (!migrateMessageSequences(db, QStringLiteral("friend_messages"),
                                  QStringLiteral("friendship_id"),
                                  QStringLiteral("friendship_message_sequences"),
-                                 QStringLiteral("friendship_id"))) {
+                                 QStringLiteral("friendship_id"),
+                                 QString(), &friendshipSequences)) {
         return false;
     }
+    m_friendshipSequences.seed(friendshipSequences);
     if (!q.exec("CREATE UNIQUE INDEX IF NOT EXISTS idx_friend_messages_friendship_sequence "
                 "ON friend_messages(friendship_id, sequence) WHERE sequence IS NOT NULL") ||
         !q.exec("CREATE INDEX IF NOT EXISTS idx_friend_messages_mutation_sequence "
@@ -817,6 +1918,95 @@ bool DatabaseManager::initialize() {
         return false;
     }
 
+    // 物化未读计数：消息写入/删除时由触发器维护，标记已读时清零，
+    // 房间/好友列表一次查询即可取回全部未读数，不再逐会话 COUNT(*)
+    const bool roomUnreadAdded = q.exec(
+        "ALTER TABLE room_members ADD COLUMN unread_count INTEGER NOT NULL DEFAULT 0");
+    const bool friendUnreadAdded1 = q.exec(
+        "ALTER TABLE friendships ADD COLUMN user1_unread_count INTEGER NOT NULL DEFAULT 0");
+    const bool friendUnreadAdded2 = q.exec(
+        "ALTER TABLE friendships ADD COLUMN user2_unread_count INTEGER NOT NULL DEFAULT 0");
+    if (roomUnreadAdded
+        && !q.exec("UPDATE room_members SET unread_count = "
+                   "(SELECT COUNT(*) FROM messages m WHERE m.room_id = room_members.room_id "
+                   " AND m.id > COALESCE(room_members.last_read_msg_id, 0))")) {
+        qCritical() << "[DB] 回填房间未读计数失败:" << q.lastError().text();
+        return false;
+    }
+    if ((friendUnreadAdded1 || friendUnreadAdded2)
+        && !q.exec("UPDATE friendships SET "
+                   "user1_unread_count = (SELECT COUNT(*) FROM friend_messages m "
+                   " WHERE m.friendship_id = friendships.id "
+                   " AND m.id > COALESCE(friendships.user1_last_read_msg_id, 0)), "
+                   "user2_unread_count = (SELECT COUNT(*) FROM friend_messages m "
+                   " WHERE m.friendship_id = friendships.id "
+                   " AND m.id > COALESCE(friendships.user2_last_read_msg_id, 0))")) {
+        qCritical() << "[DB] 回填好友未读计数失败:" << q.lastError().text();
+        return false;
+    }
+    if (!q.exec("CREATE TRIGGER IF NOT EXISTS trg_messages_unread_insert "
+                "AFTER INSERT ON messages BEGIN "
+                "  UPDATE room_members SET unread_count = unread_count + 1 "
+                "  WHERE room_id = NEW.room_id AND COALESCE(last_read_msg_id, 0) < NEW.id; "
+                "END") ||
+        !q.exec("CREATE TRIGGER IF NOT EXISTS trg_messages_unread_delete "
+                "AFTER DELETE ON messages BEGIN "
+                "  UPDATE room_members SET unread_count = MAX(unread_count - 1, 0) "
+                "  WHERE room_id = OLD.room_id AND COALESCE(last_read_msg_id, 0) < OLD.id; "
+                "END") ||
+        !q.exec("CREATE TRIGGER IF NOT EXISTS trg_room_members_unread_init "
+                "AFTER INSERT ON room_members BEGIN "
+                "  UPDATE room_members SET unread_count = "
+                "    (SELECT COUNT(*) FROM messages "
+                "     WHERE room_id = NEW.room_id AND id > COALESCE(NEW.last_read_msg_id, 0)) "
+                "  WHERE room_id = NEW.room_id AND user_id = NEW.user_id; "
+                "END") ||
+        !q.exec("CREATE TRIGGER IF NOT EXISTS trg_friend_messages_unread_insert "
+                "AFTER INSERT ON friend_messages BEGIN "
+                "  UPDATE friendships SET "
+                "    user1_unread_count = user1_unread_count "
+                "      + (COALESCE(user1_last_read_msg_id, 0) < NEW.id), "
+                "    user2_unread_count = user2_unread_count "
+                "      + (COALESCE(user2_last_read_msg_id, 0) < NEW.id) "
+                "  WHERE id = NEW.friendship_id; "
+                "END") ||
+        !q.exec("CREATE TRIGGER IF NOT EXISTS trg_friend_messages_unread_delete "
+                "AFTER DELETE ON friend_messages BEGIN "
+                "  UPDATE friendships SET "
+                "    user1_unread_count = MAX(user1_unread_count "
+                "      - (COALESCE(user1_last_read_msg_id, 0) < OLD.id), 0), "
+                "    user2_unread_count = MAX(user2_unread_count "
+                "      - (COALESCE(user2_last_read_msg_id, 0) < OLD.id), 0) "
+                "  WHERE id = OLD.friendship_id; "
+                "END")) {
+        qCritical() << "[DB] 创建未读计数触发器失败:" << q.lastError().text();
+        return false;
+    }
+
+    // 序列号由内存分配器发放，写消息时不再更新高水位表；删除消息时由触发器把被删除的
+    // 序列号并入高水位，保证重启重建时不会复用已删除消息的序列号。会话本身被级联删除时跳过。
+    if (!q.exec("CREATE TRIGGER IF NOT EXISTS trg_messages_sequence_watermark "
+                "AFTER DELETE ON messages "
+                "WHEN EXISTS (SELECT 1 FROM rooms WHERE id = OLD.room_id) BEGIN "
+                "  INSERT INTO room_message_sequences (room_id, last_sequence) "
+                "  VALUES (OLD.room_id, MAX(COALESCE(OLD.sequence, 0), "
+                "                           COALESCE(OLD.mutation_sequence, 0))) "
+                "  ON CONFLICT(room_id) DO UPDATE SET "
+                "    last_sequence = MAX(last_sequence, excluded.last_sequence); "
+                "END") ||
+        !q.exec("CREATE TRIGGER IF NOT EXISTS trg_friend_messages_sequence_watermark "
+                "AFTER DELETE ON friend_messages "
+                "WHEN EXISTS (SELECT 1 FROM friendships WHERE id = OLD.friendship_id) BEGIN "
+                "  INSERT INTO friendship_message_sequences (friendship_id, last_sequence) "
+                "  VALUES (OLD.friendship_id, MAX(COALESCE(OLD.sequence, 0), "
+                "                                 COALESCE(OLD.mutation_sequence, 0))) "
+                "  ON CONFLICT(friendship_id) DO UPDATE SET "
+                "    last_sequence = MAX(last_sequence, excluded.last_sequence); "
+                "END")) {
+        qCritical() << "[DB] 创建消息序列高水位触发器失败:" << q.lastError().text();
+        return false;
+    }
+
     // 好友文件表
     q.exec("CREATE TABLE IF NOT EXISTS friend_files ("
            "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
@@ -836,26 +2026,115 @@ bool DatabaseManager::initialize() {
     q.exec("ALTER TABLE friend_files ADD COLUMN clear_reason TEXT DEFAULT ''");
     q.exec("ALTER TABLE friend_files ADD COLUMN cleared_at TIMESTAMP DEFAULT NULL");
     q.exec("ALTER TABLE friend_files ADD COLUMN cos_url TEXT DEFAULT ''");
+    q.exec("CREATE INDEX IF NOT EXISTS idx_friend_files_expiry ON friend_files(cleared, created_at)");
+
+    // 内容寻址 blob 表：缩略图与头像按 SHA-256 去重存储，消息行与头像表只引用哈希
+    if (!q.exec("CREATE TABLE IF NOT EXISTS blobs ("
+                "  hash TEXT PRIMARY KEY,"
+                "  data BLOB NOT NULL,"
+                "  size INTEGER NOT NULL,"
+                "  created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
+                ")")) {
+        qCritical() << "[DB] 创建 blob 表失败:" << q.lastError().text();
+        return false;
+    }
+    const QList<QPair<QString, QString>> blobColumns = {
+        {QStringLiteral("messages"), QStringLiteral("thumbnail")},
+        {QStringLiteral("friend_messages"), QStringLiteral("thumbnail")},
+        {QStringLiteral("user_avatars"), QStringLiteral("avatar")},
+        {QStringLiteral("room_avatars"), QStringLiteral("avatar")},
+    };
+    for (const auto &column : blobColumns) {
+        if (!ensureColumn(db, column.first, column.second + QStringLiteral("_hash"),
+                          QStringLiteral("TEXT DEFAULT ''")) ||
+            !ensureColumn(db, column.first, column.second + QStringLiteral("_size"),
+                          QStringLiteral("INTEGER DEFAULT 0"))) {
+            qCritical() << "[DB] 扩展 blob 引用列失败:" << column.first << db.lastError().text();
+            return false;
+        }
+        // 回收无引用 blob 时按哈希反查引用
+        q.exec(QStringLiteral("CREATE INDEX IF NOT EXISTS idx_%1_%2_hash ON %1(%2_hash)")
+                   .arg(column.first, column.second));
+    }
+    if (!migrateInlineThumbnails(db, QStringLiteral("messages")) ||
+        !migrateInlineThumbnails(db, QStringLiteral("friend_messages")) ||
+        !migrateAvatarBlobs(db, QStringLiteral("user_avatars"), QStringLiteral("user_id")) ||
+        !migrateAvatarBlobs(db, QStringLiteral("room_avatars"), QStringLiteral("room_id"))) {
+        qCritical() << "[DB] 迁移内联缩略图或头像失败:" << db.lastError().text();
+        return false;
+    }
 
-    expireStoredFiles();
+    // 文件内容寻址存储：相同内容的上传与转发在磁盘上只存一份，文件记录按 content_hash 引用；
+    // ref_count 由触发器随记录的插入、清除与删除（含房间/好友关系的级联删除）维护，
+    // 旧记录 content_hash 为空，仍按各自的 file_path 单独存放与删除
+    if (!q.exec("CREATE TABLE IF NOT EXISTS file_blobs ("
+                "  hash TEXT PRIMARY KEY,"
+                "  file_path TEXT NOT NULL,"
+                "  file_size INTEGER NOT NULL,"
+                "  ref_count INTEGER NOT NULL DEFAULT 0,"
+                "  created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP"
+                ")") ||
+        !q.exec("CREATE INDEX IF NOT EXISTS idx_file_blobs_unreferenced "
+                "ON file_blobs(ref_count) WHERE ref_count = 0")) {
+        qCritical() << "[DB] 创建文件 blob 表失败:" << q.lastError().text();
+        return false;
+    }
+    for (const QString &fileTable : {QStringLiteral("files"), QStringLiteral("friend_files")}) {
+        if (!ensureColumn(db, fileTable, QStringLiteral("content_hash"),
+                          QStringLiteral("TEXT DEFAULT ''")) ||
+            !q.exec(QStringLiteral(
+                "CREATE TRIGGER IF NOT EXISTS trg_%1_blob_ref_insert "
+                "AFTER INSERT ON %1 WHEN NEW.content_hash != '' AND NEW.cleared = 0 BEGIN "
+                "  UPDATE file_blobs SET ref_count = ref_count + 1 WHERE hash = NEW.content_hash; "
+                "END").arg(fileTable)) ||
+            !q.exec(QStringLiteral(
+                "CREATE TRIGGER IF NOT EXISTS trg_%1_blob_ref_clear "
+                "AFTER UPDATE OF cleared ON %1 "
+                "WHEN OLD.content_hash != '' AND OLD.cleared = 0 AND NEW.cleared != 0 BEGIN "
+                "  UPDATE file_blobs SET ref_count = MAX(ref_count - 1, 0) "
+                "  WHERE hash = OLD.content_hash; "
+                "END").arg(fileTable)) ||
+            !q.exec(QStringLiteral(
+                "CREATE TRIGGER IF NOT EXISTS trg_%1_blob_ref_delete "
+                "AFTER DELETE ON %1 WHEN OLD.content_hash != '' AND OLD.cleared = 0 BEGIN "
+                "  UPDATE file_blobs SET ref_count = MAX(ref_count - 1, 0) "
+                "  WHERE hash = OLD.content_hash; "
+                "END").arg(fileTable))) {
+            qCritical() << "[DB] 创建文件引用计数触发器失败:" << fileTable << q.lastError().text();
+            return false;
+        }
+    }
 
     m_initialized = true;
     qInfo() << "[DB] SQLite 数据库初始化完成，路径:" << m_dbPath;
     return true;
 }
 
-QStringList DatabaseManager::expireStoredFiles() {
+FileExpiryBatch DatabaseManager::expireStoredFiles(int batchSize) {
     static QMutex expireMutex;
     QMutexLocker locker(&expireMutex);
 
+    FileExpiryBatch batch;
     QSqlDatabase db = getConnection();
-    if (!db.isOpen())
-        return {};
-
-    QStringList cosUrls;
-    markExpiredFiles(db, QStringLiteral("files"), QStringLiteral("messages"), kExpiredFileReason, cosUrls);
-    markExpiredFiles(db, QStringLiteral("friend_files"), QStringLiteral("friend_messages"), kExpiredFileReason, cosUrls);
-    return cosUrls;
+    if (!db.isOpen() || batchSize <= 0)
+        return batch;
+
+    int roomExpired = 0;
+    int friendExpired = 0;
+    markExpiredFiles(db, QStringLiteral("files"), QStringLiteral("messages"),
+                     kExpiredFileReason, batchSize, batch.cosUrls, &roomExpired);
+    markExpiredFiles(db, QStringLiteral("friend_files"), QStringLiteral("friend_messages"),
+                     kExpiredFileReason, batchSize, batch.cosUrls, &friendExpired);
+    // 过期批次跨越多个房间，直接清空房间消息缓存与配额账本
+    if (roomExpired > 0) {
+        m_roomHistory.invalidateAll();
+        m_roomFileQuota.invalidateAll();
+    }
+    batch.expiredCount = roomExpired + friendExpired;
+    batch.hasMore = roomExpired >= batchSize || friendExpired >= batchSize;
+    // 删除消息和更换头像会留下无引用的 blob，随过期任务逐段回收
+    batch.prunedBlobCount = sweepUnreferencedBlobs(db, kBlobSweepBatch, &m_blobSweepCursor);
+    return batch;
 }
 
 // ==================== 用户管理 ====================
@@ -1000,7 +2279,10 @@ bool DatabaseManager::setDisplayName(int userId, const QString &newDisplayName)
     q.prepare("UPDATE users SET display_name = ? WHERE id = ?");
     q.addBindValue(newDisplayName);
     q.addBindValue(userId);
-    return q.exec();
+    if (!q.exec()) return false;
+    // 缓存的消息记录带有发送者昵称
+    m_roomHistory.invalidateAll();
+    return true;
 }
 
 QString DatabaseManager::getUniqueId(int userId) {
@@ -1031,7 +2313,9 @@ bool DatabaseManager::changeUniqueId(int userId, const QString &newUniqueId) {
     q.prepare("UPDATE users SET username = ?, last_uid_change = datetime('now') WHERE id = ?");
     q.addBindValue(newUniqueId);
     q.addBindValue(userId);
-    return q.exec();
+    if (!q.exec()) return false;
+    m_roomHistory.invalidateAll();
+    return true;
 }
 
 // ==================== 房间管理 ====================
@@ -1127,7 +2411,10 @@ bool DatabaseManager::deleteRoom(int roomId) {
     // CASCADE 会自动删除 room_members, messages, files, room_admins, room_settings
     q.prepare("DELETE FROM rooms WHERE id = ?");
     q.addBindValue(roomId);
-    return q.exec();
+    if (!q.exec()) return false;
+    m_roomHistory.invalidate(roomId);
+    m_roomFileQuota.invalidate(roomId);
+    return true;
 }
 
 QString DatabaseManager::getRoomName(int roomId) {
@@ -1163,12 +2450,11 @@ int DatabaseManager::getRoomMemberCount(int roomId) {
 
 bool DatabaseManager::isUserInRoom(int roomId, int userId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT 1 FROM room_members WHERE room_id = ? AND user_id = ?");
-    q.addBindValue(roomId);
-    q.addBindValue(userId);
-    q.exec();
-    return q.next();
+    CachedQuery q(db, QStringLiteral("room.member.exists"),
+                  "SELECT 1 FROM room_members WHERE room_id = ? AND user_id = ?");
+    q->addBindValue(roomId);
+    q->addBindValue(userId);
+    return q.exec() && q->next();
 }
 
 QJsonArray DatabaseManager::getRoomMembers(int roomId) {
@@ -1281,24 +2567,42 @@ QJsonArray DatabaseManager::searchRooms(const QString &keyword, int limit) {
 // ==================== 聊天室头像 ====================
 
 QByteArray DatabaseManager::getRoomAvatar(int roomId) {
+    return getBlob(getRoomAvatarRef(roomId).hash);
+}
+
+BlobRef DatabaseManager::getRoomAvatarRef(int roomId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT avatar_data FROM room_avatars WHERE room_id = ?");
-    q.addBindValue(roomId);
-    q.exec();
-    if (q.next())
-        return q.value(0).toByteArray();
-    return {};
+    CachedQuery q(db, QStringLiteral("room.avatar.ref"),
+                  "SELECT avatar_hash, avatar_size FROM room_avatars WHERE room_id = ?");
+    q->addBindValue(roomId);
+    BlobRef ref;
+    if (q.exec() && q->next()) {
+        ref.hash = q->value(0).toString();
+        ref.size = q->value(1).toLongLong();
+    }
+    return ref;
 }
 
-bool DatabaseManager::setRoomAvatar(int roomId, const QByteArray &avatarData) {
+bool DatabaseManager::setRoomAvatar(int roomId, const QByteArray &avatarData, BlobRef *ref) {
     QSqlDatabase db = getConnection();
+    if (!beginWriteTransaction(db)) return false;
+    BlobRef stored;
+    if (!storeBlob(db, avatarData, &stored)) {
+        db.rollback();
+        return false;
+    }
     QSqlQuery q(db);
-    q.prepare("INSERT OR REPLACE INTO room_avatars (room_id, avatar_data, updated_at) "
-              "VALUES (?, ?, CURRENT_TIMESTAMP)");
+    q.prepare("INSERT OR REPLACE INTO room_avatars (room_id, avatar_hash, avatar_size, updated_at) "
+              "VALUES (?, ?, ?, CURRENT_TIMESTAMP)");
     q.addBindValue(roomId);
-    q.addBindValue(avatarData);
-    return q.exec();
+    q.addBindValue(stored.hash);
+    q.addBindValue(stored.size);
+    if (!q.exec() || !db.commit()) {
+        db.rollback();
+        return false;
+    }
+    if (ref) *ref = stored;
+    return true;
 }
 
 // ==================== 消息管理 ====================
@@ -1309,53 +2613,65 @@ int DatabaseManager::saveMessage(int roomId, int userId, const QString &content,
                                   const QString &thumbnail, qint64 *sequenceOut,
                                   qint64 *timestampOut) {
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) {
+    if (!beginWriteTransaction(db)) {
         qWarning() << "[DB] 开启消息保存事务失败:" << db.lastError().text();
         return -1;
     }
 
     qint64 sequence = 0;
-    if (!reserveMessageSequence(db, QStringLiteral("room_message_sequences"),
-                                QStringLiteral("room_id"), roomId, &sequence)) {
+    if (!m_roomSequences.reserve(db, roomId, &sequence)) {
         qWarning() << "[DB] 分配房间消息序列失败:" << db.lastError().text();
         db.rollback();
         return -1;
     }
+    BlobRef thumbnailRef;
+    if (!storeThumbnailBlob(db, thumbnail, &thumbnailRef)) {
+        db.rollback();
+        return -1;
+    }
 
-    QSqlQuery q(db);
-    q.prepare("INSERT INTO messages (room_id, user_id, content, content_type, file_name, file_size, file_id, thumbnail, sequence)"
-              " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
-    q.addBindValue(roomId);
-    q.addBindValue(userId);
-    q.addBindValue(content);
-    q.addBindValue(contentType);
-    q.addBindValue(fileName);
-    q.addBindValue(fileSize);
-    q.addBindValue(fileId);
-    q.addBindValue(thumbnail);
-    q.addBindValue(sequence);
+    CachedQuery q(db, QStringLiteral("room.message.insert"),
+                  "INSERT INTO messages (room_id, user_id, content, content_type, file_name, file_size, file_id, thumbnail_hash, thumbnail_size, sequence)"
+                  " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    q->addBindValue(roomId);
+    q->addBindValue(userId);
+    q->addBindValue(content);
+    q->addBindValue(contentType);
+    q->addBindValue(fileName);
+    q->addBindValue(fileSize);
+    q->addBindValue(fileId);
+    q->addBindValue(thumbnailRef.hash);
+    q->addBindValue(thumbnailRef.size);
+    q->addBindValue(sequence);
 
     if (q.exec()) {
-        const int messageId = q.lastInsertId().toInt();
+        const int messageId = q->lastInsertId().toInt();
         qint64 timestamp = 0;
         if (timestampOut) {
-            QSqlQuery created(db);
-            created.prepare("SELECT created_at FROM messages WHERE id = ?");
-            created.addBindValue(messageId);
-            if (!created.exec() || !created.next()) {
+            CachedQuery created(db, QStringLiteral("room.message.created_at"),
+                                "SELECT created_at FROM messages WHERE id = ?");
+            created->addBindValue(messageId);
+            if (!created.exec() || !created->next()) {
                 db.rollback();
                 return -1;
             }
-            timestamp = utcTimestampMs(created.value(0));
+            timestamp = utcTimestampMs(created->value(0));
         }
-        if (db.commit()) {
+        const QJsonObject record = stageRoomHistoryAppend(db, roomId, messageId);
+        const bool committed = db.commit();
+        if (committed) {
+            m_roomSequences.publish(roomId, sequence);
+            m_roomHistory.append(roomId, record);
+        }
+        m_roomHistory.endWrite(roomId);
+        if (committed) {
             if (sequenceOut) *sequenceOut = sequence;
             if (timestampOut) *timestampOut = timestamp;
             return messageId;
         }
     }
 
-    qWarning() << "[DB] 保存消息失败:" << q.lastError().text();
+    qWarning() << "[DB] 保存消息失败:" << q->lastError().text();
     db.rollback();
     return -1;
 }
@@ -1363,76 +2679,127 @@ int DatabaseManager::saveMessage(int roomId, int userId, const QString &content,
 MessageSaveResult DatabaseManager::saveRoomMessageIdempotent(
     int roomId, int userId, const QString &clientMessageId,
     const QString &content, const QString &contentType) {
-    MessageSaveResult result;
-    QSqlDatabase db = getConnection();
-    if (!db.transaction()) {
-        qWarning() << "[DB] 开启幂等消息事务失败:" << db.lastError().text();
-        return result;
-    }
+    PendingMessageWrite write;
+    write.ownerId = roomId;
+    write.senderId = userId;
+    write.clientMessageId = clientMessageId;
+    write.content = content;
+    write.contentType = contentType;
+    return submitMessageWrite(write);
+}
 
-    QSqlQuery existing(db);
-    existing.prepare("SELECT id, room_id, content, content_type, sequence, created_at "
-                     "FROM messages WHERE user_id = ? AND client_message_id = ?");
-    existing.addBindValue(userId);
-    existing.addBindValue(clientMessageId);
-    if (!existing.exec()) {
-        qWarning() << "[DB] 查询幂等消息失败:" << existing.lastError().text();
-        db.rollback();
-        return result;
+MessageSaveResult DatabaseManager::submitMessageWrite(PendingMessageWrite &write) {
+    QMutexLocker locker(&m_messageWriteMutex);
+    m_pendingMessageWrites.append(&write);
+    if (m_pendingMessageWrites.size() >= m_messageCommitMaxBatch)
+        m_messageWriteBatchFull.wakeOne();
+
+    // 领导者/跟随者组提交：没有批次在提交时由当前线程担任领导者，收集队列中的写入后
+    // 在一个事务内提交；其余线程等待自己的写入被某个领导者完成。
+    while (!write.done) {
+        if (m_messageWriteLeaderActive) {
+            m_messageWriteDone.wait(&m_messageWriteMutex);
+            continue;
+        }
+        m_messageWriteLeaderActive = true;
+
+        // 上一批只有一条时视为空闲，不额外等待，避免单发消息增加延迟
+        if (m_messageCommitWindowUs > 0 && m_lastMessageCommitBatchSize > 1) {
+            QDeadlineTimer deadline(std::chrono::microseconds(m_messageCommitWindowUs),
+                                    Qt::PreciseTimer);
+            while (m_pendingMessageWrites.size() < m_messageCommitMaxBatch &&
+                   !deadline.hasExpired()) {
+                m_messageWriteBatchFull.wait(&m_messageWriteMutex, deadline);
+            }
+        }
+
+        const QList<PendingMessageWrite *> batch =
+            m_pendingMessageWrites.mid(0, m_messageCommitMaxBatch);
+        m_pendingMessageWrites.remove(0, batch.size());
+
+        locker.unlock();
+        commitMessageWriteBatch(batch);
+        locker.relock();
+
+        for (PendingMessageWrite *item : batch) item->done = true;
+        m_lastMessageCommitBatchSize = batch.size();
+        ++m_messageCommitBatches;
+        m_messageCommitItems += static_cast<quint64>(batch.size());
+        m_messageCommitMaxObserved = qMax(m_messageCommitMaxObserved, static_cast<int>(batch.size()));
+        if ((m_messageCommitBatches & (m_messageCommitBatches - 1)) == 0 &&
+            m_messageCommitBatches >= 1024) {
+            qInfo().noquote()
+                << QStringLiteral("[DB] group-commit batches=%1 messages=%2 avgBatch=%3 maxBatch=%4")
+                       .arg(m_messageCommitBatches)
+                       .arg(m_messageCommitItems)
+                       .arg(static_cast<double>(m_messageCommitItems) /
+                                static_cast<double>(m_messageCommitBatches), 0, 'f', 2)
+                       .arg(m_messageCommitMaxObserved);
+        }
+        m_messageWriteLeaderActive = false;
+        m_messageWriteDone.wakeAll();
     }
-    if (existing.next()) {
-        result.messageId = existing.value(0).toInt();
-        result.sequence = existing.value(4).toLongLong();
-        result.createdAtMs = utcTimestampMs(existing.value(5));
-        const bool sameCommand = existing.value(1).toInt() == roomId &&
-                                 existing.value(2).toString() == content &&
-                                 existing.value(3).toString() == contentType;
-        result.status = sameCommand ? MessageSaveResult::Status::Duplicate
-                                    : MessageSaveResult::Status::Conflict;
-        if (!db.commit()) result.status = MessageSaveResult::Status::Failed;
-        return result;
+    return write.result;
+}
+
+void DatabaseManager::commitMessageWriteBatch(const QList<PendingMessageWrite *> &batch) {
+    QSqlDatabase db = getConnection();
+    if (!beginWriteTransaction(db)) {
+        qWarning() << "[DB] 开启消息组提交事务失败:" << db.lastError().text();
+        for (PendingMessageWrite *write : batch) write->result = MessageSaveResult{};
+        return;
     }
 
-    if (!reserveMessageSequence(db, QStringLiteral("room_message_sequences"),
-                                QStringLiteral("room_id"), roomId,
-                                &result.sequence)) {
-        qWarning() << "[DB] 分配幂等消息序列失败:" << db.lastError().text();
-        db.rollback();
-        return result;
+    for (PendingMessageWrite *write : batch) {
+        if (!execSavepointStatement(db, QStringLiteral("group_commit.savepoint"),
+                                    QStringLiteral("SAVEPOINT message_write"))) {
+            write->result = MessageSaveResult{};
+            continue;
+        }
+        write->result = write->friendMessage
+                            ? writeFriendMessage(db, m_friendshipSequences, write->ownerId,
+                                                 write->senderId, write->clientMessageId,
+                                                 write->content, write->contentType)
+                            : writeRoomMessage(db, m_roomSequences, write->ownerId,
+                                               write->senderId, write->clientMessageId,
+                                               write->content, write->contentType);
+        // 单条失败只回滚自己的序列号与插入，不影响同批其他消息
+        if (write->result.status == MessageSaveResult::Status::Failed) {
+            execSavepointStatement(db, QStringLiteral("group_commit.rollback_to"),
+                                   QStringLiteral("ROLLBACK TO message_write"));
+        }
+        execSavepointStatement(db, QStringLiteral("group_commit.release"),
+                               QStringLiteral("RELEASE message_write"));
     }
 
-    QSqlQuery insert(db);
-    insert.prepare("INSERT INTO messages "
-                   "(room_id, user_id, content, content_type, client_message_id, sequence) "
-                   "VALUES (?, ?, ?, ?, ?, ?)");
-    insert.addBindValue(roomId);
-    insert.addBindValue(userId);
-    insert.addBindValue(content);
-    insert.addBindValue(contentType);
-    insert.addBindValue(clientMessageId);
-    insert.addBindValue(result.sequence);
-    if (!insert.exec()) {
-        qWarning() << "[DB] 保存幂等消息失败:" << insert.lastError().text();
-        db.rollback();
-        return result;
+    // 提交前仍在写事务内：读取新消息的完整记录，提交成功后再追加到房间缓存
+    QList<QJsonObject> records(batch.size());
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+        const PendingMessageWrite *write = batch.at(i);
+        if (write->friendMessage || write->result.status != MessageSaveResult::Status::Created)
+            continue;
+        records[i] = stageRoomHistoryAppend(db, write->ownerId, write->result.messageId);
     }
-    result.messageId = insert.lastInsertId().toInt();
 
-    QSqlQuery created(db);
-    created.prepare("SELECT created_at FROM messages WHERE id = ?");
-    created.addBindValue(result.messageId);
-    if (!created.exec() || !created.next()) {
-        qWarning() << "[DB] 读取新消息时间失败:" << created.lastError().text();
+    const bool committed = db.commit();
+    if (!committed) {
+        qWarning() << "[DB] 提交消息组提交事务失败:" << batch.size() << db.lastError().text();
         db.rollback();
-        return MessageSaveResult{};
     }
-    result.createdAtMs = utcTimestampMs(created.value(0));
-    if (!db.commit()) {
-        qWarning() << "[DB] 提交幂等消息失败:" << db.lastError().text();
-        return MessageSaveResult{};
+    for (qsizetype i = 0; i < batch.size(); ++i) {
+        PendingMessageWrite *write = batch.at(i);
+        if (write->result.status != MessageSaveResult::Status::Created) continue;
+        if (write->friendMessage) {
+            if (committed) m_friendshipSequences.publish(write->ownerId, write->result.sequence);
+        } else {
+            if (committed) {
+                m_roomSequences.publish(write->ownerId, write->result.sequence);
+                m_roomHistory.append(write->ownerId, records.at(i));
+            }
+            m_roomHistory.endWrite(write->ownerId);
+        }
+        if (!committed) write->result = MessageSaveResult{};
     }
-    result.status = MessageSaveResult::Status::Created;
-    return result;
 }
 
 MessageSaveResult DatabaseManager::findRoomAttachmentByClientMessageId(
@@ -1467,7 +2834,7 @@ MessageSaveResult DatabaseManager::saveRoomAttachmentIdempotent(
     qint64 fileSize, int fileId, const QString &thumbnail) {
     MessageSaveResult result;
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) return result;
+    if (!beginWriteTransaction(db)) return result;
 
     QSqlQuery existing(db);
     existing.prepare(
@@ -1495,17 +2862,17 @@ MessageSaveResult DatabaseManager::saveRoomAttachmentIdempotent(
         return result;
     }
 
-    if (!reserveMessageSequence(db, QStringLiteral("room_message_sequences"),
-                                QStringLiteral("room_id"), roomId,
-                                &result.sequence)) {
+    BlobRef thumbnailRef;
+    if (!m_roomSequences.reserve(db, roomId, &result.sequence) ||
+        !storeThumbnailBlob(db, thumbnail, &thumbnailRef)) {
         db.rollback();
         return result;
     }
     QSqlQuery insert(db);
     insert.prepare(
         "INSERT INTO messages "
-        "(room_id, user_id, content, content_type, file_name, file_size, file_id, thumbnail, "
-        " client_message_id, sequence) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        "(room_id, user_id, content, content_type, file_name, file_size, file_id, thumbnail_hash, "
+        " thumbnail_size, client_message_id, sequence) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
     insert.addBindValue(roomId);
     insert.addBindValue(userId);
     insert.addBindValue(fileName);
@@ -1513,7 +2880,8 @@ MessageSaveResult DatabaseManager::saveRoomAttachmentIdempotent(
     insert.addBindValue(fileName);
     insert.addBindValue(fileSize);
     insert.addBindValue(fileId);
-    insert.addBindValue(thumbnail);
+    insert.addBindValue(thumbnailRef.hash);
+    insert.addBindValue(thumbnailRef.size);
     insert.addBindValue(clientMessageId);
     insert.addBindValue(result.sequence);
     if (!insert.exec()) {
@@ -1530,111 +2898,129 @@ MessageSaveResult DatabaseManager::saveRoomAttachmentIdempotent(
         return MessageSaveResult{};
     }
     result.createdAtMs = utcTimestampMs(created.value(0));
-    if (!db.commit()) return MessageSaveResult{};
+    const QJsonObject record = stageRoomHistoryAppend(db, roomId, result.messageId);
+    if (!db.commit()) {
+        db.rollback();
+        m_roomHistory.endWrite(roomId);
+        return MessageSaveResult{};
+    }
+    m_roomSequences.publish(roomId, result.sequence);
+    m_roomHistory.append(roomId, record);
+    m_roomHistory.endWrite(roomId);
     result.status = MessageSaveResult::Status::Created;
     return result;
 }
 
 QJsonArray DatabaseManager::getMessageHistory(int roomId, int count, qint64 beforeTimestamp) {
-    expireStoredFiles();
-    QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-
-    // 用子查询取最新N条（DESC），再按时间正序排列（ASC）
-    QString sql = "SELECT * FROM ("
-                  "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id,"
-                  "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail,"
-                  "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id,"
-                  "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0))"
-                  " FROM messages m JOIN users u ON m.user_id = u.id"
-                  " WHERE m.room_id = ?";
-
-    if (beforeTimestamp > 0)
-        sql += " AND m.created_at < datetime(? / 1000, 'unixepoch')";
-
-    sql += " ORDER BY m.sequence DESC LIMIT ?"
-           ") ORDER BY sequence ASC";
+    // 不带 before 的最新一页优先由热点房间缓存回答；未缓存时加载窗口后直接由窗口回答
+    if (beforeTimestamp <= 0 && m_roomHistory.enabled() &&
+        count <= m_roomHistory.messagesPerRoom()) {
+        QJsonArray messages;
+        if (m_roomHistory.latest(roomId, count, &messages)) {
+            m_roomHistory.recordLookup(true);
+            return messages;
+        }
+        m_roomHistory.recordLookup(false);
+        RoomHistoryCache::Window window;
+        if (!m_roomHistory.contains(roomId) && loadRoomHistoryWindow(roomId, &window) &&
+            RoomHistoryCache::latestFrom(window, count, &messages)) {
+            return messages;
+        }
+    }
 
-    q.prepare(sql);
-    q.addBindValue(roomId);
+    QSqlDatabase db = getConnection();
+    // 是否带时间上限对应两条不同的 SQL，分别缓存
+    CachedQuery q(db, beforeTimestamp > 0 ? QStringLiteral("room.history.before_time")
+                                          : QStringLiteral("room.history.latest"),
+                  latestRoomMessagesSql(beforeTimestamp > 0));
+    q->addBindValue(roomId);
     if (beforeTimestamp > 0)
-        q.addBindValue(beforeTimestamp);
-    q.addBindValue(count);
+        q->addBindValue(beforeTimestamp);
+    q->addBindValue(count);
     if (!q.exec()) {
-        qWarning() << "[DB] 查询房间消息历史失败:" << q.lastError().text();
+        qWarning() << "[DB] 查询房间消息历史失败:" << q->lastError().text();
         return {};
     }
-    return roomMessagesFromQuery(q, roomId);
+    return roomMessagesFromQuery(*q, roomId);
 }
 
 QJsonArray DatabaseManager::getMessageHistoryAfterSequence(int roomId, int count,
                                                            qint64 afterSequence) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    query.prepare(
+    CachedQuery query(db, QStringLiteral("room.history.after_sequence"),
         "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id, "
-        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail, "
+        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail_hash, "
         "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id, "
-        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)) "
+        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)), m.thumbnail_size "
         "FROM messages m JOIN users u ON m.user_id = u.id "
         "WHERE m.room_id = ? AND (m.sequence > ? OR m.mutation_sequence > ?) "
         "ORDER BY MAX(m.sequence, COALESCE(m.mutation_sequence, 0)) ASC LIMIT ?");
-    query.addBindValue(roomId);
-    query.addBindValue(afterSequence);
-    query.addBindValue(afterSequence);
-    query.addBindValue(count);
+    query->addBindValue(roomId);
+    query->addBindValue(afterSequence);
+    query->addBindValue(afterSequence);
+    query->addBindValue(count);
     if (!query.exec()) {
-        qWarning() << "[DB] 查询房间消息增量失败:" << query.lastError().text();
+        qWarning() << "[DB] 查询房间消息增量失败:" << query->lastError().text();
         return {};
     }
-    return roomMessagesFromQuery(query, roomId);
+    return roomMessagesFromQuery(*query, roomId);
 }
 
 RoomSyncPage DatabaseManager::getRoomSyncPage(int roomId, int count,
                                               qint64 afterSequence) {
     RoomSyncPage page;
-    expireStoredFiles();
+    // 游标落在缓存窗口内时直接由内存回答；房间尚未缓存时先加载窗口
+    if (m_roomHistory.enabled()) {
+        if (m_roomHistory.syncPage(roomId, count, afterSequence, &page)) {
+            m_roomHistory.recordLookup(true);
+            return page;
+        }
+        m_roomHistory.recordLookup(false);
+        RoomHistoryCache::Window window;
+        if (!m_roomHistory.contains(roomId) && loadRoomHistoryWindow(roomId, &window) &&
+            RoomHistoryCache::syncPageFrom(window, count, afterSequence, &page)) {
+            return page;
+        }
+    }
+
     QSqlDatabase db = getConnection();
     if (!db.transaction()) return page;
 
-    QSqlQuery messageQuery(db);
-    messageQuery.prepare(
+    CachedQuery messageQuery(db, QStringLiteral("room.sync.messages"),
         "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id, "
-        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail, "
+        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail_hash, "
         "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id, "
-        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)) "
+        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)), m.thumbnail_size "
         "FROM messages m JOIN users u ON m.user_id = u.id "
         "WHERE m.room_id = ? AND (m.sequence > ? OR m.mutation_sequence > ?) "
         "ORDER BY MAX(m.sequence, COALESCE(m.mutation_sequence, 0)) ASC LIMIT ?");
-    messageQuery.addBindValue(roomId);
-    messageQuery.addBindValue(afterSequence);
-    messageQuery.addBindValue(afterSequence);
-    messageQuery.addBindValue(count);
+    messageQuery->addBindValue(roomId);
+    messageQuery->addBindValue(afterSequence);
+    messageQuery->addBindValue(afterSequence);
+    messageQuery->addBindValue(count);
     if (!messageQuery.exec()) {
-        qWarning() << "[DB] 查询房间同步消息失败:" << messageQuery.lastError().text();
+        qWarning() << "[DB] 查询房间同步消息失败:" << messageQuery->lastError().text();
         db.rollback();
         return page;
     }
-    const QJsonArray messages = roomMessagesFromQuery(messageQuery, roomId);
+    const QJsonArray messages = roomMessagesFromQuery(*messageQuery, roomId);
 
-    QSqlQuery eventQuery(db);
-    eventQuery.prepare(
+    CachedQuery eventQuery(db, QStringLiteral("room.sync.events"),
         "SELECT id, room_id, operator_name, client_operation_id, mode, "
         "       message_ids_json, file_ids_json, cutoff_ms, deleted_count, "
         "       sequence, created_at "
         "FROM room_message_deletion_events "
         "WHERE room_id = ? AND sequence > ? ORDER BY sequence ASC LIMIT ?");
-    eventQuery.addBindValue(roomId);
-    eventQuery.addBindValue(afterSequence);
-    eventQuery.addBindValue(count);
+    eventQuery->addBindValue(roomId);
+    eventQuery->addBindValue(afterSequence);
+    eventQuery->addBindValue(count);
     if (!eventQuery.exec()) {
-        qWarning() << "[DB] 查询房间删除事件失败:" << eventQuery.lastError().text();
+        qWarning() << "[DB] 查询房间删除事件失败:" << eventQuery->lastError().text();
         db.rollback();
         return page;
     }
     QJsonArray events;
-    while (eventQuery.next()) events.append(deletionEventFromQuery(eventQuery));
+    while (eventQuery->next()) events.append(deletionEventFromQuery(*eventQuery));
     if (!db.commit()) return RoomSyncPage{};
 
     struct SyncItem {
@@ -1667,20 +3053,69 @@ RoomSyncPage DatabaseManager::getRoomSyncPage(int roomId, int count,
     return page;
 }
 
+bool DatabaseManager::loadRoomHistoryWindow(int roomId, RoomHistoryCache::Window *window) {
+    // 先取版本号再读库：读取期间若有写入提交，install 会放弃这份快照
+    const quint64 version = m_roomHistory.version(roomId);
+    const int capacity = m_roomHistory.messagesPerRoom();
+    QSqlDatabase db = getConnection();
+    if (!db.transaction()) return false;
+
+    QJsonArray messages;
+    {
+        CachedQuery latest(db, QStringLiteral("room.history.latest"), latestRoomMessagesSql(false));
+        latest->addBindValue(roomId);
+        latest->addBindValue(capacity);
+        if (!latest.exec()) {
+            qWarning() << "[DB] 加载房间消息缓存失败:" << latest->lastError().text();
+            db.rollback();
+            return false;
+        }
+        messages = roomMessagesFromQuery(*latest, roomId);
+    }
+    for (const QJsonValue &value : std::as_const(messages))
+        window->messages.append(value.toObject());
+    if (window->messages.size() >= capacity)
+        window->floorSequence = messageSequence(window->messages.first()) - 1;
+
+    // 窗口之外的撤回变更与删除事件同样推进增量游标，早于它们的增量页只能由数据库回答
+    CachedQuery outside(db, QStringLiteral("room.history.cache_floor"),
+        "SELECT MAX(COALESCE((SELECT MAX(mutation_sequence) FROM messages "
+        "                     WHERE room_id = ? AND sequence <= ?), 0), "
+        "           COALESCE((SELECT MAX(sequence) FROM room_message_deletion_events "
+        "                     WHERE room_id = ?), 0))");
+    outside->addBindValue(roomId);
+    outside->addBindValue(window->floorSequence);
+    outside->addBindValue(roomId);
+    if (!outside.exec() || !outside->next()) {
+        qWarning() << "[DB] 查询房间缓存增量下界失败:" << outside->lastError().text();
+        db.rollback();
+        return false;
+    }
+    window->syncFloor = qMax(window->floorSequence, outside->value(0).toLongLong());
+    if (!db.commit()) return false;
+
+    m_roomHistory.install(roomId, version, *window);
+    return true;
+}
+
+QJsonObject DatabaseManager::stageRoomHistoryAppend(QSqlDatabase &db, int roomId, int messageId) {
+    if (!m_roomHistory.enabled()) return {};
+    m_roomHistory.beginWrite(roomId);
+    // 只为已缓存的房间读取完整记录；调用方仍在写事务内，记录与即将提交的数据一致
+    return m_roomHistory.contains(roomId) ? readRoomMessageRecord(db, roomId, messageId)
+                                          : QJsonObject{};
+}
+
 qint64 DatabaseManager::getRoomLastMessageSequence(int roomId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    query.prepare("SELECT last_sequence FROM room_message_sequences WHERE room_id = ?");
-    query.addBindValue(roomId);
-    if (!query.exec() || !query.next()) return 0;
-    return query.value(0).toLongLong();
+    return m_roomSequences.lastCommitted(db, roomId);
 }
 
 RecallResult DatabaseManager::recallMessage(int messageId, int userId,
                                             int timeLimitSec) {
     RecallResult result;
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) return result;
+    if (!beginWriteTransaction(db)) return result;
     QSqlQuery q(db);
 
     q.prepare("SELECT user_id, created_at, room_id, recalled, "
@@ -1716,9 +3151,7 @@ RecallResult DatabaseManager::recallMessage(int messageId, int userId,
         return result;
     }
 
-    if (!reserveMessageSequence(db, QStringLiteral("room_message_sequences"),
-                                QStringLiteral("room_id"), result.conversationId,
-                                &result.mutationSequence)) {
+    if (!m_roomSequences.reserve(db, result.conversationId, &result.mutationSequence)) {
         db.rollback();
         return result;
     }
@@ -1726,13 +3159,69 @@ RecallResult DatabaseManager::recallMessage(int messageId, int userId,
               "mutation_sequence = ? WHERE id = ? AND recalled = 0");
     q.addBindValue(result.mutationSequence);
     q.addBindValue(messageId);
-    if (!q.exec() || q.numRowsAffected() != 1 || !db.commit()) {
+    if (!q.exec() || q.numRowsAffected() != 1) {
+        db.rollback();
+        result.status = RecallResult::Status::Failed;
+        return result;
+    }
+    m_roomHistory.beginWrite(result.conversationId);
+    if (!db.commit()) {
         db.rollback();
+        m_roomHistory.endWrite(result.conversationId);
         result.status = RecallResult::Status::Failed;
         return result;
     }
-    result.status = RecallResult::Status::Applied;
-    return result;
+    m_roomSequences.publish(result.conversationId, result.mutationSequence);
+    m_roomHistory.applyRecall(result.conversationId, messageId, result.mutationSequence);
+    m_roomHistory.endWrite(result.conversationId);
+    result.status = RecallResult::Status::Applied;
+    return result;
+}
+
+bool DatabaseManager::setMessageThumbnail(int roomId, int messageId,
+                                          const QByteArray &thumbnail, BlobRef *ref) {
+    if (thumbnail.isEmpty()) return false;
+    QSqlDatabase db = getConnection();
+    if (!beginWriteTransaction(db)) return false;
+    BlobRef thumbnailRef;
+    if (!storeBlob(db, thumbnail, &thumbnailRef)) {
+        db.rollback();
+        return false;
+    }
+    QSqlQuery q(db);
+    q.prepare("UPDATE messages SET thumbnail = '', thumbnail_hash = ?, thumbnail_size = ? "
+              "WHERE id = ? AND room_id = ? AND recalled = 0");
+    q.addBindValue(thumbnailRef.hash);
+    q.addBindValue(thumbnailRef.size);
+    q.addBindValue(messageId);
+    q.addBindValue(roomId);
+    if (!q.exec() || q.numRowsAffected() != 1) {
+        db.rollback();
+        return false;
+    }
+    m_roomHistory.beginWrite(roomId);
+    if (!db.commit()) {
+        db.rollback();
+        m_roomHistory.endWrite(roomId);
+        return false;
+    }
+    m_roomHistory.applyThumbnail(roomId, messageId, thumbnailRef);
+    m_roomHistory.endWrite(roomId);
+    if (ref) *ref = thumbnailRef;
+    return true;
+}
+
+QString DatabaseManager::getFileThumbnailHash(int fileId, bool isFriendFile) {
+    QSqlDatabase db = getConnection();
+    QSqlQuery q(db);
+    q.prepare(QStringLiteral("SELECT thumbnail_hash FROM %1 "
+                             "WHERE file_id = ? AND file_id > 0 AND recalled = 0 AND thumbnail_hash != '' "
+                             "ORDER BY id LIMIT 1")
+                  .arg(isFriendFile ? QStringLiteral("friend_messages") : QStringLiteral("messages")));
+    q.addBindValue(fileId);
+    if (q.exec() && q.next())
+        return q.value(0).toString();
+    return {};
 }
 
 bool DatabaseManager::isMessageInRoom(int messageId, int roomId) {
@@ -1759,34 +3248,41 @@ QPair<int, QString> DatabaseManager::getFileInfoForMessage(int messageId) {
 // ==================== 文件管理 ====================
 
 int DatabaseManager::saveFile(int roomId, int userId, const QString &fileName,
-                               const QString &filePath, qint64 fileSize) {
+                               const QString &filePath, qint64 fileSize,
+                               const QString &contentHash) {
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
 
-    q.prepare("INSERT INTO files (room_id, user_id, file_name, file_path, file_size)"
-              " VALUES (?, ?, ?, ?, ?)");
+    q.prepare("INSERT INTO files (room_id, user_id, file_name, file_path, file_size, content_hash)"
+              " VALUES (?, ?, ?, ?, ?, ?)");
     q.addBindValue(roomId);
     q.addBindValue(userId);
     q.addBindValue(fileName);
     q.addBindValue(filePath);
     q.addBindValue(fileSize);
+    q.addBindValue(contentHash.isNull() ? QStringLiteral("") : contentHash);
 
-    if (q.exec())
-        return q.lastInsertId().toInt();
+    m_roomFileQuota.beginWrite(roomId);
+    if (q.exec()) {
+        const int fileId = q.lastInsertId().toInt();
+        m_roomFileQuota.commit(roomId, fileSize);
+        return fileId;
+    }
 
     qWarning() << "[DB] 保存文件记录失败:" << q.lastError().text();
     return -1;
 }
 
 QString DatabaseManager::getFilePath(int fileId, bool isFriendFile) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
 
     if (isFriendFile) {
-        q.prepare("SELECT file_path FROM friend_files WHERE id = ? AND cleared = 0");
+        q.prepare(QStringLiteral("SELECT file_path FROM friend_files WHERE id = ? AND cleared = 0 AND %1")
+                      .arg(notExpiredPredicate(QStringLiteral("created_at"))));
     } else {
-        q.prepare("SELECT file_path FROM files WHERE id = ? AND cleared = 0");
+        q.prepare(QStringLiteral("SELECT file_path FROM files WHERE id = ? AND cleared = 0 AND %1")
+                      .arg(notExpiredPredicate(QStringLiteral("created_at"))));
     }
     q.addBindValue(fileId);
     q.exec();
@@ -1816,21 +3312,22 @@ QString DatabaseManager::getFileName(int fileId, bool isFriendFile) {
 bool DatabaseManager::canUserAccessFile(int fileId, bool isFriendFile, int userId) {
     if (fileId <= 0 || userId <= 0) return false;
 
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
     if (isFriendFile) {
-        q.prepare("SELECT 1 FROM friend_files ff "
-                  "JOIN friendships fs ON fs.id = ff.friendship_id "
-                  "WHERE ff.id = ? AND ff.cleared = 0 "
-                  "AND (fs.user_id1 = ? OR fs.user_id2 = ?)");
+        q.prepare(QStringLiteral("SELECT 1 FROM friend_files ff "
+                                 "JOIN friendships fs ON fs.id = ff.friendship_id "
+                                 "WHERE ff.id = ? AND ff.cleared = 0 AND %1 "
+                                 "AND (fs.user_id1 = ? OR fs.user_id2 = ?)")
+                      .arg(notExpiredPredicate(QStringLiteral("ff.created_at"))));
         q.addBindValue(fileId);
         q.addBindValue(userId);
         q.addBindValue(userId);
     } else {
-        q.prepare("SELECT 1 FROM files f "
-                  "JOIN room_members rm ON rm.room_id = f.room_id "
-                  "WHERE f.id = ? AND f.cleared = 0 AND rm.user_id = ?");
+        q.prepare(QStringLiteral("SELECT 1 FROM files f "
+                                 "JOIN room_members rm ON rm.room_id = f.room_id "
+                                 "WHERE f.id = ? AND f.cleared = 0 AND %1 AND rm.user_id = ?")
+                      .arg(notExpiredPredicate(QStringLiteral("f.created_at"))));
         q.addBindValue(fileId);
         q.addBindValue(userId);
     }
@@ -1840,24 +3337,104 @@ bool DatabaseManager::canUserAccessFile(int fileId, bool isFriendFile, int userI
 bool DatabaseManager::deleteStoredFileRecord(int fileId, bool isFriendFile) {
     if (fileId <= 0) return false;
     QSqlDatabase db = getConnection();
+    const QList<int> roomIds = isFriendFile ? QList<int>() : roomsOwningFiles(db, {fileId});
     QSqlQuery q(db);
     q.prepare(isFriendFile ? "DELETE FROM friend_files WHERE id = ?"
                            : "DELETE FROM files WHERE id = ?");
     q.addBindValue(fileId);
-    return q.exec();
+    if (!q.exec()) return false;
+    for (int roomId : roomIds)
+        m_roomFileQuota.invalidate(roomId);
+    return true;
+}
+
+bool DatabaseManager::registerFileBlob(const QString &hash, const QString &filePath,
+                                       qint64 fileSize) {
+    QSqlDatabase db = getConnection();
+    CachedQuery q(db, QStringLiteral("file_blob.register"),
+                  "INSERT OR IGNORE INTO file_blobs (hash, file_path, file_size) VALUES (?, ?, ?)");
+    q->addBindValue(hash);
+    q->addBindValue(filePath);
+    q->addBindValue(fileSize);
+    if (!q.exec()) {
+        qWarning() << "[DB] 登记文件 blob 失败:" << q->lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::adoptFileBlob(int fileId, bool isFriendFile, const QString &legacyPath,
+                                    const QString &blobPath, const QString &hash) {
+    QSqlDatabase db = getConnection();
+    if (!beginWriteTransaction(db)) return false;
+
+    // 引用计数触发器只跟随插入、清除与删除，改写 content_hash 时在同一事务内手动计入
+    QSqlQuery update(db);
+    update.prepare(QStringLiteral("UPDATE %1 SET file_path = ?, content_hash = ? "
+                                  "WHERE id = ? AND cleared = 0 AND content_hash = '' AND file_path = ?")
+                       .arg(isFriendFile ? QStringLiteral("friend_files") : QStringLiteral("files")));
+    update.addBindValue(blobPath);
+    update.addBindValue(hash);
+    update.addBindValue(fileId);
+    update.addBindValue(legacyPath);
+    if (!update.exec() || update.numRowsAffected() != 1) {
+        db.rollback();
+        return false;
+    }
+    QSqlQuery ref(db);
+    ref.prepare("UPDATE file_blobs SET ref_count = ref_count + 1 WHERE hash = ?");
+    ref.addBindValue(hash);
+    if (!ref.exec() || ref.numRowsAffected() != 1) {
+        qWarning() << "[DB] 旧版文件计入 blob 引用失败:" << ref.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return db.commit();
+}
+
+QList<QPair<QString, QString>> DatabaseManager::takeUnreferencedFileBlobs(int limit) {
+    QList<QPair<QString, QString>> taken;
+    QSqlDatabase db = getConnection();
+    if (limit <= 0 || !beginWriteTransaction(db)) return taken;
+
+    CachedQuery select(db, QStringLiteral("file_blob.unreferenced"),
+                       "SELECT hash, file_path FROM file_blobs WHERE ref_count = 0 LIMIT ?");
+    select->addBindValue(limit);
+    if (!select.exec()) {
+        qWarning() << "[DB] 查询无引用文件 blob 失败:" << select->lastError().text();
+        db.rollback();
+        return taken;
+    }
+    while (select->next())
+        taken.append({select->value(0).toString(), select->value(1).toString()});
+
+    CachedQuery remove(db, QStringLiteral("file_blob.remove"),
+                       "DELETE FROM file_blobs WHERE hash = ? AND ref_count = 0");
+    for (const auto &blob : std::as_const(taken)) {
+        remove->addBindValue(blob.first);
+        if (!remove.exec()) {
+            qWarning() << "[DB] 删除无引用文件 blob 失败:" << remove->lastError().text();
+            db.rollback();
+            return {};
+        }
+    }
+    if (!db.commit()) return {};
+    return taken;
 }
 
-bool DatabaseManager::setCosUrl(int fileId, bool isFriendFile, const QString &cosUrl) {
+int DatabaseManager::setCosUrl(int fileId, bool isFriendFile, const QString &cosUrl) {
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
     if (isFriendFile) {
-        q.prepare("UPDATE friend_files SET cos_url = ? WHERE id = ?");
+        q.prepare("UPDATE friend_files SET cos_url = ? WHERE id = ? AND cleared = 0");
     } else {
-        q.prepare("UPDATE files SET cos_url = ? WHERE id = ?");
+        q.prepare("UPDATE files SET cos_url = ? WHERE id = ? AND cleared = 0");
     }
     q.addBindValue(cosUrl);
     q.addBindValue(fileId);
-    return q.exec();
+    if (!q.exec())
+        return -1;
+    return q.numRowsAffected();
 }
 
 QString DatabaseManager::getCosUrl(int fileId, bool isFriendFile) {
@@ -1956,7 +3533,7 @@ AdministrativeDeletionSaveResult DatabaseManager::saveAdministrativeDeletion(
     result.cutoffMs = cutoffMs;
 
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) return result;
+    if (!beginWriteTransaction(db)) return result;
 
     QSqlQuery existing(db);
     existing.prepare(
@@ -2035,9 +3612,7 @@ AdministrativeDeletionSaveResult DatabaseManager::saveAdministrativeDeletion(
         result.messageIds = intListToJson(affectedMessageIds);
     result.deletedFileIds = intListToJson(fileIds);
 
-    if (!reserveMessageSequence(db, QStringLiteral("room_message_sequences"),
-                                QStringLiteral("room_id"), roomId,
-                                &result.sequence)) {
+    if (!m_roomSequences.reserve(db, roomId, &result.sequence)) {
         db.rollback();
         return result;
     }
@@ -2082,6 +3657,8 @@ AdministrativeDeletionSaveResult DatabaseManager::saveAdministrativeDeletion(
     }
     result.createdAtMs = utcTimestampMs(created.value(0));
     if (!db.commit()) return AdministrativeDeletionSaveResult{};
+    m_roomSequences.publish(roomId, result.sequence);
+    m_roomHistory.invalidate(roomId);
     result.status = AdministrativeDeletionSaveResult::Status::Created;
     return result;
 }
@@ -2103,7 +3680,9 @@ bool DatabaseManager::deleteMessages(int roomId, const QList<int> &messageIds) {
     for (int id : messageIds)
         q.addBindValue(id);
 
-    return q.exec();
+    if (!q.exec()) return false;
+    m_roomHistory.invalidate(roomId);
+    return true;
 }
 
 int DatabaseManager::deleteAllMessages(int roomId) {
@@ -2111,9 +3690,10 @@ int DatabaseManager::deleteAllMessages(int roomId) {
     QSqlQuery q(db);
     q.prepare("DELETE FROM messages WHERE room_id = ?");
     q.addBindValue(roomId);
-    if (q.exec())
-        return q.numRowsAffected();
-    return -1;
+    if (!q.exec())
+        return -1;
+    m_roomHistory.invalidate(roomId);
+    return q.numRowsAffected();
 }
 
 int DatabaseManager::deleteMessagesBefore(int roomId, const QDateTime &before) {
@@ -2122,9 +3702,10 @@ int DatabaseManager::deleteMessagesBefore(int roomId, const QDateTime &before) {
     q.prepare("DELETE FROM messages WHERE room_id = ? AND created_at < ?");
     q.addBindValue(roomId);
     q.addBindValue(before.toUTC().toString("yyyy-MM-dd HH:mm:ss"));
-    if (q.exec())
-        return q.numRowsAffected();
-    return -1;
+    if (!q.exec())
+        return -1;
+    m_roomHistory.invalidate(roomId);
+    return q.numRowsAffected();
 }
 
 int DatabaseManager::deleteMessagesAfter(int roomId, const QDateTime &after) {
@@ -2133,9 +3714,10 @@ int DatabaseManager::deleteMessagesAfter(int roomId, const QDateTime &after) {
     q.prepare("DELETE FROM messages WHERE room_id = ? AND created_at > ?");
     q.addBindValue(roomId);
     q.addBindValue(after.toUTC().toString("yyyy-MM-dd HH:mm:ss"));
-    if (q.exec())
-        return q.numRowsAffected();
-    return -1;
+    if (!q.exec())
+        return -1;
+    m_roomHistory.invalidate(roomId);
+    return q.numRowsAffected();
 }
 
 // ==================== 文件清理辅助方法 ====================
@@ -2249,6 +3831,7 @@ bool DatabaseManager::deleteFileRecords(const QList<int> &fileIds) {
     if (fileIds.isEmpty()) return true;
 
     QSqlDatabase db = getConnection();
+    const QList<int> roomIds = roomsOwningFiles(db, fileIds);
     QSqlQuery q(db);
 
     QStringList placeholders;
@@ -2260,7 +3843,10 @@ bool DatabaseManager::deleteFileRecords(const QList<int> &fileIds) {
     for (int id : fileIds)
         q.addBindValue(id);
 
-    return q.exec();
+    if (!q.exec()) return false;
+    for (int roomId : roomIds)
+        m_roomFileQuota.invalidate(roomId);
+    return true;
 }
 
 QStringList DatabaseManager::getCosUrlsForFileIds(const QList<int> &fileIds, bool isFriendFile) {
@@ -2350,7 +3936,9 @@ bool DatabaseManager::setRoomSettings(int roomId, qint64 maxFileSize, qint64 tot
     q.addBindValue(totalFileSpace);
     q.addBindValue(maxFileCount);
     q.addBindValue(maxMembers);
-    return q.exec();
+    if (!q.exec()) return false;
+    m_roomFileQuota.invalidate(roomId);
+    return true;
 }
 
 qint64 DatabaseManager::getRoomMaxFileSize(int roomId) {
@@ -2367,51 +3955,50 @@ bool DatabaseManager::setRoomMaxFileSize(int roomId, qint64 maxSize) {
 }
 
 qint64 DatabaseManager::getRoomUsedFileSpace(int roomId) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT COALESCE(SUM(file_size), 0) FROM files WHERE room_id = ? AND cleared = 0");
-    q.addBindValue(roomId);
-    if (q.exec() && q.next()) return q.value(0).toLongLong();
-    return 0;
+    RoomFileQuotaLedger::Usage usage;
+    return m_roomFileQuota.usage(db, roomId, &usage) ? usage.usedBytes : 0;
 }
 
 int DatabaseManager::getRoomFileCount(int roomId) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT COUNT(*) FROM files WHERE room_id = ? AND cleared = 0");
-    q.addBindValue(roomId);
-    if (q.exec() && q.next()) return q.value(0).toInt();
-    return 0;
+    RoomFileQuotaLedger::Usage usage;
+    return m_roomFileQuota.usage(db, roomId, &usage) ? usage.fileCount : 0;
+}
+
+bool DatabaseManager::reserveRoomFileQuota(int roomId, qint64 fileSize, QString *error) {
+    QSqlDatabase db = getConnection();
+    return m_roomFileQuota.reserve(db, roomId, fileSize, error);
 }
 
-QJsonArray DatabaseManager::getRoomActiveFilesOrdered(int roomId) {
-    expireStoredFiles();
+void DatabaseManager::releaseRoomFileQuota(int roomId, qint64 fileSize) {
+    m_roomFileQuota.release(roomId, fileSize);
+}
+
+QList<RoomActiveFile> DatabaseManager::getRoomActiveFilesOrdered(int roomId) {
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
-    q.prepare("SELECT id, file_name, file_path, file_size, created_at "
+    q.setForwardOnly(true);
+    q.prepare("SELECT id, file_size, file_path, COALESCE(cos_url, '') "
               "FROM files WHERE room_id = ? AND cleared = 0 "
               "ORDER BY created_at ASC, id ASC");
     q.addBindValue(roomId);
 
-    QJsonArray out;
+    QList<RoomActiveFile> out;
     if (q.exec()) {
         while (q.next()) {
-            QJsonObject file;
-            file["fileId"] = q.value(0).toInt();
-            file["fileName"] = q.value(1).toString();
-            file["filePath"] = q.value(2).toString();
-            file["fileSize"] = static_cast<double>(q.value(3).toLongLong());
-            file["createdAt"] = q.value(4).toString();
-            out.append(file);
+            RoomActiveFile file;
+            file.fileId = q.value(0).toInt();
+            file.fileSize = q.value(1).toLongLong();
+            file.filePath = q.value(2).toString();
+            file.cosUrl = q.value(3).toString();
+            out.append(std::move(file));
         }
     }
     return out;
 }
 
 QJsonArray DatabaseManager::getRoomAllFiles(int roomId) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
     q.prepare("SELECT id, file_name, file_path, file_size, cleared, clear_reason, created_at "
@@ -2436,79 +4023,191 @@ QJsonArray DatabaseManager::getRoomAllFiles(int roomId) {
     return out;
 }
 
-bool DatabaseManager::markRoomFilesCleared(int roomId, const QList<int> &fileIds, const QString &reason) {
+bool DatabaseManager::markRoomFilesCleared(int roomId, const QList<int> &fileIds, const QString &reason,
+                                           QList<int> *clearedIds) {
+    if (clearedIds) clearedIds->clear();
     if (fileIds.isEmpty()) return true;
 
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) {
+    if (!beginWriteTransaction(db)) {
         return false;
     }
 
-    QStringList placeholders;
-    for (int i = 0; i < fileIds.size(); ++i)
-        placeholders << "?";
-    QString inExpr = placeholders.join(",");
-
+    // 逐条标记并跳过已清除的记录：过期任务并发清除的文件保留原 clear_reason，也不会被重复删除
+    QList<int> cleared;
     QSqlQuery q1(db);
-    q1.prepare(QString("UPDATE files SET cleared = 1, clear_reason = ?, cleared_at = CURRENT_TIMESTAMP "
-                       "WHERE room_id = ? AND id IN (%1)").arg(inExpr));
-    q1.addBindValue(reason);
-    q1.addBindValue(roomId);
-    for (int fileId : fileIds)
+    q1.prepare("UPDATE files SET cleared = 1, clear_reason = ?, cleared_at = CURRENT_TIMESTAMP "
+               "WHERE room_id = ? AND id = ? AND cleared = 0");
+    for (int fileId : fileIds) {
+        q1.addBindValue(reason);
+        q1.addBindValue(roomId);
         q1.addBindValue(fileId);
-    if (!q1.exec()) {
+        if (!q1.exec()) {
+            db.rollback();
+            return false;
+        }
+        if (q1.numRowsAffected() == 1) cleared.append(fileId);
+    }
+    if (cleared.isEmpty()) {
         db.rollback();
-        return false;
+        return true;
     }
 
+    QStringList placeholders;
+    for (int i = 0; i < cleared.size(); ++i)
+        placeholders << "?";
     QSqlQuery q2(db);
     q2.prepare(QString("UPDATE messages SET file_cleared = 1, clear_reason = ? "
-                       "WHERE room_id = ? AND file_id IN (%1)").arg(inExpr));
+                       "WHERE room_id = ? AND file_id IN (%1) AND file_cleared = 0")
+                   .arg(placeholders.join(",")));
     q2.addBindValue(reason);
     q2.addBindValue(roomId);
-    for (int fileId : fileIds)
+    for (int fileId : std::as_const(cleared))
         q2.addBindValue(fileId);
     if (!q2.exec()) {
         db.rollback();
         return false;
     }
 
-    return db.commit();
+    if (!db.commit()) return false;
+    if (clearedIds) *clearedIds = cleared;
+    m_roomHistory.invalidate(roomId);
+    m_roomFileQuota.invalidate(roomId);
+    return true;
 }
 
 // ==================== 用户头像 ====================
 
 QByteArray DatabaseManager::getUserAvatar(int userId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT avatar_data FROM user_avatars WHERE user_id = ?");
-    q.addBindValue(userId);
-    q.exec();
-    if (q.next())
-        return q.value(0).toByteArray();
+    CachedQuery q(db, QStringLiteral("user.avatar.ref_by_id"),
+                  "SELECT avatar_hash FROM user_avatars WHERE user_id = ?");
+    q->addBindValue(userId);
+    if (q.exec() && q->next())
+        return getBlob(q->value(0).toString());
     return {};
 }
 
-bool DatabaseManager::setUserAvatar(int userId, const QByteArray &avatarData) {
+bool DatabaseManager::setUserAvatar(int userId, const QByteArray &avatarData, BlobRef *ref) {
     QSqlDatabase db = getConnection();
+    if (!beginWriteTransaction(db)) return false;
+    BlobRef stored;
+    if (!storeBlob(db, avatarData, &stored)) {
+        db.rollback();
+        return false;
+    }
     QSqlQuery q(db);
-    q.prepare("INSERT OR REPLACE INTO user_avatars (user_id, avatar_data, updated_at) "
-              "VALUES (?, ?, CURRENT_TIMESTAMP)");
+    q.prepare("INSERT OR REPLACE INTO user_avatars (user_id, avatar_hash, avatar_size, updated_at) "
+              "VALUES (?, ?, ?, CURRENT_TIMESTAMP)");
     q.addBindValue(userId);
-    q.addBindValue(avatarData);
-    return q.exec();
+    q.addBindValue(stored.hash);
+    q.addBindValue(stored.size);
+    if (!q.exec() || !db.commit()) {
+        db.rollback();
+        return false;
+    }
+    if (ref) *ref = stored;
+    return true;
 }
 
 QByteArray DatabaseManager::getUserAvatarByName(const QString &username) {
+    return getBlob(getUserAvatarRef(username).hash);
+}
+
+BlobRef DatabaseManager::getUserAvatarRef(const QString &username) {
+    QSqlDatabase db = getConnection();
+    CachedQuery q(db, QStringLiteral("user.avatar.ref_by_name"),
+                  "SELECT a.avatar_hash, a.avatar_size FROM user_avatars a "
+                  "JOIN users u ON a.user_id = u.id WHERE u.username = ?");
+    q->addBindValue(username);
+    BlobRef ref;
+    if (q.exec() && q->next()) {
+        ref.hash = q->value(0).toString();
+        ref.size = q->value(1).toLongLong();
+    }
+    return ref;
+}
+
+// ==================== 内容寻址 blob ====================
+
+QByteArray DatabaseManager::getBlob(const QString &hash) {
+    if (hash.isEmpty()) return {};
+    {
+        QMutexLocker locker(&m_blobCacheMutex);
+        if (const QByteArray *cached = m_blobCache.object(hash)) return *cached;
+    }
+
+    QSqlDatabase db = getConnection();
+    CachedQuery q(db, QStringLiteral("blob.data"), "SELECT data FROM blobs WHERE hash = ?");
+    q->addBindValue(hash);
+    if (!q.exec() || !q->next()) return {};
+    const QByteArray data = q->value(0).toByteArray();
+
+    // blob 内容由哈希决定、永不改变，缓存无需失效
+    QMutexLocker locker(&m_blobCacheMutex);
+    m_blobCache.insert(hash, new QByteArray(data), qMax<qsizetype>(1, data.size()));
+    return data;
+}
+
+QHash<QString, QByteArray> DatabaseManager::getBlobs(const QStringList &hashes) {
+    QHash<QString, QByteArray> blobs;
+    QStringList missing;
+    {
+        QMutexLocker locker(&m_blobCacheMutex);
+        for (const QString &hash : hashes) {
+            if (hash.isEmpty() || blobs.contains(hash) || missing.contains(hash)) continue;
+            if (const QByteArray *cached = m_blobCache.object(hash))
+                blobs.insert(hash, *cached);
+            else
+                missing.append(hash);
+        }
+    }
+    if (missing.isEmpty()) return blobs;
+
     QSqlDatabase db = getConnection();
+    QStringList placeholders;
+    for (int i = 0; i < missing.size(); ++i)
+        placeholders.append("?");
     QSqlQuery q(db);
-    q.prepare("SELECT a.avatar_data FROM user_avatars a "
-              "JOIN users u ON a.user_id = u.id WHERE u.username = ?");
-    q.addBindValue(username);
-    q.exec();
-    if (q.next())
-        return q.value(0).toByteArray();
-    return {};
+    q.prepare(QString("SELECT hash, data FROM blobs WHERE hash IN (%1)").arg(placeholders.join(",")));
+    for (const QString &hash : std::as_const(missing))
+        q.addBindValue(hash);
+    if (!q.exec()) {
+        qWarning() << "[DB] 批量读取 blob 失败:" << q.lastError().text();
+        return blobs;
+    }
+    QMutexLocker locker(&m_blobCacheMutex);
+    while (q.next()) {
+        const QString hash = q.value(0).toString();
+        const QByteArray data = q.value(1).toByteArray();
+        blobs.insert(hash, data);
+        m_blobCache.insert(hash, new QByteArray(data), qMax<qsizetype>(1, data.size()));
+    }
+    return blobs;
+}
+
+bool DatabaseManager::canUserReadBlob(int userId, const QString &hash) {
+    if (userId <= 0 || hash.isEmpty()) return false;
+    QSqlDatabase db = getConnection();
+    // 各分支都走 *_hash 索引；头像与 AVATAR_GET / ROOM_AVATAR_GET 一样不限制读取者
+    CachedQuery q(db, QStringLiteral("blob.access"),
+                  "SELECT EXISTS (SELECT 1 FROM user_avatars WHERE avatar_hash = ?) "
+                  "    OR EXISTS (SELECT 1 FROM room_avatars WHERE avatar_hash = ?) "
+                  "    OR EXISTS (SELECT 1 FROM messages m "
+                  "               JOIN room_members rm ON rm.room_id = m.room_id AND rm.user_id = ? "
+                  "               WHERE m.thumbnail_hash = ? AND m.recalled = 0) "
+                  "    OR EXISTS (SELECT 1 FROM friend_messages fm "
+                  "               JOIN friendships f ON f.id = fm.friendship_id "
+                  "               WHERE fm.thumbnail_hash = ? AND fm.recalled = 0 "
+                  "                 AND (f.user_id1 = ? OR f.user_id2 = ?))");
+    q->addBindValue(hash);
+    q->addBindValue(hash);
+    q->addBindValue(userId);
+    q->addBindValue(hash);
+    q->addBindValue(hash);
+    q->addBindValue(userId);
+    q->addBindValue(userId);
+    return q.exec() && q->next() && q->value(0).toInt() != 0;
 }
 
 bool DatabaseManager::setRoomPassword(int roomId, const QString &password) {
@@ -2771,13 +4470,13 @@ int DatabaseManager::getFriendshipId(int userId1, int userId2) {
 
 bool DatabaseManager::isUserInFriendship(int friendshipId, int userId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT 1 FROM friendships "
-              "WHERE id = ? AND (user_id1 = ? OR user_id2 = ?)");
-    q.addBindValue(friendshipId);
-    q.addBindValue(userId);
-    q.addBindValue(userId);
-    return q.exec() && q.next();
+    CachedQuery q(db, QStringLiteral("friendship.member.exists"),
+                  "SELECT 1 FROM friendships "
+                  "WHERE id = ? AND (user_id1 = ? OR user_id2 = ?)");
+    q->addBindValue(friendshipId);
+    q->addBindValue(userId);
+    q->addBindValue(userId);
+    return q.exec() && q->next();
 }
 
 QString DatabaseManager::getOtherFriendUsername(int friendshipId, int userId) {
@@ -2816,40 +4515,45 @@ int DatabaseManager::saveFriendMessage(int friendshipId, int senderId, const QSt
                                        const QString &thumbnail, qint64 *sequenceOut,
                                        qint64 *timestampOut) {
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) return -1;
+    if (!beginWriteTransaction(db)) return -1;
     qint64 sequence = 0;
-    if (!reserveMessageSequence(db, QStringLiteral("friendship_message_sequences"),
-                                QStringLiteral("friendship_id"), friendshipId,
-                                &sequence)) {
+    if (!m_friendshipSequences.reserve(db, friendshipId, &sequence)) {
         db.rollback();
         return -1;
     }
-    QSqlQuery q(db);
-    q.prepare("INSERT INTO friend_messages (friendship_id, sender_id, content, content_type, file_name, file_size, file_id, thumbnail, sequence)"
-              " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)");
-    q.addBindValue(friendshipId);
-    q.addBindValue(senderId);
-    q.addBindValue(content);
-    q.addBindValue(contentType);
-    q.addBindValue(fileName);
-    q.addBindValue(fileSize);
-    q.addBindValue(fileId);
-    q.addBindValue(thumbnail);
-    q.addBindValue(sequence);
+    BlobRef thumbnailRef;
+    if (!storeThumbnailBlob(db, thumbnail, &thumbnailRef)) {
+        db.rollback();
+        return -1;
+    }
+    CachedQuery q(db, QStringLiteral("friend.message.insert"),
+                  "INSERT INTO friend_messages (friendship_id, sender_id, content, content_type, file_name, file_size, file_id, thumbnail_hash, thumbnail_size, sequence)"
+                  " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    q->addBindValue(friendshipId);
+    q->addBindValue(senderId);
+    q->addBindValue(content);
+    q->addBindValue(contentType);
+    q->addBindValue(fileName);
+    q->addBindValue(fileSize);
+    q->addBindValue(fileId);
+    q->addBindValue(thumbnailRef.hash);
+    q->addBindValue(thumbnailRef.size);
+    q->addBindValue(sequence);
     if (q.exec()) {
-        const int messageId = q.lastInsertId().toInt();
+        const int messageId = q->lastInsertId().toInt();
         qint64 timestamp = 0;
         if (timestampOut) {
-            QSqlQuery created(db);
-            created.prepare("SELECT created_at FROM friend_messages WHERE id = ?");
-            created.addBindValue(messageId);
-            if (!created.exec() || !created.next()) {
+            CachedQuery created(db, QStringLiteral("friend.message.created_at"),
+                                "SELECT created_at FROM friend_messages WHERE id = ?");
+            created->addBindValue(messageId);
+            if (!created.exec() || !created->next()) {
                 db.rollback();
                 return -1;
             }
-            timestamp = utcTimestampMs(created.value(0));
+            timestamp = utcTimestampMs(created->value(0));
         }
         if (db.commit()) {
+            m_friendshipSequences.publish(friendshipId, sequence);
             if (sequenceOut) *sequenceOut = sequence;
             if (timestampOut) *timestampOut = timestamp;
             return messageId;
@@ -2862,68 +4566,14 @@ int DatabaseManager::saveFriendMessage(int friendshipId, int senderId, const QSt
 MessageSaveResult DatabaseManager::saveFriendMessageIdempotent(
     int friendshipId, int senderId, const QString &clientMessageId,
     const QString &content, const QString &contentType) {
-    MessageSaveResult result;
-    QSqlDatabase db = getConnection();
-    if (!db.transaction()) return result;
-
-    QSqlQuery existing(db);
-    existing.prepare(
-        "SELECT id, friendship_id, content, content_type, sequence, created_at "
-        "FROM friend_messages WHERE sender_id = ? AND client_message_id = ?");
-    existing.addBindValue(senderId);
-    existing.addBindValue(clientMessageId);
-    if (!existing.exec()) {
-        qWarning() << "[DB] 查询私聊幂等消息失败:" << existing.lastError().text();
-        db.rollback();
-        return result;
-    }
-    if (existing.next()) {
-        result.messageId = existing.value(0).toInt();
-        result.sequence = existing.value(4).toLongLong();
-        result.createdAtMs = utcTimestampMs(existing.value(5));
-        const bool sameCommand = existing.value(1).toInt() == friendshipId &&
-                                 existing.value(2).toString() == content &&
-                                 existing.value(3).toString() == contentType;
-        result.status = sameCommand ? MessageSaveResult::Status::Duplicate
-                                    : MessageSaveResult::Status::Conflict;
-        if (!db.commit()) result.status = MessageSaveResult::Status::Failed;
-        return result;
-    }
-
-    if (!reserveMessageSequence(db, QStringLiteral("friendship_message_sequences"),
-                                QStringLiteral("friendship_id"), friendshipId,
-                                &result.sequence)) {
-        db.rollback();
-        return result;
-    }
-    QSqlQuery insert(db);
-    insert.prepare(
-        "INSERT INTO friend_messages "
-        "(friendship_id, sender_id, content, content_type, client_message_id, sequence) "
-        "VALUES (?, ?, ?, ?, ?, ?)");
-    insert.addBindValue(friendshipId);
-    insert.addBindValue(senderId);
-    insert.addBindValue(content);
-    insert.addBindValue(contentType);
-    insert.addBindValue(clientMessageId);
-    insert.addBindValue(result.sequence);
-    if (!insert.exec()) {
-        qWarning() << "[DB] 保存私聊幂等消息失败:" << insert.lastError().text();
-        db.rollback();
-        return result;
-    }
-    result.messageId = insert.lastInsertId().toInt();
-    QSqlQuery created(db);
-    created.prepare("SELECT created_at FROM friend_messages WHERE id = ?");
-    created.addBindValue(result.messageId);
-    if (!created.exec() || !created.next()) {
-        db.rollback();
-        return MessageSaveResult{};
-    }
-    result.createdAtMs = utcTimestampMs(created.value(0));
-    if (!db.commit()) return MessageSaveResult{};
-    result.status = MessageSaveResult::Status::Created;
-    return result;
+    PendingMessageWrite write;
+    write.friendMessage = true;
+    write.ownerId = friendshipId;
+    write.senderId = senderId;
+    write.clientMessageId = clientMessageId;
+    write.content = content;
+    write.contentType = contentType;
+    return submitMessageWrite(write);
 }
 
 MessageSaveResult DatabaseManager::findFriendAttachmentByClientMessageId(
@@ -2958,7 +4608,7 @@ MessageSaveResult DatabaseManager::saveFriendAttachmentIdempotent(
     qint64 fileSize, int fileId, const QString &thumbnail) {
     MessageSaveResult result;
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) return result;
+    if (!beginWriteTransaction(db)) return result;
 
     QSqlQuery existing(db);
     existing.prepare(
@@ -2986,17 +4636,17 @@ MessageSaveResult DatabaseManager::saveFriendAttachmentIdempotent(
         return result;
     }
 
-    if (!reserveMessageSequence(db, QStringLiteral("friendship_message_sequences"),
-                                QStringLiteral("friendship_id"), friendshipId,
-                                &result.sequence)) {
+    BlobRef thumbnailRef;
+    if (!m_friendshipSequences.reserve(db, friendshipId, &result.sequence) ||
+        !storeThumbnailBlob(db, thumbnail, &thumbnailRef)) {
         db.rollback();
         return result;
     }
     QSqlQuery insert(db);
     insert.prepare(
         "INSERT INTO friend_messages "
-        "(friendship_id, sender_id, content, content_type, file_name, file_size, file_id, thumbnail, "
-        " client_message_id, sequence) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        "(friendship_id, sender_id, content, content_type, file_name, file_size, file_id, thumbnail_hash, "
+        " thumbnail_size, client_message_id, sequence) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
     insert.addBindValue(friendshipId);
     insert.addBindValue(senderId);
     insert.addBindValue(fileName);
@@ -3004,7 +4654,8 @@ MessageSaveResult DatabaseManager::saveFriendAttachmentIdempotent(
     insert.addBindValue(fileName);
     insert.addBindValue(fileSize);
     insert.addBindValue(fileId);
-    insert.addBindValue(thumbnail);
+    insert.addBindValue(thumbnailRef.hash);
+    insert.addBindValue(thumbnailRef.size);
     insert.addBindValue(clientMessageId);
     insert.addBindValue(result.sequence);
     if (!insert.exec()) {
@@ -3022,20 +4673,19 @@ MessageSaveResult DatabaseManager::saveFriendAttachmentIdempotent(
     }
     result.createdAtMs = utcTimestampMs(created.value(0));
     if (!db.commit()) return MessageSaveResult{};
+    m_friendshipSequences.publish(friendshipId, result.sequence);
     result.status = MessageSaveResult::Status::Created;
     return result;
 }
 
 QJsonArray DatabaseManager::getFriendMessageHistory(int friendshipId, int count, qint64 beforeTimestamp) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
 
     QString sql = "SELECT * FROM ("
                   "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id,"
-                  "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail,"
+                  "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail_hash,"
                   "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id,"
-                  "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0))"
+                  "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)), m.thumbnail_size"
                   " FROM friend_messages m JOIN users u ON m.sender_id = u.id"
                   " WHERE m.friendship_id = ?";
     if (beforeTimestamp > 0)
@@ -3043,56 +4693,53 @@ QJsonArray DatabaseManager::getFriendMessageHistory(int friendshipId, int count,
     sql += " ORDER BY m.sequence DESC LIMIT ?"
            ") ORDER BY sequence ASC";
 
-    q.prepare(sql);
-    q.addBindValue(friendshipId);
-    if (beforeTimestamp > 0) q.addBindValue(beforeTimestamp);
-    q.addBindValue(count);
+    CachedQuery q(db, beforeTimestamp > 0 ? QStringLiteral("friend.history.before_time")
+                                          : QStringLiteral("friend.history.latest"),
+                  sql);
+    q->addBindValue(friendshipId);
+    if (beforeTimestamp > 0) q->addBindValue(beforeTimestamp);
+    q->addBindValue(count);
     if (!q.exec()) return {};
-    return friendMessagesFromQuery(q, friendshipId);
+    return friendMessagesFromQuery(*q, friendshipId);
 }
 
 QJsonArray DatabaseManager::getFriendMessageHistoryAfterSequence(
     int friendshipId, int count, qint64 afterSequence) {
-    expireStoredFiles();
     QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    query.prepare(
+    CachedQuery query(db, QStringLiteral("friend.history.after_sequence"),
         "SELECT m.id, m.content, m.content_type, m.file_name, m.file_size, m.file_id, "
-        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail, "
+        "       m.recalled, m.created_at, u.username, u.display_name, m.thumbnail_hash, "
         "       m.file_cleared, m.clear_reason, m.sequence, m.client_message_id, "
-        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)) "
+        "       m.mutation_sequence, MAX(m.sequence, COALESCE(m.mutation_sequence, 0)), m.thumbnail_size "
         "FROM friend_messages m JOIN users u ON m.sender_id = u.id "
         "WHERE m.friendship_id = ? AND (m.sequence > ? OR m.mutation_sequence > ?) "
         "ORDER BY MAX(m.sequence, COALESCE(m.mutation_sequence, 0)) ASC LIMIT ?");
-    query.addBindValue(friendshipId);
-    query.addBindValue(afterSequence);
-    query.addBindValue(afterSequence);
-    query.addBindValue(count);
+    query->addBindValue(friendshipId);
+    query->addBindValue(afterSequence);
+    query->addBindValue(afterSequence);
+    query->addBindValue(count);
     if (!query.exec()) return {};
-    return friendMessagesFromQuery(query, friendshipId);
+    return friendMessagesFromQuery(*query, friendshipId);
 }
 
 qint64 DatabaseManager::getFriendshipLastMessageSequence(int friendshipId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery query(db);
-    query.prepare(
-        "SELECT last_sequence FROM friendship_message_sequences WHERE friendship_id = ?");
-    query.addBindValue(friendshipId);
-    if (!query.exec() || !query.next()) return 0;
-    return query.value(0).toLongLong();
+    return m_friendshipSequences.lastCommitted(db, friendshipId);
 }
 
 int DatabaseManager::saveFriendFile(int friendshipId, int userId, const QString &fileName,
-                                    const QString &filePath, qint64 fileSize) {
+                                    const QString &filePath, qint64 fileSize,
+                                    const QString &contentHash) {
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
-    q.prepare("INSERT INTO friend_files (friendship_id, user_id, file_name, file_path, file_size)"
-              " VALUES (?, ?, ?, ?, ?)");
+    q.prepare("INSERT INTO friend_files (friendship_id, user_id, file_name, file_path, file_size, content_hash)"
+              " VALUES (?, ?, ?, ?, ?, ?)");
     q.addBindValue(friendshipId);
     q.addBindValue(userId);
     q.addBindValue(fileName);
     q.addBindValue(filePath);
     q.addBindValue(fileSize);
+    q.addBindValue(contentHash.isNull() ? QStringLiteral("") : contentHash);
     if (q.exec()) return q.lastInsertId().toInt();
     return -1;
 }
@@ -3101,7 +4748,7 @@ RecallResult DatabaseManager::recallFriendMessage(int messageId, int userId,
                                                   int timeLimitSec) {
     RecallResult result;
     QSqlDatabase db = getConnection();
-    if (!db.transaction()) return result;
+    if (!beginWriteTransaction(db)) return result;
     QSqlQuery q(db);
 
     q.prepare("SELECT sender_id, created_at, friendship_id, recalled, "
@@ -3137,10 +4784,7 @@ RecallResult DatabaseManager::recallFriendMessage(int messageId, int userId,
         return result;
     }
 
-    if (!reserveMessageSequence(db, QStringLiteral("friendship_message_sequences"),
-                                QStringLiteral("friendship_id"),
-                                result.conversationId,
-                                &result.mutationSequence)) {
+    if (!m_friendshipSequences.reserve(db, result.conversationId, &result.mutationSequence)) {
         db.rollback();
         return result;
     }
@@ -3154,10 +4798,36 @@ RecallResult DatabaseManager::recallFriendMessage(int messageId, int userId,
         result.status = RecallResult::Status::Failed;
         return result;
     }
+    m_friendshipSequences.publish(result.conversationId, result.mutationSequence);
     result.status = RecallResult::Status::Applied;
     return result;
 }
 
+bool DatabaseManager::setFriendMessageThumbnail(int friendshipId, int messageId,
+                                                const QByteArray &thumbnail, BlobRef *ref) {
+    if (thumbnail.isEmpty()) return false;
+    QSqlDatabase db = getConnection();
+    if (!beginWriteTransaction(db)) return false;
+    BlobRef thumbnailRef;
+    if (!storeBlob(db, thumbnail, &thumbnailRef)) {
+        db.rollback();
+        return false;
+    }
+    QSqlQuery q(db);
+    q.prepare("UPDATE friend_messages SET thumbnail = '', thumbnail_hash = ?, thumbnail_size = ? "
+              "WHERE id = ? AND friendship_id = ? AND recalled = 0");
+    q.addBindValue(thumbnailRef.hash);
+    q.addBindValue(thumbnailRef.size);
+    q.addBindValue(messageId);
+    q.addBindValue(friendshipId);
+    if (!q.exec() || q.numRowsAffected() != 1 || !db.commit()) {
+        db.rollback();
+        return false;
+    }
+    if (ref) *ref = thumbnailRef;
+    return true;
+}
+
 int DatabaseManager::getFriendshipIdForOwnedMessage(int messageId, int userId) {
     QSqlDatabase db = getConnection();
     QSqlQuery q(db);
@@ -3183,46 +4853,49 @@ QPair<int, QString> DatabaseManager::getFileInfoForFriendMessage(int messageId)
 
 // ==================== 未读消息 ====================
 
-int DatabaseManager::getUnreadRoomCount(int roomId, int userId) {
+QHash<int, int> DatabaseManager::getUnreadRoomCounts(int userId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT COUNT(*) FROM messages "
-              "WHERE room_id = ? AND id > "
-              "(SELECT COALESCE(last_read_msg_id, 0) FROM room_members WHERE room_id = ? AND user_id = ?)");
-    q.addBindValue(roomId);
-    q.addBindValue(roomId);
-    q.addBindValue(userId);
-    if (q.exec() && q.next()) return q.value(0).toInt();
-    return 0;
+    CachedQuery q(db, QStringLiteral("room.member.unread_counts"),
+                  "SELECT room_id, unread_count FROM room_members WHERE user_id = ?");
+    q->addBindValue(userId);
+
+    QHash<int, int> counts;
+    if (q.exec()) {
+        while (q->next())
+            counts.insert(q->value(0).toInt(), q->value(1).toInt());
+    }
+    return counts;
 }
 
 void DatabaseManager::markRoomRead(int roomId, int userId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("UPDATE room_members SET last_read_msg_id = "
-              "(SELECT COALESCE(MAX(id), 0) FROM messages WHERE room_id = ?) "
-              "WHERE room_id = ? AND user_id = ?");
-    q.addBindValue(roomId);
-    q.addBindValue(roomId);
-    q.addBindValue(userId);
+    CachedQuery q(db, QStringLiteral("room.member.mark_read"),
+                  "UPDATE room_members SET last_read_msg_id = "
+                  "(SELECT COALESCE(MAX(id), 0) FROM messages WHERE room_id = ?), "
+                  "unread_count = 0 "
+                  "WHERE room_id = ? AND user_id = ?");
+    q->addBindValue(roomId);
+    q->addBindValue(roomId);
+    q->addBindValue(userId);
     q.exec();
 }
 
-int DatabaseManager::getUnreadFriendCount(int friendshipId, int userId) {
+QHash<int, int> DatabaseManager::getUnreadFriendCounts(int userId) {
     QSqlDatabase db = getConnection();
-    QSqlQuery q(db);
-    q.prepare("SELECT user_id1, user_id2, user1_last_read_msg_id, user2_last_read_msg_id "
-              "FROM friendships WHERE id = ?");
-    q.addBindValue(friendshipId);
-    if (!q.exec() || !q.next()) return 0;
-    int uid1 = q.value(0).toInt();
-    int lastRead = (userId == uid1) ? q.value(2).toInt() : q.value(3).toInt();
-
-    q.prepare("SELECT COUNT(*) FROM friend_messages WHERE friendship_id = ? AND id > ?");
-    q.addBindValue(friendshipId);
-    q.addBindValue(lastRead);
-    if (q.exec() && q.next()) return q.value(0).toInt();
-    return 0;
+    CachedQuery q(db, QStringLiteral("friendship.unread_counts"),
+                  "SELECT id, CASE WHEN user_id1 = ? THEN user1_unread_count "
+                  "ELSE user2_unread_count END "
+                  "FROM friendships WHERE user_id1 = ? OR user_id2 = ?");
+    q->addBindValue(userId);
+    q->addBindValue(userId);
+    q->addBindValue(userId);
+
+    QHash<int, int> counts;
+    if (q.exec()) {
+        while (q->next())
+            counts.insert(q->value(0).toInt(), q->value(1).toInt());
+    }
+    return counts;
 }
 
 int DatabaseManager::markFriendRead(int friendshipId, int userId) {
@@ -3233,10 +4906,12 @@ int DatabaseManager::markFriendRead(int friendshipId, int userId) {
     if (!q.exec() || !q.next()) return -1;
     int uid1 = q.value(0).toInt();
     QString col = (userId == uid1) ? "user1_last_read_msg_id" : "user2_last_read_msg_id";
+    QString unreadCol = (userId == uid1) ? "user1_unread_count" : "user2_unread_count";
 
     q.prepare(QString("UPDATE friendships SET %1 = MAX(COALESCE(%1, 0), "
-              "(SELECT COALESCE(MAX(id), 0) FROM friend_messages WHERE friendship_id = ?)) "
-              "WHERE id = ?").arg(col));
+              "(SELECT COALESCE(MAX(id), 0) FROM friend_messages WHERE friendship_id = ?)), "
+              "%2 = 0 "
+              "WHERE id = ?").arg(col, unreadCol));
     q.addBindValue(friendshipId);
     q.addBindValue(friendshipId);
     if (!q.exec()) return -1;
@@ -5,7 +5,10 @@
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QMutex>
+#include <QWaitCondition>
 #include <QPair>
+#include <QHash>
+#include <QCache>
 
 struct MessageSaveResult {
     enum class Status {
@@ -42,6 +45,12 @@ struct AdministrativeDeletionSaveResult {
     QJsonArray deletedFileIds;
 };
 
+/// 内容寻址 blob 的引用：hash 为 SHA-256 十六进制，空表示没有内容
+struct BlobRef {
+    QString hash;
+    qint64 size = 0;
+};
+
 struct RoomSyncPage {
     QJsonArray messages;
     QJsonArray events;
@@ -49,6 +58,172 @@ struct RoomSyncPage {
     int itemCount = 0;
 };
 
+struct FileExpiryBatch {
+    QStringList cosUrls;      // 需要从 COS 删除的 URL
+    int expiredCount = 0;
+    int prunedBlobCount = 0;  // 本批回收的无引用缩略图/头像 blob
+    bool hasMore = false;     // 本批已满，可能仍有待过期文件
+};
+
+/// 房间内未清除的文件记录，供配额调整时计算清理计划
+struct RoomActiveFile {
+    int fileId = 0;
+    qint64 fileSize = 0;
+    QString filePath;
+    QString cosUrl;
+};
+
+/// 单条预编译语句的缓存计数（进程内所有连接汇总）
+struct StatementCacheCounters {
+    quint64 hits = 0;
+    quint64 misses = 0;     // 首次准备或失效后重新准备
+    quint64 executions = 0;
+};
+
+/// 会话消息序列号分配器：计数器常驻内存，启动时由持久化高水位与消息表重建，
+/// 未见过的会话在首次使用时懒加载。分配必须发生在写事务（BEGIN IMMEDIATE）内，
+/// 使分配顺序与提交顺序一致；事务回滚会留下空洞，序列号只保证单调递增。
+/// 假定同一数据库文件只由一个 DatabaseManager 写入。
+class MessageSequenceAllocator {
+public:
+    struct Scope {
+        QString messageTable;       // messages / friend_messages
+        QString ownerColumn;        // room_id / friendship_id
+        QString watermarkTable;     // 删除消息时由触发器维护的持久化高水位
+        QString eventTable;         // 同样占用序列号的事件表，可为空
+    };
+
+    explicit MessageSequenceAllocator(const Scope &scope);
+
+    void seed(const QHash<int, qint64> &lastSequences);
+    bool reserve(QSqlDatabase &db, int ownerId, qint64 *sequence);
+    /// 写事务提交成功后调用，推进对外可见的最新序列号
+    void publish(int ownerId, qint64 sequence);
+    qint64 lastCommitted(QSqlDatabase &db, int ownerId);
+
+private:
+    struct Counter {
+        qint64 allocated = 0;
+        qint64 committed = 0;
+    };
+
+    bool load(QSqlDatabase &db, int ownerId, qint64 *lastSequence);
+    Counter &counterFor(int ownerId, qint64 lastSequence);
+
+    Scope m_scope;
+    QString m_loadStatementId;
+    QString m_loadSql;
+    QMutex m_mutex;
+    QHash<int, Counter> m_counters;
+};
+
+/// 热点房间最近消息缓存：每个房间保留按 sequence 排序的最新若干条完整消息记录，
+/// 不带 before 的历史页与 afterSequence 增量页可直接由内存返回。
+/// 保存与撤回就地更新窗口；删除、文件清理、改名等无法就地更新的变更使整个房间失效。
+class RoomHistoryCache {
+public:
+    struct Window {
+        QList<QJsonObject> messages;    // 按 sequence 升序
+        qint64 floorSequence = 0;       // sequence 大于该值的消息全部在窗口内
+        qint64 syncFloor = 0;           // afterSequence 不小于该值的增量页可由窗口完整回答
+        quint64 lastUsed = 0;
+    };
+
+    RoomHistoryCache(int messagesPerRoom, int maxRooms);
+
+    bool enabled() const { return m_messagesPerRoom > 0 && m_maxRooms > 0; }
+    int  messagesPerRoom() const { return m_messagesPerRoom; }
+    bool contains(int roomId);
+
+    bool latest(int roomId, int count, QJsonArray *messages);
+    bool syncPage(int roomId, int count, qint64 afterSequence, RoomSyncPage *page);
+    static bool latestFrom(const Window &window, int count, QJsonArray *messages);
+    static bool syncPageFrom(const Window &window, int count, qint64 afterSequence,
+                             RoomSyncPage *page);
+
+    /// 加载前取得版本号；加载期间房间发生任何变更时 install 放弃写入，避免装入过期快照
+    quint64 version(int roomId);
+    void install(int roomId, quint64 version, Window window);
+
+    /// 写事务提交前调用 beginWrite：房间有未完成的写入时 latest / syncPage 不由窗口回答，
+    /// 读请求改查数据库，避免提交与更新窗口之间读到缺少已提交消息的窗口。
+    /// 提交成功后再调用 append / applyRecall / applyThumbnail，窗口只反映已提交的数据；
+    /// 无论成败最后都调用 endWrite。append 按 sequence 插入，多个写入的应用顺序无关紧要。
+    /// message 为空表示调用方未读取记录，房间已缓存时直接失效
+    void beginWrite(int roomId);
+    void append(int roomId, const QJsonObject &message);
+    void applyRecall(int roomId, int messageId, qint64 mutationSequence);
+    void applyThumbnail(int roomId, int messageId, const BlobRef &thumbnail);
+    void endWrite(int roomId);
+    void invalidate(int roomId);
+    void invalidateAll();
+
+    void recordLookup(bool hit);
+    void logStats();
+
+private:
+    static constexpr int kVersionStripes = 64;
+
+    quint64 &versionFor(int roomId) { return m_versions[static_cast<quint32>(roomId) % kVersionStripes]; }
+    void evictLeastRecentlyUsed();
+    QString statsLine() const;
+
+    int m_messagesPerRoom = 0;
+    int m_maxRooms = 0;
+    QMutex m_mutex;
+    QHash<int, Window> m_rooms;
+    QHash<int, int> m_writesInFlight;   // roomId -> 已 beginWrite 尚未 endWrite 的写入数
+    quint64 m_versions[kVersionStripes] = {};
+    quint64 m_tick = 0;
+    quint64 m_lookups = 0;
+    quint64 m_hits = 0;
+    quint64 m_loads = 0;
+    quint64 m_invalidations = 0;
+};
+
+/// 房间文件配额账本：每个房间的配额上限与已用空间/文件数常驻内存，首次使用时由
+/// room_settings 与 files 加载一次；进行中上传的预留也记在这里，检查与预留在同一把锁内完成，
+/// 可从任意工作线程调用。文件记录保存后对应预留就地转为已用；清理、删除、过期与设置变更
+/// 使房间失效，下次使用时重新加载。加载与写入重叠时按 RoomHistoryCache 的版本号规则放弃装入。
+class RoomFileQuotaLedger {
+public:
+    struct Usage {
+        qint64 maxFileSize = 0;
+        qint64 totalFileSpace = 0;
+        int maxFileCount = 0;
+        qint64 usedBytes = 0;
+        int fileCount = 0;
+    };
+
+    bool usage(QSqlDatabase &db, int roomId, Usage *usage);
+    /// 检查上限并预留；失败时 error 为面向用户的原因
+    bool reserve(QSqlDatabase &db, int roomId, qint64 fileSize, QString *error);
+    void release(int roomId, qint64 fileSize);
+    /// 写入文件记录前调用；提交成功后调用 commit，把对应预留转为已用
+    void beginWrite(int roomId);
+    void commit(int roomId, qint64 fileSize);
+    void invalidate(int roomId);
+    void invalidateAll();
+
+private:
+    static constexpr int kVersionStripes = 64;
+
+    struct Room {
+        Usage usage;
+        bool loaded = false;
+        qint64 reservedBytes = 0;
+        int reservedCount = 0;
+    };
+
+    quint64 &versionFor(int roomId) { return m_versions[static_cast<quint32>(roomId) % kVersionStripes]; }
+    bool load(QSqlDatabase &db, int roomId, Usage *usage);
+    void dropIfIdle(int roomId);
+
+    QMutex m_mutex;
+    QHash<int, Room> m_rooms;
+    quint64 m_versions[kVersionStripes] = {};
+};
+
 /// 数据库管理器 —— 线程安全，使用每线程独立连接
 class DatabaseManager : public QObject {
     Q_OBJECT
@@ -57,6 +232,11 @@ public:
     ~DatabaseManager() override;
 
     bool initialize();
+    /// 输出预编译语句缓存的命中率与各语句耗时（进程内所有连接汇总）
+    static void logStatementCacheStats();
+    static StatementCacheCounters statementCacheCounters(const QString &statementId);
+    /// 输出热点房间消息缓存的命中统计
+    void logRoomHistoryCacheStats();
 
     // 用户管理
     int  registerUser(const QString &uniqueId, const QString &displayName, const QString &password);
@@ -97,7 +277,8 @@ public:
 
     // 聊天室头像
     QByteArray getRoomAvatar(int roomId);
-    bool       setRoomAvatar(int roomId, const QByteArray &avatarData);
+    BlobRef    getRoomAvatarRef(int roomId);
+    bool       setRoomAvatar(int roomId, const QByteArray &avatarData, BlobRef *ref = nullptr);
 
     // 消息管理
     int  saveMessage(int roomId, int userId, const QString &content,
@@ -123,21 +304,37 @@ public:
     qint64 getRoomLastMessageSequence(int roomId);
     bool isMessageInRoom(int messageId, int roomId);
     RecallResult recallMessage(int messageId, int userId, int timeLimitSec);
+    /// 后台生成的缩略图（JPEG 字节）替换消息原有缩略图；消息已撤回或删除时返回 false
+    bool setMessageThumbnail(int roomId, int messageId, const QByteArray &thumbnail,
+                             BlobRef *ref = nullptr);
+    /// 引用该文件的未撤回消息已有的缩略图哈希，没有时返回空；转发时复用，不再重新生成
+    QString getFileThumbnailHash(int fileId, bool isFriendFile);
     /// 获取单条消息关联的文件信息 (file_id, file_path)，用于撤回时清理文件
     QPair<int, QString> getFileInfoForMessage(int messageId);
 
     // 文件管理
+    /// contentHash 非空时记录引用内容寻址存储中的 blob（须先 registerFileBlob）
     int     saveFile(int roomId, int userId, const QString &fileName,
-                     const QString &filePath, qint64 fileSize);
+                     const QString &filePath, qint64 fileSize,
+                     const QString &contentHash = QString());
     QString getFilePath(int fileId, bool isFriendFile = false);
     QString getFileName(int fileId, bool isFriendFile = false);
     bool canUserAccessFile(int fileId, bool isFriendFile, int userId);
     bool deleteStoredFileRecord(int fileId, bool isFriendFile = false);
-    /// 过期处理，返回需要从 COS 删除的 URL 列表
-    QStringList expireStoredFiles();
+    /// 过期处理（后台维护任务调用）：每张文件表最多标记 batchSize 个到期文件
+    FileExpiryBatch expireStoredFiles(int batchSize);
+    /// 登记内容寻址文件 blob，已存在时保持原记录；引用计数由文件记录触发器维护
+    bool registerFileBlob(const QString &hash, const QString &filePath, qint64 fileSize);
+    /// 旧版文件收入存储后，把仍指向 legacyPath 的未清理记录改为引用 blob 并计入引用；
+    /// 记录已清除、已删除或已改写时返回 false
+    bool adoptFileBlob(int fileId, bool isFriendFile, const QString &legacyPath,
+                       const QString &blobPath, const QString &hash);
+    /// 删除最多 limit 个引用计数为零的文件 blob 记录，返回 {hash, file_path} 供调用方删除磁盘文件
+    QList<QPair<QString, QString>> takeUnreferencedFileBlobs(int limit);
 
     // COS 云存储 URL
-    bool        setCosUrl(int fileId, bool isFriendFile, const QString &cosUrl);
+    /// 只写入未清理的记录，返回受影响行数（0 表示记录已删除或已清理），失败返回 -1
+    int         setCosUrl(int fileId, bool isFriendFile, const QString &cosUrl);
     QString     getCosUrl(int fileId, bool isFriendFile);
     QStringList getCosUrlsForFileIds(const QList<int> &fileIds, bool isFriendFile = false);
     QStringList getCosUrlsForRoom(int roomId);
@@ -176,14 +373,29 @@ public:
     bool   setRoomMaxFileSize(int roomId, qint64 maxSize);
     qint64 getRoomUsedFileSpace(int roomId);
     int    getRoomFileCount(int roomId);
-    QJsonArray getRoomActiveFilesOrdered(int roomId);
+    /// 房间文件配额：检查上限并为即将保存的文件预留空间。saveFile 成功后预留自动转为已用，
+    /// 未能保存文件记录时调用方须 releaseRoomFileQuota
+    bool reserveRoomFileQuota(int roomId, qint64 fileSize, QString *error);
+    void releaseRoomFileQuota(int roomId, qint64 fileSize);
+    /// 按 created_at, id 升序（最早的在前）
+    QList<RoomActiveFile> getRoomActiveFilesOrdered(int roomId);
     QJsonArray getRoomAllFiles(int roomId);
-    bool markRoomFilesCleared(int roomId, const QList<int> &fileIds, const QString &reason);
+    /// 只标记仍未清除的文件；clearedIds 返回本次实际标记的 id（已被过期任务等清除的不在其中）
+    bool markRoomFilesCleared(int roomId, const QList<int> &fileIds, const QString &reason,
+                              QList<int> *clearedIds = nullptr);
 
     // 用户头像
     QByteArray getUserAvatar(int userId);
-    bool       setUserAvatar(int userId, const QByteArray &avatarData);
+    bool       setUserAvatar(int userId, const QByteArray &avatarData, BlobRef *ref = nullptr);
     QByteArray getUserAvatarByName(const QString &username);
+    BlobRef    getUserAvatarRef(const QString &username);
+
+    // 内容寻址 blob（缩略图、头像），按哈希读取，热点内容缓存在内存
+    QByteArray getBlob(const QString &hash);
+    /// 批量读取：缓存未命中的哈希合并为一条 IN (...) 查询，缺失的哈希不出现在结果中
+    QHash<QString, QByteArray> getBlobs(const QStringList &hashes);
+    /// 头像对所有登录用户可见；缩略图须属于用户所在房间或所属好友会话中未撤回的消息
+    bool canUserReadBlob(int userId, const QString &hash);
 
     // 好友系统
     bool sendFriendRequest(int fromUserId, int toUserId);
@@ -200,9 +412,11 @@ public:
     int  ensureSelfFriendship(int userId);
 
     // 未读消息
-    int  getUnreadRoomCount(int roomId, int userId);
+    /// 用户所有房间的未读数 roomId -> unread（物化计数，一次查询）
+    QHash<int, int> getUnreadRoomCounts(int userId);
     void markRoomRead(int roomId, int userId);
-    int  getUnreadFriendCount(int friendshipId, int userId);
+    /// 用户所有好友会话的未读数 friendshipId -> unread（物化计数，一次查询）
+    QHash<int, int> getUnreadFriendCounts(int userId);
     int  markFriendRead(int friendshipId, int userId);
     int  getPendingFriendRequestCount(int userId);
 
@@ -230,18 +444,60 @@ public:
 
     // 好友消息撤回
     RecallResult recallFriendMessage(int messageId, int userId, int timeLimitSec);
+    bool setFriendMessageThumbnail(int friendshipId, int messageId,
+                                   const QByteArray &thumbnail, BlobRef *ref = nullptr);
     int getFriendshipIdForOwnedMessage(int messageId, int userId);
     QPair<int, QString> getFileInfoForFriendMessage(int messageId);
 
     // 好友文件
     int  saveFriendFile(int friendshipId, int userId, const QString &fileName,
-                        const QString &filePath, qint64 fileSize);
+                        const QString &filePath, qint64 fileSize,
+                        const QString &contentHash = QString());
 
 private:
+    // 等待组提交的一条幂等文本消息；由提交线程栈上持有，完成后 done 置位
+    struct PendingMessageWrite {
+        bool friendMessage = false;
+        int ownerId = 0;            // roomId 或 friendshipId
+        int senderId = 0;
+        QString clientMessageId;
+        QString content;
+        QString contentType;
+        MessageSaveResult result;
+        bool done = false;
+    };
+
     QSqlDatabase getConnection();
+    bool loadRoomHistoryWindow(int roomId, RoomHistoryCache::Window *window);
+    /// 写事务内调用：登记房间写入并读取新消息的完整记录，提交成功后交给 m_roomHistory.append
+    QJsonObject stageRoomHistoryAppend(QSqlDatabase &db, int roomId, int messageId);
+    MessageSaveResult submitMessageWrite(PendingMessageWrite &write);
+    void commitMessageWriteBatch(const QList<PendingMessageWrite *> &batch);
 
     QString m_dbPath;   // SQLite 数据库文件路径
 
     QMutex m_initMutex;
     bool   m_initialized = false;
+
+    MessageSequenceAllocator m_roomSequences;
+    MessageSequenceAllocator m_friendshipSequences;
+    RoomHistoryCache m_roomHistory;
+    RoomFileQuotaLedger m_roomFileQuota;
+
+    QMutex m_blobCacheMutex;
+    QCache<QString, QByteArray> m_blobCache;  // 代价按字节计
+    qint64 m_blobSweepCursor = 0;             // 由过期任务串行推进
+
+    // 消息组提交队列（受 m_messageWriteMutex 保护）
+    QMutex m_messageWriteMutex;
+    QWaitCondition m_messageWriteDone;
+    QWaitCondition m_messageWriteBatchFull;
+    QList<PendingMessageWrite *> m_pendingMessageWrites;
+    bool m_messageWriteLeaderActive = false;
+    int m_messageCommitWindowUs = 0;
+    int m_messageCommitMaxBatch = 1;
+    int m_lastMessageCommitBatchSize = 0;
+    int m_messageCommitMaxObserved = 0;
+    quint64 m_messageCommitBatches = 0;
+    quint64 m_messageCommitItems = 0;
 };
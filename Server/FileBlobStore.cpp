@@ -0,0 +1,199 @@
+#include "FileBlobStore.h"
+#include "DatabaseManager.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QUuid>
+
+namespace {
+
+constexpr int kHashHexLength = 64;
+
+QAtomicInteger<quint64> g_stored{0};
+QAtomicInteger<quint64> g_deduplicated{0};
+QAtomicInteger<qint64> g_savedBytes{0};
+QAtomicInteger<quint64> g_reaped{0};
+
+QString incomingDir(const QString &rootDir) {
+    return rootDir + QStringLiteral("/incoming");
+}
+
+// 每次收入或共享都计数一次，总数到 2 的幂时输出去重效果
+void recordCommit(bool deduplicated, qint64 size) {
+    if (deduplicated) {
+        g_deduplicated.fetchAndAddRelaxed(1);
+        g_savedBytes.fetchAndAddRelaxed(size);
+    } else {
+        g_stored.fetchAndAddRelaxed(1);
+    }
+    const quint64 total = g_stored.loadRelaxed() + g_deduplicated.loadRelaxed();
+    if (total >= 1024 && (total & (total - 1)) == 0) {
+        qInfo().noquote() << QStringLiteral("[FileStore] stored=%1 deduplicated=%2 savedBytes=%3 reaped=%4")
+                                 .arg(g_stored.loadRelaxed())
+                                 .arg(g_deduplicated.loadRelaxed())
+                                 .arg(g_savedBytes.loadRelaxed())
+                                 .arg(g_reaped.loadRelaxed());
+    }
+}
+
+} // namespace
+
+FileBlobStore::FileBlobStore(DatabaseManager *db, const QString &rootDir)
+    : m_db(db)
+    , m_rootDir(QDir::cleanPath(rootDir))
+{}
+
+bool FileBlobStore::open() {
+    // 进行中的上传只保存在内存里，重启后无法续传，残留的临时文件直接丢弃
+    QDir incoming(incomingDir(m_rootDir));
+    if (incoming.exists()) incoming.removeRecursively();
+    if (!QDir().mkpath(incomingDir(m_rootDir))) {
+        qCritical() << "[FileStore] 无法创建存储目录:" << m_rootDir;
+        return false;
+    }
+    return true;
+}
+
+QString FileBlobStore::createIncomingPath() const {
+    return incomingDir(m_rootDir) + QLatin1Char('/')
+           + QUuid::createUuid().toString(QUuid::WithoutBraces) + QStringLiteral(".part");
+}
+
+bool FileBlobStore::isValidHash(const QString &hash) {
+    if (hash.size() != kHashHexLength) return false;
+    for (const QChar c : hash) {
+        if (!((c >= QLatin1Char('0') && c <= QLatin1Char('9'))
+              || (c >= QLatin1Char('a') && c <= QLatin1Char('f'))))
+            return false;
+    }
+    return true;
+}
+
+QString FileBlobStore::blobPath(const QString &hash) const {
+    return m_rootDir + QLatin1Char('/') + hash.left(2) + QLatin1Char('/') + hash;
+}
+
+bool FileBlobStore::contains(const QString &path) const {
+    if (path.isEmpty()) return false;
+    const QString hash = QFileInfo(path).fileName();
+    return isValidHash(hash) && QDir::cleanPath(path) == blobPath(hash);
+}
+
+bool FileBlobStore::place(const QString &tempPath, const QString &target, bool *placed) {
+    *placed = false;
+    // blob 名即内容哈希，已存在的文件内容必然相同
+    if (QFileInfo::exists(target)) {
+        QFile::remove(tempPath);
+        return true;
+    }
+    if (!QDir().mkpath(QFileInfo(target).absolutePath()) || !QFile::rename(tempPath, target)) {
+        qWarning() << "[FileStore] 收入 blob 失败:" << target;
+        QFile::remove(tempPath);
+        return false;
+    }
+    *placed = true;
+    return true;
+}
+
+int FileBlobStore::commit(const QString &target, const QString &hash, qint64 size,
+                          bool placed, const RecordFn &record) {
+    if (!m_db->registerFileBlob(hash, target, size)) {
+        // 刚放入的文件还没有登记，不会被回收，这里直接删除
+        if (placed) QFile::remove(target);
+        return -1;
+    }
+    recordCommit(!placed, size);
+    return record(target, hash);
+}
+
+int FileBlobStore::storeFile(const QString &tempPath, const QString &hash, qint64 size,
+                             const RecordFn &record) {
+    if (!isValidHash(hash)) {
+        QFile::remove(tempPath);
+        return -1;
+    }
+    const QString target = blobPath(hash);
+    QMutexLocker locker(&m_mutex);
+    bool placed = false;
+    if (!place(tempPath, target, &placed)) return -1;
+    return commit(target, hash, size, placed, record);
+}
+
+int FileBlobStore::storeData(const QByteArray &data, const RecordFn &record) {
+    const QString hash = QString::fromLatin1(
+        QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex());
+    const QString target = blobPath(hash);
+    QMutexLocker locker(&m_mutex);
+    bool placed = false;
+    if (!QFileInfo::exists(target)) {
+        const QString tempPath = createIncomingPath();
+        QFile file(tempPath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+            file.close();
+            QFile::remove(tempPath);
+            return -1;
+        }
+        file.close();
+        if (!place(tempPath, target, &placed)) return -1;
+    }
+    return commit(target, hash, data.size(), placed, record);
+}
+
+int FileBlobStore::share(const QString &path, const RecordFn &record) {
+    if (!contains(path)) return -1;
+    const QString hash = QFileInfo(path).fileName();
+    const QString target = blobPath(hash);
+    QMutexLocker locker(&m_mutex);
+    // 源记录持有引用时 blob 不会被回收；文件缺失说明源记录已在此前被清除
+    const QFileInfo info(target);
+    if (!info.isFile()) return -1;
+    return commit(target, hash, info.size(), false, record);
+}
+
+QString FileBlobStore::import(const QString &path, const AdoptFn &adopt) {
+    if (contains(path)) return path;
+    QFile source(path);
+    QCryptographicHash hasher(QCryptographicHash::Sha256);
+    if (!source.open(QIODevice::ReadOnly) || !hasher.addData(&source)) return {};
+    source.close();
+    const QString hash = QString::fromLatin1(hasher.result().toHex());
+    const QString target = blobPath(hash);
+
+    // 复制在锁外进行，避免大文件阻塞其他上传的收入
+    QString tempPath;
+    if (!QFileInfo::exists(target)) {
+        tempPath = createIncomingPath();
+        if (!QFile::copy(path, tempPath)) {
+            QFile::remove(tempPath);
+            return {};
+        }
+    }
+    QMutexLocker locker(&m_mutex);
+    bool placed = false;
+    if (tempPath.isEmpty() ? !QFileInfo::exists(target) : !place(tempPath, target, &placed))
+        return {};
+    if (!m_db->registerFileBlob(hash, target, QFileInfo(target).size())) {
+        if (placed) QFile::remove(target);
+        return {};
+    }
+    // 源记录已被清除时 blob 保持零引用，由下一轮回收删除
+    if (!adopt(target, hash)) return {};
+    recordCommit(!placed, QFileInfo(target).size());
+    if (!QFile::remove(path))
+        qWarning() << "[FileStore] 删除已收入的旧版文件失败:" << path;
+    return target;
+}
+
+int FileBlobStore::reap(int batchSize) {
+    QMutexLocker locker(&m_mutex);
+    const QList<QPair<QString, QString>> blobs = m_db->takeUnreferencedFileBlobs(batchSize);
+    for (const auto &blob : blobs) {
+        if (QFile::exists(blob.second) && !QFile::remove(blob.second))
+            qWarning() << "[FileStore] 删除无引用 blob 失败:" << blob.second;
+    }
+    if (!blobs.isEmpty()) g_reaped.fetchAndAddRelaxed(blobs.size());
+    return blobs.size();
+}
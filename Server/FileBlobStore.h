@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <functional>
+
+class DatabaseManager;
+
+/// 文件内容寻址存储 —— 上传与转发的文件字节按 SHA-256 在 {root}/xx/<hash> 下只存一份，
+/// files / friend_files 记录引用同一路径，引用计数由数据库触发器随记录增删维护。
+/// 放入 blob 与写入引用它的记录在同一把锁内完成，回收计数归零的 blob 也持有该锁，
+/// 因此回收不会删掉刚被新记录引用的文件。可从多个工作线程并发调用。
+class FileBlobStore {
+public:
+    /// 在锁内为 blob 写入一条文件记录，返回记录 id；<= 0 表示失败，blob 保持零引用等待回收
+    using RecordFn = std::function<int(const QString &blobPath, const QString &hash)>;
+    /// 在锁内把旧版文件的源记录改为引用 blob（计入引用），返回是否改写成功
+    using AdoptFn = std::function<bool(const QString &blobPath, const QString &hash)>;
+
+    static constexpr int REAP_BATCH = 64;
+
+    FileBlobStore(DatabaseManager *db, const QString &rootDir);
+
+    /// 启动时调用：创建目录并清空上次运行残留的上传临时文件
+    bool open();
+    QString rootDir() const { return m_rootDir; }
+    /// 新上传的临时文件路径；与 blob 位于同一文件系统，收入时只需重命名
+    QString createIncomingPath() const;
+    /// path 是否为本存储中的 blob（否则是旧版按记录存放的文件）
+    bool contains(const QString &path) const;
+    QString blobPath(const QString &hash) const;
+
+    /// 收入已写完并在写入时计算了哈希的临时文件：内容已存在时删除临时文件，否则重命名为 blob
+    int storeFile(const QString &tempPath, const QString &hash, qint64 size,
+                  const RecordFn &record);
+    /// 收入内存中的小文件：内容已存在时不写磁盘
+    int storeData(const QByteArray &data, const RecordFn &record);
+    /// 为已有 blob 再写一条记录（转发），不复制字节；旧版文件须先经 import() 收入存储
+    int share(const QString &path, const RecordFn &record);
+    /// 把旧版按记录存放的文件收入存储（内容已存在时不复制），返回 blob 路径，失败返回空。
+    /// 登记 blob 与 adopt 改写源记录在同一把锁内完成，blob 不会以零引用暴露给回收；
+    /// 改写成功后删除旧文件，之后的转发直接共享 blob，不再重新计算哈希
+    QString import(const QString &path, const AdoptFn &adopt);
+    /// 删除引用计数归零的 blob，返回本批删除数量
+    int reap(int batchSize = REAP_BATCH);
+
+    /// 64 位小写十六进制 SHA-256
+    static bool isValidHash(const QString &hash);
+
+private:
+    bool place(const QString &tempPath, const QString &target, bool *placed);
+    int commit(const QString &target, const QString &hash, qint64 size, bool placed,
+               const RecordFn &record);
+
+    DatabaseManager *m_db = nullptr;
+    QString m_rootDir;
+    QMutex m_mutex;
+};
@@ -0,0 +1,434 @@
+#include "HttpConnection.h"
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QFile>
+#include <QSocketNotifier>
+#include <QTcpSocket>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sys/sendfile.h>
+#endif
+
+namespace {
+
+constexpr int kDefaultKeepAliveMs = 15000;
+constexpr int kMaxKeepAliveMs = 300000;
+constexpr int kMaxKeepAliveRequests = 100;
+constexpr qint64 kBodyChunkBytes = 256 * 1024;
+constexpr qint64 kCopyChunkBytes = 256 * 1024;
+constexpr qint64 kHighWaterBytes = 2 * 1024 * 1024;
+constexpr qint64 kSendfileChunkBytes = 4 * 1024 * 1024;
+// 当前响应未完成时积压的流水线数据上限
+constexpr qsizetype kMaxPipelinedBytes = 256 * 1024;
+
+QAtomicInteger<quint64> g_httpConnections{0};
+QAtomicInteger<quint64> g_httpRequests{0};
+QAtomicInteger<quint64> g_httpReusedRequests{0};
+QAtomicInteger<quint64> g_httpZeroCopyBytes{0};
+
+void recordRequest(bool reused) {
+    if (reused) g_httpReusedRequests.fetchAndAddRelaxed(1);
+    const quint64 requests = g_httpRequests.fetchAndAddRelaxed(1) + 1;
+    if ((requests & (requests - 1)) == 0 && requests >= 1024) {
+        qInfo().noquote()
+            << QStringLiteral("[Http] requests=%1 connections=%2 reused=%3 zeroCopyMB=%4")
+                   .arg(requests)
+                   .arg(g_httpConnections.loadRelaxed())
+                   .arg(g_httpReusedRequests.loadRelaxed())
+                   .arg(static_cast<double>(g_httpZeroCopyBytes.loadRelaxed()) / (1024.0 * 1024.0),
+                        0, 'f', 1);
+    }
+}
+
+} // namespace
+
+// ==================== 请求头解析 ====================
+
+void HttpRequestParser::append(const QByteArray &data) {
+    if (m_readPos > 0) {
+        if (m_readPos == m_buffer.size()) {
+            m_buffer.resize(0);   // 保留已分配容量
+            m_scanPos = 0;
+            m_readPos = 0;
+        } else if (m_readPos >= m_buffer.size() / 2) {
+            m_buffer.remove(0, m_readPos);
+            m_scanPos -= m_readPos;
+            m_readPos = 0;
+        }
+    }
+    m_buffer.append(data);
+}
+
+HttpRequestParser::Result HttpRequestParser::next(HttpRequest &request) {
+    // 请求之间允许出现多余的空行
+    while (m_readPos + 1 < m_buffer.size() && m_buffer.at(m_readPos) == '\r'
+           && m_buffer.at(m_readPos + 1) == '\n') {
+        m_readPos += 2;
+    }
+    if (m_scanPos < m_readPos) m_scanPos = m_readPos;
+
+    // 只扫描上次之后到达的字节；回退 3 字节以覆盖跨两次到达的结束标记
+    const qsizetype headerEnd = m_buffer.indexOf("\r\n\r\n", qMax(m_readPos, m_scanPos - 3));
+    if (headerEnd < 0) {
+        m_scanPos = m_buffer.size();
+        return bufferedBytes() > MAX_HEADER_BYTES ? Result::TooLarge : Result::Incomplete;
+    }
+    if (headerEnd + 4 - m_readPos > MAX_HEADER_BYTES)
+        return Result::TooLarge;
+
+    const QList<QByteArray> lines =
+        m_buffer.mid(m_readPos, headerEnd - m_readPos).split('\n');
+    m_readPos = headerEnd + 4;
+    m_scanPos = m_readPos;
+
+    request = HttpRequest();
+    const QList<QByteArray> parts = lines.first().trimmed().split(' ');
+    if (parts.size() < 2 || parts.at(0).isEmpty() || parts.at(1).isEmpty())
+        return Result::Invalid;
+    request.method = parts.at(0);
+    request.target = parts.at(1);
+    request.version = parts.size() > 2 ? parts.at(2) : QByteArrayLiteral("HTTP/1.0");
+
+    for (qsizetype i = 1; i < lines.size(); ++i) {
+        const QByteArray &line = lines.at(i);
+        const int separator = line.indexOf(':');
+        if (separator <= 0) continue;
+        const QByteArray name = line.left(separator).trimmed().toLower();
+        const QByteArray value = line.mid(separator + 1).trimmed();
+        auto it = request.headers.find(name);
+        if (it == request.headers.end())
+            request.headers.insert(name, value);
+        else
+            it.value() += ", " + value;   // 重复的列表型头字段（如 If-None-Match）合并
+    }
+
+    const QByteArray connection = request.header("connection").toLower();
+    request.keepAlive = request.version == "HTTP/1.1"
+        ? !connection.contains("close")
+        : connection.contains("keep-alive");
+    request.chunked = !request.header("transfer-encoding").isEmpty();
+    if (request.headers.contains("content-length")) {
+        bool ok = false;
+        request.contentLength = request.header("content-length").toLongLong(&ok);
+        if (!ok || request.contentLength < 0) request.contentLength = -1;
+    }
+    return Result::Complete;
+}
+
+QByteArray HttpRequestParser::take(qint64 maxBytes) {
+    const qsizetype count = static_cast<qsizetype>(qMin<qint64>(maxBytes, bufferedBytes()));
+    const QByteArray data = m_buffer.mid(m_readPos, count);
+    m_readPos += count;
+    if (m_scanPos < m_readPos) m_scanPos = m_readPos;
+    return data;
+}
+
+void HttpRequestParser::clear() {
+    m_buffer.clear();
+    m_readPos = 0;
+    m_scanPos = 0;
+}
+
+// ==================== 连接 ====================
+
+HttpConnection::HttpConnection(QTcpSocket *socket, QObject *parent)
+    : QObject(parent)
+    , m_socket(socket)
+{
+    m_socket->setParent(this);
+    connect(m_socket, &QTcpSocket::readyRead, this, &HttpConnection::onReadyRead);
+    connect(m_socket, &QTcpSocket::bytesWritten, this, [this](qint64) {
+        if (m_state != State::SendingFile) return;
+        // 写缓冲有字节写入内核才算进展；客户端不再读取时不会触发
+        m_idle.touch();
+        pumpFile();
+    });
+    connect(m_socket, &QTcpSocket::disconnected, this, &HttpConnection::onDisconnected);
+    g_httpConnections.fetchAndAddRelaxed(1);
+    // 空闲或请求头迟迟不完整的连接到期断开；正在应答的连接只续期
+    m_idle.start(keepAliveTimeoutMs(), [this]() { onIdleTimeout(); });
+}
+
+HttpConnection::~HttpConnection() {
+    // 线程停止时仍在接收的请求体按中止处理，调用方据此清理上传状态
+    if (m_bodyDone) {
+        const auto done = std::move(m_bodyDone);
+        m_bodyDone = nullptr;
+        done(false);
+    }
+}
+
+int HttpConnection::keepAliveTimeoutMs() {
+    bool ok = false;
+    const int configured = qEnvironmentVariableIntValue("CHATROOM_HTTP_KEEPALIVE_MS", &ok);
+    if (ok && configured > 0 && configured <= kMaxKeepAliveMs) return configured;
+    return kDefaultKeepAliveMs;
+}
+
+bool HttpConnection::isOpen() const {
+    return m_state != State::Closing && m_socket->state() == QAbstractSocket::ConnectedState;
+}
+
+void HttpConnection::onReadyRead() {
+    if (m_state == State::Closing) {
+        m_socket->readAll();
+        return;
+    }
+    if (m_state == State::ReadingBody) {
+        // 请求体直接从 socket 读取交给 sink，不经过解析缓冲区
+        feedBody();
+        if (m_state == State::ReadingBody || m_state == State::Closing) return;
+    }
+    m_parser.append(m_socket->readAll());
+    if (m_state == State::Idle) {
+        processRequests();
+    } else if (m_parser.bufferedBytes() > kMaxPipelinedBytes) {
+        qWarning() << "[Http] 流水线请求积压过多，断开连接";
+        m_socket->abort();
+    }
+}
+
+void HttpConnection::onIdleTimeout() {
+    if (m_state == State::Idle) {
+        closeAfterWrite();
+        return;
+    }
+    if (m_state == State::ReadingBody) {
+        // 请求体停滞：按中止交给调用方（其应答后连接因请求体未读完而断开）
+        qWarning().noquote() << QStringLiteral("[Http] request body stalled remaining=%1")
+                                    .arg(m_bodyRemaining);
+        finishBody(false);
+        if (m_state == State::Handling) closeAfterWrite();
+        return;
+    }
+    if (m_state == State::SendingFile) {
+        // 客户端停止读取：期限内没有字节写出，写缓冲永远写不空，直接断开并释放文件
+        qWarning().noquote() << QStringLiteral("[Http] response body stalled remaining=%1")
+                                    .arg(m_fileRemaining);
+        abort();
+        return;
+    }
+    if (m_state != State::Closing)
+        m_idle.start(keepAliveTimeoutMs(), [this]() { onIdleTimeout(); });
+}
+
+void HttpConnection::abort() {
+    m_socket->abort();
+    // 未处于连接状态的 socket 不会发出 disconnected，这里补做断开处理
+    if (m_state != State::Closing) onDisconnected();
+}
+
+void HttpConnection::onDisconnected() {
+    m_idle.stop();
+    if (m_writeNotifier) m_writeNotifier->setEnabled(false);
+    if (m_state == State::ReadingBody) finishBody(false);
+    m_state = State::Closing;
+    deleteLater();
+}
+
+void HttpConnection::processRequests() {
+    // 同步应答时 finishResponse 回到这里；由外层循环继续解析，避免递归
+    if (m_dispatching) return;
+    m_dispatching = true;
+    while (m_state == State::Idle) {
+        HttpRequest request;
+        const HttpRequestParser::Result result = m_parser.next(request);
+        if (result == HttpRequestParser::Result::Incomplete) {
+            m_idle.touch();
+            break;
+        }
+        m_state = State::Handling;
+        if (result != HttpRequestParser::Result::Complete) {
+            respond(result == HttpRequestParser::Result::TooLarge
+                        ? QByteArrayLiteral("HTTP/1.1 431 Request Header Fields Too Large\r\n"
+                                            "Content-Length: 0\r\n")
+                        : QByteArrayLiteral("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"),
+                    QByteArray(), true);
+            break;
+        }
+        ++m_requests;
+        m_keepAlive = request.keepAlive && m_requests < kMaxKeepAliveRequests;
+        m_bodyPending = request.contentLength != 0 || request.chunked;
+        recordRequest(m_requests > 1);
+        emit requestReceived(this, request);
+    }
+    m_dispatching = false;
+}
+
+void HttpConnection::readBody(qint64 length, std::function<bool(const QByteArray &)> sink,
+                              std::function<void(bool)> done, qint64 idleTimeoutMs) {
+    if (m_state != State::Handling || length < 0) {
+        if (done) done(false);
+        return;
+    }
+    m_state = State::ReadingBody;
+    m_bodyRemaining = length;
+    m_bodySink = std::move(sink);
+    m_bodyDone = std::move(done);
+    m_idle.start(idleTimeoutMs > 0 ? idleTimeoutMs : keepAliveTimeoutMs(),
+                 [this]() { onIdleTimeout(); });
+    feedBody();
+}
+
+void HttpConnection::feedBody() {
+    while (m_state == State::ReadingBody && m_bodyRemaining > 0) {
+        const qint64 wanted = qMin(m_bodyRemaining, kBodyChunkBytes);
+        const QByteArray chunk = m_parser.bufferedBytes() > 0 ? m_parser.take(wanted)
+                                                              : m_socket->read(wanted);
+        if (chunk.isEmpty()) return;   // 等待下一次 readyRead
+        m_idle.touch();
+        m_bodyRemaining -= chunk.size();
+        if (!m_bodySink(chunk)) {
+            finishBody(false);
+            return;
+        }
+    }
+    if (m_state == State::ReadingBody) finishBody(true);
+}
+
+void HttpConnection::finishBody(bool complete) {
+    m_state = State::Handling;
+    // 请求体收齐或被拒绝后恢复连接的保持时间；断开或停滞超时时计时已停止，不再恢复
+    if (m_idle.isActive()) m_idle.start(keepAliveTimeoutMs(), [this]() { onIdleTimeout(); });
+    m_bodySink = nullptr;
+    // 未读完的请求体无法与下一个请求区分，应答后必须断开
+    if (complete) m_bodyPending = false;
+    const auto done = std::move(m_bodyDone);
+    m_bodyDone = nullptr;
+    if (done) done(complete);
+}
+
+void HttpConnection::writeHead(const QByteArray &head) {
+    QByteArray response;
+    response.reserve(head.size() + 64);
+    response += head;
+    if (m_keepAlive) {
+        response += "Connection: keep-alive\r\nKeep-Alive: timeout="
+                    + QByteArray::number(qMax(1, keepAliveTimeoutMs() / 1000)) + ", max="
+                    + QByteArray::number(kMaxKeepAliveRequests - m_requests) + "\r\n\r\n";
+    } else {
+        response += "Connection: close\r\n\r\n";
+    }
+    m_socket->write(response);
+}
+
+void HttpConnection::respond(const QByteArray &head, const QByteArray &body, bool close) {
+    if (m_state != State::Handling || !isOpen()) return;
+    if (close || m_bodyPending) m_keepAlive = false;
+    writeHead(head);
+    if (!body.isEmpty()) m_socket->write(body);
+    finishResponse();
+}
+
+void HttpConnection::respondWithFile(const QByteArray &head, QFile *file, qint64 offset,
+                                     qint64 length) {
+    if (m_state != State::Handling || !isOpen()) {
+        delete file;
+        return;
+    }
+    if (m_bodyPending) m_keepAlive = false;
+    file->setParent(this);
+    m_file = file;
+    m_fileOffset = offset;
+    m_fileRemaining = length;
+    m_zeroCopy = false;
+#ifdef Q_OS_LINUX
+    bool ok = false;
+    const int sendfileSetting = qEnvironmentVariableIntValue("CHATROOM_HTTP_SENDFILE", &ok);
+    m_zeroCopy = file->handle() >= 0 && (!ok || sendfileSetting != 0);
+#endif
+    if (!m_zeroCopy) m_file->seek(offset);
+    writeHead(head);
+    m_state = State::SendingFile;
+    // 发送期间只有写出进展才续期
+    m_idle.start(keepAliveTimeoutMs(), [this]() { onIdleTimeout(); });
+    pumpFile();
+}
+
+void HttpConnection::pumpFile() {
+    if (m_state != State::SendingFile) return;
+
+    if (m_zeroCopy) {
+        if (!sendFileZeroCopy()) return;
+    } else {
+        // 非阻塞分段发送：写缓冲低于高水位时继续读文件，bytesWritten 后再次进入
+        bool exhausted = false;
+        while (m_fileRemaining > 0 && m_socket->bytesToWrite() < kHighWaterBytes) {
+            const QByteArray chunk = m_file->read(qMin(kCopyChunkBytes, m_fileRemaining));
+            if (chunk.isEmpty()) {
+                exhausted = true;
+                break;
+            }
+            m_fileRemaining -= chunk.size();
+            m_socket->write(chunk);
+        }
+        if (m_fileRemaining > 0 && !exhausted) return;
+    }
+
+    // 文件在发送中被截断时已声明的长度无法满足，只能断开
+    if (m_fileRemaining > 0) m_keepAlive = false;
+    delete m_file;
+    m_file = nullptr;
+    finishResponse();
+}
+
+bool HttpConnection::sendFileZeroCopy() {
+#ifdef Q_OS_LINUX
+    // 响应头仍在 Qt 写缓冲中：等 bytesWritten 写空后再由内核直接发送文件
+    if (m_socket->bytesToWrite() > 0) return false;
+
+    const int socketFd = static_cast<int>(m_socket->socketDescriptor());
+    while (m_fileRemaining > 0) {
+        off_t offset = static_cast<off_t>(m_fileOffset);
+        const ssize_t sent = ::sendfile(socketFd, m_file->handle(), &offset,
+                                        static_cast<size_t>(qMin(kSendfileChunkBytes, m_fileRemaining)));
+        if (sent > 0) {
+            m_fileOffset += sent;
+            m_fileRemaining -= sent;
+            m_idle.touch();
+            g_httpZeroCopyBytes.fetchAndAddRelaxed(static_cast<quint64>(sent));
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Qt 写缓冲为空时它的写通知器处于关闭状态，这里单独监听可写事件
+            if (!m_writeNotifier) {
+                m_writeNotifier = new QSocketNotifier(socketFd, QSocketNotifier::Write, this);
+                connect(m_writeNotifier, &QSocketNotifier::activated, this,
+                        [this]() { pumpFile(); });
+            }
+            m_writeNotifier->setEnabled(true);
+            return false;
+        }
+        if (sent < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            // 文件系统不支持 sendfile：退回分段读写
+            if (m_writeNotifier) m_writeNotifier->setEnabled(false);
+            m_zeroCopy = false;
+            m_file->seek(m_fileOffset);
+            pumpFile();
+            return false;
+        }
+        break;   // 文件被截断（sent == 0）或 socket 错误
+    }
+    if (m_writeNotifier) m_writeNotifier->setEnabled(false);
+#endif
+    return true;
+}
+
+void HttpConnection::finishResponse() {
+    if (!m_keepAlive) {
+        closeAfterWrite();
+        return;
+    }
+    m_state = State::Idle;
+    processRequests();
+}
+
+void HttpConnection::closeAfterWrite() {
+    m_state = State::Closing;
+    m_idle.stop();
+    // disconnectFromHost 会先写完 Qt 写缓冲中的数据
+    m_socket->disconnectFromHost();
+}
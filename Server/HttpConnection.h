@@ -0,0 +1,112 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <functional>
+
+#include "TimingWheel.h"
+
+class QFile;
+class QSocketNotifier;
+class QTcpSocket;
+
+/// 已解析的 HTTP 请求行与请求头；头字段名统一为小写
+struct HttpRequest {
+    QByteArray method;
+    QByteArray target;
+    QByteArray version;
+    QHash<QByteArray, QByteArray> headers;
+    bool keepAlive = true;        // HTTP/1.1 默认保持连接，HTTP/1.0 需显式 keep-alive
+    qint64 contentLength = 0;     // -1 表示 Content-Length 非法
+    bool chunked = false;
+
+    QByteArray header(const QByteArray &lowerName) const { return headers.value(lowerName); }
+};
+
+/// 增量请求头解析器：每次只扫描新到达的字节查找头部结束标记，
+/// 解析后的剩余数据留在缓冲区，作为请求体或流水线中的下一个请求。
+class HttpRequestParser {
+public:
+    enum class Result { Incomplete, Complete, Invalid, TooLarge };
+
+    static constexpr qsizetype MAX_HEADER_BYTES = 16 * 1024;
+
+    void append(const QByteArray &data);
+    Result next(HttpRequest &request);
+    /// 取出最多 maxBytes 字节的请求体
+    QByteArray take(qint64 maxBytes);
+    qsizetype bufferedBytes() const { return m_buffer.size() - m_readPos; }
+    void clear();
+
+private:
+    QByteArray m_buffer;
+    qsizetype  m_readPos = 0;
+    qsizetype  m_scanPos = 0;   // 已确认不含 "\r\n\r\n" 的位置，下次从这里继续查找
+};
+
+/// 嵌入式 HTTP 服务的单个连接 —— 驻留在 HTTP 线程，支持 keep-alive 与流水线请求。
+/// 同一连接上的请求按到达顺序逐个应答：当前响应（含文件体）交给 socket 之前不解析下一个请求。
+/// Linux 上文件响应体经 sendfile(2) 由内核从页缓存直接写入 socket，其他平台分段读写。
+class HttpConnection : public QObject {
+    Q_OBJECT
+public:
+    /// 接管已连接的 socket；连接断开后对象自行 deleteLater()
+    explicit HttpConnection(QTcpSocket *socket, QObject *parent = nullptr);
+    ~HttpConnection() override;
+
+    /// 应答当前请求。head 为状态行与响应头（不含 Connection 头与结尾空行）；
+    /// close 为真、请求要求关闭或请求体未被读取时，应答后断开连接
+    void respond(const QByteArray &head, const QByteArray &body = QByteArray(), bool close = false);
+    /// 以文件区间作为响应体；文件须已打开，所有权转移给连接
+    void respondWithFile(const QByteArray &head, QFile *file, qint64 offset, qint64 length);
+    /// 把当前请求的 length 字节请求体逐段交给 sink，sink 返回 false 时中止。
+    /// done 在收齐（true）、中止或断开（false）时调用一次，之后仍须 respond()。
+    /// idleTimeoutMs 内没有收到新的请求体数据时按中止处理并在应答后断开（<= 0 使用 keepAliveTimeoutMs()）
+    void readBody(qint64 length, std::function<bool(const QByteArray &)> sink,
+                  std::function<void(bool complete)> done, qint64 idleTimeoutMs = 0);
+    /// 立即断开连接；正在接收的请求体按中止处理。须在连接所在线程调用
+    void abort();
+
+    bool isOpen() const;
+
+    /// CHATROOM_HTTP_KEEPALIVE_MS 环境变量，空闲连接的保持时间，默认 15 秒
+    static int keepAliveTimeoutMs();
+
+signals:
+    void requestReceived(HttpConnection *connection, const HttpRequest &request);
+
+private:
+    enum class State { Idle, Handling, ReadingBody, SendingFile, Closing };
+
+    void onReadyRead();
+    void onDisconnected();
+    void onIdleTimeout();
+    void processRequests();
+    void feedBody();
+    void finishBody(bool complete);
+    void writeHead(const QByteArray &head);
+    void finishResponse();
+    void pumpFile();
+    bool sendFileZeroCopy();
+    void closeAfterWrite();
+
+    QTcpSocket *m_socket = nullptr;
+    IdleWatch   m_idle;         // 空闲、请求头未收齐、请求体停滞或响应体写不出时计时，到期断开
+    HttpRequestParser m_parser;
+    State m_state = State::Idle;
+    bool  m_keepAlive = true;
+    bool  m_bodyPending = false;   // 当前请求声明了请求体但尚未读取
+    bool  m_dispatching = false;   // processRequests 正在分发，应答完成后由它继续解析
+    int   m_requests = 0;
+
+    qint64 m_bodyRemaining = 0;
+    std::function<bool(const QByteArray &)> m_bodySink;
+    std::function<void(bool)> m_bodyDone;
+
+    QFile  *m_file = nullptr;
+    qint64  m_fileOffset = 0;
+    qint64  m_fileRemaining = 0;
+    bool    m_zeroCopy = false;
+    QSocketNotifier *m_writeNotifier = nullptr;
+};
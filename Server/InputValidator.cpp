@@ -59,28 +59,50 @@ bool decodeInlineFile(const QString &encoded, qint64 declaredSize, qint64 maximu
     }
     const auto result = QByteArray::fromBase64Encoding(
         encoded.toLatin1(), QByteArray::AbortOnBase64DecodingErrors);
-    if (!result || result.decoded.size() != declaredSize) {
+    if (!result) {
         if (error) *error = QStringLiteral("文件数据与声明大小不一致");
         return false;
     }
+    if (!validateInlineFile(result.decoded, declaredSize, maximumSize, error)) return false;
     if (decoded) *decoded = result.decoded;
     return true;
 }
 
+bool validateInlineFile(const QByteArray &data, qint64 declaredSize, qint64 maximumSize,
+                        QString *error) {
+    if (declaredSize <= 0 || declaredSize > maximumSize) {
+        if (error) *error = QStringLiteral("文件大小无效");
+        return false;
+    }
+    if (data.size() != declaredSize) {
+        if (error) *error = QStringLiteral("文件数据与声明大小不一致");
+        return false;
+    }
+    return true;
+}
+
 bool decodeUploadChunk(const QString &encoded, qint64 remainingBytes,
                        QByteArray *decoded, QString *error) {
     const auto result = QByteArray::fromBase64Encoding(
         encoded.toLatin1(), QByteArray::AbortOnBase64DecodingErrors);
-    if (!result || result.decoded.isEmpty()
-        || result.decoded.size() > Protocol::FILE_CHUNK_SIZE
-        || result.decoded.size() > remainingBytes) {
+    if (!result) {
         if (error) *error = QStringLiteral("上传分片无效或超过声明大小");
         return false;
     }
+    if (!validateUploadChunk(result.decoded, remainingBytes, error)) return false;
     if (decoded) *decoded = result.decoded;
     return true;
 }
 
+bool validateUploadChunk(const QByteArray &chunk, qint64 remainingBytes, QString *error) {
+    if (chunk.isEmpty() || chunk.size() > Protocol::FILE_CHUNK_SIZE
+        || chunk.size() > remainingBytes) {
+        if (error) *error = QStringLiteral("上传分片无效或超过声明大小");
+        return false;
+    }
+    return true;
+}
+
 int boundedHistoryCount(int requested) {
     if (requested <= 0) return 50;
     return qMin(requested, MAX_HISTORY_COUNT);
@@ -17,8 +17,11 @@ bool validateMessage(const QString &content, const QString &contentType, QString
 bool validateFileName(const QString &fileName, QString *safeName, QString *error);
 bool decodeInlineFile(const QString &encoded, qint64 declaredSize, qint64 maximumSize,
                       QByteArray *decoded, QString *error);
+bool validateInlineFile(const QByteArray &data, qint64 declaredSize, qint64 maximumSize,
+                        QString *error);
 bool decodeUploadChunk(const QString &encoded, qint64 remainingBytes,
                        QByteArray *decoded, QString *error);
+bool validateUploadChunk(const QByteArray &chunk, qint64 remainingBytes, QString *error);
 int boundedHistoryCount(int requested);
 
 } // namespace InputValidator
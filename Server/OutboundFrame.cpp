@@ -0,0 +1,119 @@
+#include "OutboundFrame.h"
+#include "Protocol.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+namespace {
+
+// 字符串按 UTF-8 长度加引号计，忽略转义；只遍历结构，不分配缓冲区
+qsizetype estimateStringBytes(const QString &text) {
+    qsizetype bytes = 2;
+    for (const QChar ch : text) {
+        const ushort unit = ch.unicode();
+        bytes += unit < 0x80 ? 1 : (unit < 0x800 ? 2 : 3);
+    }
+    return bytes;
+}
+
+qsizetype estimateJsonBytes(const QJsonValue &value);
+
+qsizetype estimateObjectBytes(const QJsonObject &object) {
+    qsizetype bytes = 2;
+    for (auto it = object.begin(); it != object.end(); ++it)
+        bytes += estimateStringBytes(it.key()) + 2 + estimateJsonBytes(it.value());
+    return bytes;
+}
+
+qsizetype estimateJsonBytes(const QJsonValue &value) {
+    switch (value.type()) {
+    case QJsonValue::Object:
+        return estimateObjectBytes(value.toObject());
+    case QJsonValue::Array: {
+        qsizetype bytes = 2;
+        for (const QJsonValue &item : value.toArray()) bytes += estimateJsonBytes(item) + 1;
+        return bytes;
+    }
+    case QJsonValue::String:
+        return estimateStringBytes(value.toString());
+    case QJsonValue::Double:
+        return 13;
+    case QJsonValue::Bool:
+        return 5;
+    default:
+        return 4;
+    }
+}
+
+} // namespace
+
+OutboundFrame::OutboundFrame(const QJsonObject &msg)
+    : m_msg(msg)
+    , m_sizeHint(estimateObjectBytes(msg))
+{
+    // 上线/下线只关心最新状态：同一房间同一用户、或同一好友的通知可以合并
+    const QString type = msg["type"].toString();
+    m_compressible = Protocol::isCompressibleType(type);
+    const QJsonObject data = msg["data"].toObject();
+    if (type == Protocol::MsgType::USER_ONLINE || type == Protocol::MsgType::USER_OFFLINE) {
+        m_mergeKey = QStringLiteral("room:%1:%2").arg(data["roomId"].toInt())
+                                                 .arg(data["username"].toString());
+        m_priority = Priority::Presence;
+    } else if (type == Protocol::MsgType::FRIEND_ONLINE_NOTIFY
+               || type == Protocol::MsgType::FRIEND_OFFLINE_NOTIFY) {
+        m_mergeKey = QStringLiteral("friend:%1").arg(data["username"].toString());
+        m_priority = Priority::Presence;
+    } else if (type == Protocol::MsgType::FILE_COS_PROGRESS) {
+        // 同一上传的进度只保留最新一条；最终进度不可丢弃，客户端据此结束进度显示
+        m_mergeKey = QStringLiteral("progress:%1").arg(data["uploadId"].toString());
+        if (data["sent"].toDouble() < data["total"].toDouble())
+            m_priority = Priority::Progress;
+    }
+}
+
+const QByteArray &OutboundFrame::json() const {
+    std::call_once(m_jsonOnce, [this]() {
+        m_json = QJsonDocument(m_msg).toJson(QJsonDocument::Compact);
+    });
+    return m_json;
+}
+
+const QByteArray &OutboundFrame::tcpPacket() const {
+    std::call_once(m_tcpOnce, [this]() { m_tcpPacket = Protocol::packPayload(json()); });
+    return m_tcpPacket;
+}
+
+const QString &OutboundFrame::webSocketText() const {
+    std::call_once(m_wsOnce, [this]() { m_wsText = QString::fromUtf8(json()); });
+    return m_wsText;
+}
+
+const QByteArray &OutboundFrame::cborPacket() const {
+    std::call_once(m_cborOnce, [this]() { m_cborPacket = Protocol::packCbor(m_msg); });
+    return m_cborPacket;
+}
+
+const QByteArray &OutboundFrame::compressedTcpPacket(bool cbor) const {
+    if (!m_compressible) return cbor ? cborPacket() : tcpPacket();
+    if (cbor) {
+        std::call_once(m_compressedCborOnce, [this]() {
+            m_compressedCborPacket = Protocol::compressPacket(cborPacket());
+        });
+        return m_compressedCborPacket;
+    }
+    std::call_once(m_compressedTcpOnce, [this]() {
+        m_compressedTcpPacket = Protocol::compressPacket(tcpPacket());
+    });
+    return m_compressedTcpPacket;
+}
+
+const QByteArray &OutboundFrame::webSocketCompressed() const {
+    std::call_once(m_wsCompressedOnce, [this]() {
+        if (!m_compressible) return;
+        // 与 TCP 压缩帧共用一次压缩：去掉 4 字节长度前缀即为 qCompress 字节
+        const QByteArray &packet = compressedTcpPacket(false);
+        if (qFromBigEndian<quint32>(packet.constData()) & Protocol::COMPRESSED_FRAME_FLAG)
+            m_wsCompressed = packet.mid(4);
+    });
+    return m_wsCompressed;
+}
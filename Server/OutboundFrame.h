@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include <memory>
+#include <mutex>
+
+/// 预编码的出站帧 —— 同一条消息只序列化一次，按传输层各编码一次
+/// 紧凑 JSON、TCP 长度前缀帧、WebSocket 文本帧、CBOR 帧及其压缩版本都在首次使用时惰性生成，
+/// 之后所有会话共享同一份（隐式共享的）字节，广播时不再逐个接收者重复序列化。
+/// 对象创建后不可变，可通过 OutboundFramePtr 在线程间安全传递。
+class OutboundFrame {
+public:
+    /// 出站优先级：会话积压时先丢弃进度，再丢弃上下线状态；聊天与请求响应从不丢弃
+    enum class Priority { Normal, Presence, Progress };
+
+    explicit OutboundFrame(const QJsonObject &msg);
+
+    /// 紧凑 JSON 负载
+    const QByteArray &json() const;
+    /// [4字节长度][JSON] TCP 帧
+    const QByteArray &tcpPacket() const;
+    /// WebSocket 文本帧
+    const QString &webSocketText() const;
+    /// [4字节长度|CBOR 标记][CBOR] TCP 帧，供协商了 cborFrames 的会话使用
+    const QByteArray &cborPacket() const;
+    /// 协商了 compressedFrames 的 TCP 会话使用：历史/列表大帧返回压缩帧，其余与未压缩版本相同
+    const QByteArray &compressedTcpPacket(bool cbor) const;
+    /// 历史/列表大帧的 qCompress 字节，作为 WebSocket 二进制消息发送；不值得压缩时为空
+    const QByteArray &webSocketCompressed() const;
+    /// 幂等状态通知（上下线）的合并键；非空时会话出站队列中同键的旧帧被新帧取代
+    const QString &mergeKey() const { return m_mergeKey; }
+    Priority priority() const { return m_priority; }
+    /// 出站队列记账用的估算字节数：构造时按消息结构估算紧凑 JSON 长度，不触发任何编码。
+    /// 会话按自己的编码写出后，以 socket 写缓冲中的实际字节取代估算值
+    qsizetype sizeHint() const { return m_sizeHint; }
+
+private:
+    QJsonObject m_msg;
+    qsizetype m_sizeHint = 0;
+    QString m_mergeKey;
+    Priority m_priority = Priority::Normal;
+    mutable std::once_flag m_jsonOnce;
+    mutable QByteArray m_json;
+    mutable std::once_flag m_tcpOnce;
+    mutable QByteArray m_tcpPacket;
+    mutable std::once_flag m_wsOnce;
+    mutable QString m_wsText;
+    mutable std::once_flag m_cborOnce;
+    mutable QByteArray m_cborPacket;
+    bool m_compressible = false;
+    mutable std::once_flag m_compressedTcpOnce;
+    mutable QByteArray m_compressedTcpPacket;
+    mutable std::once_flag m_compressedCborOnce;
+    mutable QByteArray m_compressedCborPacket;
+    mutable std::once_flag m_wsCompressedOnce;
+    mutable QByteArray m_wsCompressed;
+};
+
+using OutboundFramePtr = std::shared_ptr<const OutboundFrame>;
+
+inline OutboundFramePtr makeOutboundFrame(const QJsonObject &msg) {
+    return std::make_shared<const OutboundFrame>(msg);
+}
@@ -0,0 +1,56 @@
+#include "PasswordHashPool.h"
+
+#include <QThread>
+
+namespace {
+
+int boundedEnvironmentInt(const char *name, int fallback, int minimum, int maximum) {
+    bool ok = false;
+    const int value = qEnvironmentVariableIntValue(name, &ok);
+    if (!ok || value < minimum || value > maximum) {
+        return fallback;
+    }
+    return value;
+}
+
+} // namespace
+
+PasswordHashPool::PasswordHashPool(const Limits &limits)
+    : m_limits(limits)
+{
+    if (m_limits.workers <= 0)
+        m_limits.workers = qMax(1, QThread::idealThreadCount() / 2);
+    m_limits.queueDepth = qMax(m_limits.queueDepth, m_limits.workers);
+    m_pool.setMaxThreadCount(m_limits.workers);
+    // 线程常驻：DatabaseManager 按线程持有 SQLite 连接，线程回收会留下失效连接
+    m_pool.setExpiryTimeout(-1);
+}
+
+PasswordHashPool::~PasswordHashPool() {
+    m_pool.waitForDone();
+}
+
+PasswordHashPool::Limits PasswordHashPool::limitsFromEnvironment() {
+    Limits limits;
+    limits.workers = boundedEnvironmentInt(
+        "CHATROOM_AUTH_HASH_WORKERS", limits.workers, 1, 256);
+    limits.queueDepth = boundedEnvironmentInt(
+        "CHATROOM_AUTH_HASH_QUEUE_DEPTH", limits.queueDepth, 1, 100000);
+    return limits;
+}
+
+bool PasswordHashPool::trySubmit(std::function<void()> job) {
+    if (m_pending.fetchAndAddOrdered(1) >= m_limits.queueDepth) {
+        m_pending.fetchAndAddOrdered(-1);
+        return false;
+    }
+    m_pool.start([this, job = std::move(job)]() {
+        job();
+        m_pending.fetchAndAddOrdered(-1);
+    });
+    return true;
+}
+
+void PasswordHashPool::waitForDone() {
+    m_pool.waitForDone();
+}
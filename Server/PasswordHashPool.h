@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QThreadPool>
+#include <functional>
+
+/// 密码哈希线程池 —— Argon2id 的生成与校验在独立的有界线程池中执行，
+/// 不占用请求工作线程。在途任务（执行中 + 排队）超过 queueDepth 时 trySubmit 直接拒绝，
+/// 由调用方按认证限流处理（AuthenticationAbuseGuard 的 hash-queue 维度）。
+class PasswordHashPool {
+public:
+    struct Limits {
+        int workers = 0;        // <= 0 时取 CPU 核心数的一半（至少 1）
+        int queueDepth = 128;
+    };
+
+    explicit PasswordHashPool(const Limits &limits = limitsFromEnvironment());
+    ~PasswordHashPool();
+
+    /// 投递任务；队列已满返回 false，任务不会执行
+    bool trySubmit(std::function<void()> job);
+    /// 等待所有在途任务完成（停服时调用）
+    void waitForDone();
+
+    int pending() const { return m_pending.loadRelaxed(); }
+    int workerCount() const { return m_pool.maxThreadCount(); }
+    const Limits &limits() const { return m_limits; }
+
+    static Limits limitsFromEnvironment();
+
+private:
+    Limits m_limits;
+    QThreadPool m_pool;
+    QAtomicInt m_pending{0};
+};
@@ -0,0 +1,84 @@
+#include "RequestDispatcher.h"
+
+#include <QThread>
+#include <QHash>
+#include <QDebug>
+
+namespace {
+
+constexpr int kMaxWorkerThreads = 256;
+
+} // namespace
+
+RequestDispatcher::RequestDispatcher(QObject *parent)
+    : QObject(parent)
+{
+}
+
+RequestDispatcher::~RequestDispatcher() {
+    stop();
+}
+
+int RequestDispatcher::defaultWorkerCount() {
+    bool ok = false;
+    const int configured = qEnvironmentVariableIntValue("CHATROOM_WORKER_THREADS", &ok);
+    if (ok && configured > 0 && configured <= kMaxWorkerThreads) return configured;
+    return qMax(1, QThread::idealThreadCount());
+}
+
+void RequestDispatcher::start(int workerCount) {
+    if (isRunning()) return;
+    if (workerCount <= 0) workerCount = defaultWorkerCount();
+    workerCount = qMin(workerCount, kMaxWorkerThreads);
+
+    m_workers.reserve(workerCount);
+    for (int i = 0; i < workerCount; ++i) {
+        Worker worker;
+        worker.thread = new QThread(this);
+        worker.thread->setObjectName(QStringLiteral("chat-worker-%1").arg(i));
+        worker.context = new QObject;
+        worker.context->moveToThread(worker.thread);
+        connect(worker.thread, &QThread::finished, worker.context, &QObject::deleteLater);
+        worker.thread->start();
+        m_workers.append(worker);
+    }
+    qInfo() << "[Dispatcher] 工作线程已启动, 数量:" << workerCount;
+}
+
+void RequestDispatcher::stop() {
+    if (!isRunning()) return;
+    // 退出指令排在已投递任务之后，工作线程先把队列排空再结束事件循环
+    for (const Worker &worker : std::as_const(m_workers)) {
+        QThread *thread = worker.thread;
+        QMetaObject::invokeMethod(worker.context, [thread]() { thread->quit(); },
+                                  Qt::QueuedConnection);
+    }
+    for (const Worker &worker : std::as_const(m_workers)) {
+        worker.thread->wait();
+        delete worker.thread;
+    }
+    m_workers.clear();
+    const int dropped = m_queuedTasks.fetchAndStoreRelaxed(0);
+    if (dropped > 0)
+        qWarning() << "[Dispatcher] 停止时丢弃排空期间投递的任务:" << dropped;
+}
+
+int RequestDispatcher::shardFor(const QString &key) const {
+    if (m_workers.isEmpty()) return -1;
+    return static_cast<int>(qHash(key) % static_cast<size_t>(m_workers.size()));
+}
+
+void RequestDispatcher::post(const QString &key, std::function<void()> task) {
+    const int shard = shardFor(key);
+    if (shard < 0) {
+        task();
+        return;
+    }
+    m_queuedTasks.fetchAndAddRelaxed(1);
+    QMetaObject::invokeMethod(m_workers.at(shard).context,
+                              [this, task = std::move(task)]() {
+                                  task();
+                                  m_queuedTasks.fetchAndSubRelaxed(1);
+                              },
+                              Qt::QueuedConnection);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QList>
+#include <QString>
+#include <functional>
+
+class QThread;
+
+/// 请求分发器 —— 把客户端请求按分片键投递到固定数量的工作线程
+/// 同一分片键（房间 / 好友会话 / 客户端会话）的请求总在同一线程按到达顺序执行，
+/// 不同会话之间并行处理，避免所有 handle* 挤在主线程上。
+class RequestDispatcher : public QObject {
+    Q_OBJECT
+public:
+    explicit RequestDispatcher(QObject *parent = nullptr);
+    ~RequestDispatcher() override;
+
+    /// 启动 workerCount 个工作线程（<= 0 时使用 defaultWorkerCount()）
+    void start(int workerCount = 0);
+    /// 停止所有工作线程：先执行完停止前已排队的任务（含数据库写入）再退出；
+    /// 排空期间新投递的任务无法执行，按数量记录日志
+    void stop();
+
+    bool isRunning() const { return !m_workers.isEmpty(); }
+    int workerCount() const { return m_workers.size(); }
+
+    /// 分片键 -> 工作线程下标（稳定哈希）
+    int shardFor(const QString &key) const;
+
+    /// 将任务投递到分片键对应的工作线程；未启动时在调用线程直接执行
+    void post(const QString &key, std::function<void()> task);
+
+    /// CHATROOM_WORKER_THREADS 环境变量，默认 CPU 核心数
+    static int defaultWorkerCount();
+
+private:
+    struct Worker {
+        QThread *thread = nullptr;
+        QObject *context = nullptr;   // 驻留在工作线程中的投递目标
+    };
+    QList<Worker> m_workers;
+    QAtomicInt m_queuedTasks{0};   // 已投递尚未执行的任务数
+};
@@ -20,7 +20,15 @@ SOURCES += \
     DatabaseManager.cpp \
     PasswordHasher.cpp \
     RoomManager.cpp \
-    CosManager.cpp
+    CosManager.cpp \
+    RequestDispatcher.cpp \
+    SessionIoPool.cpp \
+    HttpConnection.cpp \
+    TimingWheel.cpp \
+    OutboundFrame.cpp \
+    PasswordHashPool.cpp \
+    FileBlobStore.cpp \
+    ThumbnailService.cpp
 
 HEADERS += \
     AuthenticationAbuseGuard.h \
@@ -33,4 +41,12 @@ HEADERS += \
     DatabaseManager.h \
     PasswordHasher.h \
     RoomManager.h \
-    CosManager.h
+    CosManager.h \
+    RequestDispatcher.h \
+    SessionIoPool.h \
+    HttpConnection.h \
+    TimingWheel.h \
+    OutboundFrame.h \
+    PasswordHashPool.h \
+    FileBlobStore.h \
+    ThumbnailService.h
@@ -0,0 +1,142 @@
+#include "SessionIoPool.h"
+
+#include <QThread>
+#include <QDebug>
+#include <QStringList>
+
+namespace {
+
+constexpr int kMaxIoThreads = 256;
+constexpr quint64 kAssignmentLogThreshold = 1024;
+
+} // namespace
+
+SessionIoPool::SessionIoPool(QObject *parent)
+    : QObject(parent)
+{
+}
+
+SessionIoPool::~SessionIoPool() {
+    stop();
+}
+
+int SessionIoPool::defaultThreadCount() {
+    bool ok = false;
+    const int configured = qEnvironmentVariableIntValue("CHATROOM_IO_THREADS", &ok);
+    if (ok && configured > 0 && configured <= kMaxIoThreads) return configured;
+    return qMax(1, QThread::idealThreadCount());
+}
+
+void SessionIoPool::start(int threadCount, const QString &name) {
+    if (isRunning()) return;
+    if (threadCount <= 0) threadCount = defaultThreadCount();
+    threadCount = qMin(threadCount, kMaxIoThreads);
+    m_name = name;
+
+    m_threads.reserve(threadCount);
+    for (int i = 0; i < threadCount; ++i) {
+        IoThread io;
+        io.thread = new QThread(this);
+        io.thread->setObjectName(QStringLiteral("%1-%2").arg(m_name).arg(i));
+        io.sessions = std::make_shared<QAtomicInt>(0);
+        io.context = new QObject;
+        io.context->moveToThread(io.thread);
+        connect(io.thread, &QThread::finished, io.context, &QObject::deleteLater);
+        io.thread->start();
+        m_threads.push_back(std::move(io));
+    }
+    m_assigned.storeRelaxed(0);
+    qInfo() << "[IoPool] I/O 线程已启动:" << m_name << "数量:" << threadCount;
+}
+
+void SessionIoPool::stop() {
+    if (!isRunning()) return;
+    logStats();
+    for (const IoThread &io : m_threads) {
+        io.thread->quit();
+    }
+    for (const IoThread &io : m_threads) {
+        io.thread->wait();
+        delete io.thread;
+    }
+    m_threads.clear();
+}
+
+QThread *SessionIoPool::assign(QObject *session) {
+    const int index = reserve();
+    if (index < 0) return nullptr;
+    attach(index, session);
+    session->moveToThread(m_threads[index].thread);
+    return m_threads[index].thread;
+}
+
+int SessionIoPool::reserve() {
+    if (!isRunning()) return -1;
+
+    // 从轮转起点开始找会话数最少的线程：空闲时均匀铺开，长连接不均时补齐最空的线程
+    const int count = threadCount();
+    const int start = static_cast<int>(static_cast<unsigned>(m_nextThread.fetchAndAddRelaxed(1)) %
+                                       static_cast<unsigned>(count));
+    int chosen = start;
+    int chosenLoad = m_threads[start].sessions->loadRelaxed();
+    for (int step = 1; step < count && chosenLoad > 0; ++step) {
+        const int index = (start + step) % count;
+        const int load = m_threads[index].sessions->loadRelaxed();
+        if (load < chosenLoad) {
+            chosen = index;
+            chosenLoad = load;
+        }
+    }
+    m_threads[chosen].sessions->ref();
+
+    const quint64 assigned = m_assigned.fetchAndAddRelaxed(1) + 1;
+    if (assigned >= kAssignmentLogThreshold && (assigned & (assigned - 1)) == 0)
+        logStats();
+    return chosen;
+}
+
+void SessionIoPool::attach(int index, QObject *object) {
+    const std::shared_ptr<QAtomicInt> sessions = m_threads[index].sessions;
+    connect(object, &QObject::destroyed, this, [sessions]() { sessions->deref(); },
+            Qt::DirectConnection);
+}
+
+void SessionIoPool::adopt(int index, QObject *object) {
+    attach(index, object);
+    // 线程结束时上下文对象经 deleteLater 销毁，子对象在同一线程内析构
+    object->setParent(m_threads[index].context);
+}
+
+void SessionIoPool::release(int index) {
+    m_threads[index].sessions->deref();
+}
+
+QThread *SessionIoPool::thread(int index) const {
+    return m_threads[index].thread;
+}
+
+void SessionIoPool::post(int index, std::function<void()> task) {
+    QMetaObject::invokeMethod(m_threads[index].context, std::move(task), Qt::QueuedConnection);
+}
+
+QList<int> SessionIoPool::sessionCounts() const {
+    QList<int> counts;
+    counts.reserve(threadCount());
+    for (const IoThread &io : m_threads) counts.append(io.sessions->loadRelaxed());
+    return counts;
+}
+
+void SessionIoPool::logStats() const {
+    QStringList perThread;
+    int total = 0;
+    for (int sessions : sessionCounts()) {
+        perThread.append(QString::number(sessions));
+        total += sessions;
+    }
+    qInfo().noquote() << QStringLiteral("[IoPool] pool=%1 threads=%2 sessions=%3 assigned=%4 perThread=[%5]")
+                             .arg(m_name)
+                             .arg(threadCount())
+                             .arg(total)
+                             .arg(m_assigned.loadRelaxed())
+                             .arg(perThread.join(QLatin1Char(',')));
+}
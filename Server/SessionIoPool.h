@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QList>
+#include <QString>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+/// 会话 I/O 线程池 —— 固定数量的事件循环线程承载所有 TCP 会话
+/// 新会话分配给当前会话数最少的线程（并列时轮转），会话销毁时计数归还。
+/// TCP 会话整体迁入 I/O 线程；WebSocket 连接由描述符在 I/O 线程内创建 socket 并完成握手。
+/// 线程只负责 socket 读写与心跳，业务处理仍由 RequestDispatcher 的工作线程完成。
+/// 嵌入式 HTTP 服务使用另一个实例，文件读写与鉴权查询不占用会话 I/O 线程。
+class SessionIoPool : public QObject {
+    Q_OBJECT
+public:
+    explicit SessionIoPool(QObject *parent = nullptr);
+    ~SessionIoPool() override;
+
+    /// 启动 threadCount 个 I/O 线程（<= 0 时使用 defaultThreadCount()），线程名为 name-序号
+    void start(int threadCount = 0, const QString &name = QStringLiteral("chat-io"));
+    /// 停止所有 I/O 线程；调用前应已断开仍在线的会话
+    void stop();
+
+    bool isRunning() const { return !m_threads.empty(); }
+    int threadCount() const { return static_cast<int>(m_threads.size()); }
+
+    /// 把尚无父对象的会话迁移到负载最低的 I/O 线程并返回该线程；未启动时返回 nullptr
+    QThread *assign(QObject *session);
+
+    /// 为尚未创建的会话预留负载最低的线程并计入其会话数，返回线程下标；未启动时返回 -1。
+    /// 预留随后须交给 attach()（对象销毁时归还）或 release()。
+    int reserve();
+    void attach(int index, QObject *object);
+    /// 在下标对应的 I/O 线程内调用：attach() 并由该线程的上下文对象持有，
+    /// stop() 时仍未自行销毁的对象随线程结束一并销毁
+    void adopt(int index, QObject *object);
+    void release(int index);
+    QThread *thread(int index) const;
+    /// 在下标对应的 I/O 线程执行任务
+    void post(int index, std::function<void()> task);
+
+    /// 每个 I/O 线程当前承载的会话数
+    QList<int> sessionCounts() const;
+    void logStats() const;
+
+    /// CHATROOM_IO_THREADS 环境变量，默认 CPU 核心数
+    static int defaultThreadCount();
+
+private:
+    struct IoThread {
+        QThread *thread = nullptr;
+        QObject *context = nullptr;   // 驻留在 I/O 线程中的投递目标
+        std::shared_ptr<QAtomicInt> sessions;  // 会话销毁回调也持有一份
+    };
+    std::vector<IoThread> m_threads;
+    QString m_name;
+    QAtomicInt m_nextThread{0};
+    QAtomicInteger<quint64> m_assigned{0};
+};
@@ -0,0 +1,195 @@
+#include "ThumbnailService.h"
+
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <QFileInfo>
+#include <QProcess>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
+#include <QBuffer>
+#include <QImage>
+#include <QImageReader>
+#endif
+
+namespace {
+
+QAtomicInteger<quint64> g_generated{0};
+QAtomicInteger<quint64> g_failed{0};
+QAtomicInteger<quint64> g_rejected{0};
+
+int boundedEnvironmentInt(const char *name, int fallback, int minimum, int maximum) {
+    bool ok = false;
+    const int value = qEnvironmentVariableIntValue(name, &ok);
+    if (!ok || value < minimum || value > maximum) {
+        return fallback;
+    }
+    return value;
+}
+
+bool isPowerOfTwo(quint64 value) {
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+// 每完成一个任务计数一次，总数到 2 的幂时输出生成情况
+void recordResult(bool generated) {
+    (generated ? g_generated : g_failed).fetchAndAddRelaxed(1);
+    const quint64 total = g_generated.loadRelaxed() + g_failed.loadRelaxed();
+    if (total >= 1024 && isPowerOfTwo(total)) {
+        qInfo().noquote() << QStringLiteral("[Thumbnail] generated=%1 failed=%2 rejected=%3")
+                                 .arg(g_generated.loadRelaxed())
+                                 .arg(g_failed.loadRelaxed())
+                                 .arg(g_rejected.loadRelaxed());
+    }
+}
+
+} // namespace
+
+ThumbnailService::ThumbnailService(const Limits &limits)
+    : m_limits(limits)
+{
+    if (m_limits.workers <= 0)
+        m_limits.workers = qMax(1, QThread::idealThreadCount() / 4);
+    m_limits.queueDepth = qMax(m_limits.queueDepth, m_limits.workers);
+    m_pool.setMaxThreadCount(m_limits.workers);
+}
+
+ThumbnailService::~ThumbnailService() {
+    shutdown();
+}
+
+ThumbnailService::Limits ThumbnailService::limitsFromEnvironment() {
+    Limits limits;
+    limits.workers = boundedEnvironmentInt(
+        "CHATROOM_THUMBNAIL_WORKERS", limits.workers, 1, 64);
+    limits.queueDepth = boundedEnvironmentInt(
+        "CHATROOM_THUMBNAIL_QUEUE_DEPTH", limits.queueDepth, 1, 100000);
+    // 视频缩略图需显式开启：只有设置了 CHATROOM_FFMPEG_PATH 才会对上传文件运行 ffmpeg
+    const QString configured = qEnvironmentVariable("CHATROOM_FFMPEG_PATH").trimmed();
+    if (!configured.isEmpty() && QFileInfo(configured).isExecutable())
+        limits.ffmpegPath = configured;
+    else if (!configured.isEmpty())
+        qWarning() << "[Thumbnail] CHATROOM_FFMPEG_PATH 不可执行，视频缩略图已关闭:" << configured;
+    return limits;
+}
+
+bool ThumbnailService::supports(Kind kind) const {
+    if (kind == Kind::Video) return !m_limits.ffmpegPath.isEmpty();
+#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool ThumbnailService::trySubmit(Kind kind, const QString &filePath, qint64 fileSize,
+                                 Callback done) {
+    if (!supports(kind) || (kind == Kind::Image && fileSize > MAX_IMAGE_BYTES))
+        return false;
+    if (m_pending.fetchAndAddOrdered(1) >= m_limits.queueDepth) {
+        m_pending.fetchAndAddOrdered(-1);
+        const quint64 rejected = g_rejected.fetchAndAddRelaxed(1) + 1;
+        if (isPowerOfTwo(rejected)) {
+            qWarning().noquote() << QStringLiteral("[Thumbnail] 队列已满，保留客户端缩略图 rejected=%1 queueDepth=%2")
+                                        .arg(rejected)
+                                        .arg(m_limits.queueDepth);
+        }
+        return false;
+    }
+    const QString ffmpegPath = m_limits.ffmpegPath;
+    m_pool.start([this, kind, filePath, ffmpegPath, done = std::move(done)]() {
+        const QByteArray jpeg = kind == Kind::Video
+            ? renderVideoFrame(ffmpegPath, filePath)
+            : renderImage(filePath);
+        recordResult(!jpeg.isEmpty());
+        done(jpeg);
+        m_pending.fetchAndAddOrdered(-1);
+    });
+    return true;
+}
+
+void ThumbnailService::shutdown() {
+    // 排队中的任务直接丢弃，其完成回调不会再投递到已停止的工作线程
+    m_pool.clear();
+    m_pool.waitForDone();
+    m_pending.storeRelease(0);
+}
+
+QByteArray ThumbnailService::renderImage(const QString &filePath) {
+#ifndef CHATROOM_DISABLE_IMAGE_THUMBNAILS
+    QImageReader reader(filePath);
+    reader.setAutoTransform(true);
+    const QSize size = reader.size();
+    if (!size.isValid()) return {};
+    // JPEG 等支持 ScaledSize 的格式在解码阶段直接缩小，不再分配原尺寸位图；
+    // 其他格式由 QImageReader 解码后缩放
+    if (size.width() > MAX_EDGE || size.height() > MAX_EDGE)
+        reader.setScaledSize(size.scaled(MAX_EDGE, MAX_EDGE, Qt::KeepAspectRatio));
+    const QImage image = reader.read();
+    if (image.isNull()) return {};
+
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    if (!image.save(&buffer, "JPEG", JPEG_QUALITY)) return {};
+    return bytes;
+#else
+    Q_UNUSED(filePath)
+    return {};
+#endif
+}
+
+QByteArray ThumbnailService::renderVideoFrame(const QString &ffmpegPath,
+                                              const QString &filePath) {
+    if (ffmpegPath.isEmpty()) return {};
+    // 首帧缩放到 200×200 以内（不放大）后以 MJPEG 写到标准输出
+    const QString scale = QStringLiteral(
+        "scale='min(%1\\,iw)':'min(%1\\,ih)':force_original_aspect_ratio=decrease")
+        .arg(MAX_EDGE);
+    QProcess ffmpeg;
+    ffmpeg.setProcessChannelMode(QProcess::SeparateChannels);
+#ifdef Q_OS_UNIX
+    // 在子进程 exec 前设置资源上限：超出 CPU 时间由内核发送 SIGKILL，超出地址空间时分配失败
+    ffmpeg.setChildProcessModifier([] {
+        const rlimit cpu{VIDEO_CPU_SECONDS, VIDEO_CPU_SECONDS};
+        const rlimit memory{static_cast<rlim_t>(VIDEO_MEMORY_BYTES),
+                            static_cast<rlim_t>(VIDEO_MEMORY_BYTES)};
+        setrlimit(RLIMIT_CPU, &cpu);
+        setrlimit(RLIMIT_AS, &memory);
+    });
+#endif
+    // 墙钟时间从启动算起，启动与运行共用同一个期限，到期直接杀掉进程
+    const QDeadlineTimer deadline(VIDEO_TIMEOUT_MS);
+    ffmpeg.start(ffmpegPath, {
+        QStringLiteral("-nostdin"), QStringLiteral("-v"), QStringLiteral("error"),
+        QStringLiteral("-threads"), QStringLiteral("1"),
+        QStringLiteral("-i"), filePath,
+        QStringLiteral("-frames:v"), QStringLiteral("1"),
+        QStringLiteral("-vf"), scale,
+        QStringLiteral("-q:v"), QStringLiteral("5"),
+        QStringLiteral("-f"), QStringLiteral("image2pipe"),
+        QStringLiteral("-c:v"), QStringLiteral("mjpeg"),
+        QStringLiteral("pipe:1")});
+    if (!ffmpeg.waitForStarted(static_cast<int>(deadline.remainingTime()))) {
+        ffmpeg.kill();
+        ffmpeg.waitForFinished();
+        return {};
+    }
+    ffmpeg.closeWriteChannel();
+    if (!ffmpeg.waitForFinished(static_cast<int>(qMax<qint64>(1, deadline.remainingTime())))) {
+        ffmpeg.kill();
+        ffmpeg.waitForFinished();
+        qWarning() << "[Thumbnail] 截取视频首帧超时:" << filePath;
+        return {};
+    }
+    const QByteArray jpeg = ffmpeg.readAllStandardOutput();
+    if (ffmpeg.exitStatus() != QProcess::NormalExit || ffmpeg.exitCode() != 0
+        || !jpeg.startsWith("\xFF\xD8")) {
+        return {};
+    }
+    return jpeg;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+#include <QThreadPool>
+#include <functional>
+
+/// 缩略图线程池 —— 图片按缩小后的尺寸解码、视频经外部 ffmpeg 截取首帧，统一编码为
+/// 200×200 以内的 JPEG，不占用请求工作线程。在途任务（执行中 + 排队）超过 queueDepth 时
+/// trySubmit 直接拒绝，消息保留客户端提供的缩略图。
+class ThumbnailService {
+public:
+    enum class Kind { Image, Video };
+
+    struct Limits {
+        int workers = 0;          // <= 0 时取 CPU 核心数的四分之一（至少 1）
+        int queueDepth = 64;
+        QString ffmpegPath;       // 为空时不生成视频缩略图；只取 CHATROOM_FFMPEG_PATH，不在 PATH 中查找
+    };
+
+    /// 在线程池线程上调用；生成失败时 jpeg 为空
+    using Callback = std::function<void(const QByteArray &jpeg)>;
+
+    static constexpr int MAX_EDGE = 200;
+    static constexpr int JPEG_QUALITY = 60;
+    static constexpr qint64 MAX_IMAGE_BYTES = 20 * 1024 * 1024;
+    // ffmpeg 处理的是不可信的上传文件：整个进程的墙钟时间、CPU 时间与地址空间都有上限
+    static constexpr int VIDEO_TIMEOUT_MS = 15000;
+    static constexpr int VIDEO_CPU_SECONDS = 10;
+    static constexpr qint64 VIDEO_MEMORY_BYTES = 512LL * 1024 * 1024;
+
+    explicit ThumbnailService(const Limits &limits = limitsFromEnvironment());
+    ~ThumbnailService();
+
+    /// 图片需要带 QtGui 构建，视频需要可执行的 ffmpeg
+    bool supports(Kind kind) const;
+    /// 投递任务；不支持、文件过大或队列已满返回 false，done 不会被调用
+    bool trySubmit(Kind kind, const QString &filePath, qint64 fileSize, Callback done);
+    /// 丢弃排队中的任务并等待执行中的任务完成（停服时调用）
+    void shutdown();
+
+    int pending() const { return m_pending.loadRelaxed(); }
+    int workerCount() const { return m_pool.maxThreadCount(); }
+    const Limits &limits() const { return m_limits; }
+
+    static QByteArray renderImage(const QString &filePath);
+    static QByteArray renderVideoFrame(const QString &ffmpegPath, const QString &filePath);
+
+    static Limits limitsFromEnvironment();
+
+private:
+    Limits m_limits;
+    QThreadPool m_pool;
+    QAtomicInt m_pending{0};
+};
@@ -0,0 +1,154 @@
+#include "TimingWheel.h"
+
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <QThreadStorage>
+
+namespace {
+
+constexpr quint64 kSlotMask = (quint64(1) << TimingWheel::SLOT_BITS) - 1;
+constexpr quint64 kMaxDelayTicks = (quint64(1) << (TimingWheel::SLOT_BITS * TimingWheel::LEVELS)) - 1;
+
+QThreadStorage<TimingWheel *> g_wheels;
+QAtomicInteger<quint64> g_fired{0};
+QAtomicInteger<quint64> g_deferred{0};
+
+} // namespace
+
+TimingWheel *TimingWheel::forCurrentThread() {
+    if (!g_wheels.hasLocalData()) g_wheels.setLocalData(new TimingWheel);
+    return g_wheels.localData();
+}
+
+qint64 TimingWheel::clockMs() {
+    return QDeadlineTimer::current().deadline();
+}
+
+TimingWheel::TimingWheel(QObject *parent)
+    : QObject(parent)
+{
+    m_timer.setInterval(TICK_MS);
+    m_timer.setTimerType(Qt::CoarseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &TimingWheel::onTick);
+    m_nowMs = clockMs();
+    m_originMs = m_nowMs;
+}
+
+TimingWheel::TimerId TimingWheel::schedule(qint64 delayMs, std::function<void()> callback) {
+    const qint64 clock = clockMs();
+    if (!m_timer.isActive()) {
+        // 空闲期间时间轮不推进：把当前格对齐到此刻，后续推进从这里继续
+        m_originMs = clock - static_cast<qint64>(m_tick) * TICK_MS;
+        m_nowMs = clock;
+        m_timer.start();
+    }
+    const qint64 due = clock + qMax<qint64>(0, delayMs) - m_originMs;
+    const quint64 expireTick = qMax<quint64>(m_tick + 1, static_cast<quint64>((due + TICK_MS - 1) / TICK_MS));
+
+    const TimerId id = ++m_nextId;
+    m_entries.insert(id, Entry{expireTick, std::move(callback)});
+    place(id, expireTick);
+    return id;
+}
+
+void TimingWheel::cancel(TimerId id) {
+    m_entries.remove(id);
+}
+
+void TimingWheel::place(TimerId id, quint64 expireTick) {
+    const quint64 delta = expireTick > m_tick ? expireTick - m_tick : 0;
+    for (int level = 0; level < LEVELS; ++level) {
+        if (delta < (quint64(1) << (SLOT_BITS * (level + 1)))) {
+            m_slots[level][(expireTick >> (SLOT_BITS * level)) & kSlotMask].append(id);
+            return;
+        }
+    }
+    // 超出最高层范围：先挂在最远的槽，降级时按真实到期时间重新放置
+    const quint64 farthest = m_tick + kMaxDelayTicks;
+    m_slots[LEVELS - 1][(farthest >> (SLOT_BITS * (LEVELS - 1))) & kSlotMask].append(id);
+}
+
+void TimingWheel::cascade(int level) {
+    QVector<TimerId> ids;
+    ids.swap(m_slots[level][(m_tick >> (SLOT_BITS * level)) & kSlotMask]);
+    for (const TimerId id : ids) {
+        const auto it = m_entries.constFind(id);
+        if (it != m_entries.constEnd()) place(id, it->expireTick);
+    }
+}
+
+void TimingWheel::onTick() {
+    m_nowMs = clockMs();
+    const quint64 target = static_cast<quint64>(qMax<qint64>(0, (m_nowMs - m_originMs) / TICK_MS));
+    while (m_tick < target && !m_entries.isEmpty()) advance();
+    if (m_entries.isEmpty()) {
+        m_timer.stop();
+        // 其余槽中只剩已取消的 id
+        for (auto &level : m_slots)
+            for (auto &slot : level) slot.clear();
+    }
+}
+
+void TimingWheel::advance() {
+    ++m_tick;
+    // 低层转满一圈时，把高层当前槽中的项降级到更细的层
+    for (int level = LEVELS - 1; level > 0; --level) {
+        if ((m_tick & ((quint64(1) << (SLOT_BITS * level)) - 1)) == 0) cascade(level);
+    }
+
+    QVector<TimerId> ids;
+    ids.swap(m_slots[0][m_tick & kSlotMask]);
+    for (const TimerId id : ids) {
+        auto it = m_entries.find(id);
+        if (it == m_entries.end()) continue;
+        if (it->expireTick > m_tick) {
+            place(id, it->expireTick);
+            continue;
+        }
+        // 先移出再回调：回调中可以登记新的超时或取消其他项
+        const std::function<void()> callback = std::move(it->callback);
+        m_entries.erase(it);
+        callback();
+
+        const quint64 fired = g_fired.fetchAndAddRelaxed(1) + 1;
+        if (fired >= 1024 && (fired & (fired - 1)) == 0) {
+            qInfo().noquote() << QStringLiteral("[Timer] fired=%1 deferred=%2 pending=%3")
+                                     .arg(fired)
+                                     .arg(g_deferred.loadRelaxed())
+                                     .arg(m_entries.size());
+        }
+    }
+}
+
+// ==================== IdleWatch ====================
+
+void IdleWatch::start(qint64 timeoutMs, std::function<void()> onIdle) {
+    stop();
+    m_wheel = TimingWheel::forCurrentThread();
+    m_timeoutMs = timeoutMs;
+    m_onIdle = std::move(onIdle);
+    m_lastActivityMs = TimingWheel::clockMs();
+    arm(timeoutMs);
+}
+
+void IdleWatch::stop() {
+    if (m_id != 0 && m_wheel) m_wheel->cancel(m_id);
+    m_id = 0;
+}
+
+void IdleWatch::arm(qint64 delayMs) {
+    m_id = m_wheel->schedule(delayMs, [this]() { onExpired(); });
+}
+
+void IdleWatch::onExpired() {
+    m_id = 0;
+    const qint64 idleMs = m_wheel->now() - m_lastActivityMs;
+    if (idleMs < m_timeoutMs) {
+        g_deferred.fetchAndAddRelaxed(1);
+        arm(m_timeoutMs - idleMs);
+        return;
+    }
+    // 回调可能重新 start() 或释放所属对象，先复制一份
+    const std::function<void()> onIdle = m_onIdle;
+    onIdle();
+}
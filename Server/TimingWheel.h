@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+#include <array>
+#include <functional>
+
+/// 分层时间轮 —— 每个线程一个实例，承载该线程上所有连接与上传的超时。
+/// 三层各 64 个槽，每 TICK_MS 推进一格，只处理当前槽；高层槽在低层转满一圈时降级。
+/// 登记、取消与每次推进都是 O(1)，不随连接数增长；没有登记项时内部定时器停止。
+/// 实例只能在所属线程使用，跨线程登记须先投递到该线程。
+class TimingWheel : public QObject {
+    Q_OBJECT
+public:
+    using TimerId = quint64;
+
+    static constexpr int TICK_MS = 250;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int LEVELS = 3;
+
+    /// 当前线程的时间轮，首次调用时创建，线程结束时销毁
+    static TimingWheel *forCurrentThread();
+    /// 单调时钟（毫秒），可在任意线程调用
+    static qint64 clockMs();
+
+    /// 最近一次推进时的时间，供高频的活跃时间戳使用，不读取系统时钟
+    qint64 now() const { return m_nowMs; }
+
+    /// delayMs 之后（精度 TICK_MS，最长约 18 小时）在所属线程调用 callback 一次
+    TimerId schedule(qint64 delayMs, std::function<void()> callback);
+    void cancel(TimerId id);
+    int pendingCount() const { return m_entries.size(); }
+
+private:
+    explicit TimingWheel(QObject *parent = nullptr);
+
+    struct Entry {
+        quint64 expireTick = 0;
+        std::function<void()> callback;
+    };
+
+    void onTick();
+    void advance();
+    void place(TimerId id, quint64 expireTick);
+    void cascade(int level);
+
+    QTimer m_timer;
+    quint64 m_tick = 0;
+    qint64  m_originMs = 0;   // m_tick == 0 对应的时钟值
+    qint64  m_nowMs = 0;
+    TimerId m_nextId = 0;
+    QHash<TimerId, Entry> m_entries;   // 取消只删除这里，槽中残留的 id 推进时跳过
+    std::array<std::array<QVector<TimerId>, 1 << SLOT_BITS>, LEVELS> m_slots;
+};
+
+/// 空闲超时：活跃时只记录时间戳，不重新登记；到期时若期间有活动则按剩余时间再登记一次。
+/// 与所属对象同线程使用。
+class IdleWatch {
+public:
+    IdleWatch() = default;
+    ~IdleWatch() { stop(); }
+    IdleWatch(const IdleWatch &) = delete;
+    IdleWatch &operator=(const IdleWatch &) = delete;
+
+    /// timeoutMs 内没有 touch() 时调用 onIdle，之后不再计时，直到再次 start()
+    void start(qint64 timeoutMs, std::function<void()> onIdle);
+    void touch() { if (m_wheel) m_lastActivityMs = m_wheel->now(); }
+    void stop();
+    bool isActive() const { return m_id != 0; }
+
+private:
+    void arm(qint64 delayMs);
+    void onExpired();
+
+    QPointer<TimingWheel> m_wheel;
+    TimingWheel::TimerId m_id = 0;
+    qint64 m_timeoutMs = 0;
+    qint64 m_lastActivityMs = 0;
+    std::function<void()> m_onIdle;
+};
@@ -34,6 +34,27 @@ int main(int argc, char *argv[]) {
         "0");
     parser.addOption(httpPortOption);
 
+    QCommandLineOption workersOption(
+        QStringList() << "workers",
+        "请求处理工作线程数 (默认 CPU 核心数，或 CHATROOM_WORKER_THREADS)",
+        "count",
+        "0");
+    parser.addOption(workersOption);
+
+    QCommandLineOption ioThreadsOption(
+        QStringList() << "io-threads",
+        "TCP 会话 I/O 线程数 (默认 CPU 核心数，或 CHATROOM_IO_THREADS)",
+        "count",
+        "0");
+    parser.addOption(ioThreadsOption);
+
+    QCommandLineOption httpThreadsOption(
+        QStringList() << "http-threads",
+        "HTTP 上传/下载连接线程数 (默认 CPU 核心数的一半，或 CHATROOM_HTTP_THREADS)",
+        "count",
+        "0");
+    parser.addOption(httpThreadsOption);
+
     parser.process(app);
 
     quint16 port   = parser.value(portOption).toUShort();
@@ -43,6 +64,9 @@ int main(int argc, char *argv[]) {
     if (httpPort == 0) httpPort = port + 2;
 
     ChatServer server;
+    server.setWorkerThreadCount(parser.value(workersOption).toInt());
+    server.setIoThreadCount(parser.value(ioThreadsOption).toInt());
+    server.setHttpThreadCount(parser.value(httpThreadsOption).toInt());
     if (!server.startServer(port, wsPort, httpPort)) {
         qCritical() << "服务器启动失败!";
         return 1;
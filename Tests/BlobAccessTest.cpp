@@ -0,0 +1,109 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[BlobAccessTest]" << message;
+    return false;
+}
+
+QString firstThumbnailHash(const QJsonArray &history) {
+    for (const QJsonValue &value : history) {
+        const QString hash = value.toObject()["thumbnailHash"].toString();
+        if (!hash.isEmpty()) return hash;
+    }
+    return {};
+}
+
+QString base64(const char *bytes) {
+    return QString::fromLatin1(QByteArray(bytes).toBase64());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("BlobAccessTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("blob-access-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+
+    const int alice = manager.registerUser(QStringLiteral("blob_alice"), QStringLiteral("Alice"),
+                                           QStringLiteral("alice-password"));
+    const int bob = manager.registerUser(QStringLiteral("blob_bob"), QStringLiteral("Bob"),
+                                         QStringLiteral("bob-password"));
+    const int carol = manager.registerUser(QStringLiteral("blob_carol"), QStringLiteral("Carol"),
+                                           QStringLiteral("carol-password"));
+    if (alice <= 0 || bob <= 0 || carol <= 0) return fail(QStringLiteral("cannot register users")) ? 0 : 1;
+
+    // 房间缩略图：只有房间成员可读，加入后可读，撤回后不再可读
+    const int roomId = manager.createRoom(QStringLiteral("Blob Room"), alice);
+    bool ok = roomId > 0 && manager.joinRoom(roomId, alice) && manager.joinRoom(roomId, bob);
+    const int roomMessageId = manager.saveMessage(roomId, alice, QStringLiteral("a.png"),
+                                                  QStringLiteral("image"), QStringLiteral("a.png"),
+                                                  10, 0, base64("room-thumbnail"));
+    const QString roomHash = firstThumbnailHash(manager.getMessageHistory(roomId, 10));
+    ok &= roomMessageId > 0 && !roomHash.isEmpty();
+    ok &= manager.canUserReadBlob(bob, roomHash) && !manager.canUserReadBlob(carol, roomHash);
+    ok &= manager.joinRoom(roomId, carol) && manager.canUserReadBlob(carol, roomHash);
+    ok &= manager.recallMessage(roomMessageId, alice, 120).status == RecallResult::Status::Applied;
+    ok &= !manager.canUserReadBlob(bob, roomHash);
+    if (!ok) return fail(QStringLiteral("room thumbnail access diverged")) ? 0 : 1;
+
+    // 私聊缩略图：只有好友双方可读
+    ok = manager.sendFriendRequest(alice, bob);
+    const QJsonArray pending = manager.getPendingFriendRequests(bob);
+    ok &= pending.size() == 1
+          && manager.acceptFriendRequest(pending.first().toObject()["requestId"].toInt(), bob);
+    const int friendshipId = manager.getFriendshipId(alice, bob);
+    ok &= manager.saveFriendMessage(friendshipId, alice, QStringLiteral("b.png"),
+                                    QStringLiteral("image"), QStringLiteral("b.png"), 10, 0,
+                                    base64("friend-thumbnail")) > 0;
+    const QString friendHash = firstThumbnailHash(manager.getFriendMessageHistory(friendshipId, 10));
+    ok &= !friendHash.isEmpty();
+    ok &= manager.canUserReadBlob(alice, friendHash) && manager.canUserReadBlob(bob, friendHash);
+    ok &= !manager.canUserReadBlob(carol, friendHash);
+    if (!ok) return fail(QStringLiteral("friend thumbnail access diverged")) ? 0 : 1;
+
+    // 头像：任何登录用户可读；未被引用的哈希与无效用户一律拒绝
+    BlobRef avatar;
+    ok = manager.setUserAvatar(alice, QByteArray("avatar-bytes"), &avatar);
+    ok &= manager.canUserReadBlob(carol, avatar.hash);
+    ok &= !manager.canUserReadBlob(0, avatar.hash);
+    const QString unknownHash(64, QLatin1Char('0'));
+    ok &= !manager.canUserReadBlob(alice, unknownHash);
+    if (!ok) return fail(QStringLiteral("avatar access diverged")) ? 0 : 1;
+
+    // 批量读取：一次返回全部已知哈希，忽略重复与未知哈希
+    const QHash<QString, QByteArray> blobs =
+        manager.getBlobs({friendHash, avatar.hash, friendHash, unknownHash, QString()});
+    ok = blobs.size() == 2 && blobs.value(friendHash) == QByteArray("friend-thumbnail")
+         && blobs.value(avatar.hash) == QByteArray("avatar-bytes");
+    ok &= manager.getBlobs({avatar.hash}).value(avatar.hash) == QByteArray("avatar-bytes");
+    if (!ok) return fail(QStringLiteral("batched blob lookup diverged")) ? 0 : 1;
+
+    qInfo() << "[BlobAccessTest] PASS: blob reads follow room membership, friendships and"
+               " avatars, and batched lookups return every known hash";
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "OutboundFrame.h"
+#include "Protocol.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+
+namespace {
+
+constexpr int kRounds = 20;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[BroadcastFanoutBenchmark]" << message;
+    return false;
+}
+
+QJsonObject sampleChatMessage() {
+    QJsonObject data;
+    data["roomId"]        = 42;
+    data["sender"]        = QStringLiteral("benchmark_sender");
+    data["displayName"]   = QStringLiteral("压测用户");
+    data["content"]       = QString(256, QLatin1Char('x'));
+    data["contentType"]   = QStringLiteral("text");
+    data["serverMsgId"]   = QStringLiteral("00000000-0000-0000-0000-000000000000");
+    data["roomSeq"]       = 123456;
+    return Protocol::makeMessage(Protocol::MsgType::CHAT_MSG, data);
+}
+
+// 模拟接收者的出站缓冲区：偶数下标为 TCP 会话，奇数下标为 WebSocket 会话
+struct Sink {
+    qint64 bytes = 0;
+    void write(const QByteArray &packet) { bytes += packet.size(); }
+    void write(const QString &text) { bytes += text.size(); }
+};
+
+// 旧实现：每个接收者各自 pack() / toJson()
+qint64 legacyFanout(const QJsonObject &msg, int recipients, Sink &sink) {
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < recipients; ++i) {
+        if (i % 2 == 0) {
+            sink.write(Protocol::pack(msg));
+        } else {
+            const QByteArray json = QJsonDocument(msg).toJson(QJsonDocument::Compact);
+            sink.write(QString::fromUtf8(json));
+        }
+    }
+    return timer.nsecsElapsed();
+}
+
+// 新实现：整条广播共享一份预编码帧
+qint64 sharedFanout(const QJsonObject &msg, int recipients, Sink &sink) {
+    QElapsedTimer timer;
+    timer.start();
+    const OutboundFramePtr frame = makeOutboundFrame(msg);
+    for (int i = 0; i < recipients; ++i) {
+        if (i % 2 == 0)
+            sink.write(frame->tcpPacket());
+        else
+            sink.write(frame->webSocketText());
+    }
+    return timer.nsecsElapsed();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    const QJsonObject msg = sampleChatMessage();
+    const OutboundFramePtr frame = makeOutboundFrame(msg);
+    if (frame->tcpPacket() != Protocol::pack(msg))
+        return fail(QStringLiteral("shared TCP frame differs from Protocol::pack")) ? 0 : 1;
+    if (frame->webSocketText()
+        != QString::fromUtf8(QJsonDocument(msg).toJson(QJsonDocument::Compact)))
+        return fail(QStringLiteral("shared WebSocket frame differs from toJson")) ? 0 : 1;
+
+    // 出站记账的估算值不经序列化得到，应与紧凑 JSON 长度同一量级（含中文内容）
+    QJsonObject chinese = msg;
+    QJsonObject chineseData = chinese["data"].toObject();
+    chineseData["content"] = QStringLiteral("广播消息").repeated(64);
+    chinese["data"] = chineseData;
+    for (const QJsonObject &sample : {msg, chinese}) {
+        const OutboundFramePtr estimated = makeOutboundFrame(sample);
+        const qsizetype hint = estimated->sizeHint();
+        const qsizetype actual = estimated->json().size();
+        if (hint * 2 < actual || hint > actual * 2)
+            return fail(QStringLiteral("size hint %1 far from JSON size %2").arg(hint).arg(actual))
+                       ? 0 : 1;
+    }
+
+    // 出站队列合并：同一房间同一用户的上下线共享合并键，普通消息不可合并
+    QJsonObject presence;
+    presence["roomId"]   = 42;
+    presence["username"] = QStringLiteral("benchmark_sender");
+    const OutboundFramePtr online =
+        makeOutboundFrame(Protocol::makeMessage(Protocol::MsgType::USER_ONLINE, presence));
+    const OutboundFramePtr offline =
+        makeOutboundFrame(Protocol::makeMessage(Protocol::MsgType::USER_OFFLINE, presence));
+    presence["roomId"] = 43;
+    const OutboundFramePtr otherRoom =
+        makeOutboundFrame(Protocol::makeMessage(Protocol::MsgType::USER_OFFLINE, presence));
+    if (online->mergeKey().isEmpty() || online->mergeKey() != offline->mergeKey()
+        || offline->mergeKey() == otherRoom->mergeKey() || !frame->mergeKey().isEmpty())
+        return fail(QStringLiteral("presence merge keys are inconsistent")) ? 0 : 1;
+
+    // 背压优先级：聊天不可丢弃，进度先于上下线丢弃，最终进度与聊天同级
+    QJsonObject progress;
+    progress["uploadId"] = QStringLiteral("benchmark-upload");
+    progress["sent"]     = 512.0;
+    progress["total"]    = 1024.0;
+    const OutboundFramePtr partial =
+        makeOutboundFrame(Protocol::makeMessage(Protocol::MsgType::FILE_COS_PROGRESS, progress));
+    progress["sent"] = 1024.0;
+    const OutboundFramePtr finished =
+        makeOutboundFrame(Protocol::makeMessage(Protocol::MsgType::FILE_COS_PROGRESS, progress));
+    if (frame->priority() != OutboundFrame::Priority::Normal
+        || online->priority() != OutboundFrame::Priority::Presence
+        || partial->priority() != OutboundFrame::Priority::Progress
+        || finished->priority() != OutboundFrame::Priority::Normal
+        || partial->mergeKey().isEmpty() || partial->mergeKey() != finished->mergeKey())
+        return fail(QStringLiteral("outbound priorities are inconsistent")) ? 0 : 1;
+
+    for (const int recipients : {10, 100, 1000}) {
+        qint64 legacyNs = 0;
+        qint64 sharedNs = 0;
+        Sink legacySink;
+        Sink sharedSink;
+        for (int round = 0; round < kRounds; ++round) {
+            legacyNs += legacyFanout(msg, recipients, legacySink);
+            sharedNs += sharedFanout(msg, recipients, sharedSink);
+        }
+        if (legacySink.bytes != sharedSink.bytes)
+            return fail(QStringLiteral("fan-out byte count mismatch for %1 recipients")
+                            .arg(recipients)) ? 0 : 1;
+        qInfo().noquote() << QStringLiteral(
+            "[BroadcastFanoutBenchmark] recipients=%1 legacy_us=%2 shared_us=%3 speedup=%4x")
+            .arg(recipients)
+            .arg(legacyNs / 1000.0 / kRounds, 0, 'f', 1)
+            .arg(sharedNs / 1000.0 / kRounds, 0, 'f', 1)
+            .arg(sharedNs > 0 ? double(legacyNs) / double(sharedNs) : 0.0, 0, 'f', 1);
+    }
+    return 0;
+}
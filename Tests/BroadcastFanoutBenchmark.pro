@@ -0,0 +1,17 @@
+QT += core
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = BroadcastFanoutBenchmark
+
+INCLUDEPATH += ../Common ../Server
+
+SOURCES += \
+    BroadcastFanoutBenchmark.cpp \
+    ../Server/OutboundFrame.cpp
+
+HEADERS += \
+    ../Common/Protocol.h \
+    ../Server/OutboundFrame.h
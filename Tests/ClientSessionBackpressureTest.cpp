@@ -0,0 +1,198 @@
+#include "ClientSession.h"
+#include "Protocol.h"
+
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <memory>
+
+namespace {
+
+constexpr int kTimeoutMs = 10000;
+// 全局预算 4MB：全部会话待发字节超过 2MB 后丢进度，超过 3MB 后丢上下线状态
+constexpr int kBudgetMB = 4;
+constexpr qint64 kProgressSessionBytes = 256 * 1024;
+constexpr qint64 kPresenceSessionBytes = 2 * 1024 * 1024;
+constexpr qint64 kProgressGlobalBytes = kBudgetMB * 1024 * 1024 / 2;
+constexpr qint64 kPresenceGlobalBytes = kBudgetMB * 1024 * 1024 / 4 * 3;
+constexpr int kChunkChars = 256 * 1024;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[ClientSessionBackpressureTest]" << message;
+    return false;
+}
+
+// 只接收连接描述符，交给 ClientSession 自己创建 socket，与 SessionIoPool 的用法一致
+class DescriptorServer : public QTcpServer {
+public:
+    qintptr takeDescriptor() {
+        const qintptr descriptor = m_descriptor;
+        m_descriptor = -1;
+        return descriptor;
+    }
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override { m_descriptor = socketDescriptor; }
+
+private:
+    qintptr m_descriptor = -1;
+};
+
+std::unique_ptr<ClientSession> connectSession(DescriptorServer &server, QTcpSocket &peer) {
+    peer.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!peer.waitForConnected(kTimeoutMs) || !server.waitForNewConnection(kTimeoutMs))
+        return nullptr;
+    auto session = std::make_unique<ClientSession>(server.takeDescriptor());
+    session->init();
+    return session;
+}
+
+QJsonObject presence(const QString &type, const QString &username) {
+    return Protocol::makeMessage(type, {{QStringLiteral("roomId"), 1},
+                                        {QStringLiteral("username"), username}});
+}
+
+QJsonObject friendPresence(const QString &username) {
+    return Protocol::makeMessage(Protocol::MsgType::FRIEND_ONLINE_NOTIFY,
+                                 {{QStringLiteral("username"), username}});
+}
+
+QJsonObject progress(const QString &uploadId, int sent, int total) {
+    return Protocol::makeMessage(Protocol::MsgType::FILE_COS_PROGRESS,
+                                 {{QStringLiteral("uploadId"), uploadId},
+                                  {QStringLiteral("sent"), sent},
+                                  {QStringLiteral("total"), total}});
+}
+
+QJsonObject chat(const QString &content) {
+    return Protocol::makeChatMsg(1, QStringLiteral("alice"), content);
+}
+
+QJsonObject bulkChat() {
+    return chat(QString(kChunkChars, QLatin1Char('x')));
+}
+
+// 帧被接受时出站队列加深一格；被丢弃时深度不变
+bool accepted(ClientSession &session, const QJsonObject &msg) {
+    const int depth = session.outboundQueueDepth();
+    session.sendMessage(msg);
+    return session.outboundQueueDepth() == depth + 1;
+}
+
+QString describe(const QJsonObject &msg) {
+    const QJsonObject data = msg[QStringLiteral("data")].toObject();
+    QString detail = data[QStringLiteral("content")].toString();
+    if (detail.isEmpty()) detail = data[QStringLiteral("username")].toString();
+    if (detail.isEmpty()) detail = QString::number(data[QStringLiteral("sent")].toInt());
+    return msg[QStringLiteral("type")].toString() + QLatin1Char(':') + detail;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    // 预算在第一次使用时读取，必须在创建会话前设置
+    qputenv("CHATROOM_OUTBOUND_BUDGET_MB", QByteArray::number(kBudgetMB));
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("ClientSessionBackpressureTest"));
+
+    DescriptorServer server;
+    if (!server.listen(QHostAddress::LocalHost, 0)) {
+        return fail(QStringLiteral("cannot listen on loopback")) ? 0 : 1;
+    }
+    // backlogged 积压到各级阈值之上；observer 自身积压很小，只受全局阈值影响
+    QTcpSocket backloggedPeer;
+    QTcpSocket observerPeer;
+    const auto backlogged = connectSession(server, backloggedPeer);
+    const auto observer = connectSession(server, observerPeer);
+    if (!backlogged || !observer) {
+        return fail(QStringLiteral("cannot connect session socket pairs")) ? 0 : 1;
+    }
+
+    // 以下都在同一轮事件循环内入队，帧不会写出，待发字节只增不减
+    bool ok = accepted(*observer, progress(QStringLiteral("observer-upload"), 1, 10));
+
+    // 会话积压超过进度阈值：进度被丢弃，最终进度、上下线状态与聊天照常排队
+    ok &= accepted(*backlogged, bulkChat());
+    ok &= backlogged->pendingOutboundBytes() > kProgressSessionBytes;
+    ok &= !accepted(*backlogged, progress(QStringLiteral("backlogged-upload"), 1, 10));
+    ok &= accepted(*backlogged, progress(QStringLiteral("backlogged-upload"), 10, 10));
+    ok &= accepted(*backlogged, presence(Protocol::MsgType::USER_ONLINE, QStringLiteral("bob")));
+    if (!ok) {
+        return fail(QStringLiteral("session progress threshold shed the wrong frames")) ? 0 : 1;
+    }
+
+    // 会话积压超过上下线阈值：新的上下线状态被丢弃，已排队状态的替换与聊天不受影响
+    while (backlogged->pendingOutboundBytes() <= kPresenceSessionBytes)
+        ok &= accepted(*backlogged, bulkChat());
+    ok &= !accepted(*backlogged, presence(Protocol::MsgType::USER_ONLINE, QStringLiteral("carol")));
+    ok &= accepted(*backlogged, presence(Protocol::MsgType::USER_OFFLINE, QStringLiteral("bob")));
+    ok &= accepted(*backlogged, chat(QStringLiteral("after presence threshold")));
+    if (!ok) {
+        return fail(QStringLiteral("session presence threshold shed the wrong frames")) ? 0 : 1;
+    }
+
+    // 全局积压超过预算一半：积压很小的会话也丢进度，但同一上传的替换与上下线状态照常排队
+    const qint64 total = backlogged->pendingOutboundBytes() + observer->pendingOutboundBytes();
+    ok &= total > kProgressGlobalBytes && total < kPresenceGlobalBytes;
+    ok &= observer->pendingOutboundBytes() < kProgressSessionBytes;
+    ok &= !accepted(*observer, progress(QStringLiteral("observer-second"), 1, 10));
+    ok &= accepted(*observer, progress(QStringLiteral("observer-upload"), 5, 10));
+    ok &= accepted(*observer, friendPresence(QStringLiteral("dave")));
+    if (!ok) {
+        return fail(QStringLiteral("global progress threshold shed the wrong frames")) ? 0 : 1;
+    }
+
+    // 全局积压超过预算四分之三：上下线状态也被丢弃，聊天与请求响应照常排队
+    while (backlogged->pendingOutboundBytes() <= kPresenceGlobalBytes)
+        ok &= accepted(*backlogged, bulkChat());
+    ok &= !accepted(*observer, friendPresence(QStringLiteral("erin")));
+    ok &= accepted(*observer, chat(QStringLiteral("observer chat")));
+    ok &= accepted(*observer, Protocol::makeMessage(Protocol::MsgType::CHAT_SEND_RSP,
+                                                   {{QStringLiteral("content"), QStringLiteral("ok")}}));
+    if (!ok) {
+        return fail(QStringLiteral("global presence threshold shed the wrong frames")) ? 0 : 1;
+    }
+
+    // 聊天从不在入队时丢弃，只在写出时受断开上限约束：超过上限的会话被断开，一个字节也不写出
+    while (backlogged->pendingOutboundBytes() <= Protocol::MAX_PENDING_WRITE_BYTES + kChunkChars)
+        ok &= accepted(*backlogged, bulkChat());
+    if (!ok) {
+        return fail(QStringLiteral("chat frames were shed below the disconnect cap")) ? 0 : 1;
+    }
+
+    Protocol::FrameReader reader;
+    QStringList received;
+    const QDeadlineTimer deadline(kTimeoutMs);
+    while ((received.size() < 4 || backloggedPeer.state() != QAbstractSocket::UnconnectedState)
+           && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        observerPeer.waitForReadyRead(10);
+        reader.readFrom(&observerPeer);
+        QJsonObject msg;
+        while (reader.next(msg) == Protocol::FrameParseResult::Complete)
+            received.append(describe(msg));
+    }
+    const QStringList expected = {
+        QStringLiteral("FILE_COS_PROGRESS:5"),
+        QStringLiteral("FRIEND_ONLINE_NOTIFY:dave"),
+        QStringLiteral("CHAT_MSG:observer chat"),
+        QStringLiteral("CHAT_SEND_RSP:ok"),
+    };
+    ok = received == expected;
+    ok &= backloggedPeer.state() == QAbstractSocket::UnconnectedState
+          && backloggedPeer.readAll().isEmpty();
+    ok &= backlogged->pendingOutboundBytes() == 0 && backlogged->outboundQueueDepth() == 0;
+    ok &= observerPeer.state() == QAbstractSocket::ConnectedState;
+    if (!ok) {
+        return fail(QStringLiteral("observer received %1; backlogged peer state=%2")
+                        .arg(received.join(QStringLiteral(", ")))
+                        .arg(static_cast<int>(backloggedPeer.state()))) ? 0 : 1;
+    }
+
+    qInfo() << "[ClientSessionBackpressureTest] PASS: progress sheds before presence at session"
+               " and global thresholds, and chat or responses only hit the disconnect cap";
+    return 0;
+}
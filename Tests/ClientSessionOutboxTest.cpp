@@ -0,0 +1,182 @@
+#include "ClientSession.h"
+#include "OutboundFrame.h"
+#include "Protocol.h"
+
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QDebug>
+#include <QEvent>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include <memory>
+
+namespace {
+
+constexpr int kTimeoutMs = 10000;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[ClientSessionOutboxTest]" << message;
+    return false;
+}
+
+// 只接收连接描述符，交给 ClientSession 自己创建 socket，与 SessionIoPool 的用法一致
+class DescriptorServer : public QTcpServer {
+public:
+    qintptr takeDescriptor() {
+        const qintptr descriptor = m_descriptor;
+        m_descriptor = -1;
+        return descriptor;
+    }
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override { m_descriptor = socketDescriptor; }
+
+private:
+    qintptr m_descriptor = -1;
+};
+
+// 统计投递到会话的排队调用：每次投递对应一次 flushOutbox
+class FlushCounter : public QObject {
+public:
+    int flushes = 0;
+
+protected:
+    bool eventFilter(QObject *, QEvent *event) override {
+        if (event->type() == QEvent::MetaCall) ++flushes;
+        return false;
+    }
+};
+
+QJsonObject presence(const QString &type, int roomId, const QString &username) {
+    return Protocol::makeMessage(type, {{QStringLiteral("roomId"), roomId},
+                                        {QStringLiteral("username"), username}});
+}
+
+QJsonObject friendPresence(const QString &type, const QString &username) {
+    return Protocol::makeMessage(type, {{QStringLiteral("username"), username}});
+}
+
+QJsonObject progress(const QString &uploadId, int sent, int total) {
+    return Protocol::makeMessage(Protocol::MsgType::FILE_COS_PROGRESS,
+                                 {{QStringLiteral("uploadId"), uploadId},
+                                  {QStringLiteral("sent"), sent},
+                                  {QStringLiteral("total"), total}});
+}
+
+QJsonObject chat(const QString &content) {
+    return Protocol::makeChatMsg(1, QStringLiteral("alice"), content);
+}
+
+// 运行事件循环直到对端收齐 count 帧；多收到的帧同样返回，便于发现本应被合并的帧
+QList<QJsonObject> receiveFrames(QTcpSocket &peer, Protocol::FrameReader &reader, int count) {
+    QList<QJsonObject> frames;
+    const QDeadlineTimer deadline(kTimeoutMs);
+    while (frames.size() < count && !deadline.hasExpired()) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        peer.waitForReadyRead(10);
+        reader.readFrom(&peer);
+        QJsonObject msg;
+        while (reader.next(msg) == Protocol::FrameParseResult::Complete) frames.append(msg);
+    }
+    // 再转一轮，确认后面没有多余的帧
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+    peer.waitForReadyRead(50);
+    reader.readFrom(&peer);
+    QJsonObject msg;
+    while (reader.next(msg) == Protocol::FrameParseResult::Complete) frames.append(msg);
+    return frames;
+}
+
+QString describe(const QJsonObject &msg) {
+    const QJsonObject data = msg[QStringLiteral("data")].toObject();
+    const QString type = msg[QStringLiteral("type")].toString();
+    if (type == Protocol::MsgType::CHAT_MSG)
+        return type + QLatin1Char(':') + data[QStringLiteral("content")].toString();
+    if (type == Protocol::MsgType::FILE_COS_PROGRESS)
+        return type + QLatin1Char(':') + QString::number(data[QStringLiteral("sent")].toInt());
+    return type + QLatin1Char(':') + data[QStringLiteral("username")].toString();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("ClientSessionOutboxTest"));
+
+    DescriptorServer server;
+    if (!server.listen(QHostAddress::LocalHost, 0)) {
+        return fail(QStringLiteral("cannot listen on loopback")) ? 0 : 1;
+    }
+    QTcpSocket peer;
+    peer.connectToHost(QHostAddress::LocalHost, server.serverPort());
+    if (!peer.waitForConnected(kTimeoutMs) || !server.waitForNewConnection(kTimeoutMs)) {
+        return fail(QStringLiteral("cannot connect session socket pair")) ? 0 : 1;
+    }
+    auto session = std::make_unique<ClientSession>(server.takeDescriptor());
+    session->init();
+    FlushCounter counter;
+    session->installEventFilter(&counter);
+
+    // 同一轮事件循环内排队：同键的上下线与进度帧只保留最新一条，排在最后一次入队的位置
+    const QList<QJsonObject> queued = {
+        presence(Protocol::MsgType::USER_ONLINE, 1, QStringLiteral("alice")),
+        chat(QStringLiteral("first")),
+        progress(QStringLiteral("upload-1"), 1, 10),
+        presence(Protocol::MsgType::USER_ONLINE, 1, QStringLiteral("bob")),
+        presence(Protocol::MsgType::USER_OFFLINE, 1, QStringLiteral("alice")),
+        progress(QStringLiteral("upload-1"), 5, 10),
+        chat(QStringLiteral("second")),
+        friendPresence(Protocol::MsgType::FRIEND_ONLINE_NOTIFY, QStringLiteral("carol")),
+        friendPresence(Protocol::MsgType::FRIEND_OFFLINE_NOTIFY, QStringLiteral("carol")),
+        presence(Protocol::MsgType::USER_ONLINE, 2, QStringLiteral("alice")),
+        progress(QStringLiteral("upload-1"), 10, 10),
+    };
+    for (const QJsonObject &msg : queued) session->sendMessage(msg);
+
+    // 被取代的帧置空后不再计入待发字节，队列只记录仍会写出的帧
+    const QList<int> survivors = {1, 3, 4, 6, 8, 9, 10};
+    qint64 expectedBytes = 0;
+    QStringList expected;
+    for (const int index : survivors) {
+        expectedBytes += makeOutboundFrame(queued[index])->sizeHint();
+        expected.append(describe(queued[index]));
+    }
+    bool ok = session->pendingOutboundBytes() == expectedBytes;
+    ok &= counter.flushes == 0 && session->outboundQueueDepth() == queued.size();
+    if (!ok) {
+        return fail(QStringLiteral("replaced frames still counted: pending=%1 expected=%2")
+                        .arg(session->pendingOutboundBytes())
+                        .arg(expectedBytes)) ? 0 : 1;
+    }
+
+    Protocol::FrameReader reader;
+    QStringList received;
+    for (const QJsonObject &msg : receiveFrames(peer, reader, survivors.size()))
+        received.append(describe(msg));
+    if (received != expected) {
+        return fail(QStringLiteral("peer received %1, expected %2")
+                        .arg(received.join(QStringLiteral(", ")), expected.join(QStringLiteral(", "))))
+                   ? 0 : 1;
+    }
+    if (counter.flushes != 1 || session->outboundQueueDepth() != 0) {
+        return fail(QStringLiteral("one loop turn flushed %1 times").arg(counter.flushes)) ? 0 : 1;
+    }
+
+    // 已写出的状态不再参与合并：下一轮的同键通知照常送达，并只触发一次写出
+    session->sendMessage(presence(Protocol::MsgType::USER_ONLINE, 1, QStringLiteral("alice")));
+    session->sendMessage(chat(QStringLiteral("third")));
+    received.clear();
+    for (const QJsonObject &msg : receiveFrames(peer, reader, 2)) received.append(describe(msg));
+    ok = received == QStringList{QStringLiteral("USER_ONLINE:alice"), QStringLiteral("CHAT_MSG:third")};
+    ok &= counter.flushes == 2 && session->pendingOutboundBytes() == 0;
+    if (!ok) {
+        return fail(QStringLiteral("second turn received %1 after %2 flushes")
+                        .arg(received.join(QStringLiteral(", ")))
+                        .arg(counter.flushes)) ? 0 : 1;
+    }
+
+    qInfo() << "[ClientSessionOutboxTest] PASS: presence and progress frames merge by key,"
+               " replaced slots are skipped and uncounted, and each loop turn writes once";
+    return 0;
+}
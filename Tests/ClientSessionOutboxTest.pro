@@ -0,0 +1,21 @@
+QT += core network websockets
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = ClientSessionOutboxTest
+
+INCLUDEPATH += ../Common ../Server
+
+SOURCES += \
+    ClientSessionOutboxTest.cpp \
+    ../Server/ClientSession.cpp \
+    ../Server/OutboundFrame.cpp \
+    ../Server/TimingWheel.cpp
+
+HEADERS += \
+    ../Common/Protocol.h \
+    ../Server/ClientSession.h \
+    ../Server/OutboundFrame.h \
+    ../Server/TimingWheel.h
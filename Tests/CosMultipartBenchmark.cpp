@@ -0,0 +1,387 @@
+#include "CosManager.h"
+#include "HttpConnection.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QNetworkProxy>
+#include <QRandomGenerator>
+#include <QSet>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <QUrlQuery>
+#include <QXmlStreamReader>
+
+#include <memory>
+
+namespace {
+
+constexpr qint64 kPartBytes = 8 * 1024 * 1024;     // 与 CosManager::PART_SIZE 一致
+constexpr qint64 kFileBytes = 12 * kPartBytes;
+constexpr int kRequestLatencyMs = 40;              // 每个请求的往返与服务端处理时间
+constexpr double kConnectionMBps = 64.0;           // 单条连接的模拟带宽
+constexpr int kInjectedFailurePart = 3;            // 该分片首次上传返回 500
+constexpr int kTimeoutMs = 60000;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[CosMultipartBenchmark]" << message;
+    return false;
+}
+
+// 只依赖 HttpConnection 的 S3 兼容替身：CosManager 经应用级 HTTP 代理把请求发到这里，
+// 请求行是绝对 URI。按请求延迟 + 单连接带宽推迟应答，模拟到对象存储的链路
+class ObjectStoreStandIn : public QTcpServer {
+public:
+    struct Stats {
+        int initiated = 0;
+        int partPuts = 0;
+        int injectedFailures = 0;
+        int completed = 0;
+        int aborted = 0;
+    };
+
+    void setInjectFailures(bool enabled) { m_injectFailures.storeRelaxed(enabled ? 1 : 0); }
+
+    Stats stats() const {
+        QMutexLocker locker(&m_mutex);
+        return m_stats;
+    }
+
+    /// 已 Complete 的上传按分片号记录的 MD5
+    QMap<int, QByteArray> completedParts(const QString &objectPath) const {
+        QMutexLocker locker(&m_mutex);
+        return m_completed.value(objectPath);
+    }
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override {
+        auto *socket = new QTcpSocket;
+        if (!socket->setSocketDescriptor(socketDescriptor)) {
+            delete socket;
+            return;
+        }
+        auto *connection = new HttpConnection(socket, this);
+        connect(connection, &HttpConnection::requestReceived, this,
+                [this](HttpConnection *conn, const HttpRequest &request) { handle(conn, request); },
+                Qt::DirectConnection);
+    }
+
+private:
+    struct Upload {
+        QString objectPath;
+        QMap<int, QByteArray> parts;
+        QSet<int> failedOnce;
+    };
+
+    static QByteArray xmlResponse(const QByteArray &body) {
+        return "HTTP/1.1 200 OK\r\nContent-Type: application/xml\r\nContent-Length: "
+               + QByteArray::number(body.size()) + "\r\n";
+    }
+
+    void handle(HttpConnection *connection, const HttpRequest &request) {
+        const QUrl url(QString::fromLatin1(request.target));
+        const QUrlQuery query(url);
+        const QString uploadId = query.queryItemValue(QStringLiteral("uploadId"));
+
+        if (request.method == "POST" && query.hasQueryItem(QStringLiteral("uploads"))) {
+            QMutexLocker locker(&m_mutex);
+            const QString id = QStringLiteral("upload-%1").arg(++m_stats.initiated);
+            m_uploads[id].objectPath = url.path();
+            const QByteArray body = "<InitiateMultipartUploadResult><UploadId>" + id.toLatin1()
+                                    + "</UploadId></InitiateMultipartUploadResult>";
+            locker.unlock();
+            connection->respond(xmlResponse(body), body);
+            return;
+        }
+        if (request.method == "PUT" && query.hasQueryItem(QStringLiteral("partNumber"))) {
+            handlePart(connection, request, uploadId,
+                       query.queryItemValue(QStringLiteral("partNumber")).toInt());
+            return;
+        }
+        if (request.method == "POST" && !uploadId.isEmpty()) {
+            auto xml = std::make_shared<QByteArray>();
+            connection->readBody(request.contentLength,
+                [xml](const QByteArray &chunk) {
+                    xml->append(chunk);
+                    return true;
+                },
+                [this, connection, uploadId, xml](bool complete) {
+                    const bool ok = complete && completeUpload(uploadId, *xml);
+                    connection->respond(ok
+                        ? QByteArrayLiteral("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n")
+                        : QByteArrayLiteral("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"));
+                });
+            return;
+        }
+        if (request.method == "DELETE" && !uploadId.isEmpty()) {
+            QMutexLocker locker(&m_mutex);
+            ++m_stats.aborted;
+            m_uploads.remove(uploadId);
+            locker.unlock();
+            connection->respond(QByteArrayLiteral("HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n"));
+            return;
+        }
+        connection->respond(QByteArrayLiteral("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"));
+    }
+
+    void handlePart(HttpConnection *connection, const HttpRequest &request,
+                    const QString &uploadId, int partNumber) {
+        auto md5 = std::make_shared<QCryptographicHash>(QCryptographicHash::Md5);
+        auto received = std::make_shared<qint64>(0);
+        QElapsedTimer started;
+        started.start();
+        connection->readBody(request.contentLength,
+            [md5, received](const QByteArray &chunk) {
+                md5->addData(chunk);
+                *received += chunk.size();
+                return true;
+            },
+            [this, connection, uploadId, partNumber, md5, received, started](bool complete) {
+                if (!complete) {
+                    connection->respond(
+                        QByteArrayLiteral("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"), {}, true);
+                    return;
+                }
+                QByteArray head;
+                {
+                    QMutexLocker locker(&m_mutex);
+                    ++m_stats.partPuts;
+                    auto it = m_uploads.find(uploadId);
+                    if (it == m_uploads.end()) {
+                        head = QByteArrayLiteral("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n");
+                    } else if (m_injectFailures.loadRelaxed() && partNumber == kInjectedFailurePart
+                               && !it->failedOnce.contains(partNumber)) {
+                        it->failedOnce.insert(partNumber);
+                        ++m_stats.injectedFailures;
+                        head = QByteArrayLiteral("HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n");
+                    } else {
+                        const QByteArray digest = md5->result().toHex();
+                        it->parts.insert(partNumber, digest);
+                        head = "HTTP/1.1 200 OK\r\nETag: \"" + digest + "\"\r\nContent-Length: 0\r\n";
+                    }
+                }
+                // 请求体已在回环上收齐，剩余时间按模拟链路补足后再应答
+                const qint64 linkMs = kRequestLatencyMs
+                    + static_cast<qint64>(*received / (kConnectionMBps * 1024 * 1024) * 1000);
+                const int delayMs = static_cast<int>(qMax<qint64>(0, linkMs - started.elapsed()));
+                QTimer::singleShot(delayMs, connection, [connection, head]() {
+                    connection->respond(head);
+                });
+            });
+    }
+
+    bool completeUpload(const QString &uploadId, const QByteArray &body) {
+        QMutexLocker locker(&m_mutex);
+        auto it = m_uploads.find(uploadId);
+        if (it == m_uploads.end()) return false;
+        QXmlStreamReader xml(body);
+        int expectedPart = 1;
+        int partNumber = 0;
+        while (!xml.atEnd()) {
+            xml.readNext();
+            if (!xml.isStartElement()) continue;
+            if (xml.name() == QStringLiteral("PartNumber")) {
+                partNumber = xml.readElementText().toInt();
+                if (partNumber != expectedPart++) return false;
+            } else if (xml.name() == QStringLiteral("ETag")) {
+                const QByteArray etag = xml.readElementText().toLatin1();
+                if (etag != "\"" + it->parts.value(partNumber) + "\"") return false;
+            }
+        }
+        if (expectedPart - 1 != it->parts.size()) return false;
+        m_completed.insert(it->objectPath, it->parts);
+        m_uploads.erase(it);
+        ++m_stats.completed;
+        return true;
+    }
+
+    mutable QMutex m_mutex;
+    Stats m_stats;
+    QHash<QString, Upload> m_uploads;
+    QHash<QString, QMap<int, QByteArray>> m_completed;
+    QAtomicInt m_injectFailures{0};
+};
+
+bool writeFile(const QString &path, qint64 size) {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    QByteArray block(1024 * 1024, Qt::Uninitialized);
+    for (qint64 written = 0; written < size;) {
+        QRandomGenerator::global()->fillRange(reinterpret_cast<quint32 *>(block.data()),
+                                              block.size() / sizeof(quint32));
+        const qint64 n = qMin<qint64>(block.size(), size - written);
+        if (file.write(block.constData(), n) != n) return false;
+        written += n;
+    }
+    return true;
+}
+
+QMap<int, QByteArray> partDigests(const QString &path) {
+    QMap<int, QByteArray> digests;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return digests;
+    for (int part = 1; !file.atEnd(); ++part)
+        digests.insert(part, QCryptographicHash::hash(file.read(kPartBytes), QCryptographicHash::Md5).toHex());
+    return digests;
+}
+
+// 运行事件循环直到 condition 成立或超时
+bool waitUntil(const std::function<bool()> &condition, int timeoutMs = kTimeoutMs) {
+    QElapsedTimer timer;
+    timer.start();
+    QEventLoop loop;
+    QTimer poll;
+    QObject::connect(&poll, &QTimer::timeout, &loop, [&]() {
+        if (condition() || timer.elapsed() > timeoutMs) loop.quit();
+    });
+    poll.start(2);
+    if (!condition()) loop.exec();
+    return condition();
+}
+
+struct UploadResult {
+    bool finished = false;
+    bool ok = false;
+    QString urlOrError;
+};
+
+std::unique_ptr<CosManager> makeManager(int partsInFlight, const QString &stateDir) {
+    qputenv("COS_PARTS_IN_FLIGHT", QByteArray::number(partsInFlight));
+    auto manager = std::make_unique<CosManager>();
+    manager->loadConfig();
+    manager->setStateDir(stateDir);
+    return manager;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir directory;
+    const QString filePath = directory.filePath(QStringLiteral("upload.bin"));
+    const QString stateDir = directory.filePath(QStringLiteral("cos_uploads"));
+    if (!directory.isValid() || !writeFile(filePath, kFileBytes))
+        return fail(QStringLiteral("cannot create benchmark file")) ? 0 : 1;
+    const QMap<int, QByteArray> expectedParts = partDigests(filePath);
+
+    // 替身在独立线程的事件循环中运行，CosManager 在主线程
+    QThread serverThread;
+    QObject context;
+    context.moveToThread(&serverThread);
+    serverThread.start();
+    ObjectStoreStandIn *server = nullptr;
+    quint16 port = 0;
+    QMetaObject::invokeMethod(&context, [&]() {
+        server = new ObjectStoreStandIn;
+        if (server->listen(QHostAddress::LocalHost, 0)) port = server->serverPort();
+    }, Qt::BlockingQueuedConnection);
+    const auto shutdown = [&]() {
+        QMetaObject::invokeMethod(&context, [&]() { delete server; }, Qt::BlockingQueuedConnection);
+        serverThread.quit();
+        serverThread.wait();
+    };
+    if (port == 0) {
+        shutdown();
+        return fail(QStringLiteral("cannot listen on loopback")) ? 0 : 1;
+    }
+
+    QNetworkProxy::setApplicationProxy(
+        QNetworkProxy(QNetworkProxy::HttpProxy, QStringLiteral("127.0.0.1"), port));
+    qputenv("COS_SECRET_ID", "benchmark");
+    qputenv("COS_SECRET_KEY", "benchmark");
+    qputenv("COS_BUCKET", "benchmark-1250000000");
+    qputenv("COS_REGION", "ap-benchmark");
+    qputenv("COS_PART_RETRY_BASE_MS", "20");
+
+    // 串行与并发窗口的吞吐对比；并发轮次的第 3 片首次上传失败，需经重试完成
+    bool ok = true;
+    double serialMBps = 0;
+    for (const int window : {1, 4}) {
+        server->setInjectFailures(window > 1);
+        auto manager = makeManager(window, stateDir);
+        const QString objectKey = QStringLiteral("benchmark/window-%1.bin").arg(window);
+        UploadResult result;
+        QElapsedTimer timer;
+        timer.start();
+        manager->uploadFile(filePath, objectKey, nullptr,
+            [&result](bool success, const QString &urlOrError) {
+                result = {true, success, urlOrError};
+            });
+        ok &= waitUntil([&]() { return result.finished; }) && result.ok;
+        const qint64 elapsedNs = timer.nsecsElapsed();
+        ok &= server->completedParts(QLatin1Char('/') + objectKey) == expectedParts
+              && QDir(stateDir).isEmpty();
+        if (!ok) {
+            shutdown();
+            return fail(QStringLiteral("window=%1 upload failed: %2").arg(window).arg(result.urlOrError))
+                       ? 0 : 1;
+        }
+        const double mbps = kFileBytes / (1024.0 * 1024.0) / (elapsedNs / 1e9);
+        if (window == 1) serialMBps = mbps;
+        qInfo().noquote() << QStringLiteral("[CosMultipartBenchmark] file=%1MB window=%2 MBps=%3 speedup=%4x")
+            .arg(kFileBytes / (1024 * 1024))
+            .arg(window)
+            .arg(mbps, 0, 'f', 1)
+            .arg(serialMBps > 0 ? mbps / serialMBps : 0.0, 0, 'f', 1);
+    }
+    if (server->stats().injectedFailures != 1) {
+        shutdown();
+        return fail(QStringLiteral("injected part failure was not retried")) ? 0 : 1;
+    }
+
+    // 断点续传：上传到一半销毁 CosManager（模拟重启），新实例从状态目录继续，已完成的分片不再重传
+    server->setInjectFailures(false);
+    const QString resumeKey = QStringLiteral("benchmark/resume.bin");
+    const int putsBefore = server->stats().partPuts;
+    {
+        auto manager = makeManager(2, stateDir);
+        QJsonObject callerContext;
+        callerContext["fileId"] = 42;
+        bool finished = false;
+        qint64 uploaded = 0;
+        manager->uploadFile(filePath, resumeKey,
+            [&uploaded](qint64 sent, qint64) { uploaded = sent; },
+            [&finished](bool, const QString &) { finished = true; },
+            callerContext);
+        ok &= waitUntil([&]() { return uploaded >= kFileBytes / 2 || finished; }) && !finished;
+    }
+    const int putsInterrupted = server->stats().partPuts - putsBefore;
+
+    UploadResult resumed;
+    int resumedFileId = 0;
+    auto manager = makeManager(4, stateDir);
+    const int resumedCount = manager->resumePendingUploads([&](const QJsonObject &saved) {
+        resumedFileId = saved.value(QStringLiteral("fileId")).toInt();
+        return [&resumed](bool success, const QString &urlOrError) {
+            resumed = {true, success, urlOrError};
+        };
+    });
+    ok &= resumedCount == 1 && resumedFileId == 42;
+    ok &= waitUntil([&]() { return resumed.finished; }) && resumed.ok;
+    ok &= server->completedParts(QLatin1Char('/') + resumeKey) == expectedParts
+          && QDir(stateDir).isEmpty();
+    const int putsTotal = server->stats().partPuts - putsBefore;
+    // 中断时仍在途的分片（最多一个窗口）会重传，其余已完成分片不再上传
+    ok &= putsTotal <= expectedParts.size() + 2;
+    manager.reset();
+    shutdown();
+    QNetworkProxy::setApplicationProxy(QNetworkProxy::NoProxy);
+    if (!ok)
+        return fail(QStringLiteral("resume failed: %1").arg(resumed.urlOrError)) ? 0 : 1;
+    qInfo().noquote() << QStringLiteral("[CosMultipartBenchmark] resume parts=%1 before_restart=%2 after_restart=%3")
+        .arg(expectedParts.size())
+        .arg(putsInterrupted)
+        .arg(putsTotal - putsInterrupted);
+    return 0;
+}
@@ -0,0 +1,20 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = CosMultipartBenchmark
+
+INCLUDEPATH += ../Server
+
+SOURCES += \
+    CosMultipartBenchmark.cpp \
+    ../Server/CosManager.cpp \
+    ../Server/HttpConnection.cpp \
+    ../Server/TimingWheel.cpp
+
+HEADERS += \
+    ../Server/CosManager.h \
+    ../Server/HttpConnection.h \
+    ../Server/TimingWheel.h
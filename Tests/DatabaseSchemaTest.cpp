@@ -93,6 +93,8 @@ bool readSchema(const QString &connectionName,
             QStringLiteral("friendship_message_sequences"),
             QStringLiteral("friend_messages"),
             QStringLiteral("friend_files"),
+            QStringLiteral("blobs"),
+            QStringLiteral("file_blobs"),
         };
         for (const QString &table : requiredTables) {
             state->columns.insert(table, tableColumns(database, table));
@@ -160,6 +162,51 @@ bool requireQueryPlanIndex(const QString &databasePath,
     return ok;
 }
 
+// 文件记录的插入、清除、删除与级联删除都要同步 file_blobs.ref_count，测试数据结束时全部删除
+bool requireFileBlobRefCounts(const QString &databasePath) {
+    const QString connectionName = QStringLiteral("schema_probe_file_blobs");
+    bool ok = true;
+    {
+        QSqlDatabase database;
+        if (!openProbe(connectionName, databasePath, &database)) return false;
+        QSqlQuery query(database);
+        const auto exec = [&](const QString &sql) {
+            if (!query.exec(sql)) {
+                ok = fail(QStringLiteral("file blob probe failed: %1: %2")
+                              .arg(sql, query.lastError().text()));
+            }
+        };
+        const auto expectRefCount = [&](int expected, const QString &step) {
+            exec(QStringLiteral("SELECT ref_count FROM file_blobs WHERE hash = 'probe'"));
+            if (ok && (!query.next() || query.value(0).toInt() != expected)) {
+                ok = fail(QStringLiteral("file blob ref_count after %1 is not %2").arg(step).arg(expected));
+            }
+        };
+        exec(QStringLiteral("PRAGMA foreign_keys=ON"));
+        exec(QStringLiteral("INSERT INTO users (id, username, password_hash, salt) VALUES (9001, 'blob_probe', 'x', 'x')"));
+        exec(QStringLiteral("INSERT INTO rooms (id, name, creator_id) VALUES (9001, 'blob_probe', 9001)"));
+        exec(QStringLiteral("INSERT INTO file_blobs (hash, file_path, file_size) VALUES ('probe', 'probe', 1)"));
+        for (int id = 9001; id <= 9003; ++id) {
+            exec(QStringLiteral("INSERT INTO files (id, room_id, user_id, file_name, file_path, file_size, content_hash) "
+                                "VALUES (%1, 9001, 9001, 'probe', 'probe', 1, 'probe')").arg(id));
+        }
+        expectRefCount(3, QStringLiteral("insert"));
+        exec(QStringLiteral("UPDATE files SET cleared = 1 WHERE id = 9001"));
+        exec(QStringLiteral("UPDATE files SET cleared = 1 WHERE id = 9001"));
+        expectRefCount(2, QStringLiteral("clear"));
+        exec(QStringLiteral("DELETE FROM files WHERE id IN (9001, 9002)"));
+        expectRefCount(1, QStringLiteral("delete"));
+        exec(QStringLiteral("DELETE FROM rooms WHERE id = 9001"));
+        expectRefCount(0, QStringLiteral("cascade"));
+        exec(QStringLiteral("DELETE FROM users WHERE id = 9001"));
+        exec(QStringLiteral("DELETE FROM file_blobs WHERE hash = 'probe'"));
+        query.finish();
+        database.close();
+    }
+    QSqlDatabase::removeDatabase(connectionName);
+    return ok;
+}
+
 } // namespace
 
 int main(int argc, char *argv[]) {
@@ -188,15 +235,20 @@ int main(int argc, char *argv[]) {
     ok &= requireColumns(firstStart, QStringLiteral("users"),
                          {QStringLiteral("display_name"), QStringLiteral("last_uid_change")});
     ok &= requireColumns(firstStart, QStringLiteral("room_members"),
-                         {QStringLiteral("last_read_msg_id")});
+                         {QStringLiteral("last_read_msg_id"), QStringLiteral("unread_count")});
     ok &= requireColumns(firstStart, QStringLiteral("friendships"),
                          {QStringLiteral("user1_last_read_msg_id"),
-                          QStringLiteral("user2_last_read_msg_id")});
+                          QStringLiteral("user2_last_read_msg_id"),
+                          QStringLiteral("user1_unread_count"),
+                          QStringLiteral("user2_unread_count")});
     ok &= requireColumns(firstStart, QStringLiteral("messages"),
                          {QStringLiteral("thumbnail"), QStringLiteral("file_cleared"),
                           QStringLiteral("clear_reason"), QStringLiteral("sequence"),
                           QStringLiteral("client_message_id"),
-                          QStringLiteral("mutation_sequence")});
+                          QStringLiteral("mutation_sequence"),
+                          QStringLiteral("thumbnail_hash"), QStringLiteral("thumbnail_size")});
+    ok &= requireColumns(firstStart, QStringLiteral("blobs"),
+                         {QStringLiteral("hash"), QStringLiteral("data"), QStringLiteral("size")});
     ok &= requireColumns(firstStart, QStringLiteral("room_message_sequences"),
                          {QStringLiteral("room_id"), QStringLiteral("last_sequence")});
     ok &= requireColumns(firstStart, QStringLiteral("room_message_deletion_events"),
@@ -214,7 +266,11 @@ int main(int argc, char *argv[]) {
                           QStringLiteral("created_at")});
     ok &= requireColumns(firstStart, QStringLiteral("files"),
                          {QStringLiteral("cleared"), QStringLiteral("clear_reason"),
-                          QStringLiteral("cleared_at"), QStringLiteral("cos_url")});
+                          QStringLiteral("cleared_at"), QStringLiteral("cos_url"),
+                          QStringLiteral("content_hash")});
+    ok &= requireColumns(firstStart, QStringLiteral("file_blobs"),
+                         {QStringLiteral("hash"), QStringLiteral("file_path"),
+                          QStringLiteral("file_size"), QStringLiteral("ref_count")});
     ok &= requireColumns(firstStart, QStringLiteral("friend_messages"),
                          {QStringLiteral("file_cleared"), QStringLiteral("clear_reason"),
                           QStringLiteral("sequence"), QStringLiteral("client_message_id"),
@@ -223,7 +279,8 @@ int main(int argc, char *argv[]) {
                          {QStringLiteral("friendship_id"), QStringLiteral("last_sequence")});
     ok &= requireColumns(firstStart, QStringLiteral("friend_files"),
                          {QStringLiteral("cleared"), QStringLiteral("clear_reason"),
-                          QStringLiteral("cleared_at"), QStringLiteral("cos_url")});
+                          QStringLiteral("cleared_at"), QStringLiteral("cos_url"),
+                          QStringLiteral("content_hash")});
     if (!ok) {
         return 1;
     }
@@ -259,6 +316,15 @@ int main(int argc, char *argv[]) {
         {QStringLiteral("plan_room_files"),
          {QStringLiteral("SELECT id FROM files WHERE room_id = 1 AND cleared = 0 ORDER BY created_at, id"),
           QStringLiteral("idx_files_room_active")}},
+        {QStringLiteral("plan_room_file_expiry"),
+         {QStringLiteral("SELECT id FROM files WHERE cleared = 0 AND created_at <= datetime('now', '-7 days') ORDER BY created_at, id LIMIT 200"),
+          QStringLiteral("idx_files_expiry")}},
+        {QStringLiteral("plan_friend_file_expiry"),
+         {QStringLiteral("SELECT id FROM friend_files WHERE cleared = 0 AND created_at <= datetime('now', '-7 days') ORDER BY created_at, id LIMIT 200"),
+          QStringLiteral("idx_friend_files_expiry")}},
+        {QStringLiteral("plan_file_blobs_unreferenced"),
+         {QStringLiteral("SELECT hash, file_path FROM file_blobs WHERE ref_count = 0 LIMIT 64"),
+          QStringLiteral("idx_file_blobs_unreferenced")}},
         {QStringLiteral("plan_pending_requests"),
          {QStringLiteral("SELECT id FROM friend_requests WHERE to_user_id = 1 AND status = 'pending' ORDER BY created_at"),
           QStringLiteral("idx_friend_requests_recipient")}},
@@ -272,6 +338,7 @@ int main(int argc, char *argv[]) {
     for (const auto &check : planChecks) {
         ok &= requireQueryPlanIndex(databasePath, check.first, check.second.first, check.second.second);
     }
+    ok &= requireFileBlobRefCounts(databasePath);
     if (!ok) return 1;
 
     if (!initializeDatabase()) {
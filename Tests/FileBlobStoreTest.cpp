@@ -0,0 +1,107 @@
+#include "DatabaseManager.h"
+#include "FileBlobStore.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[FileBlobStoreTest]" << message;
+    return false;
+}
+
+bool writeFile(const QString &path, const QByteArray &data) {
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("FileBlobStoreTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("file-blob-store-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+    FileBlobStore store(&manager, directory.filePath(QStringLiteral("blobs")));
+    if (!store.open()) {
+        return fail(QStringLiteral("cannot open blob store")) ? 0 : 1;
+    }
+
+    const int ownerId = manager.registerUser(QStringLiteral("blob_owner"),
+                                             QStringLiteral("Blob Owner"),
+                                             QStringLiteral("owner-password"));
+    const int roomId = ownerId > 0 ? manager.createRoom(QStringLiteral("Blob Room"), ownerId) : 0;
+    if (roomId <= 0 || !manager.joinRoom(roomId, ownerId)) {
+        return fail(QStringLiteral("cannot create room fixture")) ? 0 : 1;
+    }
+
+    // 旧版记录按各自路径存放：收入存储后源记录改为引用 blob，旧文件删除，回收不会删掉它
+    const QByteArray content("legacy file content");
+    const QString legacyPath = directory.filePath(QStringLiteral("legacy.bin"));
+    const int sourceId = writeFile(legacyPath, content)
+        ? manager.saveFile(roomId, ownerId, QStringLiteral("legacy.bin"), legacyPath, content.size())
+        : -1;
+    const auto adoptSource = [&](int fileId, const QString &path) {
+        return [&manager, fileId, path](const QString &blobPath, const QString &hash) {
+            return manager.adoptFileBlob(fileId, false, path, blobPath, hash);
+        };
+    };
+    const QString blobPath = sourceId > 0
+        ? store.import(legacyPath, adoptSource(sourceId, legacyPath)) : QString();
+    bool ok = store.contains(blobPath) && !QFile::exists(legacyPath);
+    ok &= manager.getFilePath(sourceId) == blobPath;
+    ok &= store.reap() == 0 && QFile::exists(blobPath);
+    if (!ok) {
+        return fail(QStringLiteral("imported legacy file was not adopted by its source record")) ? 0 : 1;
+    }
+
+    // 转发共享同一 blob：源记录删除后仍由转发记录持有，全部删除后才被回收
+    const int forwardId = store.share(manager.getFilePath(sourceId),
+        [&](const QString &path, const QString &hash) {
+            return manager.saveFile(roomId, ownerId, QStringLiteral("legacy.bin"), path,
+                                    content.size(), hash);
+        });
+    ok = forwardId > 0 && manager.getFilePath(forwardId) == blobPath;
+    ok &= manager.deleteStoredFileRecord(sourceId);
+    ok &= store.reap() == 0 && QFile::exists(blobPath);
+    ok &= manager.deleteStoredFileRecord(forwardId);
+    ok &= store.reap() == 1 && !QFile::exists(blobPath);
+    if (!ok) {
+        return fail(QStringLiteral("shared blob reference counting diverged")) ? 0 : 1;
+    }
+
+    // 源记录已删除时不改写，旧文件保留，收入的 blob 保持零引用等待回收
+    const QString orphanPath = directory.filePath(QStringLiteral("orphan.bin"));
+    const int orphanId = writeFile(orphanPath, QByteArray("orphan file content"))
+        ? manager.saveFile(roomId, ownerId, QStringLiteral("orphan.bin"), orphanPath, 19)
+        : -1;
+    ok = orphanId > 0 && manager.deleteStoredFileRecord(orphanId);
+    ok &= store.import(orphanPath, adoptSource(orphanId, orphanPath)).isEmpty();
+    ok &= QFile::exists(orphanPath) && store.reap() == 1;
+    if (!ok) {
+        return fail(QStringLiteral("import adopted a deleted source record")) ? 0 : 1;
+    }
+
+    qInfo() << "[FileBlobStoreTest] PASS: legacy imports are adopted under the store lock,"
+               " shared blobs survive until their last record, and orphan imports are reaped";
+    return 0;
+}
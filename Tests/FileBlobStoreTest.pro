@@ -0,0 +1,22 @@
+QT += core sql
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = FileBlobStoreTest
+
+include(../Common/Libsodium.pri)
+
+INCLUDEPATH += ../Server
+
+SOURCES += \
+    FileBlobStoreTest.cpp \
+    ../Server/DatabaseManager.cpp \
+    ../Server/FileBlobStore.cpp \
+    ../Server/PasswordHasher.cpp
+
+HEADERS += \
+    ../Server/DatabaseManager.h \
+    ../Server/FileBlobStore.h \
+    ../Server/PasswordHasher.h
@@ -0,0 +1,119 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+const QString kProbeConnection = QStringLiteral("file_expiry_probe");
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[FileExpiryTest]" << message;
+    return false;
+}
+
+// 直接改写数据库，把文件记录的创建时间推到过期期限之前
+bool backdateFiles(const QString &databasePath) {
+    bool ok = false;
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), kProbeConnection);
+        database.setDatabaseName(databasePath);
+        QSqlQuery query(database);
+        ok = database.open()
+             && query.exec(QStringLiteral("UPDATE files SET created_at = datetime('now', '-365 days')"));
+        if (!ok) fail(QStringLiteral("cannot backdate files: %1").arg(query.lastError().text()));
+    }
+    QSqlDatabase::removeDatabase(kProbeConnection);
+    return ok;
+}
+
+QString clearReason(const QString &databasePath, int fileId) {
+    QString reason;
+    {
+        QSqlDatabase database = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), kProbeConnection);
+        database.setDatabaseName(databasePath);
+        QSqlQuery query(database);
+        query.prepare(QStringLiteral("SELECT clear_reason FROM files WHERE id = ?"));
+        query.addBindValue(fileId);
+        if (database.open() && query.exec() && query.next())
+            reason = query.value(0).toString();
+    }
+    QSqlDatabase::removeDatabase(kProbeConnection);
+    return reason;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("FileExpiryTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("file-expiry-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+
+    const int ownerId = manager.registerUser(QStringLiteral("expiry_owner"),
+                                             QStringLiteral("Expiry Owner"),
+                                             QStringLiteral("owner-password"));
+    const int roomId = ownerId > 0 ? manager.createRoom(QStringLiteral("Expiry Room"), ownerId) : 0;
+    if (roomId <= 0 || !manager.joinRoom(roomId, ownerId)) {
+        return fail(QStringLiteral("cannot create room fixture")) ? 0 : 1;
+    }
+
+    QList<int> fileIds;
+    for (int i = 0; i < 3; ++i) {
+        const QString name = QStringLiteral("expired-%1.bin").arg(i);
+        const int fileId = manager.saveFile(roomId, ownerId, name, directory.filePath(name), 10);
+        if (fileId <= 0
+            || manager.setCosUrl(fileId, false, QStringLiteral("https://cos.example.test/%1").arg(name)) != 1) {
+            return fail(QStringLiteral("cannot create file fixture")) ? 0 : 1;
+        }
+        fileIds.append(fileId);
+    }
+    if (!backdateFiles(databasePath)) return 1;
+
+    // 房间清理先清除了第一个文件：过期任务只处理其余两个，不改写它的原因，也不返回它的 COS 对象
+    const QString roomReason = QStringLiteral("room cleanup");
+    QList<int> roomCleared;
+    bool ok = manager.markRoomFilesCleared(roomId, {fileIds.first()}, roomReason, &roomCleared);
+    ok &= roomCleared == QList<int>{fileIds.first()};
+    const FileExpiryBatch batch = manager.expireStoredFiles(10);
+    ok &= batch.expiredCount == 2 && !batch.hasMore;
+    ok &= batch.cosUrls.size() == 2
+          && !batch.cosUrls.contains(QStringLiteral("https://cos.example.test/expired-0.bin"));
+    ok &= clearReason(databasePath, fileIds.first()) == roomReason;
+    if (!ok) {
+        return fail(QStringLiteral("expiry re-cleared a file cleared by room cleanup")) ? 0 : 1;
+    }
+
+    // 反过来，房间清理计划包含已过期的文件时，只有尚未清除的文件算作本次清除
+    ok = manager.markRoomFilesCleared(roomId, fileIds, roomReason, &roomCleared);
+    ok &= roomCleared.isEmpty();
+    ok &= clearReason(databasePath, fileIds.last()) != roomReason;
+    ok &= manager.expireStoredFiles(10).expiredCount == 0;
+    if (!ok) {
+        return fail(QStringLiteral("room cleanup re-cleared expired files")) ? 0 : 1;
+    }
+
+    qInfo() << "[FileExpiryTest] PASS: expiry and room cleanup each clear a file at most once"
+               " and report only the files they cleared";
+    return 0;
+}
@@ -0,0 +1,20 @@
+QT += core sql
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = FileExpiryTest
+
+include(../Common/Libsodium.pri)
+
+INCLUDEPATH += ../Server
+
+SOURCES += \
+    FileExpiryTest.cpp \
+    ../Server/DatabaseManager.cpp \
+    ../Server/PasswordHasher.cpp
+
+HEADERS += \
+    ../Server/DatabaseManager.h \
+    ../Server/PasswordHasher.h
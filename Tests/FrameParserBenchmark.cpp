@@ -0,0 +1,311 @@
+#include "Protocol.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QRandomGenerator>
+#include <QStringList>
+
+namespace {
+
+constexpr int kFrames = 20000;
+constexpr int kMalformedEvery = 97;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[FrameParserBenchmark]" << message;
+    return false;
+}
+
+// 随机长度的聊天消息帧流，夹杂少量无法解析的负载
+QByteArray buildStream(QRandomGenerator &random) {
+    QByteArray stream;
+    for (int i = 0; i < kFrames; ++i) {
+        if (i % kMalformedEvery == kMalformedEvery - 1) {
+            stream += Protocol::packPayload(QByteArrayLiteral("{\"type\": broken"));
+            continue;
+        }
+        QJsonObject data;
+        data["roomId"] = random.bounded(1, 1000);
+        data["content"] = QString(random.bounded(8, 600), QLatin1Char('a' + i % 26));
+        QJsonObject msg = Protocol::makeMessage(Protocol::MsgType::CHAT_MSG, data);
+        msg["id"] = QString::number(i);
+        stream += Protocol::pack(msg);
+    }
+    return stream;
+}
+
+// 把字节流切成随机大小的读取，maxRead 控制一次读取平均包含的帧数
+QList<QByteArray> splitReads(const QByteArray &stream, QRandomGenerator &random, int maxRead) {
+    QList<QByteArray> reads;
+    for (qsizetype offset = 0; offset < stream.size();) {
+        const qsizetype size = qMin<qsizetype>(random.bounded(1, maxRead + 1),
+                                               stream.size() - offset);
+        reads.append(stream.mid(offset, size));
+        offset += size;
+    }
+    return reads;
+}
+
+struct Outcome {
+    QStringList ids;
+    int malformed = 0;
+    qint64 elapsedNs = 0;
+};
+
+Outcome parseLegacy(const QList<QByteArray> &reads) {
+    Outcome outcome;
+    QByteArray buffer;
+    QElapsedTimer timer;
+    timer.start();
+    for (const QByteArray &read : reads) {
+        buffer.append(read);
+        for (;;) {
+            QJsonObject msg;
+            const Protocol::FrameParseResult result = Protocol::inspectFrame(buffer, msg);
+            if (result == Protocol::FrameParseResult::Malformed) {
+                ++outcome.malformed;
+                continue;
+            }
+            if (result != Protocol::FrameParseResult::Complete) break;
+            outcome.ids.append(msg["id"].toString());
+        }
+    }
+    outcome.elapsedNs = timer.nsecsElapsed();
+    return outcome;
+}
+
+Outcome parseIncremental(const QList<QByteArray> &reads) {
+    Outcome outcome;
+    Protocol::FrameReader reader;
+    QElapsedTimer timer;
+    timer.start();
+    for (const QByteArray &read : reads) {
+        reader.append(read);
+        for (;;) {
+            QJsonObject msg;
+            const Protocol::FrameParseResult result = reader.next(msg);
+            if (result == Protocol::FrameParseResult::Malformed) {
+                ++outcome.malformed;
+                continue;
+            }
+            if (result != Protocol::FrameParseResult::Complete) break;
+            outcome.ids.append(msg["id"].toString());
+        }
+    }
+    outcome.elapsedNs = timer.nsecsElapsed();
+    if (reader.bufferedBytes() != 0) outcome.malformed = -1;
+    return outcome;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QRandomGenerator random(20260413);
+    const QByteArray stream = buildStream(random);
+    const int expectedMalformed = kFrames / kMalformedEvery;
+
+    // 从逐字节到一次读入数百帧，覆盖帧头跨读取边界与大批量小帧两种情况
+    for (const int maxRead : {7, 1500, 64 * 1024, 1024 * 1024}) {
+        const QList<QByteArray> reads = splitReads(stream, random, maxRead);
+        const Outcome legacy = parseLegacy(reads);
+        const Outcome incremental = parseIncremental(reads);
+        if (incremental.ids != legacy.ids || incremental.malformed != legacy.malformed
+            || legacy.malformed != expectedMalformed
+            || legacy.ids.size() != kFrames - expectedMalformed) {
+            return fail(QStringLiteral("parsers disagree for maxRead=%1").arg(maxRead)) ? 0 : 1;
+        }
+        const double megabytes = stream.size() / (1024.0 * 1024.0);
+        qInfo().noquote() << QStringLiteral(
+            "[FrameParserBenchmark] maxRead=%1 reads=%2 legacy_MBps=%3 incremental_MBps=%4 speedup=%5x")
+            .arg(maxRead)
+            .arg(reads.size())
+            .arg(megabytes / (legacy.elapsedNs / 1e9), 0, 'f', 1)
+            .arg(megabytes / (incremental.elapsedNs / 1e9), 0, 'f', 1)
+            .arg(incremental.elapsedNs > 0
+                     ? double(legacy.elapsedNs) / double(incremental.elapsedNs) : 0.0, 0, 'f', 1);
+    }
+
+    // CBOR 帧：与 JSON 帧解码结果一致，二进制字段以原始字节携带；
+    // 接收方传入 BinaryFields 时字节串原样交给处理逻辑，data 中不再出现该字段
+    QJsonObject chunkData;
+    chunkData["uploadId"] = QStringLiteral("benchmark-upload");
+    chunkData["offset"] = 0;
+    QByteArray chunk(256 * 1024, Qt::Uninitialized);
+    for (qsizetype i = 0; i < chunk.size(); ++i) chunk[i] = static_cast<char>(random.bounded(256));
+    chunkData["chunkData"] = QString::fromLatin1(chunk.toBase64());
+    const QJsonObject chunkMsg = Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK, chunkData);
+    const QByteArray jsonPacket = Protocol::pack(chunkMsg);
+    const QByteArray cborPacket = Protocol::packCbor(chunkMsg);
+    Protocol::FrameReader cborReader;
+    cborReader.append(jsonPacket);
+    cborReader.append(cborPacket);
+    QJsonObject fromJson;
+    QJsonObject fromCbor;
+    if (cborReader.next(fromJson) != Protocol::FrameParseResult::Complete
+        || cborReader.next(fromCbor) != Protocol::FrameParseResult::Complete
+        || fromJson != chunkMsg || fromCbor != chunkMsg) {
+        return fail(QStringLiteral("CBOR frame did not round-trip")) ? 0 : 1;
+    }
+    QJsonObject withoutChunk = chunkData;
+    withoutChunk.remove(QStringLiteral("chunkData"));
+    Protocol::BinaryFields binaryFields;
+    QJsonObject fromCborBinary;
+    QByteArray cborBuffer = jsonPacket + cborPacket;
+    if (Protocol::inspectFrame(cborBuffer, fromCborBinary, &binaryFields)
+            != Protocol::FrameParseResult::Complete
+        || fromCborBinary != chunkMsg || !binaryFields.isEmpty()
+        || Protocol::inspectFrame(cborBuffer, fromCborBinary, &binaryFields)
+            != Protocol::FrameParseResult::Complete
+        || fromCborBinary["data"].toObject() != withoutChunk
+        || binaryFields.value(QStringLiteral("chunkData")) != chunk || binaryFields.size() != 1) {
+        return fail(QStringLiteral("CBOR byte string was not passed through as raw bytes")) ? 0 : 1;
+    }
+    QElapsedTimer codecTimer;
+    codecTimer.start();
+    for (int round = 0; round < 20; ++round) Protocol::FrameReader().append(Protocol::pack(chunkMsg));
+    const qint64 jsonPackNs = codecTimer.nsecsElapsed();
+    codecTimer.restart();
+    for (int round = 0; round < 20; ++round) Protocol::FrameReader().append(Protocol::packCbor(chunkMsg));
+    const qint64 cborPackNs = codecTimer.nsecsElapsed();
+    qInfo().noquote() << QStringLiteral(
+        "[FrameParserBenchmark] chunk json_bytes=%1 cbor_bytes=%2 saved=%3% json_pack_us=%4 cbor_pack_us=%5")
+        .arg(jsonPacket.size())
+        .arg(cborPacket.size())
+        .arg(100.0 * (jsonPacket.size() - cborPacket.size()) / jsonPacket.size(), 0, 'f', 1)
+        .arg(jsonPackNs / 1000.0 / 20, 0, 'f', 1)
+        .arg(cborPackNs / 1000.0 / 20, 0, 'f', 1);
+
+    // 二进制分块帧：头部不含 chunkData，分块原样还原；不接受二进制帧的读取方按损坏帧跳过
+    QJsonObject binaryData = chunkData;
+    binaryData.remove(QStringLiteral("chunkData"));
+    const QJsonObject binaryHeader =
+        Protocol::makeMessage(Protocol::MsgType::FILE_UPLOAD_CHUNK, binaryData);
+    const QByteArray binaryPacket = Protocol::packBinary(binaryHeader, chunk);
+    Protocol::FrameReader binaryReader;
+    binaryReader.append(binaryPacket);
+    binaryReader.append(binaryPacket);
+    binaryReader.append(jsonPacket);
+    QJsonObject header;
+    QByteArray payload;
+    if (binaryReader.next(header, &payload) != Protocol::FrameParseResult::Binary
+        || header != binaryHeader || payload != chunk
+        || binaryReader.next(header) != Protocol::FrameParseResult::Malformed
+        || binaryReader.next(header) != Protocol::FrameParseResult::Complete || header != chunkMsg) {
+        return fail(QStringLiteral("binary chunk frame did not round-trip")) ? 0 : 1;
+    }
+    qInfo().noquote() << QStringLiteral("[FrameParserBenchmark] chunk binary_bytes=%1 saved_vs_json=%2%")
+        .arg(binaryPacket.size())
+        .arg(100.0 * (jsonPacket.size() - binaryPacket.size()) / jsonPacket.size(), 0, 'f', 1);
+
+    // 解码耗时：从完整帧到处理逻辑拿到分块字节为止。JSON 帧与未走旁路的 CBOR 帧都要再做一次
+    // base64 解码；CBOR 旁路与二进制分块帧直接得到原始字节
+    constexpr int kDecodeRounds = 20;
+    bool decodedAll = true;
+    codecTimer.restart();
+    for (int round = 0; round < kDecodeRounds; ++round) {
+        QByteArray buffer = jsonPacket;
+        QJsonObject decoded;
+        decodedAll &= Protocol::inspectFrame(buffer, decoded) == Protocol::FrameParseResult::Complete
+                      && QByteArray::fromBase64(
+                             decoded["data"].toObject()["chunkData"].toString().toLatin1()) == chunk;
+    }
+    const qint64 jsonDecodeNs = codecTimer.nsecsElapsed();
+    codecTimer.restart();
+    for (int round = 0; round < kDecodeRounds; ++round) {
+        QByteArray buffer = cborPacket;
+        QJsonObject decoded;
+        decodedAll &= Protocol::inspectFrame(buffer, decoded) == Protocol::FrameParseResult::Complete
+                      && QByteArray::fromBase64(
+                             decoded["data"].toObject()["chunkData"].toString().toLatin1()) == chunk;
+    }
+    const qint64 cborBase64DecodeNs = codecTimer.nsecsElapsed();
+    codecTimer.restart();
+    for (int round = 0; round < kDecodeRounds; ++round) {
+        QByteArray buffer = cborPacket;
+        QJsonObject decoded;
+        Protocol::BinaryFields fields;
+        decodedAll &= Protocol::inspectFrame(buffer, decoded, &fields)
+                          == Protocol::FrameParseResult::Complete
+                      && fields.value(QStringLiteral("chunkData")) == chunk;
+    }
+    const qint64 cborDecodeNs = codecTimer.nsecsElapsed();
+    codecTimer.restart();
+    for (int round = 0; round < kDecodeRounds; ++round) {
+        Protocol::FrameReader decodeReader;
+        decodeReader.append(binaryPacket);
+        QJsonObject decoded;
+        QByteArray decodedPayload;
+        decodedAll &= decodeReader.next(decoded, &decodedPayload) == Protocol::FrameParseResult::Binary
+                      && decodedPayload == chunk;
+    }
+    const qint64 binaryDecodeNs = codecTimer.nsecsElapsed();
+    if (!decodedAll) return fail(QStringLiteral("chunk decode timing produced wrong bytes")) ? 0 : 1;
+    qInfo().noquote() << QStringLiteral(
+        "[FrameParserBenchmark] chunk json_decode_us=%1 cbor_base64_decode_us=%2 cbor_decode_us=%3 "
+        "binary_decode_us=%4")
+        .arg(jsonDecodeNs / 1000.0 / kDecodeRounds, 0, 'f', 1)
+        .arg(cborBase64DecodeNs / 1000.0 / kDecodeRounds, 0, 'f', 1)
+        .arg(cborDecodeNs / 1000.0 / kDecodeRounds, 0, 'f', 1)
+        .arg(binaryDecodeNs / 1000.0 / kDecodeRounds, 0, 'f', 1);
+
+    // 压缩帧：历史分页压缩后与原帧解码一致；服务端读取方拒绝压缩帧，小帧不压缩
+    QJsonArray history;
+    for (int i = 0; i < 50; ++i) {
+        QJsonObject item;
+        item["id"] = 1000 + i;
+        item["sender"] = QStringLiteral("user_%1").arg(i % 5);
+        item["senderName"] = QStringLiteral("用户%1").arg(i % 5);
+        item["content"] = QStringLiteral("第 %1 条历史消息").arg(i);
+        item["contentType"] = QStringLiteral("text");
+        item["clientMessageId"] = QStringLiteral("00000000-0000-0000-0000-%1").arg(i, 12, 10, QLatin1Char('0'));
+        item["timestamp"] = 1760000000000LL + i * 1000;
+        history.append(item);
+    }
+    QJsonObject historyData;
+    historyData["roomId"] = 42;
+    historyData["messages"] = history;
+    const QJsonObject historyMsg = Protocol::makeMessage(Protocol::MsgType::HISTORY_RSP, historyData);
+    const QByteArray historyPacket = Protocol::pack(historyMsg);
+    const QByteArray compressedJson = Protocol::compressPacket(historyPacket);
+    const QByteArray compressedCbor = Protocol::compressPacket(Protocol::packCbor(historyMsg));
+    const QByteArray smallPacket = Protocol::pack(Protocol::makeMessage(Protocol::MsgType::CHAT_MSG, {}));
+    Protocol::FrameReader serverReader;
+    serverReader.append(compressedJson);
+    Protocol::FrameReader clientReader;
+    clientReader.setAcceptCompressed(true);
+    clientReader.append(compressedJson);
+    clientReader.append(compressedCbor);
+    QJsonObject rejected;
+    QJsonObject fromCompressedJson;
+    QJsonObject fromCompressedCbor;
+    if (compressedJson.size() >= historyPacket.size()
+        || Protocol::compressPacket(smallPacket) != smallPacket
+        || serverReader.next(rejected) != Protocol::FrameParseResult::Malformed
+        || clientReader.next(fromCompressedJson) != Protocol::FrameParseResult::Complete
+        || clientReader.next(fromCompressedCbor) != Protocol::FrameParseResult::Complete
+        || fromCompressedJson != historyMsg || fromCompressedCbor != historyMsg) {
+        return fail(QStringLiteral("compressed frame did not round-trip")) ? 0 : 1;
+    }
+    qInfo().noquote() << QStringLiteral(
+        "[FrameParserBenchmark] history json_bytes=%1 compressed_bytes=%2 compressed_cbor_bytes=%3 saved=%4%")
+        .arg(historyPacket.size())
+        .arg(compressedJson.size())
+        .arg(compressedCbor.size())
+        .arg(100.0 * (historyPacket.size() - compressedJson.size()) / historyPacket.size(), 0, 'f', 1);
+
+    // 超长帧：不消费数据，两种解析器都应停在该帧
+    QByteArray oversized = Protocol::packPayload(QByteArrayLiteral("{}"));
+    oversized += QByteArray::fromHex("7fffffff");
+    Protocol::FrameReader reader;
+    reader.append(oversized);
+    QJsonObject msg;
+    if (reader.next(msg) != Protocol::FrameParseResult::Complete
+        || reader.next(msg) != Protocol::FrameParseResult::Oversized
+        || reader.bufferedBytes() != 4) {
+        return fail(QStringLiteral("oversized frame was not rejected in place")) ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+QT += core
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = FrameParserBenchmark
+
+INCLUDEPATH += ../Common
+
+SOURCES += \
+    FrameParserBenchmark.cpp
+
+HEADERS += \
+    ../Common/Protocol.h
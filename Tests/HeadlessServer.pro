@@ -29,7 +29,15 @@ SOURCES += \
     ../Server/DatabaseManager.cpp \
     ../Server/PasswordHasher.cpp \
     ../Server/RoomManager.cpp \
-    ../Server/CosManager.cpp
+    ../Server/CosManager.cpp \
+    ../Server/RequestDispatcher.cpp \
+    ../Server/SessionIoPool.cpp \
+    ../Server/HttpConnection.cpp \
+    ../Server/TimingWheel.cpp \
+    ../Server/OutboundFrame.cpp \
+    ../Server/PasswordHashPool.cpp \
+    ../Server/FileBlobStore.cpp \
+    ../Server/ThumbnailService.cpp
 
 HEADERS += \
     ../Common/Message.h \
@@ -44,4 +52,12 @@ HEADERS += \
     ../Server/DatabaseManager.h \
     ../Server/PasswordHasher.h \
     ../Server/RoomManager.h \
-    ../Server/CosManager.h
+    ../Server/CosManager.h \
+    ../Server/RequestDispatcher.h \
+    ../Server/SessionIoPool.h \
+    ../Server/HttpConnection.h \
+    ../Server/TimingWheel.h \
+    ../Server/OutboundFrame.h \
+    ../Server/PasswordHashPool.h \
+    ../Server/FileBlobStore.h \
+    ../Server/ThumbnailService.h
@@ -0,0 +1,261 @@
+#include "HttpConnection.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <memory>
+
+namespace {
+
+constexpr qint64 kSmallFileBytes = 4 * 1024;
+constexpr qint64 kLargeFileBytes = 32 * 1024 * 1024;
+constexpr int kKeepAliveRequests = 2000;
+constexpr int kPipelineDepth = 16;
+constexpr int kCloseRequests = 300;
+constexpr int kLargeRequests = 4;
+constexpr int kTimeoutMs = 10000;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[HttpLoadBenchmark]" << message;
+    return false;
+}
+
+// 只依赖 HttpConnection 的最小服务端：/small 与 /large 返回文件，PUT 统计请求体长度
+class BenchmarkServer : public QTcpServer {
+public:
+    BenchmarkServer(const QString &smallPath, const QString &largePath)
+        : m_smallPath(smallPath), m_largePath(largePath) {}
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override {
+        auto *socket = new QTcpSocket;
+        if (!socket->setSocketDescriptor(socketDescriptor)) {
+            delete socket;
+            return;
+        }
+        auto *connection = new HttpConnection(socket, this);
+        connect(connection, &HttpConnection::requestReceived, this,
+                [this](HttpConnection *conn, const HttpRequest &request) { handle(conn, request); },
+                Qt::DirectConnection);
+    }
+
+private:
+    void handle(HttpConnection *connection, const HttpRequest &request) {
+        if (request.method == "PUT") {
+            const qint64 expected = request.contentLength;
+            auto received = std::make_shared<qint64>(0);
+            connection->readBody(expected,
+                [received](const QByteArray &chunk) {
+                    *received += chunk.size();
+                    return true;
+                },
+                [connection, received, expected](bool complete) {
+                    connection->respond(complete && *received == expected
+                        ? QByteArrayLiteral("HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n")
+                        : QByteArrayLiteral("HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n"));
+                });
+            return;
+        }
+        auto *file = new QFile(request.target == "/large" ? m_largePath : m_smallPath);
+        if (!file->open(QIODevice::ReadOnly)) {
+            delete file;
+            connection->respond(QByteArrayLiteral("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"));
+            return;
+        }
+        const QByteArray head = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                "Content-Length: " + QByteArray::number(file->size()) + "\r\n";
+        connection->respondWithFile(head, file, 0, file->size());
+    }
+
+    QString m_smallPath;
+    QString m_largePath;
+};
+
+struct Response {
+    int status = 0;
+    qint64 bodyBytes = 0;
+    bool keepAlive = false;
+};
+
+// 阻塞读取一个响应；buffer 保存已读出但属于后续响应的字节
+bool readResponse(QTcpSocket &socket, QByteArray &buffer, Response *response) {
+    qsizetype headerEnd = -1;
+    while ((headerEnd = buffer.indexOf("\r\n\r\n")) < 0) {
+        if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(kTimeoutMs)) return false;
+        buffer += socket.readAll();
+    }
+    const QByteArray head = buffer.left(headerEnd).toLower();
+    buffer.remove(0, headerEnd + 4);
+    response->status = head.mid(9, 3).toInt();
+    response->keepAlive = head.contains("connection: keep-alive");
+    response->bodyBytes = 0;
+    for (const QByteArray &line : head.split('\n')) {
+        if (line.startsWith("content-length:"))
+            response->bodyBytes = line.mid(15).trimmed().toLongLong();
+    }
+
+    qint64 remaining = response->bodyBytes;
+    const qint64 buffered = qMin<qint64>(remaining, buffer.size());
+    buffer.remove(0, buffered);
+    remaining -= buffered;
+    while (remaining > 0) {
+        if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(kTimeoutMs)) return false;
+        remaining -= socket.read(qMin<qint64>(remaining, 1024 * 1024)).size();
+    }
+    return true;
+}
+
+bool writeFile(const QString &path, qint64 size) {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return false;
+    QByteArray block(1024 * 1024, Qt::Uninitialized);
+    for (qsizetype i = 0; i < block.size(); ++i)
+        block[i] = static_cast<char>(QRandomGenerator::global()->bounded(256));
+    for (qint64 written = 0; written < size;) {
+        const qint64 n = qMin<qint64>(block.size(), size - written);
+        if (file.write(block.constData(), n) != n) return false;
+        written += n;
+    }
+    return true;
+}
+
+QByteArray getRequest(const QByteArray &path, bool close = false) {
+    return "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n"
+           + (close ? QByteArray("Connection: close\r\n") : QByteArray()) + "\r\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir directory;
+    const QString smallPath = directory.filePath(QStringLiteral("small.bin"));
+    const QString largePath = directory.filePath(QStringLiteral("large.bin"));
+    if (!directory.isValid() || !writeFile(smallPath, kSmallFileBytes)
+        || !writeFile(largePath, kLargeFileBytes)) {
+        return fail(QStringLiteral("cannot create benchmark files")) ? 0 : 1;
+    }
+
+    // 服务端在独立线程的事件循环中运行，客户端在主线程阻塞收发
+    QThread serverThread;
+    QObject context;
+    context.moveToThread(&serverThread);
+    serverThread.start();
+    BenchmarkServer *server = nullptr;
+    quint16 port = 0;
+    QMetaObject::invokeMethod(&context, [&]() {
+        server = new BenchmarkServer(smallPath, largePath);
+        if (server->listen(QHostAddress::LocalHost, 0)) port = server->serverPort();
+    }, Qt::BlockingQueuedConnection);
+    const auto shutdown = [&]() {
+        QMetaObject::invokeMethod(&context, [&]() { delete server; }, Qt::BlockingQueuedConnection);
+        serverThread.quit();
+        serverThread.wait();
+    };
+    if (port == 0) {
+        shutdown();
+        return fail(QStringLiteral("cannot listen on loopback")) ? 0 : 1;
+    }
+
+    bool ok = true;
+    QTcpSocket client;
+    client.connectToHost(QHostAddress::LocalHost, port);
+    ok &= client.waitForConnected(kTimeoutMs);
+    QByteArray buffer;
+    Response response;
+
+    // 请求头分三次到达，PUT 请求体与下一个 GET 在同一次写入中流水线到达
+    const QByteArray split = getRequest("/small");
+    client.write(split.left(7));
+    client.waitForBytesWritten(kTimeoutMs);
+    QThread::msleep(20);
+    client.write(split.mid(7, 20));
+    client.waitForBytesWritten(kTimeoutMs);
+    QThread::msleep(20);
+    client.write(split.mid(27));
+    ok &= readResponse(client, buffer, &response) && response.status == 200
+          && response.bodyBytes == kSmallFileBytes && response.keepAlive;
+    const QByteArray body(256 * 1024, 'u');
+    client.write("PUT /sink HTTP/1.1\r\nHost: localhost\r\nContent-Length: "
+                 + QByteArray::number(body.size()) + "\r\n\r\n" + body + getRequest("/small"));
+    ok &= readResponse(client, buffer, &response) && response.status == 204;
+    ok &= readResponse(client, buffer, &response) && response.status == 200
+          && response.bodyBytes == kSmallFileBytes;
+    if (!ok) {
+        shutdown();
+        return fail(QStringLiteral("incremental parsing or pipelining failed")) ? 0 : 1;
+    }
+
+    // 小文件：一条 keep-alive 连接上流水线发送
+    QElapsedTimer timer;
+    timer.start();
+    for (int sent = 0; sent < kKeepAliveRequests && ok; sent += kPipelineDepth) {
+        QByteArray batch;
+        for (int i = 0; i < kPipelineDepth; ++i) batch += getRequest("/small");
+        client.write(batch);
+        for (int i = 0; i < kPipelineDepth && ok; ++i) {
+            ok &= readResponse(client, buffer, &response) && response.status == 200
+                  && response.bodyBytes == kSmallFileBytes;
+        }
+    }
+    const qint64 keepAliveNs = timer.nsecsElapsed();
+    client.disconnectFromHost();
+
+    // 小文件：每个请求新建连接（旧实现的 Connection: close 行为）
+    timer.restart();
+    for (int i = 0; i < kCloseRequests && ok; ++i) {
+        QTcpSocket socket;
+        socket.connectToHost(QHostAddress::LocalHost, port);
+        QByteArray closeBuffer;
+        ok &= socket.waitForConnected(kTimeoutMs);
+        socket.write(getRequest("/small", true));
+        ok &= readResponse(socket, closeBuffer, &response) && !response.keepAlive;
+        socket.waitForDisconnected(kTimeoutMs);
+    }
+    const qint64 closeNs = timer.nsecsElapsed();
+    if (!ok) {
+        shutdown();
+        return fail(QStringLiteral("small file requests failed")) ? 0 : 1;
+    }
+    const double keepAliveRps = kKeepAliveRequests / (keepAliveNs / 1e9);
+    const double closeRps = kCloseRequests / (closeNs / 1e9);
+    qInfo().noquote() << QStringLiteral(
+        "[HttpLoadBenchmark] small=%1B keepalive_rps=%2 close_rps=%3 speedup=%4x")
+        .arg(kSmallFileBytes)
+        .arg(keepAliveRps, 0, 'f', 0)
+        .arg(closeRps, 0, 'f', 0)
+        .arg(closeRps > 0 ? keepAliveRps / closeRps : 0.0, 0, 'f', 1);
+
+    // 大文件：零拷贝与分段读写的吞吐对比
+    for (const bool zeroCopy : {true, false}) {
+        qputenv("CHATROOM_HTTP_SENDFILE", zeroCopy ? "1" : "0");
+        QTcpSocket socket;
+        socket.connectToHost(QHostAddress::LocalHost, port);
+        QByteArray largeBuffer;
+        ok &= socket.waitForConnected(kTimeoutMs);
+        timer.restart();
+        for (int i = 0; i < kLargeRequests && ok; ++i) {
+            socket.write(getRequest("/large"));
+            ok &= readResponse(socket, largeBuffer, &response) && response.status == 200
+                  && response.bodyBytes == kLargeFileBytes;
+        }
+        const qint64 elapsedNs = timer.nsecsElapsed();
+        if (!ok) break;
+        qInfo().noquote() << QStringLiteral("[HttpLoadBenchmark] large=%1MB mode=%2 MBps=%3")
+            .arg(kLargeFileBytes / (1024 * 1024))
+            .arg(zeroCopy ? QStringLiteral("sendfile") : QStringLiteral("copy"))
+            .arg(kLargeRequests * kLargeFileBytes / (1024.0 * 1024.0) / (elapsedNs / 1e9), 0, 'f', 1);
+    }
+    qunsetenv("CHATROOM_HTTP_SENDFILE");
+    shutdown();
+    if (!ok) return fail(QStringLiteral("large file requests failed")) ? 0 : 1;
+    return 0;
+}
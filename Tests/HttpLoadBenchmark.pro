@@ -0,0 +1,18 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = HttpLoadBenchmark
+
+INCLUDEPATH += ../Server
+
+SOURCES += \
+    HttpLoadBenchmark.cpp \
+    ../Server/HttpConnection.cpp \
+    ../Server/TimingWheel.cpp
+
+HEADERS += \
+    ../Server/HttpConnection.h \
+    ../Server/TimingWheel.h
@@ -0,0 +1,160 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QMutex>
+#include <QSet>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <sodium.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr int kWriterThreads = 8;
+constexpr int kMessagesPerWriter = 40;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[MessageGroupCommitTest]" << message;
+    return false;
+}
+
+struct WriterOutcome {
+    QList<MessageSaveResult> created;
+    QList<MessageSaveResult> replayed;
+    QList<MessageSaveResult> conflicts;
+};
+
+// 每个写线程交替发送新消息、重放上一条消息和复用 clientMessageId 的冲突消息，
+// 让幂等判定与序列分配落在同一个组提交批次内
+void runWriter(DatabaseManager &manager, bool friendMessages, int ownerId,
+               int senderId, int writerIndex, WriterOutcome *outcome) {
+    for (int i = 0; i < kMessagesPerWriter; ++i) {
+        const QString clientMessageId =
+            QStringLiteral("writer-%1-message-%2").arg(writerIndex).arg(i);
+        const QString content = QStringLiteral("content %1/%2").arg(writerIndex).arg(i);
+        const auto save = [&](const QString &body) {
+            return friendMessages
+                       ? manager.saveFriendMessageIdempotent(ownerId, senderId, clientMessageId,
+                                                             body, QStringLiteral("text"))
+                       : manager.saveRoomMessageIdempotent(ownerId, senderId, clientMessageId,
+                                                           body, QStringLiteral("text"));
+        };
+        outcome->created.append(save(content));
+        if (i % 4 == 1) outcome->replayed.append(save(content));
+        if (i % 8 == 3) outcome->conflicts.append(save(content + QStringLiteral(" changed")));
+    }
+}
+
+bool verifyOutcomes(const QString &label, const std::vector<WriterOutcome> &outcomes) {
+    QSet<qint64> sequences;
+    QSet<int> messageIds;
+    int createdCount = 0;
+    for (const WriterOutcome &outcome : outcomes) {
+        for (const MessageSaveResult &result : outcome.created) {
+            if (result.status != MessageSaveResult::Status::Created || result.messageId <= 0 ||
+                result.createdAtMs <= 0) {
+                return fail(QStringLiteral("%1: a first send was not created").arg(label));
+            }
+            sequences.insert(result.sequence);
+            messageIds.insert(result.messageId);
+            ++createdCount;
+        }
+        for (const MessageSaveResult &result : outcome.replayed) {
+            if (result.status != MessageSaveResult::Status::Duplicate ||
+                !messageIds.contains(result.messageId)) {
+                return fail(QStringLiteral("%1: a replay was not reported as duplicate").arg(label));
+            }
+        }
+        for (const MessageSaveResult &result : outcome.conflicts) {
+            if (result.status != MessageSaveResult::Status::Conflict) {
+                return fail(QStringLiteral("%1: a reused clientMessageId was not a conflict").arg(label));
+            }
+        }
+    }
+
+    if (sequences.size() != createdCount || messageIds.size() != createdCount)
+        return fail(QStringLiteral("%1: sequences or message ids were reused").arg(label));
+    for (qint64 sequence = 1; sequence <= createdCount; ++sequence) {
+        if (!sequences.contains(sequence))
+            return fail(QStringLiteral("%1: sequence %2 is missing").arg(label).arg(sequence));
+    }
+    return true;
+}
+
+bool runConcurrentWriters(DatabaseManager &manager, bool friendMessages, int ownerId,
+                          const QList<int> &senderIds, const QString &label) {
+    std::vector<WriterOutcome> outcomes(kWriterThreads);
+    std::vector<std::unique_ptr<QThread>> threads;
+    for (int writer = 0; writer < kWriterThreads; ++writer) {
+        const int senderId = senderIds.at(writer % senderIds.size());
+        threads.emplace_back(QThread::create([&manager, &outcomes, friendMessages, ownerId,
+                                              senderId, writer] {
+            runWriter(manager, friendMessages, ownerId, senderId, writer, &outcomes[writer]);
+        }));
+    }
+    for (const auto &thread : threads) thread->start();
+    for (const auto &thread : threads) thread->wait();
+    return verifyOutcomes(label, outcomes);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("MessageGroupCommitTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("group-commit-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+    // 放宽收集窗口并压低批大小，确保测试中同时出现“等满一批”和“窗口超时”两种提交
+    qputenv("CHATROOM_MESSAGE_COMMIT_WINDOW_US", "2000");
+    qputenv("CHATROOM_MESSAGE_COMMIT_BATCH", "16");
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+
+    QList<int> senderIds;
+    for (int i = 0; i < kWriterThreads; ++i) {
+        // 每个写线程使用独立账号，clientMessageId 按发送者唯一
+        const int userId = manager.registerUser(QStringLiteral("writer_%1").arg(i),
+                                                QStringLiteral("Writer %1").arg(i),
+                                                QStringLiteral("writer-password"));
+        if (userId <= 0) return fail(QStringLiteral("cannot register writer %1").arg(i)) ? 0 : 1;
+        senderIds.append(userId);
+    }
+
+    const int roomId = manager.createRoom(QStringLiteral("Group Commit Room"), senderIds.first());
+    bool ok = roomId > 0;
+    for (int senderId : std::as_const(senderIds)) ok &= manager.joinRoom(roomId, senderId);
+    ok &= runConcurrentWriters(manager, false, roomId, senderIds, QStringLiteral("room"));
+    ok &= manager.getRoomLastMessageSequence(roomId) == kWriterThreads * kMessagesPerWriter;
+
+    // 私聊只有两位参与者：同一发送者的多个线程共享 clientMessageId 命名空间，各线程前缀不同
+    const int friendshipId = manager.ensureSelfFriendship(senderIds.first());
+    ok &= friendshipId > 0;
+    ok &= runConcurrentWriters(manager, true, friendshipId, {senderIds.first()},
+                               QStringLiteral("friend"));
+    ok &= manager.getFriendshipLastMessageSequence(friendshipId) ==
+          kWriterThreads * kMessagesPerWriter;
+
+    if (!ok) {
+        return fail(QStringLiteral("group-committed message writes lost ordering or idempotency")) ? 0 : 1;
+    }
+
+    qInfo() << "[MessageGroupCommitTest] PASS: concurrent room and friend writes keep"
+               " contiguous sequences, duplicate replay and conflict detection";
+    return 0;
+}
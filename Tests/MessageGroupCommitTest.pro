@@ -0,0 +1,20 @@
+QT += core sql
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = MessageGroupCommitTest
+
+include(../Common/Libsodium.pri)
+
+INCLUDEPATH += ../Server
+
+SOURCES += \
+    MessageGroupCommitTest.cpp \
+    ../Server/DatabaseManager.cpp \
+    ../Server/PasswordHasher.cpp
+
+HEADERS += \
+    ../Server/DatabaseManager.h \
+    ../Server/PasswordHasher.h
@@ -0,0 +1,99 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+constexpr int kMessages = 12;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[MessageSequenceRecoveryTest]" << message;
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("MessageSequenceRecoveryTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("sequence-recovery-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    int senderId = 0;
+    int roomId = 0;
+    int friendshipId = 0;
+    {
+        DatabaseManager manager;
+        if (!manager.initialize()) {
+            return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+        }
+        senderId = manager.registerUser(QStringLiteral("sequence_sender"),
+                                        QStringLiteral("Sequence Sender"),
+                                        QStringLiteral("sender-password"));
+        roomId = senderId > 0 ? manager.createRoom(QStringLiteral("Sequence Room"), senderId) : 0;
+        friendshipId = senderId > 0 ? manager.ensureSelfFriendship(senderId) : 0;
+        bool ok = roomId > 0 && friendshipId > 0 && manager.joinRoom(roomId, senderId);
+        for (int i = 0; ok && i < kMessages; ++i) {
+            const QString clientMessageId = QStringLiteral("before-restart-%1").arg(i);
+            ok &= manager.saveRoomMessageIdempotent(roomId, senderId, clientMessageId,
+                                                    QStringLiteral("room %1").arg(i),
+                                                    QStringLiteral("text")).sequence == i + 1;
+            ok &= manager.saveFriendMessageIdempotent(friendshipId, senderId, clientMessageId,
+                                                      QStringLiteral("friend %1").arg(i),
+                                                      QStringLiteral("text")).sequence == i + 1;
+        }
+        ok &= manager.getRoomLastMessageSequence(roomId) == kMessages;
+        ok &= manager.getFriendshipLastMessageSequence(friendshipId) == kMessages;
+
+        // 删除最新一条房间消息：重启后高水位仍须覆盖它，序列号不得复用
+        const QJsonArray latest = manager.getMessageHistory(roomId, 1);
+        const QJsonObject latestMessage = latest.isEmpty() ? QJsonObject{} : latest.first().toObject();
+        ok &= static_cast<qint64>(latestMessage["sequence"].toDouble()) == kMessages;
+        ok &= manager.deleteMessages(roomId, {latestMessage["id"].toInt()});
+        if (!ok) return fail(QStringLiteral("cannot prepare messages before restart")) ? 0 : 1;
+    }
+
+    // 重启：内存分配器由持久化高水位与消息表重建
+    DatabaseManager restarted;
+    bool ok = restarted.initialize();
+    ok &= restarted.getRoomLastMessageSequence(roomId) == kMessages;
+    ok &= restarted.getFriendshipLastMessageSequence(friendshipId) == kMessages;
+    const MessageSaveResult roomAfter = restarted.saveRoomMessageIdempotent(
+        roomId, senderId, QStringLiteral("after-restart"), QStringLiteral("after restart"),
+        QStringLiteral("text"));
+    ok &= roomAfter.status == MessageSaveResult::Status::Created &&
+          roomAfter.sequence == kMessages + 1;
+    const MessageSaveResult friendAfter = restarted.saveFriendMessageIdempotent(
+        friendshipId, senderId, QStringLiteral("after-restart"), QStringLiteral("after restart"),
+        QStringLiteral("text"));
+    ok &= friendAfter.status == MessageSaveResult::Status::Created &&
+          friendAfter.sequence == kMessages + 1;
+    ok &= restarted.getRoomLastMessageSequence(roomId) == kMessages + 1;
+    // 重放重启前的消息仍按幂等返回原序列号
+    const MessageSaveResult replay = restarted.saveRoomMessageIdempotent(
+        roomId, senderId, QStringLiteral("before-restart-0"), QStringLiteral("room 0"),
+        QStringLiteral("text"));
+    ok &= replay.status == MessageSaveResult::Status::Duplicate && replay.sequence == 1;
+    if (!ok) {
+        return fail(QStringLiteral("message sequences were not recovered after restart")) ? 0 : 1;
+    }
+
+    qInfo() << "[MessageSequenceRecoveryTest] PASS: room and friend sequence allocators resume"
+               " above the persisted high-water mark after restart";
+    return 0;
+}
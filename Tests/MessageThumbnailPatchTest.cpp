@@ -0,0 +1,83 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[MessageThumbnailPatchTest]" << message;
+    return false;
+}
+
+QString thumbnailHashOf(const QJsonArray &history, int messageId) {
+    for (const QJsonValue &value : history) {
+        const QJsonObject message = value.toObject();
+        if (message["id"].toInt() == messageId) return message["thumbnailHash"].toString();
+    }
+    return {};
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("MessageThumbnailPatchTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("thumbnail-patch-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+    qputenv("CHATROOM_HISTORY_CACHE_MESSAGES", "0");
+    DatabaseManager uncached;
+    if (!uncached.initialize()) {
+        return fail(QStringLiteral("uncached database initialization failed")) ? 0 : 1;
+    }
+
+    const int senderId = manager.registerUser(QStringLiteral("thumbnail_sender"),
+                                              QStringLiteral("Thumbnail Sender"),
+                                              QStringLiteral("sender-password"));
+    const int roomId = senderId > 0 ? manager.createRoom(QStringLiteral("Thumbnail Room"), senderId) : 0;
+    if (roomId <= 0 || !manager.joinRoom(roomId, senderId)) {
+        return fail(QStringLiteral("cannot create room fixture")) ? 0 : 1;
+    }
+
+    // 后台缩略图补写：缓存窗口内的消息同步替换缩略图，已撤回的消息不再改写
+    const int messageId = manager.saveMessage(
+        roomId, senderId, QStringLiteral("clip.mp4"), QStringLiteral("video"),
+        QStringLiteral("clip.mp4"), 10, 0, QString::fromLatin1(QByteArray("client").toBase64()));
+    bool ok = messageId > 0 && !manager.getMessageHistory(roomId, 20).isEmpty();
+    BlobRef thumbnailRef;
+    ok &= manager.setMessageThumbnail(roomId, messageId, QByteArray("server"), &thumbnailRef);
+    ok &= manager.getBlob(thumbnailRef.hash) == QByteArray("server");
+    const QJsonArray patchedHistory = manager.getMessageHistory(roomId, 20);
+    ok &= thumbnailHashOf(patchedHistory, messageId) == thumbnailRef.hash;
+    ok &= patchedHistory == uncached.getMessageHistory(roomId, 20);
+    ok &= manager.recallMessage(messageId, senderId, 120).status == RecallResult::Status::Applied;
+    ok &= !manager.setMessageThumbnail(roomId, messageId, QByteArray("late"));
+    ok &= thumbnailHashOf(manager.getMessageHistory(roomId, 20), messageId) == thumbnailRef.hash;
+    ok &= manager.getMessageHistory(roomId, 20) == uncached.getMessageHistory(roomId, 20);
+    if (!ok) {
+        return fail(QStringLiteral("background thumbnail patch diverged from the database")) ? 0 : 1;
+    }
+
+    qInfo() << "[MessageThumbnailPatchTest] PASS: thumbnail patches reach the cached history"
+               " and recalled messages are not rewritten";
+    return 0;
+}
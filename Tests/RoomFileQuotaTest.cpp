@@ -0,0 +1,100 @@
+#include "DatabaseManager.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <sodium.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr int kReserverThreads = 8;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[RoomFileQuotaTest]" << message;
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("RoomFileQuotaTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("room-file-quota-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+    // 第二个实例不共享账本，用于对照数据库中的实际用量
+    DatabaseManager observer;
+    if (!observer.initialize()) {
+        return fail(QStringLiteral("observer database initialization failed")) ? 0 : 1;
+    }
+
+    const int ownerId = manager.registerUser(QStringLiteral("quota_owner"),
+                                             QStringLiteral("Quota Owner"),
+                                             QStringLiteral("owner-password"));
+    const int roomId = ownerId > 0 ? manager.createRoom(QStringLiteral("Quota Room"), ownerId) : 0;
+    if (roomId <= 0 || !manager.joinRoom(roomId, ownerId)) {
+        return fail(QStringLiteral("cannot create room fixture")) ? 0 : 1;
+    }
+
+    // 房间文件配额账本：并发预留不得超过数量上限；保存后预留转为已用，清理与删除后重新加载
+    bool ok = manager.setRoomSettings(roomId, 100, 250, 3, 50);
+    ok &= manager.getRoomUsedFileSpace(roomId) == 0;
+    QAtomicInt reserved{0};
+    std::vector<std::unique_ptr<QThread>> reservers;
+    for (int i = 0; i < kReserverThreads; ++i) {
+        reservers.emplace_back(QThread::create([&manager, &reserved, roomId] {
+            QString error;
+            if (manager.reserveRoomFileQuota(roomId, 50, &error)) reserved.ref();
+        }));
+    }
+    for (const auto &thread : reservers) thread->start();
+    for (const auto &thread : reservers) thread->wait();
+    ok &= reserved.loadRelaxed() == 3;
+    const int firstFileId = manager.saveFile(roomId, ownerId, QStringLiteral("a.bin"),
+                                             QStringLiteral("a.bin"), 50);
+    const int secondFileId = manager.saveFile(roomId, ownerId, QStringLiteral("b.bin"),
+                                              QStringLiteral("b.bin"), 50);
+    manager.releaseRoomFileQuota(roomId, 50);
+    ok &= firstFileId > 0 && secondFileId > 0;
+    ok &= manager.getRoomUsedFileSpace(roomId) == 100
+          && manager.getRoomFileCount(roomId) == 2
+          && observer.getRoomUsedFileSpace(roomId) == 100;
+    QString quotaError;
+    ok &= !manager.reserveRoomFileQuota(roomId, 101, &quotaError);
+    ok &= manager.reserveRoomFileQuota(roomId, 50, &quotaError);
+    ok &= !manager.reserveRoomFileQuota(roomId, 50, &quotaError);
+    manager.releaseRoomFileQuota(roomId, 50);
+    ok &= manager.markRoomFilesCleared(roomId, {firstFileId}, QStringLiteral("test"));
+    ok &= manager.getRoomUsedFileSpace(roomId) == 50
+          && manager.getRoomFileCount(roomId) == 1;
+    ok &= manager.deleteFileRecords({secondFileId});
+    ok &= manager.getRoomUsedFileSpace(roomId) == 0
+          && manager.reserveRoomFileQuota(roomId, 100, &quotaError);
+    manager.releaseRoomFileQuota(roomId, 100);
+    if (!ok) {
+        return fail(QStringLiteral("room file quota ledger diverged from the database")) ? 0 : 1;
+    }
+
+    qInfo() << "[RoomFileQuotaTest] PASS: concurrent reservations respect the room limits and"
+               " the ledger follows saves, clears and deletions";
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "DatabaseManager.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <sodium.h>
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr int kWriterThreads = 4;
+constexpr int kMessagesPerWriter = 50;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[RoomHistoryCacheTest]" << message;
+    return false;
+}
+
+// 增量读者按游标连续拉取：写入与缓存更新交错时，读到的新消息序列号必须连续，不能跳过任何已提交消息
+bool followRoom(DatabaseManager &manager, int roomId, qint64 expectedLast,
+                const QAtomicInt &writersDone) {
+    qint64 cursor = 0;
+    while (cursor < expectedLast) {
+        const bool finished = writersDone.loadAcquire() != 0;
+        const RoomSyncPage page = manager.getRoomSyncPage(roomId, 16, cursor);
+        for (const QJsonValue &value : page.messages) {
+            const qint64 sequence = static_cast<qint64>(value.toObject()["sequence"].toDouble());
+            if (sequence != cursor + 1) {
+                return fail(QStringLiteral("sync page skipped from %1 to %2").arg(cursor).arg(sequence));
+            }
+            cursor = sequence;
+        }
+        if (page.itemCount == 0 && finished && cursor < expectedLast) {
+            return fail(QStringLiteral("reader stopped at %1 of %2").arg(cursor).arg(expectedLast));
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("RoomHistoryCacheTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("history-cache-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+    // 窗口小于写入总量，覆盖窗口淘汰与 floorSequence 推进
+    qputenv("CHATROOM_HISTORY_CACHE_MESSAGES", "64");
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+    qputenv("CHATROOM_HISTORY_CACHE_MESSAGES", "0");
+    DatabaseManager uncached;
+    if (!uncached.initialize()) {
+        return fail(QStringLiteral("uncached database initialization failed")) ? 0 : 1;
+    }
+
+    QList<int> senderIds;
+    for (int i = 0; i < kWriterThreads; ++i) {
+        const int userId = manager.registerUser(QStringLiteral("history_writer_%1").arg(i),
+                                                QStringLiteral("History Writer %1").arg(i),
+                                                QStringLiteral("writer-password"));
+        if (userId <= 0) return fail(QStringLiteral("cannot register writer %1").arg(i)) ? 0 : 1;
+        senderIds.append(userId);
+    }
+    const int roomId = manager.createRoom(QStringLiteral("History Cache Room"), senderIds.first());
+    bool ok = roomId > 0;
+    for (int senderId : std::as_const(senderIds)) ok &= manager.joinRoom(roomId, senderId);
+    // 先加载窗口，使后续写入走“提交后更新缓存”的路径
+    ok &= manager.getMessageHistory(roomId, 20).isEmpty();
+    if (!ok) return fail(QStringLiteral("cannot create room fixture")) ? 0 : 1;
+
+    // 并发写入的同时由另一个线程按游标读取缓存回答的增量页
+    const qint64 expectedLast = kWriterThreads * kMessagesPerWriter;
+    QAtomicInt writersDone{0};
+    bool readerOk = false;
+    std::unique_ptr<QThread> reader(QThread::create([&] {
+        readerOk = followRoom(manager, roomId, expectedLast, writersDone);
+    }));
+    std::vector<std::unique_ptr<QThread>> writers;
+    for (int writer = 0; writer < kWriterThreads; ++writer) {
+        const int senderId = senderIds.at(writer);
+        writers.emplace_back(QThread::create([&manager, roomId, senderId, writer] {
+            for (int i = 0; i < kMessagesPerWriter; ++i) {
+                manager.saveRoomMessageIdempotent(
+                    roomId, senderId, QStringLiteral("history-%1-%2").arg(writer).arg(i),
+                    QStringLiteral("message %1/%2").arg(writer).arg(i), QStringLiteral("text"));
+            }
+        }));
+    }
+    reader->start();
+    for (const auto &thread : writers) thread->start();
+    for (const auto &thread : writers) thread->wait();
+    writersDone.storeRelease(1);
+    reader->wait();
+    ok = readerOk && manager.getRoomLastMessageSequence(roomId) == expectedLast;
+    if (!ok) return fail(QStringLiteral("concurrent readers observed a gap in the room")) ? 0 : 1;
+
+    // 加载窗口后再写入和撤回，缓存回答的最新页与增量页须与直接查库一致
+    ok = manager.getMessageHistory(roomId, 20) == uncached.getMessageHistory(roomId, 20);
+    const MessageSaveResult cachedSend = manager.saveRoomMessageIdempotent(
+        roomId, senderIds.first(), QStringLiteral("after-cache-load"),
+        QStringLiteral("after cache load"), QStringLiteral("text"));
+    ok &= cachedSend.status == MessageSaveResult::Status::Created;
+    ok &= manager.saveMessage(roomId, senderIds.last(), QStringLiteral("plain"),
+                              QStringLiteral("text")) > 0;
+    ok &= manager.recallMessage(cachedSend.messageId, senderIds.first(), 120).status ==
+          RecallResult::Status::Applied;
+    ok &= manager.getMessageHistory(roomId, 20) == uncached.getMessageHistory(roomId, 20);
+    const qint64 cursor = cachedSend.sequence - 5;
+    const RoomSyncPage cachedPage = manager.getRoomSyncPage(roomId, 10, cursor);
+    const RoomSyncPage databasePage = uncached.getRoomSyncPage(roomId, 10, cursor);
+    ok &= !cachedPage.messages.isEmpty() && cachedPage.messages == databasePage.messages &&
+          cachedPage.itemCount == databasePage.itemCount &&
+          cachedPage.nextSequence == databasePage.nextSequence;
+    // 游标早于窗口时由数据库回答，结果同样一致
+    const RoomSyncPage oldPage = manager.getRoomSyncPage(roomId, 10, 0);
+    ok &= oldPage.messages == uncached.getRoomSyncPage(roomId, 10, 0).messages;
+    if (!ok) {
+        return fail(QStringLiteral("cached room history diverged from the database")) ? 0 : 1;
+    }
+
+    qInfo() << "[RoomHistoryCacheTest] PASS: cached latest and sync pages match the database"
+               " and concurrent readers never skip committed messages";
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+const QString kMemberStatement = QStringLiteral("room.member.exists");
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[StatementCacheTest]" << message;
+    return false;
+}
+
+// 对比两次计数之间的增量
+bool expectDelta(const StatementCacheCounters &before, const StatementCacheCounters &after,
+                 quint64 hits, quint64 misses, quint64 executions, const QString &step) {
+    const quint64 actualHits = after.hits - before.hits;
+    const quint64 actualMisses = after.misses - before.misses;
+    const quint64 actualExecutions = after.executions - before.executions;
+    if (actualHits != hits || actualMisses != misses || actualExecutions != executions) {
+        return fail(QStringLiteral("%1: hits=%2 misses=%3 executions=%4, expected %5/%6/%7")
+                        .arg(step)
+                        .arg(actualHits).arg(actualMisses).arg(actualExecutions)
+                        .arg(hits).arg(misses).arg(executions));
+    }
+    return true;
+}
+
+// 通过独立连接修改表结构，使管理器连接上已缓存的语句在下次执行时失效
+bool renameTable(const QString &databasePath, const QString &from, const QString &to) {
+    bool ok = false;
+    {
+        QSqlDatabase admin = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"),
+                                                       QStringLiteral("statement_cache_admin"));
+        admin.setDatabaseName(databasePath);
+        if (admin.open()) {
+            QSqlQuery query(admin);
+            ok = query.exec(QStringLiteral("ALTER TABLE %1 RENAME TO %2").arg(from, to));
+            if (!ok) fail(QStringLiteral("rename %1 failed: %2").arg(from, query.lastError().text()));
+        }
+        admin.close();
+    }
+    QSqlDatabase::removeDatabase(QStringLiteral("statement_cache_admin"));
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("StatementCacheTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("statement-cache-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+
+    const int alice = manager.registerUser(QStringLiteral("cache_alice"), QStringLiteral("Alice"),
+                                           QStringLiteral("alice-password"));
+    const int roomId = alice > 0 ? manager.createRoom(QStringLiteral("Cache Room"), alice) : 0;
+    if (roomId <= 0 || !manager.joinRoom(roomId, alice)) {
+        return fail(QStringLiteral("cannot create room fixture")) ? 0 : 1;
+    }
+
+    // 预热：本线程首次使用时准备一次（此前的初始化可能已准备过，增量只看之后的调用）
+    if (!manager.isUserInRoom(roomId, alice)) {
+        return fail(QStringLiteral("member lookup failed before caching")) ? 0 : 1;
+    }
+
+    // 复用：后续调用命中缓存，只重新绑定参数
+    StatementCacheCounters before = DatabaseManager::statementCacheCounters(kMemberStatement);
+    bool ok = manager.isUserInRoom(roomId, alice) && manager.isUserInRoom(roomId, alice);
+    ok &= !manager.isUserInRoom(roomId, alice + 1000);
+    StatementCacheCounters after = DatabaseManager::statementCacheCounters(kMemberStatement);
+    ok &= expectDelta(before, after, 3, 0, 3, QStringLiteral("reuse"));
+    if (!ok) return fail(QStringLiteral("cached statement was not reused")) ? 0 : 1;
+
+    // 失效：表结构变化后缓存语句执行失败，条目被丢弃
+    if (!renameTable(databasePath, QStringLiteral("room_members"), QStringLiteral("room_members_moved"))) {
+        return 1;
+    }
+    before = after;
+    ok = !manager.isUserInRoom(roomId, alice);
+    after = DatabaseManager::statementCacheCounters(kMemberStatement);
+    ok &= expectDelta(before, after, 1, 0, 1, QStringLiteral("failed execution"));
+    if (!renameTable(databasePath, QStringLiteral("room_members_moved"), QStringLiteral("room_members"))) {
+        return 1;
+    }
+    if (!ok) return fail(QStringLiteral("stale statement unexpectedly succeeded")) ? 0 : 1;
+
+    // 失败后的下一次调用重新准备，再下一次重新命中
+    before = after;
+    ok = manager.isUserInRoom(roomId, alice);
+    after = DatabaseManager::statementCacheCounters(kMemberStatement);
+    ok &= expectDelta(before, after, 0, 1, 1, QStringLiteral("re-prepare after failure"));
+    before = after;
+    ok &= manager.isUserInRoom(roomId, alice);
+    after = DatabaseManager::statementCacheCounters(kMemberStatement);
+    ok &= expectDelta(before, after, 1, 0, 1, QStringLiteral("reuse after re-prepare"));
+    if (!ok) return fail(QStringLiteral("failed statement was not invalidated")) ? 0 : 1;
+
+    qInfo() << "[StatementCacheTest] PASS: cached statements are reused per connection and"
+               " re-prepared after a failed execution";
+    return 0;
+}
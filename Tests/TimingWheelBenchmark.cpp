@@ -0,0 +1,96 @@
+#include "TimingWheel.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+constexpr int kConnections = 50000;
+constexpr int kRounds = 20;
+constexpr qint64 kHeartbeatMs = 90000;
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[TimingWheelBenchmark]" << message;
+    return false;
+}
+
+// 在事件循环中运行 ms 毫秒，让时间轮推进
+void spin(int ms) {
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < ms) QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    TimingWheel *wheel = TimingWheel::forCurrentThread();
+
+    // 到期顺序、取消与空闲续期：touch 过的 IdleWatch 按最后一次活动重新计时
+    QList<int> fired;
+    wheel->schedule(600, [&]() { fired.append(600); });
+    wheel->schedule(100, [&]() { fired.append(100); });
+    const TimingWheel::TimerId cancelled = wheel->schedule(300, [&]() { fired.append(300); });
+    wheel->cancel(cancelled);
+    QElapsedTimer idleTimer;
+    qint64 idleFiredAfter = -1;
+    IdleWatch idle;
+    idle.start(500, [&]() { idleFiredAfter = idleTimer.elapsed(); });
+    idleTimer.start();
+    spin(350);
+    idle.touch();
+    spin(1200);
+    if (fired != QList<int>{100, 600} || idleFiredAfter < 350 + 500 - TimingWheel::TICK_MS
+        || wheel->pendingCount() != 0) {
+        return fail(QStringLiteral("expiry order, cancellation or idle deferral is wrong")) ? 0 : 1;
+    }
+
+    // 旧实现：每个连接一个 QTimer，每收到一帧 start() 重新登记
+    std::vector<std::unique_ptr<QTimer>> timers;
+    timers.reserve(kConnections);
+    for (int i = 0; i < kConnections; ++i) {
+        auto timer = std::make_unique<QTimer>();
+        timer->setInterval(kHeartbeatMs);
+        timer->start();
+        timers.push_back(std::move(timer));
+    }
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (int round = 0; round < kRounds; ++round)
+        for (const auto &timer : timers) timer->start();
+    const qint64 timerNs = elapsed.nsecsElapsed();
+    timers.clear();
+
+    // 新实现：每个连接一个时间轮登记项，收到一帧只刷新时间戳
+    std::vector<std::unique_ptr<IdleWatch>> watches;
+    watches.reserve(kConnections);
+    for (int i = 0; i < kConnections; ++i) {
+        auto watch = std::make_unique<IdleWatch>();
+        watch->start(kHeartbeatMs, []() {});
+        watches.push_back(std::move(watch));
+    }
+    if (wheel->pendingCount() != kConnections)
+        return fail(QStringLiteral("idle watches were not registered")) ? 0 : 1;
+    elapsed.restart();
+    for (int round = 0; round < kRounds; ++round)
+        for (const auto &watch : watches) watch->touch();
+    const qint64 wheelNs = elapsed.nsecsElapsed();
+
+    watches.clear();
+    if (wheel->pendingCount() != 0)
+        return fail(QStringLiteral("stopped idle watches remain registered")) ? 0 : 1;
+
+    qInfo().noquote() << QStringLiteral(
+        "[TimingWheelBenchmark] connections=%1 qtimer_restart_ns=%2 wheel_touch_ns=%3 speedup=%4x")
+        .arg(kConnections)
+        .arg(double(timerNs) / (double(kConnections) * kRounds), 0, 'f', 1)
+        .arg(double(wheelNs) / (double(kConnections) * kRounds), 0, 'f', 1)
+        .arg(wheelNs > 0 ? double(timerNs) / double(wheelNs) : 0.0, 0, 'f', 1);
+    return 0;
+}
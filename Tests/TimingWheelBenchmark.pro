@@ -0,0 +1,16 @@
+QT += core
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = TimingWheelBenchmark
+
+INCLUDEPATH += ../Server
+
+SOURCES += \
+    TimingWheelBenchmark.cpp \
+    ../Server/TimingWheel.cpp
+
+HEADERS += \
+    ../Server/TimingWheel.h
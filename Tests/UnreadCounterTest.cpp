@@ -0,0 +1,117 @@
+#include "DatabaseManager.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <sodium.h>
+
+namespace {
+
+bool fail(const QString &message) {
+    qCritical().noquote() << "[UnreadCounterTest]" << message;
+    return false;
+}
+
+bool expectCount(const QHash<int, int> &counts, int conversationId, int expected,
+                 const QString &step) {
+    const int actual = counts.value(conversationId, -1);
+    if (actual != expected) {
+        return fail(QStringLiteral("%1: unread count is %2, expected %3")
+                        .arg(step).arg(actual).arg(expected));
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName(QStringLiteral("UnreadCounterTest"));
+    if (sodium_init() < 0) {
+        return fail(QStringLiteral("libsodium initialization failed")) ? 0 : 1;
+    }
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        return fail(QStringLiteral("cannot create temporary directory")) ? 0 : 1;
+    }
+    const QString databasePath = directory.filePath(QStringLiteral("unread-counter-test.db"));
+    qputenv("CHATROOM_DB_PATH", QDir::toNativeSeparators(databasePath).toUtf8());
+
+    DatabaseManager manager;
+    if (!manager.initialize()) {
+        return fail(QStringLiteral("database initialization failed")) ? 0 : 1;
+    }
+
+    const int alice = manager.registerUser(QStringLiteral("unread_alice"), QStringLiteral("Alice"),
+                                           QStringLiteral("alice-password"));
+    const int bob = manager.registerUser(QStringLiteral("unread_bob"), QStringLiteral("Bob"),
+                                         QStringLiteral("bob-password"));
+    if (alice <= 0 || bob <= 0) return fail(QStringLiteral("cannot register users")) ? 0 : 1;
+
+    // 房间：写入与删除由触发器维护计数，标记已读清零，之后的新消息重新累计
+    const int roomId = manager.createRoom(QStringLiteral("Unread Room"), alice);
+    bool ok = roomId > 0 && manager.joinRoom(roomId, alice) && manager.joinRoom(roomId, bob);
+    ok &= expectCount(manager.getUnreadRoomCounts(bob), roomId, 0, QStringLiteral("room join"));
+    QList<int> roomMessageIds;
+    for (int i = 0; i < 3; ++i) {
+        roomMessageIds.append(manager.saveMessage(roomId, alice,
+                                                  QStringLiteral("room %1").arg(i),
+                                                  QStringLiteral("text")));
+    }
+    ok &= !roomMessageIds.contains(0);
+    ok &= expectCount(manager.getUnreadRoomCounts(bob), roomId, 3, QStringLiteral("room insert"));
+    ok &= manager.deleteMessages(roomId, {roomMessageIds.first()});
+    ok &= expectCount(manager.getUnreadRoomCounts(bob), roomId, 2, QStringLiteral("room delete"));
+    manager.markRoomRead(roomId, bob);
+    ok &= expectCount(manager.getUnreadRoomCounts(bob), roomId, 0, QStringLiteral("room mark read"));
+    ok &= expectCount(manager.getUnreadRoomCounts(alice), roomId, 2,
+                      QStringLiteral("room mark read is per member"));
+    ok &= manager.saveMessage(roomId, alice, QStringLiteral("after read"), QStringLiteral("text")) > 0;
+    ok &= expectCount(manager.getUnreadRoomCounts(bob), roomId, 1,
+                      QStringLiteral("room insert after read"));
+    // 新成员加入时按已有消息初始化计数
+    const int carol = manager.registerUser(QStringLiteral("unread_carol"), QStringLiteral("Carol"),
+                                           QStringLiteral("carol-password"));
+    ok &= carol > 0 && manager.joinRoom(roomId, carol);
+    ok &= expectCount(manager.getUnreadRoomCounts(carol), roomId, 3, QStringLiteral("room late join"));
+    if (!ok) {
+        return fail(QStringLiteral("materialized room unread counters diverged")) ? 0 : 1;
+    }
+
+    // 好友会话：两端各自计数，一端标记已读不影响另一端
+    ok = manager.sendFriendRequest(alice, bob);
+    const QJsonArray pending = manager.getPendingFriendRequests(bob);
+    ok &= pending.size() == 1
+          && manager.acceptFriendRequest(pending.first().toObject()["requestId"].toInt(), bob);
+    const int friendshipId = manager.getFriendshipId(alice, bob);
+    ok &= friendshipId > 0;
+    ok &= expectCount(manager.getUnreadFriendCounts(bob), friendshipId, 0,
+                      QStringLiteral("friendship created"));
+    for (int i = 0; i < 2; ++i) {
+        ok &= manager.saveFriendMessage(friendshipId, alice, QStringLiteral("friend %1").arg(i),
+                                        QStringLiteral("text")) > 0;
+    }
+    ok &= expectCount(manager.getUnreadFriendCounts(bob), friendshipId, 2,
+                      QStringLiteral("friend insert"));
+    ok &= manager.markFriendRead(friendshipId, bob) > 0;
+    ok &= expectCount(manager.getUnreadFriendCounts(bob), friendshipId, 0,
+                      QStringLiteral("friend mark read"));
+    ok &= expectCount(manager.getUnreadFriendCounts(alice), friendshipId, 2,
+                      QStringLiteral("friend mark read is per side"));
+    ok &= manager.saveFriendMessage(friendshipId, alice, QStringLiteral("after read"),
+                                    QStringLiteral("text")) > 0;
+    ok &= expectCount(manager.getUnreadFriendCounts(bob), friendshipId, 1,
+                      QStringLiteral("friend insert after read"));
+    if (!ok) {
+        return fail(QStringLiteral("materialized friend unread counters diverged")) ? 0 : 1;
+    }
+
+    qInfo() << "[UnreadCounterTest] PASS: trigger-maintained room and friend unread counters"
+               " follow inserts, deletes, joins and per-member read marks";
+    return 0;
+}
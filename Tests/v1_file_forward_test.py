@@ -5,6 +5,7 @@ from __future__ import annotations
 
 import argparse
 import base64
+import hashlib
 import tempfile
 import uuid
 from pathlib import Path
@@ -167,6 +168,10 @@ def run_test(server: Path) -> None:
                 raise SmokeFailure("forward targets reused the source file identity")
             if download(alice, room_file_id) != payload or download(bob, friend_file_id) != payload:
                 raise SmokeFailure("forwarded attachment bytes changed")
+            digest = hashlib.sha256(payload).hexdigest()
+            blob = server.parent / "server_files" / "blobs" / digest[:2] / digest
+            if not blob.is_file() or blob.read_bytes() != payload:
+                raise SmokeFailure("forwarded attachment was not stored once by content hash")
 
             alice.send(
                 "FILE_FORWARD_REQ",
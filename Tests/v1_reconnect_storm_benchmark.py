@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Measure login latency and concurrent chat latency during a V1 reconnect storm."""
+
+from __future__ import annotations
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import uuid
+from datetime import datetime, timezone
+from pathlib import Path
+
+from v1_performance_baseline import display_path, distribution, stop_process
+from v1_smoke_test import (
+    SmokeFailure,
+    V1Client,
+    data,
+    find_port_range,
+    login,
+    register,
+    require_success,
+    wait_for_server,
+)
+
+
+BUSY_ERROR = "服务器繁忙，请稍后重试"
+
+
+def run_storm(args: argparse.Namespace) -> dict[str, object]:
+    server_path = args.server.resolve()
+    if not server_path.is_file():
+        raise SmokeFailure(f"server binary does not exist: {server_path}")
+    if args.clients < 1:
+        raise SmokeFailure("the reconnect storm requires at least one client")
+
+    password = "m0-reconnect-storm-password"
+    run_token = uuid.uuid4().hex[:6]
+    base_port = find_port_range()
+
+    with tempfile.TemporaryDirectory(prefix="chat-room-v1-reconnect-storm-") as temp_path:
+        temp = Path(temp_path)
+        log_path = temp / "server.log"
+        environment = os.environ.copy()
+        environment["CHATROOM_DB_PATH"] = str(temp / "storm.db")
+        environment["CHATROOM_DEVELOPER_KEY"] = "m0-reconnect-storm-developer-key"
+        # Every client shares the loopback address; lift the rate limits so only the hash queue bound applies.
+        environment["CHATROOM_AUTH_GATEWAY_ATTEMPTS"] = "1000000"
+        environment["CHATROOM_AUTH_IP_ATTEMPTS"] = "100000"
+        if args.hash_workers > 0:
+            environment["CHATROOM_AUTH_HASH_WORKERS"] = str(args.hash_workers)
+        if args.hash_queue_depth > 0:
+            environment["CHATROOM_AUTH_HASH_QUEUE_DEPTH"] = str(args.hash_queue_depth)
+
+        with log_path.open("w+", encoding="utf-8") as server_log:
+            process = subprocess.Popen(
+                [str(server_path), "--port", str(base_port)],
+                cwd=temp,
+                env=environment,
+                stdout=server_log,
+                stderr=subprocess.STDOUT,
+                text=True,
+            )
+            clients: list[V1Client] = []
+            try:
+                wait_for_server(process, base_port)
+
+                sender = V1Client("127.0.0.1", base_port, "chat-sender")
+                clients.append(sender)
+                register(sender, f"storm_chat_{run_token}", "Storm Chat", password)
+                login(sender, f"storm_chat_{run_token}", password)
+                sender.send("CREATE_ROOM_REQ", {"roomName": "M0 Reconnect Storm Room"})
+                room_id = require_success(sender.receive_type("CREATE_ROOM_RSP")).get("roomId")
+                if not isinstance(room_id, int) or room_id <= 0:
+                    raise SmokeFailure(f"invalid benchmark room id: {room_id}")
+
+                usernames = [f"storm_{index}_{run_token}" for index in range(args.clients)]
+                registrar = V1Client("127.0.0.1", base_port, "registrar")
+                clients.append(registrar)
+                for index, username in enumerate(usernames):
+                    register(registrar, username, f"Storm {index}", password)
+
+                storm_clients = [
+                    V1Client("127.0.0.1", base_port, f"storm-{index}")
+                    for index in range(args.clients)
+                ]
+                clients.extend(storm_clients)
+
+                barrier = threading.Barrier(args.clients + 1)
+                storm_done = threading.Event()
+                lock = threading.Lock()
+                login_latencies_ms: list[float] = []
+                busy_rejections = 0
+                failures: list[str] = []
+
+                def storm_login(client: V1Client, username: str) -> None:
+                    nonlocal busy_rejections
+                    try:
+                        barrier.wait(timeout=args.timeout)
+                        started = time.perf_counter()
+                        client.send("LOGIN_REQ", {"username": username, "password": password})
+                        response = data(client.receive_type("LOGIN_RSP", timeout=args.timeout))
+                        elapsed_ms = (time.perf_counter() - started) * 1000
+                        with lock:
+                            if response.get("success") is True:
+                                login_latencies_ms.append(elapsed_ms)
+                            elif response.get("error") == BUSY_ERROR:
+                                busy_rejections += 1
+                            else:
+                                failures.append(f"{client.label}: {response.get('error')}")
+                    except Exception as error:  # surfaced on the main thread below
+                        with lock:
+                            failures.append(f"{client.label}: {error}")
+
+                chat_latencies_ms: list[float] = []
+                chat_errors: list[str] = []
+
+                def chat_probe() -> None:
+                    index = 0
+                    try:
+                        while not storm_done.is_set():
+                            content = f"storm-probe-{run_token}:{index}"
+                            started = time.perf_counter()
+                            sender.send(
+                                "CHAT_MSG",
+                                {"roomId": room_id, "content": content, "contentType": "text"},
+                            )
+                            sender.receive_type(
+                                "CHAT_MSG",
+                                timeout=args.timeout,
+                                predicate=lambda message, token=content: data(message).get("content") == token,
+                            )
+                            chat_latencies_ms.append((time.perf_counter() - started) * 1000)
+                            index += 1
+                            time.sleep(args.chat_interval)
+                    except Exception as error:  # surfaced on the main thread below
+                        chat_errors.append(str(error))
+
+                workers = [
+                    threading.Thread(target=storm_login, args=(client, username), daemon=True)
+                    for client, username in zip(storm_clients, usernames)
+                ]
+                for worker in workers:
+                    worker.start()
+                prober = threading.Thread(target=chat_probe, daemon=True)
+                prober.start()
+
+                barrier.wait(timeout=args.timeout)
+                storm_started = time.perf_counter()
+                for worker in workers:
+                    worker.join(timeout=args.timeout)
+                storm_elapsed = time.perf_counter() - storm_started
+                storm_done.set()
+                prober.join(timeout=args.timeout)
+
+                if any(worker.is_alive() for worker in workers):
+                    raise SmokeFailure("one or more storm logins did not finish")
+                if failures:
+                    raise SmokeFailure("; ".join(failures[:5]))
+                if chat_errors:
+                    raise SmokeFailure("; ".join(chat_errors))
+                if not login_latencies_ms:
+                    raise SmokeFailure("no storm login succeeded")
+                if not chat_latencies_ms:
+                    raise SmokeFailure("no chat probe completed during the storm")
+
+                return {
+                    "schemaVersion": 1,
+                    "recordedAtUtc": datetime.now(timezone.utc).isoformat(),
+                    "scenario": {
+                        "protocol": "V1 length-prefixed JSON over loopback TCP",
+                        "flow": "simultaneous LOGIN_REQ from pre-registered accounts with a concurrent room CHAT_MSG probe",
+                        "stormClients": args.clients,
+                        "hashWorkers": args.hash_workers or "server default",
+                        "hashQueueDepth": args.hash_queue_depth or "server default",
+                        "chatProbeIntervalSeconds": args.chat_interval,
+                    },
+                    "environment": {
+                        "platform": platform.platform(),
+                        "machine": platform.machine(),
+                        "python": platform.python_version(),
+                        "serverBinary": display_path(server_path),
+                    },
+                    "results": {
+                        "loginLatencyMs": distribution(login_latencies_ms),
+                        "successfulLogins": len(login_latencies_ms),
+                        "busyRejections": busy_rejections,
+                        "stormSeconds": round(storm_elapsed, 3),
+                        "chatAckLatencyMs": distribution(chat_latencies_ms),
+                        "chatProbes": len(chat_latencies_ms),
+                    },
+                    "limitations": [
+                        "Loopback removes real network latency and packet loss.",
+                        "Accounts are registered before the storm, so only login hashing is measured.",
+                        "The chat probe is sequential and measures sender echo latency only.",
+                    ],
+                }
+            finally:
+                for client in clients:
+                    client.close()
+                stop_process(process)
+
+
+def parse_args() -> argparse.Namespace:
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--server", type=Path, required=True)
+    parser.add_argument("--output", type=Path, required=True)
+    parser.add_argument("--clients", type=int, default=64)
+    parser.add_argument("--hash-workers", type=int, default=0)
+    parser.add_argument("--hash-queue-depth", type=int, default=0)
+    parser.add_argument("--chat-interval", type=float, default=0.02)
+    parser.add_argument("--timeout", type=float, default=60.0)
+    return parser.parse_args()
+
+
+def main() -> int:
+    args = parse_args()
+    try:
+        result = run_storm(args)
+        output = args.output.resolve()
+        output.parent.mkdir(parents=True, exist_ok=True)
+        output.write_text(json.dumps(result, indent=2, ensure_ascii=False) + "\n", encoding="utf-8")
+        print(
+            "[V1ReconnectStorm] PASS: "
+            f"login p99={result['results']['loginLatencyMs']['p99']} ms, "
+            f"chat p99={result['results']['chatAckLatencyMs']['p99']} ms, "
+            f"busy={result['results']['busyRejections']}, "
+            f"output={output}"
+        )
+        return 0
+    except (OSError, SmokeFailure, subprocess.SubprocessError, threading.BrokenBarrierError) as error:
+        print(f"[V1ReconnectStorm] FAIL: {error}", file=sys.stderr)
+        return 1
+
+
+if __name__ == "__main__":
+    raise SystemExit(main())
@@ -82,6 +82,8 @@ export const MsgType = {
   MARK_ROOM_READ: 'MARK_ROOM_READ', MARK_FRIEND_READ: 'MARK_FRIEND_READ',
   FRIEND_READ_NOTIFY: 'FRIEND_READ_NOTIFY',
   FILE_COS_PROGRESS: 'FILE_COS_PROGRESS',
+  FILE_THUMBNAIL_NOTIFY: 'FILE_THUMBNAIL_NOTIFY',
+  FRIEND_FILE_THUMBNAIL_NOTIFY: 'FRIEND_FILE_THUMBNAIL_NOTIFY',
 }
 
 function uuid() {
@@ -92,11 +94,23 @@ export function makeMessage(type, data = {}) {
   return { type, id: uuid(), timestamp: Date.now(), data }
 }
 
+// 服务器把协商后的历史/列表大响应作为二进制消息发送：4 字节大端原始长度 + zlib 流
+function supportsCompressedFrames(environment) {
+  return typeof environment.DecompressionStream === 'function'
+}
+
+async function inflateFrame(environment, buffer) {
+  const zlib = new Uint8Array(buffer).subarray(4)
+  const stream = new Blob([zlib]).stream().pipeThrough(new environment.DecompressionStream('deflate'))
+  return new Response(stream).text()
+}
+
 export class ChatWebSocket {
   constructor(environment = globalThis) {
     this.environment = environment
     this.ws = null
     this.handlers = new Map()
+    this.pendingInbound = null
     this.heartbeatTimer = null
     this.heartbeatTimeout = null
     this.reconnectTimer = null
@@ -161,7 +175,9 @@ export class ChatWebSocket {
       this.ws.close()
     }
     const socket = new this.environment.WebSocket(this.url)
+    socket.binaryType = 'arraybuffer'
     this.ws = socket
+    this.pendingInbound = null
     socket.onopen = () => {
       if (this.ws !== socket) return
       this.connected.value = true
@@ -173,12 +189,24 @@ export class ChatWebSocket {
     socket.onmessage = (ev) => {
       if (this.ws !== socket) return
       this._resetHeartbeatTimeout()
-      try {
-        const msg = JSON.parse(ev.data)
-        this._handleMessage(msg)
-      } catch (e) {
-        console.error('[WS] 消息解析失败:', e)
+      if (typeof ev.data === 'string' && !this.pendingInbound) {
+        this._dispatchText(ev.data)
+        return
       }
+      // 压缩消息异步解压；解压期间到达的文本消息排在其后，保持服务器发送顺序
+      const decoded = typeof ev.data === 'string'
+        ? Promise.resolve(ev.data)
+        : inflateFrame(this.environment, ev.data)
+      const pending = (this.pendingInbound || Promise.resolve())
+        .then(() => decoded)
+        .then((text) => {
+          if (this.ws === socket) this._dispatchText(text)
+        })
+        .catch((e) => console.error('[WS] 压缩消息解压失败:', e))
+        .finally(() => {
+          if (this.pendingInbound === pending) this.pendingInbound = null
+        })
+      this.pendingInbound = pending
     }
     socket.onclose = () => {
       if (this.ws !== socket) return
@@ -268,6 +296,15 @@ export class ChatWebSocket {
     if (list) list.forEach(fn => fn(data))
   }
 
+  _dispatchText(text) {
+    try {
+      const msg = JSON.parse(text)
+      this._handleMessage(msg)
+    } catch (e) {
+      console.error('[WS] 消息解析失败:', e)
+    }
+  }
+
   _handleMessage(msg) {
     const type = msg.type
     if (type === MsgType.HEARTBEAT) {
@@ -307,7 +344,9 @@ export class ChatWebSocket {
   // ==================== 便捷方法 ====================
 
   login(username, password) {
-    this.send(makeMessage(MsgType.LOGIN_REQ, { username, password }))
+    const data = { username, password }
+    if (supportsCompressedFrames(this.environment)) data.compressedFrames = true
+    this.send(makeMessage(MsgType.LOGIN_REQ, data))
   }
 
   register(username, displayName, password) {
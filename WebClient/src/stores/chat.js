@@ -1042,6 +1042,18 @@ export const useChatStore = defineStore('chat', {
         }
       })
 
+      // 服务端后台生成的缩略图：替换 FILE_NOTIFY 中客户端提供的缩略图
+      chatWs.on(MsgType.FILE_THUMBNAIL_NOTIFY, (msg) => {
+        const d = msg.data
+        if (d.roomId === this.currentRoomId) {
+          const m = this.messages.find(m => m.id === d.messageId)
+          if (m) {
+            m.thumbnail = d.thumbnail
+            this._persistCurrentRoomSnapshot(d.roomId)
+          }
+        }
+      })
+
       chatWs.on(MsgType.FILE_DOWNLOAD_RSP, (msg) => {
         const d = msg.data
         // 预览模式跳过自动下载
@@ -1576,6 +1588,19 @@ export const useChatStore = defineStore('chat', {
         }
       })
 
+      chatWs.on(MsgType.FRIEND_FILE_THUMBNAIL_NOTIFY, (msg) => {
+        const d = msg.data
+        const userStore = useUserStore()
+        const chatWith = d.sender === userStore.username ? d.friendUsername : d.sender
+        if (this.isFriendChat && this.currentFriendUsername === chatWith) {
+          const m = this.friendMessages.find(m => m.id === d.messageId)
+          if (m) {
+            m.thumbnail = d.thumbnail
+            this._persistCurrentFriendSnapshot(chatWith)
+          }
+        }
+      })
+
       chatWs.on(MsgType.FRIEND_ONLINE_NOTIFY, (msg) => {
         const fr = this.friends.find(f => f.username === msg.data.username)
         if (fr) fr.isOnline = true
@@ -0,0 +1,161 @@
+import assert from 'node:assert/strict'
+import test from 'node:test'
+import { deflateSync } from 'node:zlib'
+
+import { ChatWebSocket, MsgType, makeMessage } from '../src/services/websocket.js'
+
+
+class FakeSocket {
+  static OPEN = 1
+
+  constructor(url) {
+    this.url = url
+    this.readyState = 0
+    this.sent = []
+  }
+
+  open() {
+    this.readyState = FakeSocket.OPEN
+    this.onopen?.()
+  }
+
+  send(text) {
+    this.sent.push(JSON.parse(text))
+  }
+
+  close() {
+    this.readyState = 3
+    this.onclose?.()
+  }
+
+  receive(data) {
+    this.onmessage?.({ data })
+  }
+}
+
+// 与服务端 qCompress 相同：4 字节大端原始长度 + zlib 流
+function qCompress(msg) {
+  const raw = Buffer.from(JSON.stringify(msg), 'utf8')
+  const zlib = deflateSync(raw)
+  const frame = new Uint8Array(4 + zlib.length)
+  new DataView(frame.buffer).setUint32(0, raw.length, false)
+  frame.set(zlib, 4)
+  return frame.buffer
+}
+
+function environment({ compression = true } = {}) {
+  const sockets = []
+  const formats = []
+  const WebSocket = class extends FakeSocket {
+    constructor(url) {
+      super(url)
+      sockets.push(this)
+    }
+  }
+  WebSocket.OPEN = FakeSocket.OPEN
+  const host = { navigator: { onLine: true }, WebSocket, sockets, formats }
+  if (compression) {
+    // 记录格式后交给运行时的实现，解压仍是真实的异步流
+    host.DecompressionStream = class extends DecompressionStream {
+      constructor(format) {
+        super(format)
+        formats.push(format)
+      }
+    }
+  }
+  return host
+}
+
+// 连接打开后心跳定时器开始运行；断言失败时也要断开，否则测试进程不会退出
+function connectedClient(t, host) {
+  const client = new ChatWebSocket(host)
+  client.connectUrl('wss://chat.example.test/ws')
+  host.sockets[0].open()
+  t.after(() => client.disconnect())
+  return client
+}
+
+function history(count) {
+  const messages = []
+  for (let i = 0; i < count; i++) {
+    messages.push({ id: 1000 + i, sender: `user_${i % 5}`, content: `第 ${i} 条历史消息`, contentType: 'text' })
+  }
+  return makeMessage(MsgType.HISTORY_RSP, { roomId: 42, messages })
+}
+
+async function drain(client) {
+  while (client.pendingInbound) await client.pendingInbound
+}
+
+test('login advertises compressedFrames only when DecompressionStream exists', (t) => {
+  for (const compression of [true, false]) {
+    const host = environment({ compression })
+    const client = connectedClient(t, host)
+    client.login('alice', 'secret')
+    const [login] = host.sockets[0].sent
+    assert.equal(login.type, MsgType.LOGIN_REQ)
+    assert.equal(login.data.compressedFrames, compression ? true : undefined)
+  }
+})
+
+test('binary message strips the 4-byte length prefix and inflates with deflate', async (t) => {
+  const host = environment()
+  const client = connectedClient(t, host)
+  const received = []
+  client.on(MsgType.HISTORY_RSP, (msg) => received.push(msg))
+
+  const expected = history(50)
+  host.sockets[0].receive(qCompress(expected))
+  await drain(client)
+
+  assert.deepEqual(host.formats, ['deflate'])
+  assert.deepEqual(received, [expected])
+})
+
+test('text messages that arrive during an inflate keep server order', async (t) => {
+  const host = environment()
+  const client = connectedClient(t, host)
+  const order = []
+  for (const type of [MsgType.CHAT_MSG, MsgType.HISTORY_RSP, MsgType.ROOM_LIST_RSP]) {
+    client.on(type, (msg) => order.push(`${type}:${msg.data.tag}`))
+  }
+  const tagged = (type, tag, extra = {}) => makeMessage(type, { tag, ...extra })
+  const socket = host.sockets[0]
+
+  socket.receive(JSON.stringify(tagged(MsgType.CHAT_MSG, 'before')))
+  socket.receive(qCompress(tagged(MsgType.HISTORY_RSP, 'big', history(200).data)))
+  socket.receive(JSON.stringify(tagged(MsgType.CHAT_MSG, 'during')))
+  socket.receive(qCompress(tagged(MsgType.ROOM_LIST_RSP, 'small')))
+  socket.receive(JSON.stringify(tagged(MsgType.CHAT_MSG, 'after')))
+  // 第一条文本同步分发，其余等待前面的解压
+  assert.deepEqual(order, [`${MsgType.CHAT_MSG}:before`])
+
+  await drain(client)
+  assert.deepEqual(order, [
+    `${MsgType.CHAT_MSG}:before`,
+    `${MsgType.HISTORY_RSP}:big`,
+    `${MsgType.CHAT_MSG}:during`,
+    `${MsgType.ROOM_LIST_RSP}:small`,
+    `${MsgType.CHAT_MSG}:after`,
+  ])
+  assert.equal(client.pendingInbound, null)
+})
+
+test('a corrupt compressed message is dropped without blocking later messages', async (t) => {
+  const host = environment()
+  const client = connectedClient(t, host)
+  const received = []
+  client.on(MsgType.CHAT_MSG, (msg) => received.push(msg.data.tag))
+  const socket = host.sockets[0]
+
+  const originalError = console.error
+  console.error = () => {}
+  try {
+    socket.receive(new Uint8Array([0, 0, 0, 8, 1, 2, 3, 4]).buffer)
+    socket.receive(JSON.stringify(makeMessage(MsgType.CHAT_MSG, { tag: 'next' })))
+    await drain(client)
+  } finally {
+    console.error = originalError
+  }
+  assert.deepEqual(received, ['next'])
+})